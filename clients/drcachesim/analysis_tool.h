@@ -50,6 +50,16 @@ class analysis_tool_t
     virtual bool operator!() { return !success; }
     virtual bool process_memref(const memref_t &memref) = 0;
     virtual bool print_results() = 0;
+    // A tool that only needs the fields in memref_compact_t can return true
+    // here to be handed process_memref_compact() in place of process_memref().
+    virtual bool wants_compact_memref() { return false; }
+    // The threads array maps memref.thread to its pid and tid.  It is only
+    // valid for the duration of this call, but the indices themselves are
+    // stable for the whole trace.
+    virtual bool process_memref_compact(const memref_compact_t &memref,
+                                        const memref_thread_t *threads) {
+        return false;
+    }
  protected:
     bool success;
 };
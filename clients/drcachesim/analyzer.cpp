@@ -31,8 +31,10 @@
  */
 
 #include <iostream>
+#include <vector>
 #include "analysis_tool.h"
 #include "analyzer.h"
+#include "reader/reader.h"
 #include "reader/file_reader.h"
 #ifdef HAS_ZLIB
 # include "reader/compressed_file_reader.h"
@@ -100,13 +102,34 @@ bool
 analyzer_t::run()
 {
     bool res = true;
+
+    // We query each tool's preference once up front rather than per record,
+    // and only have the reader build compact records if some tool uses them.
+    std::vector<bool> wants_compact(num_tools);
+    bool any_compact = false;
+    for (int i = 0; i < num_tools; ++i) {
+        wants_compact[i] = tools[i]->wants_compact_memref();
+        any_compact = any_compact || wants_compact[i];
+    }
+    trace_iter->set_wants_compact(any_compact);
+
     if (!start_reading())
         return false;
 
     for (; *trace_iter != *trace_end; ++(*trace_iter)) {
+        const memref_t &memref = **trace_iter;
+        if (!any_compact) {
+            for (int i = 0; i < num_tools; ++i)
+                res = tools[i]->process_memref(memref) && res;
+            continue;
+        }
+        const memref_compact_t &compact = trace_iter->get_compact();
+        const memref_thread_t *threads = trace_iter->get_threads();
         for (int i = 0; i < num_tools; ++i) {
-            memref_t memref = **trace_iter;
-            res = tools[i]->process_memref(memref) && res;
+            if (wants_compact[i])
+                res = tools[i]->process_memref_compact(compact, threads) && res;
+            else
+                res = tools[i]->process_memref(memref) && res;
         }
     }
     return res;
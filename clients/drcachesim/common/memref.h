@@ -96,4 +96,34 @@ typedef union _memref_t {
     struct _memref_thread_exit_t exit;
 } memref_t;
 
+// The reader interns each thread into a small dense index, handed out in
+// order of first appearance in the trace.
+typedef uint32_t memref_thread_idx_t;
+
+typedef struct _memref_thread_t {
+    memref_pid_t pid;
+    memref_tid_t tid;
+} memref_thread_t;
+
+// The largest size representable in memref_compact_t.size.  Larger flush
+// ranges saturate at this value.
+#define MEMREF_COMPACT_MAX_SIZE 0xffff
+
+// A compact 16-byte (on 64-bit) form of memref_t, delivered to tools that
+// request it via analysis_tool_t::wants_compact_memref().
+// The pid and tid are replaced by an index into the reader's thread table,
+// the type and size are narrowed, and the pc of data references is omitted.
+// Normally that pc is the addr of the preceding instruction entry, but with
+// -L0_filter the instruction fetch may have been filtered out and the pc is
+// then only carried by memref_t's data.pc: tools that need it must use
+// process_memref().
+// For TRACE_TYPE_THREAD_EXIT, only the type and thread fields are valid.
+typedef struct _memref_compact_t {
+    addr_t addr;
+    memref_thread_idx_t thread;
+    uint16_t size;
+    uint8_t type;   // A trace_type_t.
+    uint8_t unused;
+} memref_compact_t;
+
 #endif /* _MEMREF_H_ */
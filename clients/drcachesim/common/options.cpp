@@ -105,8 +105,10 @@ droption_t<bool> op_L0_filter
  "Filter out zero-level hits during tracing",
  "Filters out instruction and data hits in a 'zero-level' cache during tracing itself, "
  "shrinking the final trace to only contain instruction and data accesses that miss in "
- "this initial cache.  This cache is direct-mapped with sizes equal to -L0I_size and "
- "-L0D_size.  It uses virtual addresses regardless of -use_physical.");
+ "this initial cache.  This cache is direct-mapped by default (see -L0_assoc) with "
+ "sizes equal to -L0I_size and -L0D_size.  It uses virtual addresses regardless of "
+ "-use_physical.  An access that straddles two cache lines is recorded if it misses "
+ "in either line.");
 
 droption_t<bytesize_t> op_L0I_size
 (DROPTION_SCOPE_CLIENT, "L0I_size", 32*1024U,
@@ -118,6 +120,15 @@ droption_t<bytesize_t> op_L0D_size
  "If -L0_filter, filter out data hits during tracing",
  "Specifies the size of the 'zero-level' data cache for -L0_filter.");
 
+droption_t<unsigned int> op_L0_assoc
+(DROPTION_SCOPE_CLIENT, "L0_assoc", 1, 1, 2,
+ "Associativity of the -L0_filter caches",
+ "Specifies the associativity of the 'zero-level' caches for -L0_filter.  A value of "
+ "1 selects a direct-mapped cache, while a value of 2 selects a 2-way set-associative "
+ "cache with least-recently-used replacement, which filters out more conflict "
+ "misses at the cost of a few more instructions on a miss in the most-recently-used "
+ "way.");
+
 droption_t<bool> op_use_physical
 (DROPTION_SCOPE_CLIENT, "use_physical", false, "Use physical addresses if possible",
  "If available, the default virtual addresses will be translated to physical.  "
@@ -187,9 +198,11 @@ droption_t<std::string> op_TLB_replace_policy
 
 droption_t<std::string> op_simulator_type
 (DROPTION_SCOPE_FRONTEND, "simulator_type", CPU_CACHE,
- "Simulator type (" CPU_CACHE", " TLB", " REUSE_DIST", " REUSE_TIME", or " HISTOGRAM").",
+ "Simulator type (" CPU_CACHE", " TLB", " REUSE_DIST", " REUSE_TIME", " HISTOGRAM
+ ", or " BRANCH_PRED").",
  "Specifies the type of the simulator. "
- "Supported types: " CPU_CACHE", " TLB", " REUSE_DIST", " REUSE_TIME", or " HISTOGRAM".");
+ "Supported types: " CPU_CACHE", " TLB", " REUSE_DIST", " REUSE_TIME", " HISTOGRAM
+ ", or " BRANCH_PRED".");
 
 droption_t<unsigned int> op_verbose
 (DROPTION_SCOPE_ALL, "verbose", 0, 0, 64, "Verbosity level",
@@ -237,6 +250,54 @@ droption_t<bytesize_t> op_sim_refs
  "The simulated references come after the skipped and warmup references, "
  "and the references following the simulated ones are dropped.");
 
+droption_t<bytesize_t> op_interval
+(DROPTION_SCOPE_FRONTEND, "interval", 0,
+ "Snapshot interval for time-series statistics",
+ "If non-zero, the cache and TLB simulators record the hit and miss counts of every "
+ "simulated caching device each time this many simulated references have been "
+ "processed, producing a time series that can be correlated with application "
+ "phases.  Each row holds the deltas for one interval, in CSV format.  Warmup "
+ "references are not included.  See also -interval_instrs and -interval_file.");
+
+droption_t<bool> op_interval_instrs
+(DROPTION_SCOPE_FRONTEND, "interval_instrs", false,
+ "Measure -interval in instructions",
+ "By default, -interval counts all simulated references.  If this option is enabled, "
+ "only instruction fetches are counted toward each interval.");
+
+droption_t<std::string> op_interval_file
+(DROPTION_SCOPE_FRONTEND, "interval_file", "",
+ "Output file for -interval statistics",
+ "Specifies a file to which the -interval time series is written.  If empty, "
+ "the time series is printed to stderr ahead of the final results.");
+
+droption_t<std::string> op_checkpoint_out
+(DROPTION_SCOPE_FRONTEND, "checkpoint_out", "",
+ "File to save the simulator state to",
+ "If non-empty, the cache and TLB simulators write their full state (the tags and "
+ "replacement state of every block, all statistics, and the thread-to-core "
+ "mapping) to this file once -checkpoint_refs references have been seen.  "
+ "The resulting checkpoint can be resumed with -checkpoint_in to avoid "
+ "re-simulating the warmup phase in later runs on the same trace.");
+
+droption_t<bytesize_t> op_checkpoint_refs
+(DROPTION_SCOPE_FRONTEND, "checkpoint_refs", 0,
+ "Trace position at which to save -checkpoint_out",
+ "Specifies the number of trace references, counting skipped and warmup references, "
+ "after which the -checkpoint_out state is saved.  A value of 0 saves the state as "
+ "soon as warmup completes.  If the trace ends before that point, the final state "
+ "is saved.");
+
+droption_t<std::string> op_checkpoint_in
+(DROPTION_SCOPE_FRONTEND, "checkpoint_in", "",
+ "File to restore the simulator state from",
+ "If non-empty, the cache and TLB simulators restore their state from a checkpoint "
+ "produced by -checkpoint_out and resume simulating right after the trace position "
+ "at which the checkpoint was taken.  The -skip_refs and -warmup_refs values are "
+ "replaced by what remained of them when the checkpoint was taken, while -sim_refs "
+ "is taken from the command line and counts from the resumed position.  The cache "
+ "or TLB configuration must match that used when the checkpoint was taken.");
+
 // XXX: if we separate histogram + reuse_distance we should move this with them.
 droption_t<unsigned int> op_report_top
 (DROPTION_SCOPE_FRONTEND, "report_top", 10,
@@ -266,3 +327,38 @@ droption_t<bool> op_reuse_verify_skip
  "Verifies every skip list-calculated reuse distance with a full list walk. "
  "This incurs significant additional overhead.  This option is only available "
  "in debug builds.");
+
+droption_t<std::string> op_branch_predictor
+(DROPTION_SCOPE_FRONTEND, "branch_predictor", BRANCH_PREDICTOR_GSHARE,
+ "Conditional branch predictor (" BRANCH_PREDICTOR_BIMODAL", " BRANCH_PREDICTOR_GSHARE
+ ", or " BRANCH_PREDICTOR_TAGE").",
+ "Specifies the conditional branch direction predictor modeled by the "
+ BRANCH_PRED " simulator type.  The " BRANCH_PREDICTOR_TAGE " predictor is a reduced "
+ "TAGE with a bimodal base table and four tagged tables using global history "
+ "lengths of 5, 12, 27, and 64.");
+
+droption_t<unsigned int> op_bp_table_bits
+(DROPTION_SCOPE_FRONTEND, "bp_table_bits", 12, 1, 30,
+ "Log2 of the branch predictor table size",
+ "Specifies the log2 of the number of 2-bit counters in the " BRANCH_PREDICTOR_BIMODAL
+ " and " BRANCH_PREDICTOR_GSHARE " tables, and in the " BRANCH_PREDICTOR_TAGE
+ " base table.  Each " BRANCH_PREDICTOR_TAGE " tagged table is a quarter that size.");
+
+droption_t<unsigned int> op_bp_history_bits
+(DROPTION_SCOPE_FRONTEND, "bp_history_bits", 12, 0, 64,
+ "Global history length for gshare",
+ "Specifies the number of global branch history bits combined with the branch "
+ "address by the " BRANCH_PREDICTOR_GSHARE " predictor.");
+
+droption_t<unsigned int> op_btb_entries
+(DROPTION_SCOPE_FRONTEND, "btb_entries", 512,
+ "Number of branch target buffer entries",
+ "Specifies the number of entries in the direct-mapped branch target buffer "
+ "modeled by the " BRANCH_PRED " simulator type.  Indirect branches are "
+ "predicted using the branch target buffer.");
+
+droption_t<unsigned int> op_ras_entries
+(DROPTION_SCOPE_FRONTEND, "ras_entries", 16,
+ "Number of return address stack entries",
+ "Specifies the depth of the per-thread return address stack modeled by the "
+ BRANCH_PRED " simulator type.");
@@ -44,6 +44,10 @@
 #define HISTOGRAM                               "histogram"
 #define REUSE_DIST                              "reuse_distance"
 #define REUSE_TIME                              "reuse_time"
+#define BRANCH_PRED                             "branch_predictor"
+#define BRANCH_PREDICTOR_BIMODAL                "bimodal"
+#define BRANCH_PREDICTOR_GSHARE                 "gshare"
+#define BRANCH_PREDICTOR_TAGE                   "tage"
 
 #include <string>
 #include "droption.h"
@@ -64,6 +68,7 @@ extern droption_t<unsigned int> op_LL_assoc;
 extern droption_t<bytesize_t> op_L0I_size;
 extern droption_t<bool> op_L0_filter;
 extern droption_t<bytesize_t> op_L0D_size;
+extern droption_t<unsigned int> op_L0_assoc;
 extern droption_t<bool> op_use_physical;
 extern droption_t<unsigned int> op_virt2phys_freq;
 extern droption_t<bytesize_t> op_max_trace_size;
@@ -87,9 +92,20 @@ extern droption_t<std::string> op_tracer_ops;
 extern droption_t<bytesize_t> op_skip_refs;
 extern droption_t<bytesize_t> op_warmup_refs;
 extern droption_t<bytesize_t> op_sim_refs;
+extern droption_t<bytesize_t> op_interval;
+extern droption_t<bool> op_interval_instrs;
+extern droption_t<std::string> op_interval_file;
+extern droption_t<std::string> op_checkpoint_in;
+extern droption_t<std::string> op_checkpoint_out;
+extern droption_t<bytesize_t> op_checkpoint_refs;
 extern droption_t<unsigned int> op_report_top;
 extern droption_t<unsigned int> op_reuse_distance_threshold;
 extern droption_t<bool> op_reuse_distance_histogram;
 extern droption_t<unsigned int> op_reuse_skip_dist;
 extern droption_t<bool> op_reuse_verify_skip;
+extern droption_t<std::string> op_branch_predictor;
+extern droption_t<unsigned int> op_bp_table_bits;
+extern droption_t<unsigned int> op_bp_history_bits;
+extern droption_t<unsigned int> op_btb_entries;
+extern droption_t<unsigned int> op_ras_entries;
 #endif /* _OPTIONS_H_ */
@@ -31,7 +31,7 @@
  */
 
 #include <assert.h>
-#include <map>
+#include <vector>
 #include "reader.h"
 #include "../common/memref.h"
 #include "../common/utils.h"
@@ -40,10 +40,15 @@
 # include <iostream>
 #endif
 
+// Must be a power of 2.
+#define INITIAL_TID_TABLE_SIZE 64
+
 // Following typical stream iterator convention, the default constructor
 // produces an EOF object.
-reader_t::reader_t() : at_eof(true), input_entry(NULL), cur_tid(0), cur_pid(0),
-                       cur_pc(0), bundle_idx(0)
+reader_t::reader_t() : at_eof(true), input_entry(NULL), wants_compact(false),
+                       cur_tid(0), cur_pid(0),
+                       cur_thread_idx(0), cur_pc(0), bundle_idx(0),
+                       tid_table(INITIAL_TID_TABLE_SIZE, 0)
 {
     /* Empty. */
 }
@@ -54,6 +59,64 @@ reader_t::operator*()
     return cur_ref;
 }
 
+const memref_compact_t&
+reader_t::get_compact()
+{
+    return cur_compact;
+}
+
+// Fills in cur_compact for the record being decoded.  We do this alongside
+// cur_ref rather than re-deriving it from cur_ref in get_compact() so that
+// compact consumers read straight from the input entry.  Callers skip this
+// unless set_wants_compact(true) was called.
+void
+reader_t::set_compact(trace_type_t type, addr_t addr, size_t size)
+{
+    cur_compact.addr = addr;
+    cur_compact.thread = cur_thread_idx;
+    if (size > MEMREF_COMPACT_MAX_SIZE)
+        cur_compact.size = MEMREF_COMPACT_MAX_SIZE;
+    else
+        cur_compact.size = (uint16_t) size;
+    cur_compact.type = (uint8_t) type;
+    cur_compact.unused = 0;
+}
+
+// Returns the index of tid in the threads table, adding it with a pid of 0
+// if this is the first time we have seen it.
+memref_thread_idx_t
+reader_t::thread_index(memref_tid_t tid)
+{
+    size_t mask = tid_table.size() - 1;
+    size_t slot = ((size_t)tid * 0x9e3779b1) & mask;
+    while (tid_table[slot] != 0) {
+        memref_thread_idx_t idx = tid_table[slot] - 1;
+        if (threads[idx].tid == tid)
+            return idx;
+        slot = (slot + 1) & mask;
+    }
+    memref_thread_idx_t idx = (memref_thread_idx_t) threads.size();
+    memref_thread_t info = {0, tid};
+    threads.push_back(info);
+    tid_table[slot] = idx + 1;
+    // Keep the load factor at or below 1/2 so probe sequences stay short.
+    if (threads.size() * 2 > tid_table.size()) {
+        std::vector<memref_thread_idx_t> old_table;
+        old_table.swap(tid_table);
+        tid_table.resize(old_table.size() * 2, 0);
+        mask = tid_table.size() - 1;
+        for (size_t i = 0; i < old_table.size(); ++i) {
+            if (old_table[i] == 0)
+                continue;
+            slot = ((size_t)threads[old_table[i] - 1].tid * 0x9e3779b1) & mask;
+            while (tid_table[slot] != 0)
+                slot = (slot + 1) & mask;
+            tid_table[slot] = old_table[i];
+        }
+    }
+    return idx;
+}
+
 reader_t&
 reader_t::operator++()
 {
@@ -100,6 +163,8 @@ reader_t::operator++()
             // The trace stream always has the instr fetch first, which we
             // use to obtain the PC for subsequent data references.
             cur_ref.data.pc = cur_pc;
+            if (wants_compact)
+                set_compact(cur_ref.data.type, cur_ref.data.addr, cur_ref.data.size);
             break;
         case TRACE_TYPE_INSTR:
         case TRACE_TYPE_INSTR_DIRECT_JUMP:
@@ -108,12 +173,12 @@ reader_t::operator++()
         case TRACE_TYPE_INSTR_DIRECT_CALL:
         case TRACE_TYPE_INSTR_INDIRECT_CALL:
         case TRACE_TYPE_INSTR_RETURN:
-            have_memref = true;
             assert(cur_tid != 0 && cur_pid != 0);
             if (input_entry->size == 0) {
                 // Just an entry to tell us the PC of the subsequent memref,
                 // used with -L0_filter where we don't reliably have icache
-                // entries prior to data entries.
+                // entries prior to data entries.  It is not a record of its
+                // own, so neither cur_ref nor cur_compact changes.
                 cur_pc = input_entry->addr;
             } else {
                 have_memref = true;
@@ -124,6 +189,8 @@ reader_t::operator++()
                 cur_pc = input_entry->addr;
                 cur_ref.instr.addr = cur_pc;
                 next_pc = cur_pc + cur_ref.instr.size;
+                if (wants_compact)
+                    set_compact(cur_ref.instr.type, cur_pc, cur_ref.instr.size);
             }
             break;
         case TRACE_TYPE_INSTR_BUNDLE:
@@ -134,6 +201,8 @@ reader_t::operator++()
             cur_pc = next_pc;
             cur_ref.instr.addr = cur_pc;
             next_pc = cur_pc + cur_ref.instr.size;
+            if (wants_compact)
+                set_compact(cur_ref.instr.type, cur_pc, cur_ref.instr.size);
             // input_entry->size stores the number of instrs in this bundle
             assert(input_entry->size <= sizeof(input_entry->length));
             if (bundle_idx == input_entry->size)
@@ -147,35 +216,50 @@ reader_t::operator++()
             cur_ref.flush.type = (trace_type_t) input_entry->type;
             cur_ref.flush.size = input_entry->size;
             cur_ref.flush.addr = input_entry->addr;
+            if (wants_compact)
+                set_compact(cur_ref.flush.type, cur_ref.flush.addr, cur_ref.flush.size);
             if (cur_ref.flush.size != 0)
                 have_memref = true;
             break;
         case TRACE_TYPE_INSTR_FLUSH_END:
         case TRACE_TYPE_DATA_FLUSH_END:
             cur_ref.flush.size = input_entry->addr - cur_ref.flush.addr;
+            if (wants_compact)
+                set_compact(cur_ref.flush.type, cur_ref.flush.addr, cur_ref.flush.size);
             have_memref = true;
             break;
         case TRACE_TYPE_THREAD:
-            cur_tid = (memref_tid_t) input_entry->addr;
-            // tid2pid might not be filled in yet: if so, we expect a
-            // TRACE_TYPE_PID entry right after this one, and later asserts
-            // will complain if it wasn't there.
-            cur_pid = tid2pid[cur_tid];
+            // Every buffer starts with a thread entry, so most of these repeat
+            // the current thread and need no lookup.
+            if ((memref_tid_t) input_entry->addr != cur_tid) {
+                cur_tid = (memref_tid_t) input_entry->addr;
+                cur_thread_idx = thread_index(cur_tid);
+                // The pid might not be filled in yet: if so, we expect a
+                // TRACE_TYPE_PID entry right after this one, and later asserts
+                // will complain if it wasn't there.
+                cur_pid = threads[cur_thread_idx].pid;
+            }
             break;
         case TRACE_TYPE_THREAD_EXIT:
-            cur_tid = (memref_tid_t) input_entry->addr;
-            cur_pid = tid2pid[cur_tid];
+            if ((memref_tid_t) input_entry->addr != cur_tid) {
+                cur_tid = (memref_tid_t) input_entry->addr;
+                cur_thread_idx = thread_index(cur_tid);
+                cur_pid = threads[cur_thread_idx].pid;
+            }
             assert(cur_tid != 0 && cur_pid != 0);
             // We do pass this to the caller but only some fields are valid:
             cur_ref.exit.pid = cur_pid;
             cur_ref.exit.tid = cur_tid;
             cur_ref.exit.type = (trace_type_t) input_entry->type;
+            if (wants_compact)
+                set_compact(cur_ref.exit.type, 0, 0);
             have_memref = true;
             break;
         case TRACE_TYPE_PID:
             cur_pid = (memref_pid_t) input_entry->addr;
             // We do want to replace, in case of tid reuse.
-            tid2pid[cur_tid] = cur_pid;
+            cur_thread_idx = thread_index(cur_tid);
+            threads[cur_thread_idx].pid = cur_pid;
             break;
         default:
             ERRMSG("Unknown trace entry type %d\n", input_entry->type);
@@ -39,7 +39,7 @@
 
 #include <assert.h>
 #include <iterator>
-#include <map>
+#include <vector>
 #include "../common/memref.h"
 #include "../common/utils.h"
 
@@ -68,6 +68,22 @@ class reader_t : public std::iterator<std::input_iterator_tag, memref_t>
 
     virtual reader_t& operator++();
 
+    // Asks the reader to build memref_compact_t records.  This must be called
+    // before init(): when no caller wants them we skip the work per record.
+    virtual void set_wants_compact(bool wants) {
+        wants_compact = wants;
+    }
+
+    // Returns the current record in memref_compact_t form.  Only valid if
+    // set_wants_compact(true) was called.
+    virtual const memref_compact_t& get_compact();
+
+    // Returns the table indexed by memref_compact_t.thread.  The pointer is
+    // invalidated when a new thread is encountered.
+    virtual const memref_thread_t * get_threads() const {
+        return threads.empty() ? NULL : &threads[0];
+    }
+
     // We do not support the post-increment operator for two reasons:
     // 1) It prevents pure virtual functions here, as it cannot
     //    return an abstract type;
@@ -80,14 +96,25 @@ class reader_t : public std::iterator<std::input_iterator_tag, memref_t>
     bool at_eof;
 
  private:
+    memref_thread_idx_t thread_index(memref_tid_t tid);
+    void set_compact(trace_type_t type, addr_t addr, size_t size);
+
     trace_entry_t *input_entry;
     memref_t cur_ref;
+    bool wants_compact;
+    memref_compact_t cur_compact;
     memref_tid_t cur_tid;
     memref_pid_t cur_pid;
+    memref_thread_idx_t cur_thread_idx;
     addr_t cur_pc;
     addr_t next_pc;
     int bundle_idx;
-    std::map<memref_tid_t, memref_pid_t> tid2pid;
+    // Each thread seen so far, indexed by memref_thread_idx_t.  This replaces
+    // a tid-to-pid std::map that was consulted on every thread switch.
+    std::vector<memref_thread_t> threads;
+    // An open-addressed table mapping a tid to its index in threads plus one,
+    // with 0 marking an empty slot.  The size is always a power of 2.
+    std::vector<memref_thread_idx_t> tid_table;
 };
 
 #endif /* _READER_H_ */
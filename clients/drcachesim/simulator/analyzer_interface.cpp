@@ -43,6 +43,7 @@
 #include "../tools/histogram_create.h"
 #include "../tools/reuse_distance_create.h"
 #include "../tools/reuse_time_create.h"
+#include "../tools/branch_predictor_create.h"
 
 analysis_tool_t *
 drmemtrace_analysis_tool_create()
@@ -60,7 +61,13 @@ drmemtrace_analysis_tool_create()
                                       op_skip_refs.get_value(),
                                       op_warmup_refs.get_value(),
                                       op_sim_refs.get_value(),
-                                      op_verbose.get_value());
+                                      op_verbose.get_value(),
+                                      op_interval.get_value(),
+                                      op_interval_instrs.get_value(),
+                                      op_interval_file.get_value(),
+                                      op_checkpoint_in.get_value(),
+                                      op_checkpoint_out.get_value(),
+                                      op_checkpoint_refs.get_value());
     } else if (op_simulator_type.get_value() == TLB) {
         return tlb_simulator_create(op_num_cores.get_value(),
                                     op_page_size.get_value(),
@@ -74,7 +81,13 @@ drmemtrace_analysis_tool_create()
                                     op_skip_refs.get_value(),
                                     op_warmup_refs.get_value(),
                                     op_sim_refs.get_value(),
-                                    op_verbose.get_value());
+                                    op_verbose.get_value(),
+                                    op_interval.get_value(),
+                                    op_interval_instrs.get_value(),
+                                    op_interval_file.get_value(),
+                                    op_checkpoint_in.get_value(),
+                                    op_checkpoint_out.get_value(),
+                                    op_checkpoint_refs.get_value());
     } else if (op_simulator_type.get_value() == HISTOGRAM) {
         return histogram_tool_create(op_line_size.get_value(),
                                      op_report_top.get_value(),
@@ -90,10 +103,19 @@ drmemtrace_analysis_tool_create()
     } else if (op_simulator_type.get_value() == REUSE_TIME) {
         return reuse_time_tool_create(op_line_size.get_value(),
                                       op_verbose.get_value());
+    } else if (op_simulator_type.get_value() == BRANCH_PRED) {
+        return branch_predictor_tool_create(op_branch_predictor.get_value(),
+                                            op_bp_table_bits.get_value(),
+                                            op_bp_history_bits.get_value(),
+                                            op_btb_entries.get_value(),
+                                            op_ras_entries.get_value(),
+                                            op_report_top.get_value(),
+                                            op_verbose.get_value());
     } else {
         ERRMSG("Usage error: unsupported analyzer type. "
                "Please choose " CPU_CACHE ", " TLB ", "
-               HISTOGRAM ", or " REUSE_DIST ".\n");
+               HISTOGRAM ", " REUSE_DIST ", " REUSE_TIME ", or "
+               BRANCH_PRED ".\n");
         return NULL;
     }
 }
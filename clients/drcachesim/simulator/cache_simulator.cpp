@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include <iterator>
+#include <sstream>
 #include <string>
 #include <assert.h>
 #include <limits.h>
@@ -68,12 +69,20 @@ cache_simulator_create(unsigned int num_cores,
                        uint64_t skip_refs,
                        uint64_t warmup_refs,
                        uint64_t sim_refs,
-                       unsigned int verbose)
+                       unsigned int verbose,
+                       uint64_t interval,
+                       bool interval_instrs,
+                       std::string interval_file,
+                       std::string checkpoint_in,
+                       std::string checkpoint_out,
+                       uint64_t checkpoint_refs)
 {
     return new cache_simulator_t(num_cores, line_size, L1I_size, L1D_size,
                                  L1I_assoc, L1D_assoc, LL_size, LL_assoc,
                                  replace_policy, skip_refs,warmup_refs,
-                                 sim_refs, verbose);
+                                 sim_refs, verbose,
+                                 interval, interval_instrs, interval_file,
+                                 checkpoint_in, checkpoint_out, checkpoint_refs);
 }
 
 cache_simulator_t::cache_simulator_t(unsigned int num_cores,
@@ -88,8 +97,16 @@ cache_simulator_t::cache_simulator_t(unsigned int num_cores,
                                      uint64_t skip_refs,
                                      uint64_t warmup_refs,
                                      uint64_t sim_refs,
-                                     unsigned int verbose) :
-    simulator_t(num_cores, skip_refs,warmup_refs, sim_refs, verbose),
+                                     unsigned int verbose,
+                                     uint64_t interval,
+                                     bool interval_instrs,
+                                     std::string interval_file,
+                                     std::string checkpoint_in,
+                                     std::string checkpoint_out,
+                                     uint64_t checkpoint_refs) :
+    simulator_t(num_cores, skip_refs,warmup_refs, sim_refs, verbose,
+                interval, interval_instrs, interval_file,
+                checkpoint_in, checkpoint_out, checkpoint_refs),
     knob_line_size(line_size),
     knob_L1I_size(L1I_size),
     knob_L1D_size(L1D_size),
@@ -140,12 +157,22 @@ cache_simulator_t::cache_simulator_t(unsigned int num_cores,
             success = false;
             return;
         }
+        std::ostringstream name;
+        name << "core" << i;
+        register_device(name.str() + "_L1I", icaches[i]);
+        register_device(name.str() + "_L1D", dcaches[i]);
     }
+    register_device("LL", llcache);
 
     thread_counts = new unsigned int[knob_num_cores];
     memset(thread_counts, 0, sizeof(thread_counts[0])*knob_num_cores);
     thread_ever_counts = new unsigned int[knob_num_cores];
     memset(thread_ever_counts, 0, sizeof(thread_ever_counts[0])*knob_num_cores);
+
+    if (!knob_checkpoint_in.empty() && !load_checkpoint()) {
+        success = false;
+        return;
+    }
 }
 
 cache_simulator_t::~cache_simulator_t()
@@ -174,6 +201,10 @@ cache_simulator_t::~cache_simulator_t()
 bool
 cache_simulator_t::process_memref(const memref_t &memref)
 {
+    // We check before the skip and drop returns below so that a checkpoint
+    // position among skipped or dropped references is still honored.
+    checkpoint_update();
+    ++ref_ordinal;
     if (knob_skip_refs > 0) {
         knob_skip_refs--;
         return true;
@@ -181,7 +212,7 @@ cache_simulator_t::process_memref(const memref_t &memref)
 
     // The references after warmup and simulated ones are dropped.
     if (knob_warmup_refs == 0 && knob_sim_refs == 0)
-        return true;;
+        return true;
 
     // Both warmup and simulated references are simulated.
 
@@ -235,10 +266,13 @@ cache_simulator_t::process_memref(const memref_t &memref)
                 dcaches[i]->get_stats()->reset();
             }
             llcache->get_stats()->reset();
+            if (knob_checkpoint_refs == 0 && !knob_checkpoint_out.empty())
+                save_checkpoint();
         }
     }
     else {
         knob_sim_refs--;
+        interval_update(memref);
     }
     return true;
 }
@@ -246,6 +280,10 @@ cache_simulator_t::process_memref(const memref_t &memref)
 bool
 cache_simulator_t::print_results()
 {
+    interval_finish();
+    // If the checkpoint position was never reached we save the final state.
+    if (!knob_checkpoint_out.empty() && !checkpoint_written)
+        save_checkpoint();
     std::cerr << "Cache simulation results:\n";
     for (int i = 0; i < knob_num_cores; i++) {
         unsigned int threads = thread_ever_counts[i];
@@ -33,6 +33,7 @@
 #include <iostream>
 #include <iomanip>
 #include "cache_stats.h"
+#include "checkpoint_io.h"
 
 cache_stats_t::cache_stats_t() :
     num_flushes(0), num_prefetch_hits(0), num_prefetch_misses(0)
@@ -83,3 +84,25 @@ cache_stats_t::reset()
     num_prefetch_hits = 0;
     num_prefetch_misses = 0;
 }
+
+bool
+cache_stats_t::save_state(std::ostream &out)
+{
+    if (!caching_device_stats_t::save_state(out))
+        return false;
+    checkpoint_write(out, num_flushes);
+    checkpoint_write(out, num_prefetch_hits);
+    checkpoint_write(out, num_prefetch_misses);
+    return out.good();
+}
+
+bool
+cache_stats_t::load_state(std::istream &in)
+{
+    if (!caching_device_stats_t::load_state(in))
+        return false;
+    checkpoint_read(in, num_flushes);
+    checkpoint_read(in, num_prefetch_hits);
+    checkpoint_read(in, num_prefetch_misses);
+    return in.good();
+}
@@ -52,6 +52,9 @@ class cache_stats_t : public caching_device_stats_t
 
     virtual void reset();
 
+    virtual bool save_state(std::ostream &out);
+    virtual bool load_state(std::istream &in);
+
  protected:
     // In addition to caching_device_stats_t::print_counts,
     // cache_stats_t::print_counts prints stats for flushes and
@@ -33,6 +33,7 @@
 #include "caching_device.h"
 #include "caching_device_block.h"
 #include "caching_device_stats.h"
+#include "checkpoint_io.h"
 #include "../common/utils.h"
 #include <assert.h>
 
@@ -179,3 +180,34 @@ caching_device_t::replace_which_way(int block_idx)
     get_caching_device_block(block_idx, min_way).counter = 0;
     return min_way;
 }
+
+bool
+caching_device_t::save_state(std::ostream &out)
+{
+    checkpoint_write(out, associativity);
+    checkpoint_write(out, block_size);
+    checkpoint_write(out, num_blocks);
+    for (int i = 0; i < num_blocks; i++) {
+        checkpoint_write(out, blocks[i]->tag);
+        checkpoint_write(out, blocks[i]->counter);
+    }
+    return stats->save_state(out) && out.good();
+}
+
+bool
+caching_device_t::load_state(std::istream &in)
+{
+    int saved_assoc, saved_block_size, saved_num_blocks;
+    checkpoint_read(in, saved_assoc);
+    checkpoint_read(in, saved_block_size);
+    checkpoint_read(in, saved_num_blocks);
+    if (!in.good() || saved_assoc != associativity || saved_block_size != block_size ||
+        saved_num_blocks != num_blocks)
+        return false;
+    for (int i = 0; i < num_blocks; i++) {
+        checkpoint_read(in, blocks[i]->tag);
+        checkpoint_read(in, blocks[i]->counter);
+    }
+    last_tag = TAG_INVALID;
+    return stats->load_state(in) && in.good();
+}
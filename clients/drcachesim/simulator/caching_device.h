@@ -36,6 +36,7 @@
 #ifndef _CACHING_DEVICE_H_
 #define _CACHING_DEVICE_H_ 1
 
+#include <iostream>
 #include "caching_device_block.h"
 #include "caching_device_stats.h"
 #include "../common/memref.h"
@@ -60,6 +61,12 @@ class caching_device_t
     caching_device_stats_t *get_stats() const { return stats; }
     caching_device_t *get_parent() const { return parent; }
 
+    // Checkpoint support: serializes the tag and replacement state of every
+    // block, followed by the statistics.  load_state() fails if the saved
+    // geometry does not match ours.
+    virtual bool save_state(std::ostream &out);
+    virtual bool load_state(std::istream &in);
+
  protected:
     virtual void access_update(int block_idx, int way);
     virtual int replace_which_way(int block_idx);
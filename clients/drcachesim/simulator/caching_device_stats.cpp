@@ -33,6 +33,7 @@
 #include <iostream>
 #include <iomanip>
 #include "caching_device_stats.h"
+#include "checkpoint_io.h"
 
 caching_device_stats_t::caching_device_stats_t() :
     num_hits(0), num_misses(0), num_child_hits(0)
@@ -114,3 +115,21 @@ caching_device_stats_t::reset()
     num_misses = 0;
     num_child_hits = 0;
 }
+
+bool
+caching_device_stats_t::save_state(std::ostream &out)
+{
+    checkpoint_write(out, num_hits);
+    checkpoint_write(out, num_misses);
+    checkpoint_write(out, num_child_hits);
+    return out.good();
+}
+
+bool
+caching_device_stats_t::load_state(std::istream &in)
+{
+    checkpoint_read(in, num_hits);
+    checkpoint_read(in, num_misses);
+    checkpoint_read(in, num_child_hits);
+    return in.good();
+}
@@ -36,6 +36,7 @@
 #ifndef _CACHING_DEVICE_STATS_H_
 #define _CACHING_DEVICE_STATS_H_ 1
 
+#include <iostream>
 #include <string>
 #include <stdint.h>
 #include "../common/memref.h"
@@ -58,6 +59,13 @@ class caching_device_stats_t
 
     virtual void reset();
 
+    // Checkpoint support.
+    virtual bool save_state(std::ostream &out);
+    virtual bool load_state(std::istream &in);
+
+    int_least64_t get_hits() const { return num_hits; }
+    int_least64_t get_misses() const { return num_misses; }
+
  protected:
     // print different groups of information, beneficial for code reuse
     virtual void print_counts(std::string prefix); // hit/miss numbers
@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include <iterator>
+#include <string.h>
 #include <assert.h>
 #include <limits.h>
 #include "../common/memref.h"
@@ -39,23 +40,59 @@
 #include "../common/utils.h"
 #include "droption.h"
 #include "simulator.h"
+#include "checkpoint_io.h"
 
 simulator_t::simulator_t(unsigned int num_cores,
                          uint64_t skip_refs,
                          uint64_t warmup_refs,
                          uint64_t sim_refs,
-                         unsigned int verbose) :
+                         unsigned int verbose,
+                         uint64_t interval,
+                         bool interval_instrs,
+                         std::string interval_file_name,
+                         std::string checkpoint_in,
+                         std::string checkpoint_out,
+                         uint64_t checkpoint_refs) :
     knob_num_cores(num_cores),
     knob_skip_refs(skip_refs),
     knob_warmup_refs(warmup_refs),
     knob_sim_refs(sim_refs),
     knob_verbose(verbose),
+    knob_interval(interval),
+    knob_interval_instrs(interval_instrs),
+    knob_interval_file(interval_file_name),
+    knob_checkpoint_in(checkpoint_in),
+    knob_checkpoint_out(checkpoint_out),
+    knob_checkpoint_refs(checkpoint_refs),
+    ref_ordinal(0),
+    checkpoint_written(false),
     last_thread(0),
-    last_core(0)
+    last_core(0),
+    interval_out(&std::cerr),
+    interval_remaining(interval),
+    interval_index(0),
+    interval_ref_count(0),
+    interval_instr_count(0),
+    interval_last_ref_count(0),
+    interval_last_instr_count(0)
 {
+    if (knob_interval > 0 && !knob_interval_file.empty()) {
+        interval_file.open(knob_interval_file.c_str(), std::ofstream::out);
+        if (!interval_file.good()) {
+            ERRMSG("Usage error: failed to open interval file %s\n",
+                   knob_interval_file.c_str());
+            success = false;
+            return;
+        }
+        interval_out = &interval_file;
+    }
 }
 
-simulator_t::~simulator_t() {}
+simulator_t::~simulator_t()
+{
+    if (interval_file.is_open())
+        interval_file.close();
+}
 
 int
 simulator_t::core_for_thread(memref_tid_t tid)
@@ -99,3 +136,188 @@ simulator_t::handle_thread_exit(memref_tid_t tid)
     }
     thread2core.erase(tid);
 }
+
+void
+simulator_t::register_device(const std::string &name, caching_device_t *device)
+{
+    device_info_t entry;
+    entry.name = name;
+    entry.device = device;
+    entry.last_hits = 0;
+    entry.last_misses = 0;
+    devices.push_back(entry);
+}
+
+void
+simulator_t::interval_snapshot()
+{
+    // The header is deferred until the first row so that subclasses are free to
+    // register their devices anywhere in their constructors.
+    if (interval_index == 0) {
+        *interval_out << "interval,refs,instrs";
+        for (std::vector<device_info_t>::iterator it = devices.begin();
+             it != devices.end(); ++it)
+            *interval_out << "," << it->name << "_hits," << it->name << "_misses";
+        *interval_out << "\n";
+    }
+    *interval_out << interval_index << "," <<
+        (interval_ref_count - interval_last_ref_count) << "," <<
+        (interval_instr_count - interval_last_instr_count);
+    for (std::vector<device_info_t>::iterator it = devices.begin();
+         it != devices.end(); ++it) {
+        caching_device_stats_t *stats = it->device->get_stats();
+        int_least64_t hits = stats->get_hits();
+        int_least64_t misses = stats->get_misses();
+        *interval_out << "," << (hits - it->last_hits) << "," <<
+            (misses - it->last_misses);
+        it->last_hits = hits;
+        it->last_misses = misses;
+    }
+    *interval_out << "\n";
+    interval_last_ref_count = interval_ref_count;
+    interval_last_instr_count = interval_instr_count;
+    interval_remaining = knob_interval;
+    ++interval_index;
+}
+
+void
+simulator_t::interval_finish()
+{
+    if (knob_interval == 0)
+        return;
+    if (interval_ref_count > interval_last_ref_count)
+        interval_snapshot();
+    interval_out->flush();
+}
+
+// The checkpoint file starts with this magic string and a version.
+static const char CHECKPOINT_MAGIC[] = "DRCSCKPT";
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+bool
+simulator_t::save_checkpoint()
+{
+    std::ofstream out(knob_checkpoint_out.c_str(),
+                      std::ofstream::out | std::ofstream::binary);
+    if (!out.good()) {
+        ERRMSG("Failed to open checkpoint file %s\n", knob_checkpoint_out.c_str());
+        return false;
+    }
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    checkpoint_write(out, CHECKPOINT_VERSION);
+    checkpoint_write(out, knob_num_cores);
+    checkpoint_write(out, ref_ordinal);
+    checkpoint_write(out, knob_skip_refs);
+    checkpoint_write(out, knob_warmup_refs);
+    uint64_t num_threads = thread2core.size();
+    checkpoint_write(out, num_threads);
+    for (std::map<memref_tid_t, int>::iterator it = thread2core.begin();
+         it != thread2core.end(); ++it) {
+        checkpoint_write(out, it->first);
+        checkpoint_write(out, it->second);
+    }
+    for (int i = 0; i < knob_num_cores; i++) {
+        checkpoint_write(out, thread_counts[i]);
+        checkpoint_write(out, thread_ever_counts[i]);
+    }
+    uint32_t num_devices = (uint32_t)devices.size();
+    checkpoint_write(out, num_devices);
+    for (std::vector<device_info_t>::iterator it = devices.begin();
+         it != devices.end(); ++it) {
+        uint32_t len = (uint32_t)it->name.size();
+        checkpoint_write(out, len);
+        out.write(it->name.c_str(), len);
+        if (!it->device->save_state(out))
+            break;
+    }
+    checkpoint_written = true;
+    if (!out.good()) {
+        ERRMSG("Failed to write checkpoint file %s\n", knob_checkpoint_out.c_str());
+        return false;
+    }
+    if (knob_verbose >= 1) {
+        std::cerr << "wrote checkpoint at reference " << ref_ordinal << " to " <<
+            knob_checkpoint_out << std::endl;
+    }
+    return true;
+}
+
+bool
+simulator_t::load_checkpoint()
+{
+    std::ifstream in(knob_checkpoint_in.c_str(),
+                     std::ifstream::in | std::ifstream::binary);
+    if (!in.good()) {
+        ERRMSG("Failed to open checkpoint file %s\n", knob_checkpoint_in.c_str());
+        return false;
+    }
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version;
+    int num_cores;
+    in.read(magic, sizeof(magic));
+    checkpoint_read(in, version);
+    checkpoint_read(in, num_cores);
+    if (!in.good() || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+        version != CHECKPOINT_VERSION) {
+        ERRMSG("Checkpoint file %s is not a valid checkpoint\n",
+               knob_checkpoint_in.c_str());
+        return false;
+    }
+    if (num_cores != knob_num_cores) {
+        ERRMSG("Checkpoint was taken with %d cores, not %d\n", num_cores,
+               knob_num_cores);
+        return false;
+    }
+    uint64_t position, skip_refs;
+    checkpoint_read(in, position);
+    checkpoint_read(in, skip_refs);
+    checkpoint_read(in, knob_warmup_refs);
+    uint64_t num_threads;
+    checkpoint_read(in, num_threads);
+    thread2core.clear();
+    for (uint64_t i = 0; i < num_threads && in.good(); i++) {
+        memref_tid_t tid;
+        int core;
+        checkpoint_read(in, tid);
+        checkpoint_read(in, core);
+        thread2core[tid] = core;
+    }
+    for (int i = 0; i < knob_num_cores; i++) {
+        checkpoint_read(in, thread_counts[i]);
+        checkpoint_read(in, thread_ever_counts[i]);
+    }
+    uint32_t num_devices;
+    checkpoint_read(in, num_devices);
+    if (!in.good() || num_devices != devices.size()) {
+        ERRMSG("Checkpoint does not match the simulated device hierarchy\n");
+        return false;
+    }
+    for (std::vector<device_info_t>::iterator it = devices.begin();
+         it != devices.end(); ++it) {
+        uint32_t len;
+        checkpoint_read(in, len);
+        std::string name(len, '\0');
+        if (len > 0)
+            in.read(&name[0], len);
+        if (!in.good() || name != it->name) {
+            ERRMSG("Checkpoint does not match the simulated device hierarchy\n");
+            return false;
+        }
+        if (!it->device->load_state(in)) {
+            ERRMSG("Checkpoint state for %s does not match its configuration\n",
+                   it->name.c_str());
+            return false;
+        }
+    }
+    // We resume right after the reference at which the checkpoint was taken,
+    // plus whatever remained of -skip_refs if it was taken while skipping.
+    // The trace is a sequential stream so we cannot seek in it directly,
+    // but skipped references are dropped without any simulation work.
+    knob_skip_refs = position + skip_refs;
+    last_thread = 0;
+    if (knob_verbose >= 1) {
+        std::cerr << "restored checkpoint taken at reference " << position <<
+            " from " << knob_checkpoint_in << std::endl;
+    }
+    return true;
+}
@@ -36,7 +36,10 @@
 #ifndef _SIMULATOR_H_
 #define _SIMULATOR_H_ 1
 
+#include <fstream>
 #include <map>
+#include <string>
+#include <vector>
 #include "caching_device_stats.h"
 #include "caching_device.h"
 #include "../analysis_tool.h"
@@ -49,13 +52,60 @@ class simulator_t : public analysis_tool_t
                 uint64_t skip_refs,
                 uint64_t warmup_refs,
                 uint64_t sim_refs,
-                unsigned int verbose);
+                unsigned int verbose,
+                uint64_t interval,
+                bool interval_instrs,
+                std::string interval_file,
+                std::string checkpoint_in,
+                std::string checkpoint_out,
+                uint64_t checkpoint_refs);
     virtual ~simulator_t() = 0;
 
  protected:
     virtual int core_for_thread(memref_tid_t tid);
     virtual void handle_thread_exit(memref_tid_t tid);
 
+    // Subclasses register each of their caching devices, in a fixed order, for
+    // use by the time-series statistics and by checkpoints.
+    virtual void register_device(const std::string &name, caching_device_t *device);
+
+    // Time-series statistics: the hit and miss counters of each registered
+    // device are snapshotted every knob_interval simulated references
+    // (or instructions, if knob_interval_instrs).
+    // Called for each simulated (post-warmup) reference.  We keep this inlined
+    // and down to a compare and a decrement for the common case.
+    inline void interval_update(const memref_t &memref) {
+        if (knob_interval == 0)
+            return;
+        ++interval_ref_count;
+        if (type_is_instr(memref.instr.type))
+            ++interval_instr_count;
+        else if (knob_interval_instrs)
+            return;
+        if (--interval_remaining == 0)
+            interval_snapshot();
+    }
+    // Writes one row holding the counter deltas since the prior snapshot.
+    virtual void interval_snapshot();
+    // Emits a final row for a trailing partial interval, if any.
+    virtual void interval_finish();
+
+    // Checkpoints: the full simulator state (device tags, replacement state,
+    // and statistics, plus the thread-to-core mapping) is written out once
+    // knob_checkpoint_refs references have been consumed, whether simulated,
+    // skipped, or dropped, or when warmup completes if knob_checkpoint_refs
+    // is 0.  Restoring a checkpoint skips the trace references that were
+    // consumed before it was taken.
+    // This is called at the start of process_memref(), before ref_ordinal
+    // counts the incoming reference.
+    inline void checkpoint_update() {
+        if (ref_ordinal == knob_checkpoint_refs && knob_checkpoint_refs > 0 &&
+            !knob_checkpoint_out.empty())
+            save_checkpoint();
+    }
+    virtual bool save_checkpoint();
+    virtual bool load_checkpoint();
+
     int knob_num_cores;
 
     // For thread mapping to cores:
@@ -67,9 +117,36 @@ class simulator_t : public analysis_tool_t
     uint64_t knob_warmup_refs;
     uint64_t knob_sim_refs;
     unsigned int knob_verbose;
+    uint64_t knob_interval;
+    bool knob_interval_instrs;
+    std::string knob_interval_file;
+    std::string knob_checkpoint_in;
+    std::string knob_checkpoint_out;
+    uint64_t knob_checkpoint_refs;
+
+    // The number of references seen so far, including skipped ones.
+    uint64_t ref_ordinal;
+    bool checkpoint_written;
 
     memref_tid_t last_thread;
     int last_core;
+
+ private:
+    struct device_info_t {
+        std::string name;
+        caching_device_t *device;
+        int_least64_t last_hits;
+        int_least64_t last_misses;
+    };
+    std::vector<device_info_t> devices;
+    std::ofstream interval_file;
+    std::ostream *interval_out;
+    uint64_t interval_remaining;
+    uint64_t interval_index;
+    uint64_t interval_ref_count;
+    uint64_t interval_instr_count;
+    uint64_t interval_last_ref_count;
+    uint64_t interval_last_instr_count;
 };
 
 #endif /* _SIMULATOR_H_ */
@@ -31,6 +31,7 @@
  */
 
 #include "tlb.h"
+#include "checkpoint_io.h"
 #include "../common/utils.h"
 #include <assert.h>
 
@@ -122,3 +123,23 @@ tlb_t::request(const memref_t &memref_in)
         last_pid = pid;
     }
 }
+
+bool
+tlb_t::save_state(std::ostream &out)
+{
+    if (!caching_device_t::save_state(out))
+        return false;
+    for (int i = 0; i < num_blocks; i++)
+        checkpoint_write(out, ((tlb_entry_t *)blocks[i])->pid);
+    return out.good();
+}
+
+bool
+tlb_t::load_state(std::istream &in)
+{
+    if (!caching_device_t::load_state(in))
+        return false;
+    for (int i = 0; i < num_blocks; i++)
+        checkpoint_read(in, ((tlb_entry_t *)blocks[i])->pid);
+    return in.good();
+}
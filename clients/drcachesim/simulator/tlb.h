@@ -44,6 +44,9 @@ class tlb_t : public caching_device_t
 {
  public:
     virtual void request(const memref_t &memref);
+    // In addition to the base state we save the pid of each entry.
+    virtual bool save_state(std::ostream &out);
+    virtual bool load_state(std::istream &in);
  protected:
     virtual void init_blocks();
 
@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include <iterator>
+#include <sstream>
 #include <string>
 #include <assert.h>
 #include <limits.h>
@@ -57,12 +58,20 @@ tlb_simulator_create(unsigned int num_cores,
                      uint64_t skip_refs,
                      uint64_t warmup_refs,
                      uint64_t sim_refs,
-                     unsigned int verbose)
+                     unsigned int verbose,
+                     uint64_t interval,
+                     bool interval_instrs,
+                     std::string interval_file,
+                     std::string checkpoint_in,
+                     std::string checkpoint_out,
+                     uint64_t checkpoint_refs)
 {
     return new tlb_simulator_t(num_cores, page_size, TLB_L1I_entries,
                                TLB_L1D_entries, TLB_L1I_assoc, TLB_L1D_assoc,
                                TLB_L2_entries, TLB_L2_assoc, replace_policy,
-                               skip_refs,warmup_refs, sim_refs, verbose);
+                               skip_refs,warmup_refs, sim_refs, verbose,
+                               interval, interval_instrs, interval_file,
+                               checkpoint_in, checkpoint_out, checkpoint_refs);
 }
 
 tlb_simulator_t::tlb_simulator_t(unsigned int num_cores,
@@ -77,8 +86,16 @@ tlb_simulator_t::tlb_simulator_t(unsigned int num_cores,
                                  uint64_t skip_refs,
                                  uint64_t warmup_refs,
                                  uint64_t sim_refs,
-                                 unsigned int verbose) :
-    simulator_t(num_cores, skip_refs,warmup_refs, sim_refs, verbose),
+                                 unsigned int verbose,
+                                 uint64_t interval,
+                                 bool interval_instrs,
+                                 std::string interval_file,
+                                 std::string checkpoint_in,
+                                 std::string checkpoint_out,
+                                 uint64_t checkpoint_refs) :
+    simulator_t(num_cores, skip_refs,warmup_refs, sim_refs, verbose,
+                interval, interval_instrs, interval_file,
+                checkpoint_in, checkpoint_out, checkpoint_refs),
     knob_page_size(page_size),
     knob_TLB_L1I_entries(TLB_L1I_entries),
     knob_TLB_L1D_entries(TLB_L1D_entries),
@@ -119,12 +136,22 @@ tlb_simulator_t::tlb_simulator_t(unsigned int num_cores,
             success = false;
             return;
         }
+        std::ostringstream name;
+        name << "core" << i;
+        register_device(name.str() + "_L1I", itlbs[i]);
+        register_device(name.str() + "_L1D", dtlbs[i]);
+        register_device(name.str() + "_LL", lltlbs[i]);
     }
 
     thread_counts = new unsigned int[knob_num_cores];
     memset(thread_counts, 0, sizeof(thread_counts[0])*knob_num_cores);
     thread_ever_counts = new unsigned int[knob_num_cores];
     memset(thread_ever_counts, 0, sizeof(thread_ever_counts[0])*knob_num_cores);
+
+    if (!knob_checkpoint_in.empty() && !load_checkpoint()) {
+        success = false;
+        return;
+    }
 }
 
 tlb_simulator_t::~tlb_simulator_t()
@@ -154,6 +181,10 @@ tlb_simulator_t::~tlb_simulator_t()
 bool
 tlb_simulator_t::process_memref(const memref_t &memref)
 {
+    // We check before the skip and drop returns below so that a checkpoint
+    // position among skipped or dropped references is still honored.
+    checkpoint_update();
+    ++ref_ordinal;
     if (knob_skip_refs > 0) {
         knob_skip_refs--;
         return true;
@@ -212,10 +243,13 @@ tlb_simulator_t::process_memref(const memref_t &memref)
                 dtlbs[i]->get_stats()->reset();
                 lltlbs[i]->get_stats()->reset();
             }
+            if (knob_checkpoint_refs == 0 && !knob_checkpoint_out.empty())
+                save_checkpoint();
         }
     }
     else {
         knob_sim_refs--;
+        interval_update(memref);
     }
     return true;
 }
@@ -223,6 +257,10 @@ tlb_simulator_t::process_memref(const memref_t &memref)
 bool
 tlb_simulator_t::print_results()
 {
+    interval_finish();
+    // If the checkpoint position was never reached we save the final state.
+    if (!knob_checkpoint_out.empty() && !checkpoint_written)
+        save_checkpoint();
     std::cerr << "TLB simulation results:\n";
     for (int i = 0; i < knob_num_cores; i++) {
         unsigned int threads = thread_ever_counts[i];
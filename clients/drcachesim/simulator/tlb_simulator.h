@@ -56,7 +56,13 @@ class tlb_simulator_t : public simulator_t
                     uint64_t skip_refs,
                     uint64_t warmup_refs,
                     uint64_t sim_refs,
-                    unsigned int verbose);
+                    unsigned int verbose,
+                    uint64_t interval,
+                    bool interval_instrs,
+                    std::string interval_file,
+                    std::string checkpoint_in,
+                    std::string checkpoint_out,
+                    uint64_t checkpoint_refs);
     virtual ~tlb_simulator_t();
     virtual bool process_memref(const memref_t &memref);
     virtual bool print_results();
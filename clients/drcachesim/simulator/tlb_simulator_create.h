@@ -52,6 +52,12 @@ tlb_simulator_create(unsigned int num_cores = 4,
                      uint64_t skip_refs = 0,
                      uint64_t warmup_refs = 0,
                      uint64_t sim_refs = 1ULL << 63,
-                     unsigned int verbose = 0);
+                     unsigned int verbose = 0,
+                     uint64_t interval = 0,
+                     bool interval_instrs = false,
+                     std::string interval_file = "",
+                     std::string checkpoint_in = "",
+                     std::string checkpoint_out = "",
+                     uint64_t checkpoint_refs = 0);
 
 #endif /* _TLB_SIMULATOR_CREATE_H_ */
@@ -0,0 +1,68 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Line-straddling accesses under -L0_filter */
+
+#include "tools.h"
+
+#define LINE_SIZE 64
+#define BLOCK_SIZE (2*LINE_SIZE)
+/* Large enough that the misses dominate those of startup and exit. */
+#define NUM_BLOCKS 256*1024
+/* One extra block so we can line-align the start. */
+static char blocks[(NUM_BLOCKS + 1) * BLOCK_SIZE];
+
+/* Each block's first line is read by an aligned load and then again by a load
+ * that straddles into the block's second line.  Nothing else touches the second
+ * lines, so they only reach the simulator if the L0 filter checks both lines of
+ * the straddling load rather than filtering it on its first line alone.
+ */
+static int
+straddle(void)
+{
+    char *block = (char *)ALIGN_FORWARD(blocks, LINE_SIZE);
+    int i, sum = 0;
+    for (i = 0; i < NUM_BLOCKS; i++, block += BLOCK_SIZE) {
+        sum += *(volatile int *)block;
+        sum += *(volatile int *)(block + LINE_SIZE - 2);
+    }
+    return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (straddle() != 0)
+        print("blocks should be zero\n");
+    print("all done\n");
+    return 0;
+}
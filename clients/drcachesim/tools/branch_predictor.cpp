@@ -0,0 +1,469 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include "branch_predictor.h"
+#include "../common/options.h"
+#include "../common/utils.h"
+
+#ifdef DEBUG
+# define DEBUG_VERBOSE(level) (knob_verbose >= (level))
+#else
+# define DEBUG_VERBOSE(level) (false)
+#endif
+
+const std::string branch_predictor_t::TOOL_NAME = "Branch predictor tool";
+
+analysis_tool_t *
+branch_predictor_tool_create(const std::string &predictor,
+                             unsigned int table_bits,
+                             unsigned int history_bits,
+                             unsigned int btb_entries,
+                             unsigned int ras_entries,
+                             unsigned int report_top,
+                             unsigned int verbose)
+{
+    return new branch_predictor_t(predictor, table_bits, history_bits, btb_entries,
+                                  ras_entries, report_top, verbose);
+}
+
+/***************************************************************************
+ * Direction predictors
+ */
+
+// The counters are 2-bit saturating: 0,1 predict not taken and 2,3 taken.
+static inline void
+update_counter(uint8_t &counter, bool taken)
+{
+    if (taken && counter < 3)
+        ++counter;
+    else if (!taken && counter > 0)
+        --counter;
+}
+
+bimodal_predictor_t::bimodal_predictor_t(unsigned int table_bits) :
+    // Start weakly taken.
+    counters((size_t)1 << table_bits, 2), mask(((addr_t)1 << table_bits) - 1)
+{
+}
+
+bool
+bimodal_predictor_t::predict(addr_t pc, uint64_t history)
+{
+    return counters[pc & mask] >= 2;
+}
+
+void
+bimodal_predictor_t::update(addr_t pc, uint64_t history, bool taken)
+{
+    update_counter(counters[pc & mask], taken);
+}
+
+gshare_predictor_t::gshare_predictor_t(unsigned int table_bits,
+                                       unsigned int history_bits) :
+    counters((size_t)1 << table_bits, 2), mask(((addr_t)1 << table_bits) - 1),
+    history_mask(history_bits >= 64 ? ~(uint64_t)0 :
+                 (((uint64_t)1 << history_bits) - 1))
+{
+}
+
+size_t
+gshare_predictor_t::index(addr_t pc, uint64_t history)
+{
+    return (size_t)((pc ^ (history & history_mask)) & mask);
+}
+
+bool
+gshare_predictor_t::predict(addr_t pc, uint64_t history)
+{
+    return counters[index(pc, history)] >= 2;
+}
+
+void
+gshare_predictor_t::update(addr_t pc, uint64_t history, bool taken)
+{
+    update_counter(counters[index(pc, history)], taken);
+}
+
+// The history we keep is 64 bits, which bounds the longest table.
+const unsigned int tage_predictor_t::HISTORY_LENGTHS[NUM_TABLES] = { 5, 12, 27, 64 };
+
+#define TAGE_TAG_BITS 9
+#define TAGE_CTR_MAX 3
+#define TAGE_CTR_MIN -4
+#define TAGE_USEFUL_MAX 3
+
+tage_predictor_t::tage_predictor_t(unsigned int table_bits_in) :
+    base(table_bits_in), provider(-1), alt_provider(-1), provider_pred(false),
+    alt_pred(false), alloc_seed(0)
+{
+    // Each tagged table is a quarter the size of the base table.
+    table_bits = table_bits_in > 2 ? table_bits_in - 2 : 1;
+    entry_t empty = {0, 0, 0};
+    for (int i = 0; i < NUM_TABLES; ++i)
+        tables[i].resize((size_t)1 << table_bits, empty);
+}
+
+// Compresses the low length bits of history into bits bits.
+uint64_t
+tage_predictor_t::fold(uint64_t history, unsigned int length, unsigned int bits)
+{
+    if (length < 64)
+        history &= ((uint64_t)1 << length) - 1;
+    uint64_t res = 0;
+    for (; history != 0; history >>= bits)
+        res ^= history & (((uint64_t)1 << bits) - 1);
+    return res;
+}
+
+bool
+tage_predictor_t::predict(addr_t pc, uint64_t history)
+{
+    uint64_t mask = ((uint64_t)1 << table_bits) - 1;
+    provider = -1;
+    alt_provider = -1;
+    for (int i = NUM_TABLES - 1; i >= 0; --i) {
+        indices[i] = (size_t)((pc ^ (pc >> table_bits) ^
+                               fold(history, HISTORY_LENGTHS[i], table_bits)) & mask);
+        tags[i] = (uint16_t)((pc ^ fold(history, HISTORY_LENGTHS[i], TAGE_TAG_BITS) ^
+                              (fold(history, HISTORY_LENGTHS[i], TAGE_TAG_BITS - 1)
+                               << 1)) & ((1 << TAGE_TAG_BITS) - 1));
+        if (tables[i][indices[i]].tag == tags[i]) {
+            if (provider < 0)
+                provider = i;
+            else if (alt_provider < 0)
+                alt_provider = i;
+        }
+    }
+    bool base_pred = base.predict(pc, history);
+    alt_pred = alt_provider >= 0 ?
+        tables[alt_provider][indices[alt_provider]].ctr >= 0 : base_pred;
+    provider_pred = provider >= 0 ?
+        tables[provider][indices[provider]].ctr >= 0 : base_pred;
+    return provider_pred;
+}
+
+void
+tage_predictor_t::update(addr_t pc, uint64_t history, bool taken)
+{
+    if (provider >= 0) {
+        entry_t &entry = tables[provider][indices[provider]];
+        if (provider_pred != alt_pred) {
+            if (provider_pred == taken && entry.useful < TAGE_USEFUL_MAX)
+                ++entry.useful;
+            else if (provider_pred != taken && entry.useful > 0)
+                --entry.useful;
+        }
+        if (taken && entry.ctr < TAGE_CTR_MAX)
+            ++entry.ctr;
+        else if (!taken && entry.ctr > TAGE_CTR_MIN)
+            --entry.ctr;
+    } else
+        base.update(pc, history, taken);
+    // On a misprediction, allocate an entry in a table with a longer history
+    // than the provider.  We rotate the starting table to spread allocations.
+    if (provider_pred != taken && provider < NUM_TABLES - 1) {
+        int first = provider + 1;
+        int num = NUM_TABLES - first;
+        bool allocated = false;
+        for (int j = 0; j < num; ++j) {
+            int i = first + (int)((alloc_seed + j) % num);
+            entry_t &entry = tables[i][indices[i]];
+            if (entry.useful == 0) {
+                entry.tag = tags[i];
+                entry.ctr = taken ? 0 : -1;
+                allocated = true;
+                break;
+            }
+        }
+        if (!allocated) {
+            for (int i = first; i < NUM_TABLES; ++i) {
+                if (tables[i][indices[i]].useful > 0)
+                    --tables[i][indices[i]].useful;
+            }
+        }
+        ++alloc_seed;
+    }
+}
+
+/***************************************************************************
+ * The tool
+ */
+
+branch_predictor_t::branch_predictor_t(const std::string &predictor,
+                                       unsigned int table_bits,
+                                       unsigned int history_bits,
+                                       unsigned int btb_entries,
+                                       unsigned int ras_entries,
+                                       unsigned int report_top,
+                                       unsigned int verbose) :
+    direction(NULL), last_tid(0), last_state(NULL), knob_predictor(predictor),
+    knob_ras_entries(ras_entries), knob_report_top(report_top),
+    knob_verbose(verbose), num_instrs(0), num_cond(0), num_cond_taken(0),
+    num_cond_mispred(0), num_btb_lookups(0), num_btb_misses(0), num_indirect(0),
+    num_indirect_mispred(0), num_returns(0), num_ras_mispred(0)
+{
+    if (table_bits == 0 || table_bits > 30 || btb_entries == 0 || ras_entries == 0) {
+        ERRMSG("Usage error: branch predictor table bits must be between 1 and 30 "
+               "and the BTB and RAS must have at least one entry.\n");
+        success = false;
+        return;
+    }
+    if (predictor == BRANCH_PREDICTOR_BIMODAL)
+        direction = new bimodal_predictor_t(table_bits);
+    else if (predictor == BRANCH_PREDICTOR_GSHARE)
+        direction = new gshare_predictor_t(table_bits, history_bits);
+    else if (predictor == BRANCH_PREDICTOR_TAGE)
+        direction = new tage_predictor_t(table_bits);
+    else {
+        ERRMSG("Usage error: undefined branch predictor. "
+               "Please choose " BRANCH_PREDICTOR_BIMODAL ", " BRANCH_PREDICTOR_GSHARE
+               ", or " BRANCH_PREDICTOR_TAGE ".\n");
+        success = false;
+        return;
+    }
+    btb_entry_t empty = {0, 0};
+    btb.resize(btb_entries, empty);
+}
+
+branch_predictor_t::~branch_predictor_t()
+{
+    delete direction;
+    for (std::map<memref_tid_t, thread_state_t *>::iterator it =
+             thread_states.begin(); it != thread_states.end(); ++it)
+        delete it->second;
+}
+
+// Returns whether the BTB held the right target for pc, and installs the
+// target if not.
+bool
+branch_predictor_t::btb_predict(addr_t pc, addr_t target)
+{
+    ++num_btb_lookups;
+    btb_entry_t &entry = btb[pc % btb.size()];
+    if (entry.pc == pc && entry.target == target)
+        return true;
+    ++num_btb_misses;
+    entry.pc = pc;
+    entry.target = target;
+    return false;
+}
+
+// The RAS is circular: on overflow we overwrite the oldest entry.
+void
+branch_predictor_t::ras_push(thread_state_t *state, addr_t addr)
+{
+    state->ras_top = (state->ras_top + 1) % knob_ras_entries;
+    state->ras[state->ras_top] = addr;
+    if (state->ras_depth < knob_ras_entries)
+        ++state->ras_depth;
+}
+
+addr_t
+branch_predictor_t::ras_pop(thread_state_t *state)
+{
+    if (state->ras_depth == 0)
+        return 0;
+    addr_t addr = state->ras[state->ras_top];
+    state->ras_top = (state->ras_top + knob_ras_entries - 1) % knob_ras_entries;
+    --state->ras_depth;
+    return addr;
+}
+
+// Scores the pending branch in state now that we know its successor.
+void
+branch_predictor_t::resolve_branch(thread_state_t *state, addr_t target)
+{
+    addr_t pc = state->branch_pc;
+    bool taken = (target != state->fallthrough);
+    bool mispredict = false;
+    switch (state->branch_type) {
+    case TRACE_TYPE_INSTR_CONDITIONAL_JUMP: {
+        ++num_cond;
+        bool pred = direction->predict(pc, state->history);
+        direction->update(pc, state->history, taken);
+        state->history = (state->history << 1) | (taken ? 1 : 0);
+        if (pred != taken) {
+            ++num_cond_mispred;
+            mispredict = true;
+        }
+        if (taken) {
+            ++num_cond_taken;
+            btb_predict(pc, target);
+        }
+        break;
+    }
+    case TRACE_TYPE_INSTR_DIRECT_JUMP:
+        btb_predict(pc, target);
+        break;
+    case TRACE_TYPE_INSTR_DIRECT_CALL:
+        btb_predict(pc, target);
+        ras_push(state, state->fallthrough);
+        break;
+    case TRACE_TYPE_INSTR_INDIRECT_JUMP:
+    case TRACE_TYPE_INSTR_INDIRECT_CALL:
+        ++num_indirect;
+        if (!btb_predict(pc, target)) {
+            ++num_indirect_mispred;
+            mispredict = true;
+        }
+        if (state->branch_type == TRACE_TYPE_INSTR_INDIRECT_CALL)
+            ras_push(state, state->fallthrough);
+        break;
+    case TRACE_TYPE_INSTR_RETURN:
+        ++num_returns;
+        if (ras_pop(state) != target) {
+            ++num_ras_mispred;
+            mispredict = true;
+        }
+        break;
+    default:
+        break;
+    }
+    if (mispredict)
+        ++hot_spots[pc];
+    if (DEBUG_VERBOSE(3)) {
+        std::cerr << "Branch @" << (void *)pc << " " <<
+            trace_type_names[state->branch_type] << " -> " << (void *)target <<
+            (taken ? " taken" : " not taken") <<
+            (mispredict ? " mispredicted" : "") << std::endl;
+    }
+}
+
+bool
+branch_predictor_t::process_memref(const memref_t &memref)
+{
+    if (memref.exit.type == TRACE_TYPE_THREAD_EXIT) {
+        std::map<memref_tid_t, thread_state_t *>::iterator it =
+            thread_states.find(memref.exit.tid);
+        if (it != thread_states.end()) {
+            delete it->second;
+            thread_states.erase(it);
+        }
+        last_tid = 0;
+        last_state = NULL;
+        return true;
+    }
+    if (!type_is_instr(memref.instr.type))
+        return true;
+    ++num_instrs;
+
+    thread_state_t *state;
+    if (memref.instr.tid == last_tid && last_state != NULL)
+        state = last_state;
+    else {
+        std::map<memref_tid_t, thread_state_t *>::iterator it =
+            thread_states.find(memref.instr.tid);
+        if (it == thread_states.end()) {
+            state = new thread_state_t(knob_ras_entries);
+            thread_states[memref.instr.tid] = state;
+        } else
+            state = it->second;
+        last_tid = memref.instr.tid;
+        last_state = state;
+    }
+
+    // The successor of a branch tells us both its target and, for conditional
+    // branches, its direction.
+    if (state->branch_pc != 0) {
+        resolve_branch(state, memref.instr.addr);
+        state->branch_pc = 0;
+    }
+    if (memref.instr.type != TRACE_TYPE_INSTR) {
+        state->branch_pc = memref.instr.addr;
+        state->fallthrough = memref.instr.addr + memref.instr.size;
+        state->branch_type = memref.instr.type;
+    }
+    return true;
+}
+
+static bool
+cmp_hot_spots(const std::pair<addr_t, uint64_t> &l,
+              const std::pair<addr_t, uint64_t> &r)
+{
+    return l.second > r.second;
+}
+
+static void
+print_count(const std::string &label, uint64_t count)
+{
+    std::cerr << std::setw(28) << std::left << label <<
+        std::setw(20) << std::right << count << std::endl;
+}
+
+static void
+print_rate(const std::string &label, uint64_t num, uint64_t denom)
+{
+    std::cerr << std::setw(28) << std::left << label <<
+        std::setw(19) << std::fixed << std::setprecision(2) << std::right <<
+        (denom == 0 ? 0.0 : ((float)num * 100 / denom)) << "%" << std::endl;
+}
+
+bool
+branch_predictor_t::print_results()
+{
+    std::cerr << TOOL_NAME << " results:\n";
+    std::cerr << std::setw(28) << std::left << "Predictor:" <<
+        std::setw(20) << std::right << knob_predictor << std::endl;
+    print_count("Instructions:", num_instrs);
+    print_count("Conditional branches:", num_cond);
+    print_count("  Taken:", num_cond_taken);
+    print_count("  Mispredictions:", num_cond_mispred);
+    print_rate("  Misprediction rate:", num_cond_mispred, num_cond);
+    print_count("Indirect branches:", num_indirect);
+    print_count("  Mispredictions:", num_indirect_mispred);
+    print_rate("  Misprediction rate:", num_indirect_mispred, num_indirect);
+    print_count("Returns:", num_returns);
+    print_count("  Mispredictions:", num_ras_mispred);
+    print_rate("  Misprediction rate:", num_ras_mispred, num_returns);
+    print_count("BTB lookups:", num_btb_lookups);
+    print_count("  Misses:", num_btb_misses);
+    uint64_t total = num_cond_mispred + num_indirect_mispred + num_ras_mispred;
+    std::cerr << std::setw(28) << std::left << "Mispredictions per 1K instrs:" <<
+        std::setw(20) << std::fixed << std::setprecision(2) << std::right <<
+        (num_instrs == 0 ? 0.0 : ((float)total * 1000 / num_instrs)) << std::endl;
+
+    std::vector<std::pair<addr_t, uint64_t> > top(knob_report_top);
+    std::partial_sort_copy(hot_spots.begin(), hot_spots.end(),
+                           top.begin(), top.end(), cmp_hot_spots);
+    std::cerr << "Top " << top.size() << " misprediction hot spots\n";
+    for (std::vector<std::pair<addr_t, uint64_t> >::iterator it = top.begin();
+         it != top.end(); ++it) {
+        if (it->second == 0)
+            break;
+        std::cerr << std::setw(18) << std::hex << std::showbase << it->first
+                  << ": " << std::dec << it->second << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,183 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* branch_predictor: a branch prediction analysis tool.  Branch outcomes and
+ * targets are not recorded in the trace, so we infer them from the next
+ * instruction fetch of the same thread.
+ */
+
+#ifndef _BRANCH_PREDICTOR_H_
+#define _BRANCH_PREDICTOR_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../analysis_tool.h"
+#include "../common/memref.h"
+
+// A direction predictor for conditional branches.  predict() must be
+// followed by update() for the same branch before the next predict().
+class direction_predictor_t
+{
+ public:
+    virtual ~direction_predictor_t() {}
+    virtual bool predict(addr_t pc, uint64_t history) = 0;
+    virtual void update(addr_t pc, uint64_t history, bool taken) = 0;
+};
+
+// A table of 2-bit saturating counters indexed by the branch pc.
+class bimodal_predictor_t : public direction_predictor_t
+{
+ public:
+    explicit bimodal_predictor_t(unsigned int table_bits);
+    virtual bool predict(addr_t pc, uint64_t history);
+    virtual void update(addr_t pc, uint64_t history, bool taken);
+
+ protected:
+    std::vector<uint8_t> counters;
+    addr_t mask;
+};
+
+// A table of 2-bit saturating counters indexed by the branch pc xor-ed
+// with the global history.
+class gshare_predictor_t : public direction_predictor_t
+{
+ public:
+    gshare_predictor_t(unsigned int table_bits, unsigned int history_bits);
+    virtual bool predict(addr_t pc, uint64_t history);
+    virtual void update(addr_t pc, uint64_t history, bool taken);
+
+ protected:
+    size_t index(addr_t pc, uint64_t history);
+    std::vector<uint8_t> counters;
+    addr_t mask;
+    uint64_t history_mask;
+};
+
+// A reduced TAGE: a bimodal base predictor plus tagged tables using
+// geometrically increasing global history lengths.
+class tage_predictor_t : public direction_predictor_t
+{
+ public:
+    explicit tage_predictor_t(unsigned int table_bits);
+    virtual bool predict(addr_t pc, uint64_t history);
+    virtual void update(addr_t pc, uint64_t history, bool taken);
+
+ protected:
+    static const int NUM_TABLES = 4;
+    static const unsigned int HISTORY_LENGTHS[NUM_TABLES];
+    struct entry_t {
+        uint16_t tag;
+        int8_t ctr;   // 3-bit signed counter: taken if >= 0.
+        uint8_t useful; // 2-bit usefulness counter.
+    };
+    uint64_t fold(uint64_t history, unsigned int length, unsigned int bits);
+    bimodal_predictor_t base;
+    std::vector<entry_t> tables[NUM_TABLES];
+    unsigned int table_bits;
+    // State computed by predict() for use by update().
+    size_t indices[NUM_TABLES];
+    uint16_t tags[NUM_TABLES];
+    int provider;
+    int alt_provider;
+    bool provider_pred;
+    bool alt_pred;
+    uint64_t alloc_seed;
+};
+
+class branch_predictor_t : public analysis_tool_t
+{
+ public:
+    branch_predictor_t(const std::string &predictor,
+                       unsigned int table_bits,
+                       unsigned int history_bits,
+                       unsigned int btb_entries,
+                       unsigned int ras_entries,
+                       unsigned int report_top,
+                       unsigned int verbose);
+    virtual ~branch_predictor_t();
+    virtual bool process_memref(const memref_t &memref);
+    virtual bool print_results();
+
+ protected:
+    struct btb_entry_t {
+        addr_t pc;
+        addr_t target;
+    };
+    // Per-thread state: the branch awaiting its successor, the global
+    // history, and the return address stack.
+    struct thread_state_t {
+        thread_state_t(unsigned int ras_entries) :
+            branch_pc(0), fallthrough(0), branch_type(TRACE_TYPE_INSTR),
+            history(0), ras(ras_entries, 0), ras_top(0), ras_depth(0) {}
+        addr_t branch_pc;
+        addr_t fallthrough;
+        trace_type_t branch_type;
+        uint64_t history;
+        std::vector<addr_t> ras;
+        unsigned int ras_top;
+        unsigned int ras_depth;
+    };
+
+    void resolve_branch(thread_state_t *state, addr_t target);
+    bool btb_predict(addr_t pc, addr_t target);
+    void ras_push(thread_state_t *state, addr_t addr);
+    addr_t ras_pop(thread_state_t *state);
+
+    direction_predictor_t *direction;
+    std::vector<btb_entry_t> btb;
+    std::map<memref_tid_t, thread_state_t *> thread_states;
+    memref_tid_t last_tid;
+    thread_state_t *last_state;
+    // Mispredictions per branch pc.
+    std::map<addr_t, uint64_t> hot_spots;
+
+    std::string knob_predictor;
+    unsigned int knob_ras_entries;
+    unsigned int knob_report_top;
+    unsigned int knob_verbose;
+
+    uint64_t num_instrs;
+    uint64_t num_cond;
+    uint64_t num_cond_taken;
+    uint64_t num_cond_mispred;
+    uint64_t num_btb_lookups;
+    uint64_t num_btb_misses;
+    uint64_t num_indirect;
+    uint64_t num_indirect_mispred;
+    uint64_t num_returns;
+    uint64_t num_ras_mispred;
+
+    static const std::string TOOL_NAME;
+};
+
+#endif /* _BRANCH_PREDICTOR_H_ */
@@ -74,6 +74,19 @@ histogram_t::process_memref(const memref_t &memref)
     return true;
 }
 
+bool
+histogram_t::process_memref_compact(const memref_compact_t &memref,
+                                    const memref_thread_t *threads)
+{
+    trace_type_t type = (trace_type_t) memref.type;
+    if (type_is_instr(type) || type == TRACE_TYPE_PREFETCH_INSTR)
+        ++icache_map[memref.addr >> line_size_bits];
+    else if (type == TRACE_TYPE_READ || type == TRACE_TYPE_WRITE ||
+             type_is_prefetch(type))
+        ++dcache_map[memref.addr >> line_size_bits];
+    return true;
+}
+
 bool cmp(const std::pair<addr_t, uint64_t> &l,
          const std::pair<addr_t, uint64_t> &r)
 {
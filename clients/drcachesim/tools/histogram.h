@@ -50,6 +50,10 @@ class histogram_t : public analysis_tool_t
     virtual ~histogram_t();
     virtual bool process_memref(const memref_t &memref);
     virtual bool print_results();
+    // We only need the type and address, so we take the compact form.
+    virtual bool wants_compact_memref() { return true; }
+    virtual bool process_memref_compact(const memref_compact_t &memref,
+                                        const memref_thread_t *threads);
 
  protected:
     /* FIXME i#2020: use unsorted_map (C++11) for faster lookup */
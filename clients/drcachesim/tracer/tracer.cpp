@@ -39,6 +39,7 @@
  * modular.
  */
 
+#include <limits.h>
 #include <string.h>
 #include <string>
 #include "dr_api.h"
@@ -115,6 +116,7 @@ typedef struct {
 /* per bb user data during instrumentation */
 typedef struct {
     app_pc last_app_pc;
+    ptr_uint_t last_ifetch_line; /* for -L0_filter */
     instr_t *strex;
     int num_delay_instrs;
     instr_t *delay_instrs[MAX_NUM_DELAY_INSTRS];
@@ -560,73 +562,24 @@ instrument_clean_call(void *drcontext, instrlist_t *ilist, instr_t *where,
 #endif
 }
 
-// Called before writing to the trace buffer.
-// reg_ptr is treated as scratch and may be clobbered by this routine.
-// Returns DR_REG_NULL to indicate *not* to insert the instrumentation to
-// write to the trace buffer.  Otherwise, returns a register that the caller
-// must restore *after* the skip target.  The caller must also restore the
-// aflags after the skip target.  (This is for parity on all paths per drreg
-// limitations.)
-static reg_id_t
-insert_filter_addr(void *drcontext, instrlist_t *ilist, instr_t *where,
-                   user_data_t *ud, reg_id_t reg_ptr, reg_id_t reg_addr,
-                   opnd_t ref, instr_t *app, instr_t *skip, dr_pred_type_t pred)
+// Emits an inlined lookup in the "level 0" filter cache whose base is stored in
+// TLS slot offs, of the line containing the address in reg_addr.  Jumps to
+// on_hit on a hit.  On a miss, installs the line and falls through.
+// Clobbers reg_addr, reg_idx, and reg_ptr.
+//
+// With -L0_assoc 2, each set holds two tags with the most-recently-used one
+// always in the first slot, which serves as the per-set MRU bit.  The common
+// case of a hit in the first slot is thus identical to the direct-mapped path.
+static void
+insert_filter_lookup(void *drcontext, instrlist_t *ilist, instr_t *where,
+                     reg_id_t reg_ptr, reg_id_t reg_addr, reg_id_t reg_idx,
+                     bool is_icache, instr_t *on_hit)
 {
-    // Our "level 0" inlined direct-mapped cache filter.
-    DR_ASSERT(op_L0_filter.get_value());
-    reg_id_t reg_idx;
-    bool is_icache = opnd_is_null(ref);
     uint64 cache_size = is_icache ? op_L0I_size.get_value() : op_L0D_size.get_value();
-    ptr_int_t mask = (ptr_int_t)(cache_size / op_line_size.get_value()) - 1;
+    uint assoc = op_L0_assoc.get_value();
+    ptr_int_t mask = (ptr_int_t)(cache_size / op_line_size.get_value() / assoc) - 1;
     int line_bits = compute_log2(op_line_size.get_value());
     uint offs = is_icache ? MEMTRACE_TLS_OFFS_ICACHE : MEMTRACE_TLS_OFFS_DCACHE;
-    if (is_icache) {
-        // For filtering the icache, we disable bundles + delays and call here on
-        // every instr.  We skip if we're still on the same cache line.
-        if (ud->last_app_pc != NULL) {
-            ptr_uint_t prior_line = ((ptr_uint_t)ud->last_app_pc >> line_bits) & mask;
-            // FIXME i#2439: we simplify and ignore a 2nd cache line touched by an
-            // instr that straddles cache lines.  However, that is not uncommon on
-            // x86 and we should check the L0 cache for both lines, do regular instru
-            // if either misses, and have some flag telling the regular instru to
-            // only do half the instr if only one missed (for offline this flag would
-            // have to propagate to raw2trace; for online we could use a mid-instr PC
-            // and size).
-            ptr_uint_t new_line = ((ptr_uint_t)instr_get_app_pc(app) >> line_bits) & mask;
-            if (prior_line == new_line)
-                return DR_REG_NULL; // Skip instru.
-        }
-        ud->last_app_pc = instr_get_app_pc(app);
-    }
-    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
-        FATAL("Fatal error: failed to reserve aflags\n");
-    // We need a 3rd scratch register.  We can avoid clobbering the app address
-    // if we either get a 4th scratch or keep re-computing the tag and the mask
-    // but it's better to keep the common path shorter, so we clobber reg_addr
-    // with the tag and recompute on a miss.
-    if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_idx) !=
-        DRREG_SUCCESS)
-        FATAL("Fatal error: failed to reserve 3rd scratch register\n");
-#ifdef ARM
-    if (pred != DR_PRED_NONE && pred != DR_PRED_AL && pred != DR_PRED_OP) {
-        // We can't mark everything as predicated b/c we have a cond branch.
-        // Instead we jump over it if the memref won't be executed.
-        // We have to do that after spilling the regs for parity on all paths.
-        // This means we don't have to restore app flags for later predicate prefixes.
-        MINSERT(ilist, where,
-                XINST_CREATE_jump_cond(drcontext, instr_invert_predicate(pred),
-                                       opnd_create_instr(skip)));
-    }
-#endif
-    // First get the cache slot and load what's currently stored there.
-    // XXX i#2439: we simplify and ignore a memref that straddles cache lines.
-    // That will only happen for unaligned accesses.
-    if (is_icache) {
-        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)instr_get_app_pc(app),
-                                         opnd_create_reg(reg_addr), ilist, where,
-                                         NULL, NULL);
-    } else
-        instru->insert_obtain_addr(drcontext, ilist, where, reg_addr, reg_ptr, ref);
     MINSERT(ilist, where,
             XINST_CREATE_slr_s
             (drcontext, opnd_create_reg(reg_addr), OPND_CREATE_INT8(line_bits)));
@@ -654,7 +607,7 @@ insert_filter_addr(void *drcontext, instrlist_t *ilist, instr_t *where,
     MINSERT(ilist, where,
             XINST_CREATE_add_sll
             (drcontext, opnd_create_reg(reg_ptr), opnd_create_reg(reg_ptr),
-             opnd_create_reg(reg_idx), compute_log2(sizeof(app_pc))));
+             opnd_create_reg(reg_idx), compute_log2(sizeof(app_pc)*assoc)));
     MINSERT(ilist, where,
             XINST_CREATE_load
             (drcontext, opnd_create_reg(reg_idx), OPND_CREATE_MEMPTR(reg_ptr, 0)));
@@ -663,11 +616,179 @@ insert_filter_addr(void *drcontext, instrlist_t *ilist, instr_t *where,
             XINST_CREATE_cmp
             (drcontext, opnd_create_reg(reg_idx), opnd_create_reg(reg_addr)));
     MINSERT(ilist, where,
-            XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ, opnd_create_instr(skip)));
+            XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ, opnd_create_instr(on_hit)));
     // On a miss, replace the cache entry with the new cache line.
     MINSERT(ilist, where,
             XINST_CREATE_store
             (drcontext, OPND_CREATE_MEMPTR(reg_ptr, 0), opnd_create_reg(reg_addr)));
+    if (assoc == 1)
+        return;
+    // Whether the 2nd slot hits or not, the new line becomes the MRU and the old
+    // MRU moves to the 2nd slot.  We are out of registers, so we re-load the new
+    // tag from the 1st slot after stashing the old 2nd slot value in reg_addr.
+    MINSERT(ilist, where,
+            XINST_CREATE_load
+            (drcontext, opnd_create_reg(reg_addr),
+             OPND_CREATE_MEMPTR(reg_ptr, sizeof(app_pc))));
+    MINSERT(ilist, where,
+            XINST_CREATE_store
+            (drcontext, OPND_CREATE_MEMPTR(reg_ptr, sizeof(app_pc)),
+             opnd_create_reg(reg_idx)));
+    MINSERT(ilist, where,
+            XINST_CREATE_load
+            (drcontext, opnd_create_reg(reg_idx), OPND_CREATE_MEMPTR(reg_ptr, 0)));
+    MINSERT(ilist, where,
+            XINST_CREATE_cmp
+            (drcontext, opnd_create_reg(reg_idx), opnd_create_reg(reg_addr)));
+    MINSERT(ilist, where,
+            XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ, opnd_create_instr(on_hit)));
+}
+
+// Places into reg_addr the address of the first byte of ref (or of app, if ref
+// is null) plus offset.
+static void
+insert_filter_obtain_addr(void *drcontext, instrlist_t *ilist, instr_t *where,
+                          reg_id_t reg_ptr, reg_id_t reg_addr, reg_id_t reg_idx,
+                          opnd_t ref, instr_t *app, int offset)
+{
+    if (opnd_is_null(ref)) {
+        instrlist_insert_mov_immed_ptrsz(drcontext,
+                                         (ptr_int_t)instr_get_app_pc(app) + offset,
+                                         opnd_create_reg(reg_addr), ilist, where,
+                                         NULL, NULL);
+        return;
+    }
+    // A prior lookup may have clobbered reg_idx.
+    if (opnd_uses_reg(ref, reg_idx))
+        drreg_get_app_value(drcontext, ilist, where, reg_idx, reg_idx);
+    instru->insert_obtain_addr(drcontext, ilist, where, reg_addr, reg_ptr, ref);
+    if (offset != 0) {
+        MINSERT(ilist, where,
+                XINST_CREATE_add
+                (drcontext, opnd_create_reg(reg_addr), OPND_CREATE_INT8(offset)));
+    }
+}
+
+// Called before writing to the trace buffer.
+// reg_ptr is treated as scratch and may be clobbered by this routine.
+// Returns DR_REG_NULL to indicate *not* to insert the instrumentation to
+// write to the trace buffer.  Otherwise, returns a register that the caller
+// must restore *after* the skip target.  The caller must also restore the
+// aflags after the skip target.  (This is for parity on all paths per drreg
+// limitations.)
+static reg_id_t
+insert_filter_addr(void *drcontext, instrlist_t *ilist, instr_t *where,
+                   user_data_t *ud, reg_id_t reg_ptr, reg_id_t reg_addr,
+                   opnd_t ref, instr_t *app, instr_t *skip, dr_pred_type_t pred)
+{
+    // Our "level 0" inlined cache filter.
+    DR_ASSERT(op_L0_filter.get_value());
+    reg_id_t reg_idx;
+    bool is_icache = opnd_is_null(ref);
+    int line_size = (int)op_line_size.get_value();
+    int line_bits = compute_log2(line_size);
+    // An access that straddles two cache lines must be recorded if it misses in
+    // either line (i#2439).  For instructions we know statically whether that
+    // happens.  For data we only know the size statically and must check the
+    // address at runtime.
+    int size;
+    bool straddles;
+    if (is_icache) {
+        size = instr_length(drcontext, app);
+        ptr_uint_t first_line = (ptr_uint_t)instr_get_app_pc(app) >> line_bits;
+        ptr_uint_t last_line =
+            ((ptr_uint_t)instr_get_app_pc(app) + size - 1) >> line_bits;
+        straddles = (first_line != last_line);
+        // For filtering the icache, we disable bundles + delays and call here on
+        // every instr.  We skip if we're still on the same cache line.
+        if (ud->last_ifetch_line != 0 && ud->last_ifetch_line == first_line &&
+            first_line == last_line) {
+            ud->last_app_pc = instr_get_app_pc(app);
+            return DR_REG_NULL; // Skip instru.
+        }
+        ud->last_app_pc = instr_get_app_pc(app);
+        ud->last_ifetch_line = last_line;
+    } else {
+        size = (int)drutil_opnd_mem_size_in_bytes(ref, app);
+        // A size we cannot add as an 8-bit immediate is rare enough that we
+        // simply treat it as not straddling.
+        straddles = (size > 1 && size <= line_size && size <= SCHAR_MAX);
+    }
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        FATAL("Fatal error: failed to reserve aflags\n");
+    // We need a 3rd scratch register.  We can avoid clobbering the app address
+    // if we either get a 4th scratch or keep re-computing the tag and the mask
+    // but it's better to keep the common path shorter, so we clobber reg_addr
+    // with the tag and recompute on a miss.
+    if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_idx) !=
+        DRREG_SUCCESS)
+        FATAL("Fatal error: failed to reserve 3rd scratch register\n");
+#ifdef ARM
+    if (pred != DR_PRED_NONE && pred != DR_PRED_AL && pred != DR_PRED_OP) {
+        // We can't mark everything as predicated b/c we have a cond branch.
+        // Instead we jump over it if the memref won't be executed.
+        // We have to do that after spilling the regs for parity on all paths.
+        // This means we don't have to restore app flags for later predicate prefixes.
+        MINSERT(ilist, where,
+                XINST_CREATE_jump_cond(drcontext, instr_invert_predicate(pred),
+                                       opnd_create_instr(skip)));
+    }
+#endif
+    instr_t *straddle = INSTR_CREATE_label(drcontext);
+    instr_t *record = INSTR_CREATE_label(drcontext);
+    if (!is_icache || !straddles) {
+        insert_filter_obtain_addr(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                                  ref, app, 0);
+        if (straddles) {
+            // Only data gets here: check whether the offset within the line plus
+            // the size crosses into the next line.
+            MINSERT(ilist, where,
+                    XINST_CREATE_move
+                    (drcontext, opnd_create_reg(reg_idx), opnd_create_reg(reg_addr)));
+            MINSERT(ilist, where,
+                    XINST_CREATE_and_s
+                    (drcontext, opnd_create_reg(reg_idx),
+                     OPND_CREATE_INT32(line_size - 1)));
+            MINSERT(ilist, where,
+                    XINST_CREATE_cmp
+                    (drcontext, opnd_create_reg(reg_idx),
+                     OPND_CREATE_INT32(line_size - size)));
+            MINSERT(ilist, where,
+                    XINST_CREATE_jump_cond
+                    (drcontext, IF_X86_ELSE(DR_PRED_NBE, DR_PRED_HI),
+                     opnd_create_instr(straddle)));
+        }
+        insert_filter_lookup(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                             is_icache, skip);
+        if (straddles) {
+            MINSERT(ilist, where,
+                    XINST_CREATE_jump(drcontext, opnd_create_instr(record)));
+        }
+    }
+    if (straddles) {
+        // We look up the 2nd line first.  On a miss we still need to install the
+        // 1st line, but we record the access regardless.  On a hit, the 1st line
+        // decides.
+        instr_t *first_line = INSTR_CREATE_label(drcontext);
+        MINSERT(ilist, where, straddle);
+        insert_filter_obtain_addr(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                                  ref, app, size - 1);
+        insert_filter_lookup(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                             is_icache, first_line);
+        insert_filter_obtain_addr(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                                  ref, app, 0);
+        insert_filter_lookup(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                             is_icache, record);
+        MINSERT(ilist, where,
+                XINST_CREATE_jump(drcontext, opnd_create_instr(record)));
+        MINSERT(ilist, where, first_line);
+        insert_filter_obtain_addr(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                                  ref, app, 0);
+        insert_filter_lookup(drcontext, ilist, where, reg_ptr, reg_addr, reg_idx,
+                             is_icache, skip);
+    } else
+        instr_destroy(drcontext, straddle);
+    MINSERT(ilist, where, record);
     // Restore app value b/c the caller will re-compute the app addr.
     // We can avoid clobbering the app address if we either get a 4th scratch or
     // keep re-computing the tag and the mask but it's better to keep the common
@@ -686,7 +807,7 @@ instrument_memref(void *drcontext, user_data_t *ud, instrlist_t *ilist, instr_t
     reg_id_t reg_third = DR_REG_NULL;
     if (op_L0_filter.get_value()) {
         reg_third = insert_filter_addr(drcontext, ilist, where, ud, reg_ptr, reg_tmp,
-                                       ref, NULL, skip, pred);
+                                       ref, app, skip, pred);
         if (reg_third == DR_REG_NULL) {
             instr_destroy(drcontext, skip);
             return adjust;
@@ -948,6 +1069,7 @@ event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
 {
     user_data_t *data = (user_data_t *) dr_thread_alloc(drcontext, sizeof(user_data_t));
     data->last_app_pc = NULL;
+    data->last_ifetch_line = 0;
     data->strex = NULL;
     data->num_delay_instrs = 0;
     data->instru_field = NULL;
@@ -1115,7 +1237,7 @@ event_thread_exit(void *drcontext)
                         (size_t)op_L0D_size.get_value()/op_line_size.get_value()
                         *sizeof(void*));
         dr_raw_mem_free(data->l0_icache,
-                        (size_t)op_L0D_size.get_value()/op_line_size.get_value()
+                        (size_t)op_L0I_size.get_value()/op_line_size.get_value()
                         *sizeof(void*));
     }
 
@@ -0,0 +1,111 @@
+# **********************************************************
+# Copyright (c) 2017 Google, Inc.    All rights reserved.
+# **********************************************************
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+#
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+#
+# * Neither the name of Google, Inc. nor the names of its contributors may be
+#   used to endorse or promote products derived from this software without
+#   specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+
+# Invoked by the test suite to compare drcov's speed with and without
+# -hit_counts.  The timings are reported rather than checked, as they are too
+# noisy to pass or fail on; run ctest -V to see them.  The test does fail if
+# either configuration fails or if the counters change the app's output.
+
+# input:
+# * cmd = command to run, including drcov's -hit_counts option
+#     should have intra-arg space=@@ and inter-arg space=@ and ;=!
+# * reps = optional number of runs of each configuration (default 5)
+
+string(REGEX REPLACE "@@" " " cmd "${cmd}")
+string(REGEX REPLACE "@" ";" cmd "${cmd}")
+string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
+set(base_cmd ${cmd})
+list(REMOVE_ITEM base_cmd "-hit_counts")
+if ("${base_cmd}" STREQUAL "${cmd}")
+  message(FATAL_ERROR "*** ${cmd} does not use -hit_counts ***\n")
+endif ()
+if (NOT reps)
+  set(reps 5)
+endif ()
+
+# Microsecond timestamps need CMake 3.23; older versions only give seconds.
+if (CMAKE_VERSION VERSION_LESS 3.23)
+  set(stamp_format "%s")
+  set(stamp_unit "s")
+else ()
+  set(stamp_format "%s%f")
+  set(stamp_unit "us")
+endif ()
+
+# Runs the given command, fails the test if it fails, and adds its elapsed
+# time to total_var.
+function(timed_run total_var out_var)
+  string(TIMESTAMP start "${stamp_format}" UTC)
+  execute_process(COMMAND ${ARGN}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  string(TIMESTAMP end "${stamp_format}" UTC)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${ARGN} failed (${cmd_result}): ${cmd_err}***\n")
+  endif ()
+  math(EXPR total "${${total_var}} + ${end} - ${start}")
+  set(${total_var} ${total} PARENT_SCOPE)
+  set(${out_var} "${cmd_out}" PARENT_SCOPE)
+endfunction()
+
+# Alternate the two configurations so that drift in machine load affects
+# both alike.
+set(base_total 0)
+set(hits_total 0)
+foreach (rep RANGE 1 ${reps})
+  timed_run(base_total base_out ${base_cmd})
+  timed_run(hits_total hits_out ${cmd})
+  if (NOT "${base_out}" STREQUAL "${hits_out}")
+    message(FATAL_ERROR "*** output differs with -hit_counts:\n"
+      "${base_out}\nvs\n${hits_out}***\n")
+  endif ()
+endforeach ()
+
+file(GLOB drcov_logs "drcov.*.log")
+foreach (logfile ${drcov_logs})
+  file(REMOVE ${logfile})
+endforeach ()
+
+if (base_total GREATER 0)
+  math(EXPR permille "(${hits_total} * 1000) / ${base_total}")
+  math(EXPR ratio_int "${permille} / 1000")
+  math(EXPR ratio_frac "${permille} % 1000")
+  string(LENGTH "${ratio_frac}" frac_len)
+  while (frac_len LESS 3)
+    set(ratio_frac "0${ratio_frac}")
+    string(LENGTH "${ratio_frac}" frac_len)
+  endwhile ()
+  set(ratio "${ratio_int}.${ratio_frac}x")
+else ()
+  set(ratio "unmeasurable")
+endif ()
+message("drcov over ${reps} runs: ${base_total}${stamp_unit} without -hit_counts, "
+  "${hits_total}${stamp_unit} with: ${ratio}")
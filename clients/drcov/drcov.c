@@ -42,10 +42,15 @@
  * The runtime options for this client include:
  * -dump_text         Dumps the log file in text format
  * -dump_binary       Dumps the log file in binary format
+ * -dump_indexed      Dumps the log file in indexed binary format
  * -[no_]nudge_kills  On by default.
  *                    Uses nudge to notify a child process being terminated
  *                    by its parent, so that the exit event will be called.
  * -logdir <dir>      Sets log directory, which by default is ".".
+ * -hit_counts        Also records saturating per-block execution counts
+ * -hit_counts_file <path>
+ *                    UNIX only.  Like -hit_counts, but keeps the counters in
+ *                    a shared mapping of the named file.
  */
 
 #include "dr_api.h"
@@ -65,6 +70,13 @@ static client_id_t client_id;
 
 #define OPTION_MAX_LENGTH MAXIMUM_PATH
 
+#ifdef UNIX
+/* For -hit_counts_file: the counters are a shared mapping of this file. */
+static file_t hit_counts_fd = INVALID_FILE;
+static byte *hit_counts_map;
+static size_t hit_counts_map_size;
+#endif
+
 /****************************************************************************
  * Nudges
  */
@@ -108,6 +120,63 @@ event_soft_kill(process_id_t pid, int exit_code)
     return false;
 }
 
+/****************************************************************************
+ * Shared hit counters
+ */
+
+#ifdef UNIX
+/* Maps path as the counter array for drcovlib, first extending the file to
+ * DRCOVLIB_HIT_COUNT_SLOTS bytes.  We do not clear what the file already
+ * holds, as a fuzzer may have it mapped already.
+ */
+static bool
+hit_counts_file_map(const char *path, drcovlib_options_t *ops)
+{
+    static const byte zeros[4096];
+    uint64 file_size;
+    size_t size = DRCOVLIB_HIT_COUNT_SLOTS;
+    /* Unlike overwrite mode, append mode does not truncate the file. */
+    hit_counts_fd = dr_open_file(path, DR_FILE_WRITE_APPEND);
+    if (hit_counts_fd == INVALID_FILE)
+        return false;
+    if (!dr_file_size(hit_counts_fd, &file_size))
+        return false;
+    while (file_size < size) {
+        size_t len = sizeof(zeros);
+        if (len > size - file_size)
+            len = (size_t)(size - file_size);
+        if (dr_write_file(hit_counts_fd, zeros, len) != (ssize_t)len)
+            return false;
+        file_size += len;
+    }
+    /* Without DR_MAP_PRIVATE the mapping is shared with other mappers.  It
+     * must be reachable for drcovlib's inlined increments.
+     */
+    hit_counts_map = dr_map_file(hit_counts_fd, &size, 0, NULL,
+                                 DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                                 DR_MAP_CACHE_REACHABLE);
+    if (hit_counts_map == NULL)
+        return false;
+    hit_counts_map_size = size;
+    ops->hit_counts = hit_counts_map;
+    ops->num_hit_counts = DRCOVLIB_HIT_COUNT_SLOTS;
+    return true;
+}
+
+static void
+hit_counts_file_unmap(void)
+{
+    if (hit_counts_map != NULL) {
+        dr_unmap_file(hit_counts_map, hit_counts_map_size);
+        hit_counts_map = NULL;
+    }
+    if (hit_counts_fd != INVALID_FILE) {
+        dr_close_file(hit_counts_fd);
+        hit_counts_fd = INVALID_FILE;
+    }
+}
+#endif
+
 /****************************************************************************
  * Event Callbacks
  */
@@ -116,6 +185,10 @@ static void
 event_exit(void)
 {
     drcovlib_exit();
+#ifdef UNIX
+    /* drcovlib is done with the counters once it has dumped them. */
+    hit_counts_file_unmap();
+#endif
 }
 
 static void
@@ -128,10 +201,29 @@ options_init(client_id_t id, int argc, const char *argv[], drcovlib_options_t *o
 
     for (i = 1/*skip client*/; i < argc; i++) {
         token = argv[i];
-        if (strcmp(token, "-dump_text") == 0)
+        if (strcmp(token, "-dump_text") == 0) {
             ops->flags |= DRCOVLIB_DUMP_AS_TEXT;
-        else if (strcmp(token, "-dump_binary") == 0)
+            ops->flags &= ~DRCOVLIB_DUMP_INDEXED;
+        } else if (strcmp(token, "-dump_binary") == 0)
+            ops->flags &= ~(DRCOVLIB_DUMP_AS_TEXT | DRCOVLIB_DUMP_INDEXED);
+        else if (strcmp(token, "-dump_indexed") == 0) {
+            ops->flags |= DRCOVLIB_DUMP_INDEXED;
             ops->flags &= ~DRCOVLIB_DUMP_AS_TEXT;
+        }
+        else if (strcmp(token, "-hit_counts") == 0)
+            ops->flags |= DRCOVLIB_HIT_COUNTS;
+        else if (strcmp(token, "-hit_counts_file") == 0) {
+            USAGE_CHECK((i + 1) < argc, "missing hit_counts_file path");
+#ifdef UNIX
+            ops->flags |= DRCOVLIB_HIT_COUNTS;
+            if (!hit_counts_file_map(argv[++i], ops)) {
+                NOTIFY(0, "fatal error: failed to map hit_counts_file %s\n", argv[i]);
+                dr_abort();
+            }
+#else
+            USAGE_CHECK(false, "-hit_counts_file is UNIX only");
+#endif
+        }
         else if (strcmp(token, "-no_nudge_kills") == 0)
             nudge_kills = false;
         else if (strcmp(token, "-nudge_kills") == 0)
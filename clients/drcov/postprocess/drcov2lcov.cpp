@@ -45,7 +45,10 @@
 #include "drsyms.h"
 #include "hashtable.h"
 #include "dr_frontend.h"
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "../../common/utils.h"
 #undef ASSERT /* we're standalone, so no client assert */
@@ -58,9 +61,11 @@
 #ifdef UNIX
 # include <dirent.h> /* opendir, readdir */
 # include <unistd.h> /* getcwd */
+# include <pthread.h>
 #else
 # include <windows.h>
 # include <direct.h> /* _getcwd */
+# include <process.h> /* _beginthreadex */
 # pragma comment(lib, "User32.lib")
 #endif
 
@@ -174,6 +179,14 @@ static droption_t<bool> op_include_tool
  "coverage output.  Normally such execution is excluded and the output focuses on "
  "the application only.");
 
+static droption_t<unsigned int> op_jobs
+(DROPTION_SCOPE_FRONTEND, "jobs", 1, 1, 256, "Number of threads reading input files",
+ "Specifies the number of worker threads that map, parse, and merge the input log "
+ "files.  Symbolization still happens once per module after all inputs are merged. "
+ "This option is ignored with -test_pattern, whose output depends on the order in "
+ "which the basic blocks are read.  With -reduce_set, the set chosen may vary from "
+ "run to run when this is above 1, though it always has the same coverage.");
+
 static droption_t<bool> op_help
 (DROPTION_SCOPE_FRONTEND, "help", false, "Print this message",
  "Prints the usage message.");
@@ -199,6 +212,13 @@ static char set_file_buf[MAXIMUM_PATH];
 
 static file_t set_log = INVALID_FILE;
 
+/* Input log files gathered from -input, -list, and -dir, read by worker threads. */
+static std::vector<std::string> input_files;
+static size_t next_input_file;
+static void *input_lock;
+/* Protects module_htable, the module tables' contents, and set_log. */
+static void *merge_lock;
+
 /****************************************************************************
  * Utility Functions
  */
@@ -749,24 +769,35 @@ module_is_from_tool(const char * path)
             strstr(path, DRMEM_LIB_NAME) != NULL);
 }
 
+/* This only parses buf and does not touch module_htable, so it can be called
+ * without holding merge_lock.
+ */
 static const char *
-read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
+read_module_list(const char *buf, void **handle, uint *num_mods)
 {
-    const char *modpath;
-    char subst[MAXIMUM_PATH];
-    uint i;
-    void *handle;
-
     PRINT(3, "Reading module table...\n");
     /* module table header */
-    if (drmodtrack_offline_read(INVALID_FILE, buf, &buf, &handle, num_mods) !=
+    if (drmodtrack_offline_read(INVALID_FILE, buf, &buf, handle, num_mods) !=
         DRCOVLIB_SUCCESS) {
         WARN(2, "Failed to read module table");
         return NULL;
     }
+    return buf;
+}
+
+/* Returns the module table for each module in handle, creating those not seen
+ * in earlier inputs.  The caller must hold merge_lock.
+ */
+static module_table_t **
+module_list_lookup(void *handle, uint num_mods)
+{
+    module_table_t **tables;
+    const char *modpath;
+    char subst[MAXIMUM_PATH];
+    uint i;
 
-    *tables = (module_table_t **) calloc(*num_mods, sizeof(*tables));
-    for (i = 0; i < *num_mods; i++) {
+    tables = (module_table_t **) calloc(num_mods, sizeof(*tables));
+    for (i = 0; i < num_mods; i++) {
         module_table_t *mod_table;
         drmodtrack_info_t info = {sizeof(info),};
 
@@ -813,34 +844,70 @@ read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
             if (!hashtable_add(&module_htable, (void *)modpath, mod_table))
                 ASSERT(false, "Failed to add new module");
         }
-        (*tables)[i] = mod_table;
+        tables[i] = mod_table;
     }
-    if (drmodtrack_offline_exit(handle) != DRCOVLIB_SUCCESS)
-        ASSERT(false, "failed to clean up module table data");
-    return buf;
+    return tables;
 }
 
 static bool
-read_bb_list(const char *buf, module_table_t **tables, uint num_mods, uint num_bbs)
+bb_entry_less(const bb_entry_t &a, const bb_entry_t &b)
+{
+    return a.mod_id < b.mod_id || (a.mod_id == b.mod_id && a.start < b.start);
+}
+
+static bool
+bb_entry_same_start(const bb_entry_t &a, const bb_entry_t &b)
+{
+    return a.mod_id == b.mod_id && a.start == b.start;
+}
+
+/* Copies the basic blocks of one input that belong to a known module into
+ * entries.  Logs hold many repeats of each block, so unless -test_pattern needs
+ * them in order, they are sorted and all but the first occurrence of each start
+ * dropped: the module tables ignore those anyway.  This only touches buf and
+ * entries, so it can be called without holding merge_lock.
+ */
+static void
+prepare_bb_list(const char *buf, uint num_mods, uint num_bbs,
+                std::vector<bb_entry_t> &entries)
 {
     uint i;
-    bb_entry_t *entry;
-    bool add_new_bb = false;
+    bb_entry_t entry;
 
     PRINT(4, "Reading %u basic blocks\n", num_bbs);
+    entries.reserve(num_bbs);
+    for (i = 0; i < num_bbs; i++, buf += sizeof(entry)) {
+        memcpy(&entry, buf, sizeof(entry));
+        PRINT(6, "BB: " PFX", %u, %u\n",
+              (ptr_uint_t)entry.start, entry.size, entry.mod_id);
+        /* we could have mod id USHRT_MAX for unknown module e.g., [vdso] */
+        if (entry.mod_id < num_mods)
+            entries.push_back(entry);
+    }
+    if (!op_test_pattern.specified()) {
+        /* stable, so the first occurrence of each start is the one kept */
+        std::stable_sort(entries.begin(), entries.end(), bb_entry_less);
+        entries.erase(std::unique(entries.begin(), entries.end(), bb_entry_same_start),
+                      entries.end());
+    }
+}
+
+/* Adds entries to the module tables.  The caller must hold merge_lock. */
+static bool
+read_bb_list(std::vector<bb_entry_t> &entries, module_table_t **tables)
+{
+    size_t i;
+    bool add_new_bb = false;
+
     if (op_test_pattern.specified()) {
         /* i#1465: add unittest case coverage information in drcov:
          * reset the current test name to be none
          */
         cur_test = non_test;
     }
-    for (i = 0, entry = (bb_entry_t *)buf; i < num_bbs; i++, entry++) {
-        PRINT(6, "BB: " PFX", %u, %u\n",
-              (ptr_uint_t)entry->start, entry->size, entry->mod_id);
-        /* we could have mod id USHRT_MAX for unknown module e.g., [vdso] */
-        if (entry->mod_id < num_mods)
-            add_new_bb = module_table_bb_add(tables[entry->mod_id], entry) || add_new_bb;
-    }
+    for (i = 0; i < entries.size(); i++)
+        add_new_bb = module_table_bb_add(tables[entries[i].mod_id], &entries[i]) ||
+            add_new_bb;
     free(tables);
     return add_new_bb;
 }
@@ -885,6 +952,50 @@ read_file_header(const char *buf)
     return buf;
 }
 
+/* Validates the header of a DRCOVLIB_DUMP_INDEXED log file and returns its
+ * module table, or NULL if the header is corrupt or from another flavor.
+ */
+static const char *
+read_index_header(const char *map, size_t map_size, const char **bbs OUT,
+                  uint *num_bbs OUT)
+{
+    const drcov_index_header_t *header = (const drcov_index_header_t *)map;
+
+    PRINT(3, "Reading index header...\n");
+    if (map_size < sizeof(*header) ||
+        memcmp(header->magic, DRCOV_INDEX_MAGIC, sizeof(header->magic)) != 0) {
+        WARN(2, "Missing index header\n");
+        return NULL;
+    }
+    if (header->version != DRCOV_INDEX_VERSION ||
+        header->header_size < sizeof(*header)) {
+        WARN(2, "Version mismatch: file version %d vs tool version %d\n",
+             header->version, DRCOV_INDEX_VERSION);
+        return NULL;
+    }
+    if (strncmp(header->flavor, DRCOV_FLAVOR, sizeof(header->flavor)) != 0) {
+        WARN(2, "Fatal file mismatch: file %.*s vs tool %s\n",
+             (int)sizeof(header->flavor), header->flavor, DRCOV_FLAVOR);
+        return NULL;
+    }
+    if (header->modules_size == 0 ||
+        header->modules_offset > map_size ||
+        header->modules_size > map_size - header->modules_offset ||
+        map[header->modules_offset + header->modules_size - 1] != '\0') {
+        WARN(2, "Corrupt module table\n");
+        return NULL;
+    }
+    if (header->num_bbs > UINT_MAX ||
+        header->bbs_offset > map_size ||
+        header->num_bbs > (map_size - header->bbs_offset) / sizeof(bb_entry_t)) {
+        WARN(2, "Corrupt basic block table\n");
+        return NULL;
+    }
+    *bbs = map + header->bbs_offset;
+    *num_bbs = (uint)header->num_bbs;
+    return map + header->modules_offset;
+}
+
 static file_t
 open_input_file(const char *fname, const char **map_out OUT,
                 size_t *map_size OUT, uint64 *file_sz OUT)
@@ -933,11 +1044,13 @@ static bool
 read_drcov_file(const char *input)
 {
     file_t log;
-    const char  *map, *ptr;
+    const char  *map, *ptr, *bbs = NULL;
     size_t map_size;
     module_table_t **tables;
-    uint   num_mods, num_bbs;
-    bool   res;
+    void  *handle;
+    uint   num_mods, num_bbs = 0;
+    bool   indexed, res;
+    std::vector<bb_entry_t> entries;
 
     PRINT(2, "Reading drcov log file: %s\n", input);
     log = open_input_file(input, &map, &map_size, NULL);
@@ -945,29 +1058,51 @@ read_drcov_file(const char *input)
         WARN(1, "Failed to read drcov log file %s\n", input);
         return false;
     }
-    ptr = read_file_header(map);
+    indexed = map_size >= sizeof(drcov_index_header_t) &&
+        memcmp(map, DRCOV_INDEX_MAGIC, strlen(DRCOV_INDEX_MAGIC)) == 0;
+    if (indexed)
+        ptr = read_index_header(map, map_size, &bbs, &num_bbs);
+    else
+        ptr = read_file_header(map);
     if (ptr == NULL) {
         WARN(1, "Invalid version or bitwidth in drcov log file %s\n", input);
+        close_input_file(log, map, map_size);
         return false;
     }
 
-    ptr = read_module_list(ptr, &tables, &num_mods);
-    if (ptr == NULL)
-        return false;
-
-    if (dr_sscanf(ptr, "BB Table: %u bbs\n", &num_bbs) != 1) {
-        WARN(1, "Failed to read bb list from %s\n", input);
-        return false;
-    }
-    ptr = move_to_next_line(ptr);
-    if (num_bbs*sizeof(bb_entry_t) > map_size) {
-        WARN(1, "Wrong number of bbs, corrupt log file %s\n", input);
+    ptr = read_module_list(ptr, &handle, &num_mods);
+    if (ptr == NULL) {
         close_input_file(log, map, map_size);
         return false;
     }
-    res = read_bb_list(ptr, tables, num_mods, num_bbs);
+
+    if (!indexed) {
+        if (dr_sscanf(ptr, "BB Table: %u bbs\n", &num_bbs) != 1) {
+            WARN(1, "Failed to read bb list from %s\n", input);
+            drmodtrack_offline_exit(handle);
+            close_input_file(log, map, map_size);
+            return false;
+        }
+        bbs = move_to_next_line(ptr);
+        if (num_bbs*sizeof(bb_entry_t) > map_size - (bbs - map)) {
+            WARN(1, "Wrong number of bbs, corrupt log file %s\n", input);
+            drmodtrack_offline_exit(handle);
+            close_input_file(log, map, map_size);
+            return false;
+        }
+    }
+
+    prepare_bb_list(bbs, num_mods, num_bbs, entries);
+
+    dr_mutex_lock(merge_lock);
+    tables = module_list_lookup(handle, num_mods);
+    res = read_bb_list(entries, tables);
     if (res && set_log != INVALID_FILE)
         dr_fprintf(set_log, "%s\n", input);
+    dr_mutex_unlock(merge_lock);
+
+    if (drmodtrack_offline_exit(handle) != DRCOVLIB_SUCCESS)
+        ASSERT(false, "failed to clean up module table data");
     close_input_file(log, map, map_size);
     return true;
 }
@@ -1006,7 +1141,7 @@ read_drcov_dir(void)
                     WARN(1, "Fail to get full path of log file %s\n", ent->d_name);
                 } else {
                     NULL_TERMINATE_BUFFER(path);
-                    read_drcov_file(path);
+                    input_files.push_back(path);
                     found_logs = true;
                 }
             }
@@ -1053,7 +1188,8 @@ read_drcov_dir(void)
             if (!has_sep)
                 strcat(path, "\\");
             strcat(path, ffd.cFileName);
-            found_logs = read_drcov_file(path) || found_logs;
+            input_files.push_back(path);
+            found_logs = true;
         }
     } while (FindNextFile(hFind, &ffd) != 0);
     FindClose(hFind);
@@ -1086,7 +1222,8 @@ read_drcov_list(void)
         NULL_TERMINATE_BUFFER(path);
         ptr = move_to_next_line(ptr);
         null_terminate_path(path);
-        found_logs = read_drcov_file(path) || found_logs;
+        input_files.push_back(path);
+        found_logs = true;
     }
     close_input_file(list, map, map_size);
     if (!found_logs)
@@ -1094,17 +1231,90 @@ read_drcov_list(void)
     return found_logs;
 }
 
+#ifdef WINDOWS
+static unsigned int __stdcall
+#else
+static void *
+#endif
+read_drcov_worker(void *arg)
+{
+    uint *num_read = (uint *)arg;
+    size_t i;
+    while (true) {
+        dr_mutex_lock(input_lock);
+        i = next_input_file++;
+        dr_mutex_unlock(input_lock);
+        if (i >= input_files.size())
+            break;
+        if (read_drcov_file(input_files[i].c_str()))
+            (*num_read)++;
+    }
+    return 0;
+}
+
+/* Reads input_files on op_jobs threads.  Each thread maps and parses its files on
+ * its own and only takes merge_lock to add the basic blocks to the module tables.
+ */
+static bool
+read_drcov_files(void)
+{
+    uint num_jobs = op_jobs.get_value();
+    std::vector<uint> num_read;
+    uint i, total = 0;
+
+    /* The test name of each bb depends on the bbs read before it. */
+    if (op_test_pattern.specified())
+        num_jobs = 1;
+    if (num_jobs > input_files.size())
+        num_jobs = (uint)input_files.size();
+    if (num_jobs == 0)
+        return false;
+    PRINT(2, "Reading %u input files on %u threads\n",
+          (uint)input_files.size(), num_jobs);
+    num_read.resize(num_jobs, 0);
+    next_input_file = 0;
+    if (num_jobs == 1)
+        read_drcov_worker(&num_read[0]);
+    else {
+#ifdef UNIX
+        std::vector<pthread_t> threads(num_jobs);
+        for (i = 0; i < num_jobs; i++) {
+            if (pthread_create(&threads[i], NULL, read_drcov_worker, &num_read[i]) != 0)
+                ASSERT(false, "Failed to create worker thread\n");
+        }
+        for (i = 0; i < num_jobs; i++)
+            pthread_join(threads[i], NULL);
+#else
+        std::vector<uintptr_t> threads(num_jobs);
+        for (i = 0; i < num_jobs; i++) {
+            threads[i] = _beginthreadex(NULL, 0, read_drcov_worker, &num_read[i], 0,
+                                        NULL);
+            if (threads[i] == 0)
+                ASSERT(false, "Failed to create worker thread\n");
+        }
+        for (i = 0; i < num_jobs; i++) {
+            WaitForSingleObject((HANDLE)threads[i], INFINITE);
+            CloseHandle((HANDLE)threads[i]);
+        }
+#endif
+    }
+    for (i = 0; i < num_jobs; i++)
+        total += num_read[i];
+    PRINT(2, "Read %u of %u input files\n", total, (uint)input_files.size());
+    return total > 0;
+}
+
 static bool
 read_drcov_input(void)
 {
     bool res = true;
     if (op_input.specified())
-        res = read_drcov_file(input_file_buf) && res;
+        input_files.push_back(input_file_buf);
     if (op_list.specified())
         res = read_drcov_list() && res;
     if (op_dir.specified())
         res = read_drcov_dir() && res;
-    return res;
+    return read_drcov_files() && res;
 }
 
 static bool
@@ -1382,6 +1592,8 @@ main(int argc, const char *argv[])
                       true /* strdup */, false /* !synch */,
                       line_table_delete /* free */,
                       NULL /* hash */, NULL /* cmp */);
+    input_lock = dr_mutex_create();
+    merge_lock = dr_mutex_create();
 
     PRINT(1, "Reading input files...\n");
     if (!read_drcov_input()) {
@@ -1401,6 +1613,8 @@ main(int argc, const char *argv[])
         return 1;
     }
 
+    dr_mutex_destroy(input_lock);
+    dr_mutex_destroy(merge_lock);
     hashtable_delete(&module_htable);
     hashtable_delete(&line_htable);
     if (drsym_exit() != DRSYM_SUCCESS) {
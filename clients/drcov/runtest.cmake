@@ -36,6 +36,8 @@
 #     should have intra-arg space=@@ and inter-arg space=@ and ;=!
 # * cmp = file containing output to compare app output to, to ensure app ran correctly
 # * postcmd = post processing command to run
+# * postcmd2 = optional extra options for postcmd, with inter-arg space=@.
+#   When set, cmd is run twice so that postcmd has more than one input.
 
 # Intra-arg space=@@ and inter-arg space=@.
 # XXX i#1327: now that we have -c and other option passing improvements we
@@ -43,15 +45,30 @@
 string(REGEX REPLACE "@@" " " cmd "${cmd}")
 string(REGEX REPLACE "@" ";" cmd "${cmd}")
 string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
+string(REGEX REPLACE "@" ";" postcmd_ops "${postcmd2}")
+
+# With -hit_counts_file the counters must end up in the named file, which we
+# start from scratch so earlier runs cannot satisfy the check.
+if ("${cmd}" MATCHES "-hit_counts_file[ ;]([^ ;]+)")
+  set(hits_file "${CMAKE_MATCH_1}")
+  file(REMOVE ${hits_file})
+endif ()
 
 # run the cmd
-execute_process(COMMAND ${cmd}
-  RESULT_VARIABLE cmd_result
-  ERROR_VARIABLE cmd_err
-  OUTPUT_VARIABLE cmd_out)
-if (cmd_result)
-  message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
-endif (cmd_result)
+if (postcmd_ops)
+  set(num_runs 2)
+else ()
+  set(num_runs 1)
+endif ()
+foreach (run RANGE 1 ${num_runs})
+  execute_process(COMMAND ${cmd}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+endforeach ()
 
 # get the real test name:
 # CMake uses the first '.' to identify the longest extension, so we cannot use
@@ -76,6 +93,7 @@ execute_process(COMMAND ${postcmd}
   -mod_filter ${test_name}
   -src_filter ${test_name}
   -output     ${cov_file}
+  ${postcmd_ops}
   RESULT_VARIABLE cmd_result
   ERROR_VARIABLE cmd_err
   OUTPUT_VARIABLE cmd_out)
@@ -85,6 +103,27 @@ endif (cmd_result)
 
 file(READ ${cov_file} cov_out)
 
+if ("${cmd}" MATCHES "-hit_counts")
+  # The counters follow the bb table in each log.
+  foreach(logfile ${drcov_logs})
+    file(STRINGS ${logfile} hits_header REGEX "^BB Hit Counts: [0-9]+ bbs")
+    if (NOT hits_header)
+      message(FATAL_ERROR "*** ${logfile} has no hit counts ***\n")
+    endif ()
+  endforeach(logfile)
+  if (hits_file)
+    # The first blocks in the table all ran, so their counters are set.
+    if (NOT EXISTS ${hits_file})
+      message(FATAL_ERROR "*** ${hits_file} was not created ***\n")
+    endif ()
+    file(READ ${hits_file} hits_head LIMIT 64 HEX)
+    file(REMOVE ${hits_file})
+    if (NOT "${hits_head}" MATCHES "[1-9a-f]")
+      message(FATAL_ERROR "*** ${hits_file} holds no counts ***\n")
+    endif ()
+  endif ()
+endif ()
+
 # cleanup
 foreach(logfile ${drcov_logs})
   file(REMOVE ${logfile})
@@ -32,6 +32,12 @@
 
 #include "../globals.h"
 
+bool
+optimize_hot_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    return false; /* FIXME i#1569: no release-mode trace optimizations yet */
+}
+
 #ifdef INTERNAL
 
 void
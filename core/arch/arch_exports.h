@@ -132,6 +132,34 @@ typedef struct _ibl_entry_pc_t {
 } ibl_entry_pc_t;
 #endif
 
+#if defined(X86) && defined(X64)
+/* -shadow_return_stack: each mangled call records its return address and the
+ * cache pc of a direct exit to it.  The ring is exactly 256 bytes and aligned
+ * to its size so the cache can wrap its top pointer by rewriting the low byte,
+ * leaving the flags untouched.
+ */
+typedef struct _shadow_ret_entry_t {
+    app_pc tag;
+    cache_pc landing;
+} shadow_ret_entry_t;
+# define SHADOW_RET_STACK_ENTRIES 16
+# define SHADOW_RET_STACK_SIZE (SHADOW_RET_STACK_ENTRIES * sizeof(shadow_ret_entry_t))
+# ifdef DEBUG
+/* Kept just past the aligned ring, where the return IBL can find them by
+ * masking the top pointer.
+ */
+typedef struct _shadow_ret_stats_t {
+    uint hits;
+    uint misses;
+} shadow_ret_stats_t;
+#  define SHADOW_RET_STATS_SIZE sizeof(shadow_ret_stats_t)
+# else
+#  define SHADOW_RET_STATS_SIZE 0
+# endif
+/* over-allocated so the ring can be size-aligned */
+# define SHADOW_RET_STACK_ALLOC_SIZE (2 * SHADOW_RET_STACK_SIZE + SHADOW_RET_STATS_SIZE)
+#endif
+
 /* All spill slots are grouped in a separate struct because with
  * -no_ibl_table_in_tls, only these slots are mapped to TLS (and the
  * table address/mask pairs are not).
@@ -150,6 +178,10 @@ typedef struct _spill_state_t {
 #endif
     /* FIXME: move this below the tables to fit more on cache line */
     dcontext_t *dcontext;
+#if defined(X86) && defined(X64)
+    /* -shadow_return_stack: top of this thread's shadow_ret_entry_t ring */
+    byte *shadow_ret_top;
+#endif
 #ifdef AARCHXX
     /* We store addresses here so we can load pointer-sized addresses into
      * registers with a single instruction in our exit stubs and gencode.
@@ -211,6 +243,9 @@ typedef struct _local_state_extended_t {
 #define IBL_TARGET_REG           SCRATCH_REG2
 #define IBL_TARGET_SLOT          TLS_REG2_SLOT
 #define TLS_DCONTEXT_SLOT        ((ushort)offsetof(spill_state_t, dcontext))
+#if defined(X86) && defined(X64)
+# define TLS_SHADOW_RET_SLOT     ((ushort)offsetof(spill_state_t, shadow_ret_top))
+#endif
 #ifdef AARCHXX
 # define TLS_FCACHE_RETURN_SLOT  ((ushort)offsetof(spill_state_t, fcache_return))
 #endif
@@ -2042,6 +2077,7 @@ bool is_observed_call_site(dcontext_t *dcontext, app_pc retaddr);
 
 /* in optimize.c */
 void optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+bool optimize_hot_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
 #ifdef DEBUG
 void print_optimization_stats(void);
 #endif
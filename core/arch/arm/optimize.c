@@ -35,9 +35,15 @@
  * routines to support optimization of traces
  */
 
-#include "../globals.h"   /* just to disable warning C4206 about an empty file */
+#include "../globals.h"
 
-#ifdef INTERNAL /* around whole file */
+bool
+optimize_hot_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    return false; /* FIXME i#1551: no release-mode trace optimizations yet */
+}
+
+#ifdef INTERNAL /* around legacy optimizations */
 
 void
 optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
@@ -46,4 +52,4 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     ASSERT_NOT_IMPLEMENTED(false);
 }
 
-#endif /* INTERNAL around whole file */
+#endif /* INTERNAL around legacy optimizations */
@@ -120,6 +120,11 @@ DECLARE_CXTSWPROT_VAR(mutex_t bb_building_lock, INIT_LOCK_FREE(bb_building_lock)
 /* i#1111: we do not use the lock until the 2nd thread is created */
 volatile bool bb_lock_start;
 
+/* For the coarse-grain wrapper returned when a parallel build loses a race
+ * (see PARALLEL_BB_BUILD()).  The bb_building_lock protects use of this.
+ */
+static fragment_t bb_race_wrapper;
+
 #ifdef INTERNAL
 file_t bbdump_file = INVALID_FILE;
 #endif
@@ -5025,16 +5030,18 @@ at_native_exec_gateway(dcontext_t *dcontext, app_pc start, bool *is_call
 }
 
 /* Use when calling build_bb_ilist with for_cache = true.
- * Must hold bb_building_lock.
+ * Must hold bb_building_lock unless parallel (see PARALLEL_BB_BUILD()).
  */
 static inline void
 init_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
-                     uint initial_flags
+                     uint initial_flags, bool parallel
                      _IF_CLIENT(bool for_trace)
                      _IF_CLIENT(instrlist_t **unmangled_ilist))
 {
-    ASSERT_OWN_MUTEX(USE_BB_BUILDING_LOCK() && !TEST(FRAG_TEMP_PRIVATE, initial_flags),
+    ASSERT_OWN_MUTEX(USE_BB_BUILDING_LOCK() && !parallel &&
+                     !TEST(FRAG_TEMP_PRIVATE, initial_flags),
                      &bb_building_lock);
+    ASSERT_DO_NOT_OWN_MUTEX(parallel, &bb_building_lock);
     /* We need to set up for abort prior to native exec and other checks
      * that can crash */
     ASSERT(dcontext->bb_build_info == NULL);
@@ -5047,7 +5054,7 @@ init_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
                   INVALID_FILE, initial_flags |
                   (INTERNAL_OPTION(store_translations) ?
                    FRAG_HAS_TRANSLATION_INFO : 0), NULL/*no overlap*/);
-    if (!TEST(FRAG_TEMP_PRIVATE, initial_flags))
+    if (!TEST(FRAG_TEMP_PRIVATE, initial_flags) && !parallel)
         bb->has_bb_building_lock = true;
 #ifdef CLIENT_INTERFACE
     /* We avoid races where there is no hook when we start building a
@@ -5123,6 +5130,10 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
     build_bb_t bb;
     where_am_i_t wherewasi = dcontext->whereami;
     bool image_entry;
+    /* The caller holds the bb_building_lock unless PARALLEL_BB_BUILD(), in
+     * which case we acquire it ourselves prior to emitting.
+     */
+    bool parallel = PARALLEL_BB_BUILD() && !TEST(FRAG_TEMP_PRIVATE, initial_flags);
     KSTART(bb_building);
     dcontext->whereami = WHERE_INTERP;
 
@@ -5134,7 +5145,7 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
      */
     image_entry = check_for_image_entry(start);
 
-    init_interp_build_bb(dcontext, &bb, start, initial_flags
+    init_interp_build_bb(dcontext, &bb, start, initial_flags, parallel
                          _IF_CLIENT(for_trace) _IF_CLIENT(unmangled_ilist));
     if (at_native_exec_gateway(dcontext, start, &bb.native_call
                                _IF_DEBUG(false/*not xfer tgt*/))) {
@@ -5159,7 +5170,7 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
             instrlist_clear_and_destroy(dcontext, bb.ilist);
             vm_area_destroy_list(dcontext, bb.vmlist);
             dcontext->bb_build_info = NULL;
-            init_interp_build_bb(dcontext, &bb, start, initial_flags
+            init_interp_build_bb(dcontext, &bb, start, initial_flags, parallel
                                  _IF_CLIENT(for_trace) _IF_CLIENT(unmangled_ilist));
 #ifdef CLIENT_INTERFACE
             /* PR 232617 - build_native_exec_bb doesn't support setting
@@ -5177,6 +5188,29 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
     if (image_entry)
         bb.flags &= ~FRAG_COARSE_GRAIN;
 
+    if (parallel) {
+        /* Another thread may have built and added this same tag while we were
+         * decoding.  We serialize only the emit and table add, and discard our
+         * copy if we lost the race.  The caller releases the lock.
+         */
+        fragment_t *existing;
+        SHARED_BB_LOCK();
+        bb.has_bb_building_lock = true;
+        STATS_INC(num_bb_builds_parallel);
+        existing = fragment_lookup_fine_and_coarse(dcontext, start, &bb_race_wrapper,
+                                                   NULL);
+        if (existing != NULL) {
+            LOG(THREAD, LOG_INTERP, 2,
+                "lost parallel bb build race for "PFX": using F%d\n", start,
+                existing->id);
+            STATS_INC(num_bb_build_races);
+            vm_area_destroy_list(dcontext, bb.vmlist);
+            exit_interp_build_bb(dcontext, &bb);
+            f = existing;
+            goto build_basic_block_fragment_done;
+        }
+    }
+
     if (DYNAMO_OPTION(opt_jit) && visible && is_jit_managed_area(bb.start_pc)) {
         ASSERT(bb.overlap_info == NULL || bb.overlap_info->contiguous);
         jitopt_add_dgc_bb(bb.start_pc, bb.end_pc, TEST(FRAG_IS_TRACE_HEAD, bb.flags));
@@ -5539,6 +5573,24 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
             /* FIXME: case 4718 append_trace_speculate_last_ibl(true)
              * should be called as well
              */
+#ifdef CUSTOM_TRACES
+            if (DYNAMO_OPTION(trace_reform)) {
+                append_trace_side_exit_counts(dcontext, ilist, f->tag,
+                                              true/*record translation*/);
+            }
+            /* a trace optimized once hot stores its translation info, so
+             * any trace we recreate here is still counting its executions
+             */
+            if (DYNAMO_OPTION(opt_traces) && DYNAMO_OPTION(opt_trace_threshold) > 0) {
+                prepend_trace_entry_count(dcontext, ilist, f->tag,
+                                          true/*record translation*/);
+            }
+#endif
+            if (DYNAMO_OPTION(ib_target_cache) > 0) {
+                append_trace_ib_target_cache(dcontext, ilist,
+                                             t->bbs[t->num_bbs - 1].tag, NULL,
+                                             true/*record translation*/);
+            }
             if (PAD_FRAGMENT_JMPS(f->flags))
                 nop_pad_ilist(dcontext, f, ilist, false /* set translation */);
         }
@@ -6535,6 +6587,322 @@ append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
     return added_size;
 }
 
+#ifdef X86
+/* -ib_target_cache and -trace_reform: increments *counter without touching
+ * the flags, using xax and xcx as scratch, both of which the caller restores
+ */
+static int
+insert_trace_count(dcontext_t *dcontext, instrlist_t *trace, instr_t *where,
+                   uint *counter)
+{
+    int added_size = 0;
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XAX),
+                              OPND_CREATE_INTPTR((ptr_int_t)counter)));
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         XINST_CREATE_load(dcontext, opnd_create_reg(REG_ECX),
+                           OPND_CREATE_MEM32(REG_XAX, 0)));
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         XINST_CREATE_add(dcontext, opnd_create_reg(REG_XCX), OPND_CREATE_INT8(1)));
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         XINST_CREATE_store(dcontext, OPND_CREATE_MEM32(REG_XAX, 0),
+                            opnd_create_reg(REG_ECX)));
+    return added_size;
+}
+#endif
+
+#ifdef CUSTOM_TRACES
+/* -trace_reform: makes each conditional side exit of the trace with tag count
+ * itself in trace_reform_exit_counter(tag) before leaving, whether or not it
+ * is linked.  The exit cti is replaced by
+ *     j!cc  stay
+ *     mov   xax, xax-tls-spill-slot
+ *     mov   xcx, xcx-tls-spill-slot
+ *     <increment the counter>
+ *     mov   xcx-tls-spill-slot, xcx
+ *     mov   xax-tls-spill-slot, xax
+ *     jmp   target             # the exit, now a direct jmp
+ *   stay:
+ * Exits back to the trace's own head, into the IBL, and the final exit are
+ * left alone.  Returns the size added to the trace.
+ */
+int
+append_trace_side_exit_counts(dcontext_t *dcontext, instrlist_t *trace,
+                              app_pc tag, bool record_translation)
+{
+    int added_size = 0;
+# ifdef X86
+    instr_t *in, *next, *last = instrlist_last(trace);
+    opnd_t xax_slot = opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT));
+    opnd_t xcx_slot = opnd_create_tls_slot(os_tls_offset(MANGLE_XCX_SPILL_SLOT));
+    uint *counter;
+    uint num_exits = 0;
+    ibl_type_t ibl_type;
+
+#  ifdef X64
+    /* x86 code in a 64-bit cache keeps its spills in registers */
+    if (X64_CACHE_MODE_DC(dcontext) && !X64_MODE_DC(dcontext))
+        return 0;
+#  endif
+    counter = trace_reform_exit_counter(tag);
+    instrlist_set_our_mangling(trace, true); /* PR 267260 */
+    for (in = instrlist_first(trace); in != NULL && in != last; in = next) {
+        int opc;
+        app_pc target;
+        instr_t *jcc, *exit, *stay;
+        next = instr_get_next(in);
+        if (!instr_is_exit_cti(in) || !instr_is_cbr(in))
+            continue;
+        opc = instr_get_opcode(in);
+        /* jecxz and loop are left alone: they cannot simply be inverted */
+        if (!((opc >= OP_jo && opc <= OP_jnle) ||
+              (opc >= OP_jo_short && opc <= OP_jnle_short)))
+            continue;
+        target = opnd_get_pc(instr_get_target(in));
+        if (target == tag || get_ibl_routine_type(dcontext, target, &ibl_type))
+            continue;
+#  ifdef CUSTOM_EXIT_STUBS
+        if (instr_exit_stub_code(in) != NULL)
+            continue;
+#  endif
+        if (record_translation)
+            instrlist_set_translation_target(trace, instr_get_translation(in));
+        stay = INSTR_CREATE_label(dcontext);
+        jcc = INSTR_CREATE_jcc(dcontext, opc, opnd_create_instr(stay));
+        instr_invert_cbr(jcc);
+        /* do not treat the local jump as an exit cti! */
+        instr_set_meta(jcc);
+        exit = XINST_CREATE_jump(dcontext, opnd_create_pc(target));
+        instr_exit_branch_set_type(exit, instr_exit_branch_type(in));
+
+        added_size += tracelist_add(dcontext, trace, in, jcc);
+        added_size += tracelist_add(dcontext, trace, in,
+                                    XINST_CREATE_store(dcontext, xax_slot,
+                                                       opnd_create_reg(REG_XAX)));
+        added_size += tracelist_add(dcontext, trace, in,
+                                    XINST_CREATE_store(dcontext, xcx_slot,
+                                                       opnd_create_reg(REG_XCX)));
+        added_size += insert_trace_count(dcontext, trace, in, counter);
+        added_size += tracelist_add(dcontext, trace, in,
+                                    XINST_CREATE_load(dcontext, opnd_create_reg(REG_XCX),
+                                                      xcx_slot));
+        added_size += tracelist_add(dcontext, trace, in,
+                                    XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                                                      xax_slot));
+        added_size += tracelist_add(dcontext, trace, in, exit);
+        added_size += tracelist_add(dcontext, trace, in, stay);
+        added_size -= instr_length(dcontext, in);
+        instrlist_remove(trace, in);
+        instr_destroy(dcontext, in);
+        num_exits++;
+    }
+    LOG(THREAD, LOG_INTERP, 3,
+        "append_trace_side_exit_counts: counting %d side exits of "PFX"\n",
+        num_exits, tag);
+    if (record_translation)
+        instrlist_set_translation_target(trace, NULL);
+    instrlist_set_our_mangling(trace, false); /* PR 267260 */
+# elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM */
+    ASSERT_NOT_IMPLEMENTED(false);
+# endif
+    return added_size;
+}
+
+/* -opt_trace_threshold: makes the trace with tag count its executions in
+ * trace_entry_counter(tag) by inserting at its top
+ *     mov   xax, xax-tls-spill-slot
+ *     mov   xcx, xcx-tls-spill-slot
+ *     <increment the counter>
+ *     mov   xcx-tls-spill-slot, xcx
+ *     mov   xax-tls-spill-slot, xax
+ * A trace that loops back to its own head counts every iteration.  Returns
+ * the size added to the trace.
+ */
+int
+prepend_trace_entry_count(dcontext_t *dcontext, instrlist_t *trace, app_pc tag,
+                          bool record_translation)
+{
+    int added_size = 0;
+# ifdef X86
+    instr_t *first = instrlist_first(trace);
+    opnd_t xax_slot = opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT));
+    opnd_t xcx_slot = opnd_create_tls_slot(os_tls_offset(MANGLE_XCX_SPILL_SLOT));
+
+#  ifdef X64
+    /* x86 code in a 64-bit cache keeps its spills in registers */
+    if (X64_CACHE_MODE_DC(dcontext) && !X64_MODE_DC(dcontext))
+        return 0;
+#  endif
+    if (first == NULL)
+        return 0;
+    instrlist_set_our_mangling(trace, true); /* PR 267260 */
+    if (record_translation)
+        instrlist_set_translation_target(trace, tag);
+    added_size += tracelist_add(dcontext, trace, first,
+                                XINST_CREATE_store(dcontext, xax_slot,
+                                                   opnd_create_reg(REG_XAX)));
+    added_size += tracelist_add(dcontext, trace, first,
+                                XINST_CREATE_store(dcontext, xcx_slot,
+                                                   opnd_create_reg(REG_XCX)));
+    added_size += insert_trace_count(dcontext, trace, first, trace_entry_counter(tag));
+    added_size += tracelist_add(dcontext, trace, first,
+                                XINST_CREATE_load(dcontext, opnd_create_reg(REG_XCX),
+                                                  xcx_slot));
+    added_size += tracelist_add(dcontext, trace, first,
+                                XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                                                  xax_slot));
+    if (record_translation)
+        instrlist_set_translation_target(trace, NULL);
+    instrlist_set_our_mangling(trace, false); /* PR 267260 */
+    LOG(THREAD, LOG_INTERP, 3,
+        "prepend_trace_entry_count: counting executions of "PFX"\n", tag);
+# elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM */
+    ASSERT_NOT_IMPLEMENTED(false);
+# endif
+    return added_size;
+}
+#endif
+
+/* -ib_target_cache: if the trace ends in an indirect call or jump, inserts
+ * before that final exit a compare against each target inlined for the site
+ * with tag site_tag, each leading to its own direct exit.  speculate is passed
+ * to ib_target_site_freeze().  Returns the size added to the trace.
+ *
+ * Unlike insert_transparent_comparison() this works for 64-bit targets: the
+ * negated target is put in xax and added to xcx with lea, so the flags are
+ * never touched:
+ *     mov   xax, xax-tls-spill-slot
+ *   for each target:
+ *     mov   $-target, xax
+ *     lea   (xcx,xax,1), xcx
+ *     jecxz hit
+ *     mov   $target, xax
+ *     lea   (xcx,xax,1), xcx
+ *     jmp   next
+ *   hit:
+ *     mov   xax-tls-spill-slot, xax
+ *     <restore app xcx>
+ *     jmp   target             # new direct exit
+ *   next:
+ *     ...
+ *     mov   xax-tls-spill-slot, xax
+ *     jmp   ibl                # the original final exit
+ * With -ib_target_cache_stats, each hit and the final miss also bump a counter
+ * in the site record.
+ */
+int
+append_trace_ib_target_cache(dcontext_t *dcontext, instrlist_t *trace,
+                             app_pc site_tag, app_pc speculate,
+                             bool record_translation)
+{
+    int added_size = 0;
+#ifdef X86
+    instr_t *targeter = instrlist_last(trace);
+    ib_target_site_t *site;
+    ibl_type_t ibl_type;
+    opnd_t xax_slot = opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT));
+    uint i;
+
+    if (targeter == NULL || !instr_is_exit_cti(targeter) ||
+        !opnd_is_pc(instr_get_target(targeter)) ||
+        !get_ibl_routine_type(dcontext, opnd_get_pc(instr_get_target(targeter)),
+                              &ibl_type) ||
+        /* returns are left to the IBL */
+        ibl_type.branch_type == IBL_RETURN)
+        return 0;
+# ifdef X64
+    /* x86 code in a 64-bit cache keeps its spills in registers */
+    if (X64_CACHE_MODE_DC(dcontext) && !X64_MODE_DC(dcontext))
+        return 0;
+# endif
+    site = ib_target_site_freeze(dcontext, site_tag, speculate);
+    if (site->num_inlined == 0)
+        return 0;
+
+    if (record_translation)
+        instrlist_set_translation_target(trace, instr_get_translation(targeter));
+    instrlist_set_our_mangling(trace, true); /* PR 267260 */
+
+    added_size += tracelist_add(dcontext, trace, targeter,
+                                XINST_CREATE_store(dcontext, xax_slot,
+                                                   opnd_create_reg(REG_XAX)));
+    for (i = 0; i < site->num_inlined; i++) {
+        app_pc target = site->inlined[i];
+        instr_t *hit = INSTR_CREATE_label(dcontext);
+        instr_t *next = INSTR_CREATE_label(dcontext);
+        instr_t *jecxz = INSTR_CREATE_jecxz(dcontext, opnd_create_instr(hit));
+        instr_t *jmp = INSTR_CREATE_jmp_short(dcontext, opnd_create_instr(next));
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XAX),
+                                  OPND_CREATE_INTPTR(-(ptr_int_t)target)));
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XCX),
+                              OPND_CREATE_MEM_lea(REG_XCX, REG_XAX, 1, 0)));
+        /* do not treat the local jumps as exit ctis! */
+        instr_set_meta(jecxz);
+        added_size += tracelist_add(dcontext, trace, targeter, jecxz);
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XAX),
+                                  OPND_CREATE_INTPTR((ptr_int_t)target)));
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XCX),
+                              OPND_CREATE_MEM_lea(REG_XCX, REG_XAX, 1, 0)));
+        instr_set_meta(jmp);
+        added_size += tracelist_add(dcontext, trace, targeter, jmp);
+
+        added_size += tracelist_add(dcontext, trace, targeter, hit);
+        if (DYNAMO_OPTION(ib_target_cache_stats)) {
+            added_size += insert_trace_count(dcontext, trace, targeter,
+                                             &site->hits[i]);
+        }
+        added_size += tracelist_add(dcontext, trace, targeter,
+                                    XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                                                      xax_slot));
+        added_size += insert_restore_spilled_xcx(dcontext, trace, targeter);
+        added_size += tracelist_add(dcontext, trace, targeter,
+                                    XINST_CREATE_jump(dcontext,
+                                                      opnd_create_pc(target)));
+        added_size += tracelist_add(dcontext, trace, targeter, next);
+    }
+    if (DYNAMO_OPTION(ib_target_cache_stats)) {
+        /* xcx holds the target the IBL needs */
+        opnd_t xcx_slot = opnd_create_tls_slot(os_tls_offset(INDIRECT_STUB_SPILL_SLOT));
+        added_size += tracelist_add(dcontext, trace, targeter,
+                                    XINST_CREATE_store(dcontext, xcx_slot,
+                                                       opnd_create_reg(REG_XCX)));
+        added_size += insert_trace_count(dcontext, trace, targeter,
+                                         &site->misses);
+        added_size += tracelist_add(dcontext, trace, targeter,
+                                    XINST_CREATE_load(dcontext, opnd_create_reg(REG_XCX),
+                                                      xcx_slot));
+    }
+    added_size += tracelist_add(dcontext, trace, targeter,
+                                XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                                                  xax_slot));
+    LOG(THREAD, LOG_INTERP, 3,
+        "append_trace_ib_target_cache: added %d cmps for ind br in "PFX"\n",
+        site->num_inlined, site_tag);
+
+    if (record_translation)
+        instrlist_set_translation_target(trace, NULL);
+    instrlist_set_our_mangling(trace, false); /* PR 267260 */
+#elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM */
+    ASSERT_NOT_IMPLEMENTED(false);
+#endif
+    return added_size;
+}
+
 #ifdef HASHTABLE_STATISTICS
 /* Add a counter on last IBL exit
  * if speculate_next_tag is not NULL then check case 4817's possible success
@@ -7546,6 +7914,7 @@ decode_fragment(dcontext_t *dcontext, fragment_t *f, byte *buf, /*IN/OUT*/uint *
                 }
 #if defined(X86) && defined(X64)
                 else if (instr_has_rel_addr_reference(instr)) {
+                    app_pc target_pc;
                     /* We need to re-relativize, which is done automatically only for
                      * level 1 instrs (PR 251479), and only when raw bits point to
                      * their original location.  We assume that all the if statements
@@ -7564,6 +7933,18 @@ decode_fragment(dcontext_t *dcontext, fragment_t *f, byte *buf, /*IN/OUT*/uint *
                     }
                     /* should be valid right now since pointing at original bits */
                     ASSERT(instr_rip_rel_valid(instr));
+                    if (instr_get_opcode(instr) == OP_lea &&
+                        instr_get_rel_addr_target(instr, &target_pc) &&
+                        target_pc >= start_pc && target_pc <= start_pc+f->size) {
+                        /* A meta lea of a landing inside this fragment (from
+                         * -shadow_return_stack): like an intra-fragment cti, point
+                         * it at the instr in the second pass so that it refers to
+                         * the new copy.
+                         */
+                        instr_t *clone = instr_clone(dcontext, instr);
+                        instr_set_note(clone, (void *) instr);
+                        instrlist_append(&intra_ctis, clone);
+                    }
                     if (buf != NULL) {
                         /* re-relativize into the new buffer */
                         DEBUG_DECLARE(byte *nxt =)
@@ -7780,14 +8161,23 @@ decode_fragment(dcontext_t *dcontext, fragment_t *f, byte *buf, /*IN/OUT*/uint *
                  * non-level-0 ones may have allocated raw bits) so we
                  * calculate a running offset as we go.
                  */
-                if (opnd_get_pc(instr_get_target(cti)) - start_pc == offs) {
+                app_pc cti_target = NULL;
+                if (instr_is_cti(cti))
+                    cti_target = opnd_get_pc(instr_get_target(cti));
+                IF_X86_64(else instr_get_rel_addr_target(cti, &cti_target);)
+                if (cti_target - start_pc == offs) {
                     /* cti targets this instr */
                     instr_t *real_cti = (instr_t *) instr_get_note(cti);
                     /* PR 333691: do not preserve raw bits of real_cti, since
                      * instrlist may change (e.g., inserted nops).  Must re-encode
                      * once instrlist is finalized.
                      */
-                    instr_set_target(real_cti, opnd_create_instr(instr));
+                    if (instr_is_cti(cti))
+                        instr_set_target(real_cti, opnd_create_instr(instr));
+                    else {
+                        instr_set_src(real_cti, 0,
+                                      opnd_create_mem_instr(instr, 0, OPSZ_lea));
+                    }
                     DOLOG(DF_LOGLEVEL(dcontext), LOG_MONITOR, {
                         loginst(dcontext, 4, real_cti, "\tre-set intra-fragment target");
                     });
@@ -1757,6 +1757,96 @@ insert_restore_eflags(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
 #define HASHLOOKUP_TAG_OFFS       (offsetof(fragment_entry_t, tag_fragment))
 #define HASHLOOKUP_START_PC_OFFS       (offsetof(fragment_entry_t, start_pc_fragment))
 
+#if defined(UNIX) && defined(X64)
+# ifdef DEBUG
+/* Bumps the shadow_ret_stats_t field at offs, using reg as scratch.  Expects
+ * the ring top in xcx and the app flags to have been saved.
+ */
+static void
+append_shadow_ret_count(dcontext_t *dcontext, instrlist_t *ilist, reg_id_t reg,
+                        uint offs)
+{
+    if (INTERNAL_OPTION(unsafe_ignore_eflags_ibl))
+        return;
+    if (reg != SCRATCH_REG2) {
+        APP(ilist, XINST_CREATE_load(dcontext, opnd_create_reg(reg),
+                                     opnd_create_reg(SCRATCH_REG2)));
+    }
+    APP(ilist, INSTR_CREATE_and(dcontext, opnd_create_reg(reg),
+                                OPND_CREATE_INT32(-(int)SHADOW_RET_STACK_SIZE)));
+    APP(ilist, INSTR_CREATE_inc(dcontext,
+                                OPND_CREATE_MEM32(reg, SHADOW_RET_STACK_SIZE + offs)));
+}
+# endif
+
+/* -shadow_return_stack: the mangled return just popped the ring, leaving the
+ * prediction for this return in the entry at the new top.  On a tag match we
+ * restore all app state and jump straight to the recorded landing, a direct
+ * exit to the return address in the caller's fragment:
+ *     mov   %fs:shadow_ret_top -> %xcx
+ *     cmp   tag(%xcx), %xbx
+ *     jne   miss
+ *     cmp   $0, landing(%xcx)
+ *     je    miss
+ *     <debug build: count the hit>
+ *     <restore eflags, xbx, xdi>
+ *     mov   landing(%xcx) -> %xcx
+ *     <save %xcx to xbx slot>
+ *     <restore %xcx from xcx slot>
+ *     jmp*  <xbx slot>
+ *   miss:
+ *     <debug build: count the miss>
+ *     mov   %xbx -> %xcx
+ * Expects the tag in both xbx and xcx, and leaves them that way on a miss.
+ */
+static void
+append_shadow_ret_check(dcontext_t *dcontext, instrlist_t *ilist,
+                        ibl_code_t *ibl_code, bool only_spill_state_in_tls)
+{
+    instr_t *miss = INSTR_CREATE_label(dcontext);
+    APP(ilist, XINST_CREATE_load(dcontext, opnd_create_reg(SCRATCH_REG2),
+                                 OPND_TLS_FIELD(TLS_SHADOW_RET_SLOT)));
+    APP(ilist, INSTR_CREATE_cmp(dcontext,
+                                OPND_CREATE_MEMPTR(SCRATCH_REG2,
+                                                   offsetof(shadow_ret_entry_t, tag)),
+                                opnd_create_reg(SCRATCH_REG1)));
+    APP(ilist, INSTR_CREATE_jcc_short(dcontext, OP_jne_short, opnd_create_instr(miss)));
+    APP(ilist, INSTR_CREATE_cmp(dcontext,
+                                OPND_CREATE_MEMPTR(SCRATCH_REG2,
+                                                   offsetof(shadow_ret_entry_t,
+                                                            landing)),
+                                OPND_CREATE_INT8(0)));
+    APP(ilist, INSTR_CREATE_jcc_short(dcontext, OP_je_short, opnd_create_instr(miss)));
+# ifdef DEBUG
+    /* xbx is restored below; the flags are held in xax */
+    append_shadow_ret_count(dcontext, ilist, SCRATCH_REG1,
+                            offsetof(shadow_ret_stats_t, hits));
+# endif
+    if (!INTERNAL_OPTION(unsafe_ignore_eflags_ibl)) {
+        insert_restore_eflags(dcontext, ilist, NULL, 0, IBL_EFLAGS_IN_TLS(),
+                              false/*!absolute*/ _IF_X64(false/*!x86_to_x64*/));
+    }
+    APP(ilist, RESTORE_FROM_TLS(dcontext, SCRATCH_REG1, INDIRECT_STUB_SPILL_SLOT));
+    if (only_spill_state_in_tls)
+        insert_shared_restore_dcontext_reg(dcontext, ilist, NULL);
+    APP(ilist, XINST_CREATE_load(dcontext, opnd_create_reg(SCRATCH_REG2),
+                                 OPND_CREATE_MEMPTR(SCRATCH_REG2,
+                                                    offsetof(shadow_ret_entry_t,
+                                                             landing))));
+    APP(ilist, SAVE_TO_TLS(dcontext, SCRATCH_REG2, INDIRECT_STUB_SPILL_SLOT));
+    APP(ilist, RESTORE_FROM_TLS(dcontext, SCRATCH_REG2, MANGLE_XCX_SPILL_SLOT));
+    APP(ilist, XINST_CREATE_jump_mem(dcontext,
+                                     OPND_TLS_FIELD(INDIRECT_STUB_SPILL_SLOT)));
+    APP(ilist, miss);
+# ifdef DEBUG
+    append_shadow_ret_count(dcontext, ilist, SCRATCH_REG2,
+                            offsetof(shadow_ret_stats_t, misses));
+# endif
+    APP(ilist, XINST_CREATE_load(dcontext, opnd_create_reg(SCRATCH_REG2),
+                                 opnd_create_reg(SCRATCH_REG1)));
+}
+#endif
+
 /* When inline_ibl_head, this emits the inlined lookup for the exit stub.
  *   Only assumption is that xcx = effective address of indirect branch
  * Else, this emits the top of the shared lookup routine, which assumes:
@@ -1860,6 +1950,11 @@ append_ibl_head(dcontext_t *dcontext, instrlist_t *ilist,
      *>>>    mov     %xcx,%xbx                                       */
     APP(ilist, XINST_CREATE_load(dcontext, opnd_create_reg(SCRATCH_REG1),
                                  opnd_create_reg(SCRATCH_REG2)));
+#if defined(UNIX) && defined(X64)
+    if (DYNAMO_OPTION(shadow_return_stack) && ibl_code->branch_type == IBL_RETURN &&
+        !inline_ibl_head && !absolute && !ibl_code->x86_mode && !x86_to_x64_ibl_opt)
+        append_shadow_ret_check(dcontext, ilist, ibl_code, only_spill_state_in_tls);
+#endif
 
     if (only_spill_state_in_tls) {
         /* grab the per_thread_t into XDI - can't use SAVE_TO_DC after this */
@@ -2439,6 +2534,17 @@ emit_indirect_branch_lookup(dcontext_t *dcontext, generated_code_t *code, byte *
         }
     }
 # endif
+    if (DYNAMO_OPTION(ibl_table_buckets)) {
+        /* With bucketized tables a collision chain walks its home line before
+         * spilling into the next one: get that line on its way.
+         * prefetch does not touch the flags.
+         */
+        APP(&ilist,
+            INSTR_CREATE_prefetcht0(dcontext,
+                                    opnd_create_base_disp(SCRATCH_REG2, REG_NULL, 0,
+                                                          proc_get_cache_line_size(),
+                                                          OPSZ_1)));
+    }
     APP(&ilist,
         INSTR_CREATE_lea(dcontext, opnd_create_reg(SCRATCH_REG2),
                          opnd_create_base_disp(SCRATCH_REG2, REG_NULL, 0,
@@ -1777,7 +1777,10 @@ instr_is_nop(instr_t *inst)
          (opnd_get_index(instr_get_src(inst, 0)) ==
           opnd_get_reg(instr_get_dst(inst, 0)) &&
           opnd_get_base(instr_get_src(inst, 0)) == REG_NULL &&
-          opnd_get_scale(instr_get_src(inst, 0)) == 1)))
+          opnd_get_scale(instr_get_src(inst, 0)) == 1))
+        /* for 64-bit, targeting a 32-bit register zeroes the top bits => not a nop! */
+        IF_X64(&& (instr_get_x86_mode(inst) ||
+                   reg_get_size(opnd_get_reg(instr_get_dst(inst, 0))) != OPSZ_4)))
         return true;
     return false;
 }
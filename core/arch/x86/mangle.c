@@ -1287,6 +1287,108 @@ insert_push_retaddr(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
     }
 }
 
+#if defined(UNIX) && defined(X64)
+/* -shadow_return_stack: flag-free ring updates using xax and xbx, spilled to
+ * their own TLS slots so state translation can restore them.
+ */
+static bool
+shadow_ret_stack_enabled(dcontext_t *dcontext, uint flags)
+{
+    return (DYNAMO_OPTION(shadow_return_stack) && X64_MODE_DC(dcontext) &&
+            !TEST(FRAG_SELFMOD_SANDBOXED, flags));
+}
+
+/* Advances (delta > 0) or retracts the ring top, wrapping within the aligned
+ * ring by copying only the low byte of the new value.  Expects the ring top in
+ * xax and clobbers xbx.
+ */
+static void
+insert_shadow_ret_move_top(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                           int delta)
+{
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XBX),
+                         OPND_CREATE_MEM_lea(REG_XAX, REG_NULL, 0, delta)));
+    PRE(ilist, where,
+        INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_AL),
+                            opnd_create_reg(REG_BL)));
+    PRE(ilist, where,
+        XINST_CREATE_store(dcontext, OPND_TLS_FIELD(TLS_SHADOW_RET_SLOT),
+                           opnd_create_reg(REG_XAX)));
+}
+
+/* Records (retaddr, landing) for a mangled call, where landing is a direct
+ * exit to retaddr that the return IBL jumps to when the matching return's
+ * target agrees.  We emit:
+ *      jmp   push
+ *   landing:
+ *      jmp   retaddr            # exit cti
+ *   push:
+ *      <spill xax, xbx>
+ *      mov   %fs:shadow_ret_top -> %xax
+ *      mov   $retaddr -> %xbx
+ *      mov   %xbx -> tag(%xax)
+ *      lea   landing(%rip) -> %xbx
+ *      mov   %xbx -> landing(%xax)
+ *      <advance the top>
+ *      <restore xbx, xax>
+ * The landing is materialized rip-relative so decode_fragment() can retarget it
+ * at the trace's own copy when this bb is added to a trace.
+ */
+static void
+insert_shadow_ret_push(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                       ptr_uint_t retaddr)
+{
+    instr_t *landing = XINST_CREATE_jump(dcontext, opnd_create_pc((app_pc)retaddr));
+    instr_t *push = SAVE_TO_TLS(dcontext, REG_XAX, TLS_XAX_SLOT);
+    PRE(ilist, where, INSTR_CREATE_jmp_short(dcontext, opnd_create_instr(push)));
+    instr_exit_branch_set_type(landing, LINK_DIRECT | LINK_JMP);
+    instrlist_preinsert(ilist, where, landing);
+    PRE(ilist, where, push);
+    PRE(ilist, where, SAVE_TO_TLS(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where,
+        XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                          OPND_TLS_FIELD(TLS_SHADOW_RET_SLOT)));
+    insert_mov_immed_ptrsz(dcontext, (ptr_int_t)retaddr, opnd_create_reg(REG_XBX),
+                           ilist, where, NULL, NULL);
+    PRE(ilist, where,
+        XINST_CREATE_store(dcontext,
+                           OPND_CREATE_MEMPTR(REG_XAX,
+                                              offsetof(shadow_ret_entry_t, tag)),
+                           opnd_create_reg(REG_XBX)));
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XBX),
+                         opnd_create_mem_instr(landing, 0, OPSZ_lea)));
+    PRE(ilist, where,
+        XINST_CREATE_store(dcontext,
+                           OPND_CREATE_MEMPTR(REG_XAX,
+                                              offsetof(shadow_ret_entry_t, landing)),
+                           opnd_create_reg(REG_XBX)));
+    insert_shadow_ret_move_top(dcontext, ilist, where, sizeof(shadow_ret_entry_t));
+    PRE(ilist, where, RESTORE_FROM_TLS(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where, RESTORE_FROM_TLS(dcontext, REG_XAX, TLS_XAX_SLOT));
+    STATS_INC(num_shadow_ret_pushes);
+}
+
+/* Pops the ring for a mangled return.  The return IBL then finds the popped
+ * entry just above the new top.
+ */
+static void
+insert_shadow_ret_pop(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where)
+{
+    PRE(ilist, where, SAVE_TO_TLS(dcontext, REG_XAX, TLS_XAX_SLOT));
+    PRE(ilist, where, SAVE_TO_TLS(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where,
+        XINST_CREATE_load(dcontext, opnd_create_reg(REG_XAX),
+                          OPND_TLS_FIELD(TLS_SHADOW_RET_SLOT)));
+    insert_shadow_ret_move_top(dcontext, ilist, where,
+                               -(int)sizeof(shadow_ret_entry_t));
+    PRE(ilist, where, RESTORE_FROM_TLS(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where, RESTORE_FROM_TLS(dcontext, REG_XAX, TLS_XAX_SLOT));
+    STATS_INC(num_shadow_ret_pops);
+}
+#endif /* UNIX && X64 */
+
 #ifdef CLIENT_INTERFACE
 /* N.B.: keep in synch with instr_check_xsp_mangling() */
 static void
@@ -1515,6 +1617,14 @@ mangle_direct_call(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
 
     /* convert a direct call to a push of the return address */
     insert_push_retaddr(dcontext, ilist, instr, retaddr, pushsz);
+#if defined(UNIX) && defined(X64)
+    /* For an elided call the landing is a new exit in the middle of the
+     * block, just like for one that ends it.
+     */
+    if (shadow_ret_stack_enabled(dcontext, flags) &&
+        instr_get_opcode(instr) == OP_call)
+        insert_shadow_ret_push(dcontext, ilist, instr, retaddr);
+#endif
 
     /* remove the call */
     instrlist_remove(ilist, instr);
@@ -1707,6 +1817,11 @@ mangle_indirect_call(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
          */
     }
     insert_push_retaddr(dcontext, ilist, next_instr, retaddr, pushsz);
+#if defined(UNIX) && defined(X64)
+    if (shadow_ret_stack_enabled(dcontext, flags) &&
+        instr_get_opcode(instr) == OP_call_ind)
+        insert_shadow_ret_push(dcontext, ilist, next_instr, retaddr);
+#endif
 
     /* save away xcx so that we can use it */
     /* (it's restored in x86.s (indirect_branch_lookup) */
@@ -1877,6 +1992,10 @@ mangle_return(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
                  opnd_create_reg(REG_ECX), opnd_create_reg(REG_CX)));
         }
     }
+#if defined(UNIX) && defined(X64)
+    if (shadow_ret_stack_enabled(dcontext, flags) && instr_get_opcode(instr) == OP_ret)
+        insert_shadow_ret_pop(dcontext, ilist, instr);
+#endif
 
 #ifdef CLIENT_INTERFACE
     if (TEST(INSTR_CLOBBER_RETADDR, instr->flags)) {
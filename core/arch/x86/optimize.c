@@ -40,16 +40,337 @@
  * (old offline optimization stuff is in mangle.c)
  */
 
-#include "../globals.h"   /* just to disable warning C4206 about an empty file */
-
-#ifdef INTERNAL /* around whole file */
-
 #include "../globals.h"
 #include "arch.h"
 #include "instr.h"
 #include "instr_create.h"
 #include "instrlist.h"
 #include "decode.h"
+
+/****************************************************************************/
+/* Release-mode hot trace optimizations (-opt_traces)
+ *
+ * Unlike the experimental passes further below, these are supported in all
+ * builds and for both 32-bit and 64-bit code.  Each only removes or fuses
+ * adjacent app instructions such that at every remaining instruction the app
+ * state is identical to native execution, so a fault or a thread relocation
+ * at any point translates correctly.  Since they are applied only to traces
+ * hot enough to be built, or with -opt_trace_threshold to traces that have
+ * run that many times, and rely on state that is not available at
+ * recreation time, the caller stores translation info for a trace that
+ * we change rather than re-applying these passes in recreate_fragment_ilist().
+ */
+
+/* Returns whether any cti in trace targets inst directly. */
+static bool
+opt_is_local_target(instrlist_t *trace, instr_t *inst)
+{
+    instr_t *in;
+    for (in = instrlist_first(trace); in != NULL; in = instr_get_next(in)) {
+        if (instr_is_cti(in) && opnd_is_instr(instr_get_target(in)) &&
+            opnd_get_instr(instr_get_target(in)) == inst)
+            return true;
+    }
+    return false;
+}
+
+/* Returns whether inst is an app "lea xsp, [xsp + disp]", setting *adjust. */
+static bool
+opt_is_lea_xsp_adjust(instr_t *inst, int *adjust)
+{
+    opnd_t src;
+    if (instr_get_opcode(inst) != OP_lea ||
+        !opnd_is_reg(instr_get_dst(inst, 0)) ||
+        opnd_get_reg(instr_get_dst(inst, 0)) != REG_XSP)
+        return false;
+    src = instr_get_src(inst, 0);
+    if (!opnd_is_base_disp(src) || opnd_get_base(src) != REG_XSP ||
+        opnd_get_index(src) != REG_NULL || opnd_get_segment(src) != REG_NULL)
+        return false;
+    *adjust = opnd_get_disp(src);
+    return true;
+}
+
+/* Returns whether inst is an app "add/sub xsp, imm", setting *adjust. */
+static bool
+opt_is_arith_xsp_adjust(instr_t *inst, int *adjust)
+{
+    int opcode = instr_get_opcode(inst);
+    if ((opcode != OP_add && opcode != OP_sub) ||
+        !opnd_is_reg(instr_get_dst(inst, 0)) ||
+        opnd_get_reg(instr_get_dst(inst, 0)) != REG_XSP ||
+        !opnd_is_immed_int(instr_get_src(inst, 0)))
+        return false;
+    *adjust = (int) opnd_get_immed_int(instr_get_src(inst, 0));
+    if (opcode == OP_sub)
+        *adjust = -*adjust;
+    return true;
+}
+
+/* Returns whether inst overwrites all 6 arithmetic flags without reading any
+ * and cannot fault, so the flags produced just before it are unobservable.
+ */
+static bool
+opt_kills_arith_flags(instr_t *inst)
+{
+    int opcode = instr_get_opcode(inst);
+    uint eflags = instr_get_eflags(inst, DR_QUERY_DEFAULT);
+    return (opcode == OP_cmp || opcode == OP_test || opcode == OP_add ||
+            opcode == OP_sub || opcode == OP_and || opcode == OP_or ||
+            opcode == OP_xor) &&
+        instr_is_app(inst) &&
+        !instr_reads_memory(inst) && !instr_writes_memory(inst) &&
+        TESTALL(EFLAGS_WRITE_6, eflags) && !TESTANY(EFLAGS_READ_6, eflags);
+}
+
+/* Removes app nops, which are typically alignment padding that a trace
+ * places on its hot path (e.g., at the top of an inlined loop body).
+ */
+static bool
+opt_trace_remove_nops(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next;
+    bool changed = false;
+    for (inst = instrlist_first_expanded(dcontext, trace); inst != NULL; inst = next) {
+        next = instr_get_next_expanded(dcontext, trace, inst);
+        if (instr_is_app(inst) && instr_is_nop(inst) &&
+            !opt_is_local_target(trace, inst)) {
+            LOG(THREAD, LOG_OPTS, 3, "opt_traces: removing nop @"PFX" in trace "PFX"\n",
+                instr_get_translation(inst), tag);
+            instrlist_remove(trace, inst);
+            instr_destroy(dcontext, inst);
+            STATS_INC(num_trace_opt_nops_removed);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* Folds an adjacent pair of stack pointer adjustments into one.  A pair of
+ * lea adjustments is always foldable.  An add/sub pair is folded only when the
+ * very next instruction overwrites the arithmetic flags without faulting, as
+ * the fused instruction's flags can differ from the second adjustment's.
+ */
+static bool
+opt_trace_fold_stack_adjust(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next;
+    bool changed = false;
+    for (inst = instrlist_first_expanded(dcontext, trace); inst != NULL; inst = next) {
+        int adj1, adj2;
+        bool is_lea;
+        ptr_int_t total;
+        next = instr_get_next_expanded(dcontext, trace, inst);
+        if (next == NULL || !instr_is_app(inst) || !instr_is_app(next))
+            continue;
+        if (opt_is_lea_xsp_adjust(inst, &adj1) && opt_is_lea_xsp_adjust(next, &adj2))
+            is_lea = true;
+        else if (opt_is_arith_xsp_adjust(inst, &adj1) &&
+                 opt_is_arith_xsp_adjust(next, &adj2)) {
+            instr_t *killer = instr_get_next_expanded(dcontext, trace, next);
+            if (killer == NULL || !opt_kills_arith_flags(killer))
+                continue;
+            is_lea = false;
+        } else
+            continue;
+        total = (ptr_int_t) adj1 + adj2;
+        /* Both may be destroyed or replaced below, so neither can be the
+         * target of a cti in the trace.
+         */
+        if (total > INT_MAX || total < INT_MIN + 1)
+            continue;
+        if (opt_is_local_target(trace, inst) || opt_is_local_target(trace, next)) {
+            STATS_INC(num_trace_opt_local_targets_skipped);
+            continue;
+        }
+        LOG(THREAD, LOG_OPTS, 3,
+            "opt_traces: folding stack adjustments %d and %d @"PFX" in trace "PFX"\n",
+            adj1, adj2, instr_get_translation(inst), tag);
+        instrlist_remove(trace, next);
+        instr_destroy(dcontext, next);
+        if (is_lea) {
+            instr_set_src(inst, 0, opnd_create_base_disp(REG_XSP, REG_NULL, 0,
+                                                         (int) total, OPSZ_lea));
+        } else if (total == 0) {
+            /* The flags are dead, so the pair is a no-op. */
+            next = instr_get_next_expanded(dcontext, trace, inst);
+            instrlist_remove(trace, inst);
+            instr_destroy(dcontext, inst);
+        } else {
+            int imm = (int) (total < 0 ? -total : total);
+            instr_t *fused = (total < 0) ?
+                INSTR_CREATE_sub(dcontext, opnd_create_reg(REG_XSP),
+                                 (imm <= 127 ? OPND_CREATE_INT8(imm) :
+                                  OPND_CREATE_INT32(imm))) :
+                INSTR_CREATE_add(dcontext, opnd_create_reg(REG_XSP),
+                                 (imm <= 127 ? OPND_CREATE_INT8(imm) :
+                                  OPND_CREATE_INT32(imm)));
+            instr_set_translation(fused, instr_get_translation(inst));
+            instrlist_replace(trace, inst, fused);
+            instr_destroy(dcontext, inst);
+            inst = fused;
+        }
+        if (is_lea || total != 0)
+            next = inst; /* the result may fold with the instr after it */
+        STATS_INC(num_trace_opt_stack_adjusts_folded);
+        changed = true;
+    }
+    return changed;
+}
+
+/* How far back opt_trace_remove_redundant_loads() looks for a prior access. */
+#define OPT_LOAD_WINDOW 16
+
+/* Returns whether inst is an app "mov reg, [xsp/xbp + disp]" or
+ * "mov [xsp/xbp + disp], reg" of a full 32-bit or pointer-sized register,
+ * setting *reg and *mem.
+ */
+static bool
+opt_is_stack_slot_mov(instr_t *inst, int opcode, reg_id_t *reg, opnd_t *mem)
+{
+    opnd_t r;
+    opnd_size_t size;
+    if (instr_get_opcode(inst) != opcode || !instr_is_app(inst) ||
+        instr_is_our_mangling(inst))
+        return false;
+    if (opcode == OP_mov_ld) {
+        r = instr_get_dst(inst, 0);
+        *mem = instr_get_src(inst, 0);
+    } else {
+        r = instr_get_src(inst, 0);
+        *mem = instr_get_dst(inst, 0);
+    }
+    if (!opnd_is_reg(r) || !opnd_is_near_base_disp(*mem) ||
+        (opnd_get_base(*mem) != REG_XSP && opnd_get_base(*mem) != REG_XBP) ||
+        opnd_get_index(*mem) != REG_NULL || opnd_get_segment(*mem) != REG_NULL)
+        return false;
+    *reg = opnd_get_reg(r);
+    size = reg_get_size(*reg);
+    return ((size == OPSZ_4 || size == OPSZ_PTR) && size == opnd_get_size(*mem));
+}
+
+/* Returns whether the memory written by dst cannot overlap slot, which is
+ * addressed off a base register that has not changed in between.
+ */
+static bool
+opt_write_misses_slot(opnd_t dst, opnd_t slot)
+{
+    int d1, d2;
+    uint size;
+    if (!opnd_is_memory_reference(dst))
+        return true;
+    if (!opnd_is_near_base_disp(dst) || opnd_get_base(dst) != opnd_get_base(slot) ||
+        opnd_get_index(dst) != REG_NULL || opnd_get_segment(dst) != REG_NULL)
+        return false;
+    size = opnd_size_in_bytes(opnd_get_size(dst));
+    if (size == 0) /* variable-sized */
+        return false;
+    d1 = opnd_get_disp(dst);
+    d2 = opnd_get_disp(slot);
+    return (d1 + (int) size <= d2 ||
+            d2 + (int) opnd_size_in_bytes(opnd_get_size(slot)) <= d1);
+}
+
+/* Replaces a load from a stack slot with a copy of the register that was
+ * stored to, or loaded from, that slot shortly before, as in a spill and
+ * reload around a trace-inlined call.  Only a straight run of plain app
+ * instructions that are not cti targets may separate the two, and none of
+ * them may write the slot's base register, the value register, or memory
+ * that could overlap the slot, nor be a fence or system call.  The copy
+ * leaves every register and memory location as the load would, and as it
+ * cannot fault, a fault or thread relocation translates as before.  We
+ * assume, as the app's own compiler does, that no other thread writes a
+ * thread's stack slots between two nearby accesses without synchronizing.
+ */
+static bool
+opt_trace_remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next;
+    bool changed = false;
+    for (inst = instrlist_first_expanded(dcontext, trace); inst != NULL; inst = next) {
+        instr_t *prev, *in;
+        reg_id_t dst, value = REG_NULL, reg;
+        opnd_t slot, mem;
+        int dist;
+        next = instr_get_next_expanded(dcontext, trace, inst);
+        if (!opt_is_stack_slot_mov(inst, OP_mov_ld, &dst, &slot) ||
+            opt_is_local_target(trace, inst))
+            continue;
+        for (prev = instr_get_prev(inst), dist = 0;
+             prev != NULL && dist < OPT_LOAD_WINDOW; prev = instr_get_prev(prev), dist++) {
+            int i;
+            if ((opt_is_stack_slot_mov(prev, OP_mov_st, &reg, &mem) ||
+                 opt_is_stack_slot_mov(prev, OP_mov_ld, &reg, &mem)) &&
+                opnd_same_address(mem, slot) &&
+                reg_get_size(reg) == reg_get_size(dst) && reg != opnd_get_base(slot)) {
+                value = reg;
+                break;
+            }
+            if (!instr_is_app(prev) || instr_is_our_mangling(prev) ||
+                instr_is_cti(prev) || instr_is_syscall(prev) ||
+                instr_is_interrupt(prev) || instr_get_opcode(prev) == OP_mfence ||
+                instr_get_prefix_flag(prev, PREFIX_LOCK) ||
+                instr_writes_to_reg(prev, opnd_get_base(slot), DR_QUERY_INCLUDE_ALL) ||
+                opt_is_local_target(trace, prev))
+                break;
+            for (i = 0; i < instr_num_dsts(prev); i++) {
+                if (!opt_write_misses_slot(instr_get_dst(prev, i), slot))
+                    break;
+            }
+            if (i < instr_num_dsts(prev))
+                break;
+        }
+        if (value == REG_NULL)
+            continue;
+        /* the value register must still hold what the slot does */
+        for (in = instr_get_next(prev); in != inst; in = instr_get_next(in)) {
+            if (instr_writes_to_reg(in, value, DR_QUERY_INCLUDE_ALL))
+                break;
+        }
+        if (in != inst)
+            continue;
+        LOG(THREAD, LOG_OPTS, 3,
+            "opt_traces: removing redundant load @"PFX" in trace "PFX"\n",
+            instr_get_translation(inst), tag);
+        if (value == dst && reg_get_size(dst) == OPSZ_PTR) {
+            instrlist_remove(trace, inst);
+            instr_destroy(dcontext, inst);
+        } else {
+            /* for 64-bit, a 32-bit copy still zeroes the top bits like the load */
+            instr_t *copy = INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(dst),
+                                                opnd_create_reg(value));
+            instr_set_translation(copy, instr_get_translation(inst));
+            instrlist_replace(trace, inst, copy);
+            instr_destroy(dcontext, inst);
+        }
+        STATS_INC(num_trace_opt_loads_removed);
+        changed = true;
+    }
+    return changed;
+}
+
+/* Applies the release-mode optimizations enabled by -opt_trace_* to the
+ * fully mangled trace.  Returns whether trace was changed, in which case the
+ * caller must store translation info for it.
+ */
+bool
+optimize_hot_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    bool changed = false;
+    ASSERT(DYNAMO_OPTION(opt_traces));
+    if (DYNAMO_OPTION(opt_trace_nops))
+        changed = opt_trace_remove_nops(dcontext, tag, trace) || changed;
+    if (DYNAMO_OPTION(opt_trace_stack_adjust))
+        changed = opt_trace_fold_stack_adjust(dcontext, tag, trace) || changed;
+    if (DYNAMO_OPTION(opt_trace_redundant_loads))
+        changed = opt_trace_remove_redundant_loads(dcontext, tag, trace) || changed;
+    if (changed)
+        STATS_INC(num_traces_optimized);
+    return changed;
+}
+
+#ifdef INTERNAL /* around legacy optimizations */
+
 #include "decode_fast.h"
 /* XXX i#1551: eliminate PREFIX_{DATA,ADDR} refs and then remove this include */
 #include "x86/decode_private.h"
@@ -4693,4 +5014,4 @@ is_nop(instr_t *inst)
     return false;
 }
 
-#endif /* INTERNAL around whole file */
+#endif /* INTERNAL around legacy optimizations */
@@ -191,6 +191,7 @@ dispatch(dcontext_t *dcontext)
             continue;
 #endif
         do {
+            bool bb_lock_held = false;
             if (targetf != NULL) {
                 KSTART(monitor_enter);
                 /* invoke monitor to continue or start a trace
@@ -202,7 +203,14 @@ dispatch(dcontext_t *dcontext)
             if (targetf != NULL)
                 break;
             /* must call outside of USE_BB_BUILDING_LOCK guard for bb_lock_would_have: */
-            SHARED_BB_LOCK();
+            /* With PARALLEL_BB_BUILD(), build_basic_block_fragment() acquires
+             * the lock itself once the bb is ready to emit, re-checks for a
+             * racing build of the same tag, and returns with the lock held.
+             */
+            if (!PARALLEL_BB_BUILD()) {
+                SHARED_BB_LOCK();
+                bb_lock_held = true;
+            }
             if (USE_BB_BUILDING_LOCK() || targetf == NULL) {
                 /* must re-lookup while holding lock and keep the lock until we've
                  * built the bb and added it to the lookup table
@@ -219,6 +227,11 @@ dispatch(dcontext_t *dcontext)
                                                _IF_CLIENT(false/*!for_trace*/)
                                                _IF_CLIENT(NULL));
                 SELF_PROTECT_LOCAL(dcontext, READONLY);
+                /* A parallel build holds the lock iff it produced a fragment: it
+                 * returns NULL only when going native, prior to locking.
+                 */
+                if (targetf != NULL)
+                    bb_lock_held = true;
             }
             if (targetf != NULL && TEST(FRAG_COARSE_GRAIN, targetf->flags)) {
                 /* targetf is a static temp fragment protected by bb_building_lock,
@@ -232,7 +245,8 @@ dispatch(dcontext_t *dcontext)
                                         FCACHE_ENTRY_PC(targetf));
                 targetf = &coarse_f;
             }
-            SHARED_BB_UNLOCK();
+            if (bb_lock_held)
+                SHARED_BB_UNLOCK();
             if (targetf == NULL)
                 break;
             /* loop around and re-do monitor check */
@@ -557,6 +571,10 @@ enter_fcache(dcontext_t *dcontext, fcache_enter_func_t entry, cache_pc pc)
     LOG(THREAD, LOG_DISPATCH, 4, "fcache_enter = "PFX", target = "PFX"\n", entry, pc);
     set_fcache_target(dcontext, pc);
     ASSERT(pc != NULL);
+#if defined(X86) && defined(X64)
+    if (DYNAMO_OPTION(shadow_return_stack))
+        fragment_shadow_ret_stack_check(dcontext);
+#endif
 
 #ifdef PROFILE_RDTSC
     if (dynamo_options.profile_times) {
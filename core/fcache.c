@@ -4262,7 +4262,7 @@ fcache_reset_all_caches_proactively(uint target)
         fragment_reset_free();
         link_reset_free();
         fcache_reset_free();
-        /* monitor only has thread-private data */
+        monitor_reset_free();
         /* arch and os data is all persistent */
         vm_areas_reset_free();
 # ifdef HOT_PATCHING_INTERFACE
@@ -767,6 +767,8 @@ hashtable_ibl_myinit(dcontext_t *dcontext, ibl_table_t *table, uint bits,
     flags |= FRAG_TABLE_INCLUSIVE_HIERARCHY;
     flags |= FRAG_TABLE_IBL_TARGETED;
     flags |= HASHTABLE_ALIGN_TABLE;
+    if (DYNAMO_OPTION(ibl_table_buckets))
+        flags |= HASHTABLE_ALIGN_BUCKETS;
     /* use entry stats with all our ibl-targeted tables */
     flags |= HASHTABLE_USE_ENTRY_STATS;
 #ifdef HASHTABLE_STATISTICS
@@ -1858,6 +1860,10 @@ fragment_thread_reset_init(dcontext_t *dcontext)
      * so we have to explicitly set to 0 for that case.
      */
     pt->flushtime_last_update = (dynamo_resetting) ? 0 : flushtime_global;
+#if defined(X86) && defined(X64)
+    /* -shadow_return_stack: a reset frees every fragment */
+    pt->shadow_ret_stale = true;
+#endif
 
     /* set initial hashtable sizes */
     hashtable_fragment_init(dcontext, &pt->bb, INIT_HTABLE_SIZE_BB,
@@ -2060,8 +2066,59 @@ fragment_thread_init(dcontext_t *dcontext)
     pt->finished_all_unlink = create_event();
     pt->soon_to_be_linking = false;
     pt->at_syscall_at_flush = false;
+#if defined(X86) && defined(X64)
+    if (DYNAMO_OPTION(shadow_return_stack)) {
+        /* the ring is set up on the first cache entry */
+        pt->shadow_ret_stack = (byte *)
+            global_heap_alloc(SHADOW_RET_STACK_ALLOC_SIZE HEAPACCT(ACCT_OTHER));
+        memset(pt->shadow_ret_stack, 0, SHADOW_RET_STACK_ALLOC_SIZE);
+        pt->shadow_ret_stale = true;
+    } else
+        pt->shadow_ret_stack = NULL;
+#endif
+}
+
+#if defined(X86) && defined(X64)
+static byte *
+shadow_ret_stack_ring(per_thread_t *pt)
+{
+    /* the cache wraps the top by rewriting its low byte */
+    ASSERT(SHADOW_RET_STACK_SIZE == 256);
+    return (byte *) ALIGN_FORWARD(pt->shadow_ret_stack, SHADOW_RET_STACK_SIZE);
 }
 
+void
+fragment_shadow_ret_stack_invalidate(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    if (pt != NULL && pt->shadow_ret_stack != NULL)
+        pt->shadow_ret_stale = true;
+}
+
+void
+fragment_shadow_ret_stack_check(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    byte *ring;
+    ASSERT(pt != NULL && pt->shadow_ret_stack != NULL);
+    /* A shared fragment holding a landing is only freed once this thread has
+     * signed off on its deletion, which updates our flushtime, and private
+     * deletions set the stale flag.  Otherwise all landing pcs in the ring
+     * are still good.
+     */
+    if (!pt->shadow_ret_stale &&
+        pt->shadow_ret_flushtime == pt->flushtime_last_update)
+        return;
+    ring = shadow_ret_stack_ring(pt);
+    /* a NULL landing never matches in the return IBL */
+    memset(ring, 0, SHADOW_RET_STACK_SIZE);
+    dcontext->local_state->spill_space.shadow_ret_top = ring;
+    pt->shadow_ret_stale = false;
+    pt->shadow_ret_flushtime = pt->flushtime_last_update;
+    STATS_INC(num_shadow_ret_clears);
+}
+#endif
+
 static bool
 check_flush_queue(dcontext_t *dcontext, fragment_t *was_I_flushed);
 
@@ -2227,6 +2284,18 @@ fragment_thread_exit(dcontext_t *dcontext)
 #if defined(CLIENT_INTERFACE) && defined(CLIENT_SIDELINE)
     DELETE_LOCK(pt->fragment_delete_mutex);
 #endif
+#if defined(X86) && defined(X64)
+    if (pt->shadow_ret_stack != NULL) {
+        DODEBUG({
+            shadow_ret_stats_t *counts = (shadow_ret_stats_t *)
+                (shadow_ret_stack_ring(pt) + SHADOW_RET_STACK_SIZE);
+            STATS_ADD(num_shadow_ret_hits, counts->hits);
+            STATS_ADD(num_shadow_ret_misses, counts->misses);
+        });
+        global_heap_free(pt->shadow_ret_stack, SHADOW_RET_STACK_ALLOC_SIZE
+                         HEAPACCT(ACCT_OTHER));
+    }
+#endif
 
     global_heap_free(pt, sizeof(per_thread_t) HEAPACCT(ACCT_OTHER));
     dcontext->fragment_field = NULL;
@@ -3036,6 +3105,11 @@ fragment_delete(dcontext_t *dcontext, fragment_t *f, uint actions)
     });
     ASSERT((f->flags & FRAG_CANNOT_DELETE) == 0);
     ASSERT((f->flags & FRAG_IS_FUTURE) == 0);
+#if defined(X86) && defined(X64)
+    /* -shadow_return_stack: the owner's ring may hold landings inside f */
+    if (!TEST(FRAG_SHARED, f->flags) && dcontext != GLOBAL_DCONTEXT)
+        fragment_shadow_ret_stack_invalidate(dcontext);
+#endif
 
     /* ensure the actual free of a shared fragment is done only
      * after a multi-stage flush or a reset
@@ -3280,6 +3354,58 @@ fragment_remove_shared_no_flush(dcontext_t *dcontext, fragment_t *f)
     add_to_lazy_deletion_list(dcontext, f);
 }
 
+/* Swaps new_f, an invisible fragment emitted for f's tag, in for the shared
+ * fragment f in the lookup tables and in f's links, in a safe manner that
+ * does not require a full flush synch: a thread still inside f simply runs
+ * it to an (unlinked) exit.  If f was deleted in the meantime, new_f is
+ * instead added and linked as a new fragment.
+ * If f is a trace the caller must hold the trace_building_lock, which also
+ * prevents another trace from appearing for this tag.
+ * Returns true if f was replaced, in which case the caller must pass f to
+ * add_to_lazy_deletion_list() once it holds no locks.
+ */
+bool
+fragment_replace_shared_no_flush(dcontext_t *dcontext, fragment_t *f, fragment_t *new_f)
+{
+    bool replaced = false;
+    ASSERT(TEST(FRAG_SHARED, f->flags) && TEST(FRAG_SHARED, new_f->flags));
+    ASSERT(f->tag == new_f->tag);
+    ASSERT_NOT_IMPLEMENTED(!TEST(FRAG_COARSE_GRAIN, f->flags));
+    ASSERT(!TEST(FRAG_IS_TRACE, f->flags) || OWN_MUTEX(&trace_building_lock));
+    /* other threads' private ibl tables would keep targeting f */
+    ASSERT_NOT_IMPLEMENTED(!IS_IBL_TARGET(f->flags) ||
+                           (TEST(FRAG_IS_TRACE, f->flags) ?
+                            DYNAMO_OPTION(shared_trace_ibt_tables) :
+                            DYNAMO_OPTION(shared_bb_ibt_tables)));
+    LOG(THREAD, LOG_FRAGMENT, 3, "fragment_replace_shared_no_flush: F%d with F%d\n",
+        f->id, new_f->id);
+    /* grab bb building lock even for traces to further prevent link changes */
+    mutex_lock(&bb_building_lock);
+    acquire_recursive_lock(&change_linking_lock);
+    if (TEST(FRAG_WAS_DELETED, f->flags)) {
+        STATS_INC(shared_delete_noflush_race);
+        link_new_fragment(dcontext, new_f);
+        fragment_add(dcontext, new_f);
+    } else {
+        acquire_vm_areas_lock(dcontext, f->flags);
+        /* links new_f's exits before redirecting f's incoming links to it */
+        shift_links_to_new_fragment(dcontext, f, new_f);
+        fragment_replace(dcontext, f, new_f);
+        vm_area_remove_fragment(dcontext, f);
+        /* case 8419: see fragment_remove_shared_no_flush() */
+        f->flags |= FRAG_WAS_DELETED;
+        release_vm_areas_lock(dcontext, f->flags);
+        replaced = true;
+    }
+    release_recursive_lock(&change_linking_lock);
+    if (replaced && !TEST(FRAG_HAS_TRANSLATION_INFO, f->flags)) {
+        /* a flush will ignore f from now on */
+        fragment_record_translation_info(dcontext, f, NULL);
+    }
+    mutex_unlock(&bb_building_lock);
+    return replaced;
+}
+
 /* Prepares a fragment for delayed deletion by unlinking it.
  * Caller is responsible for calling vm_area_remove_fragment().
  * Caller must hold the change_linking_lock if f is shared.
@@ -3893,30 +4019,44 @@ fragment_replace(dcontext_t *dcontext, fragment_t *f, fragment_t *new_f)
 {
     per_thread_t *pt = GET_PT(dcontext);
     fragment_table_t *table = GET_FTABLE(pt, f->flags);
+    fragment_entry_t fe = FRAGENTRY_FROM_FRAGMENT(f);
+    fragment_entry_t new_fe = FRAGENTRY_FROM_FRAGMENT(new_f);
+    ibl_branch_type_t branch_type;
+    bool found;
     TABLE_RWLOCK(table, write, lock);
-    if (hashtable_fragment_replace(f, new_f, table)) {
-        fragment_entry_t fe = FRAGENTRY_FROM_FRAGMENT(f);
-        fragment_entry_t new_fe = FRAGENTRY_FROM_FRAGMENT(new_f);
+    found = hashtable_fragment_replace(f, new_f, table);
+    if (found) {
         LOG(THREAD, LOG_FRAGMENT, 4,
             "removed F%d from fcache lookup table (replaced with F%d) "PFX
             "->~"PFX","PFX"\n",
             f->id, new_f->id, f->tag, f->start_pc, new_f->start_pc);
         /* Need to replace all entries from the IBL tables that may have this entry */
         if (IS_IBL_TARGET(f->flags)) {
-            ibl_branch_type_t branch_type;
             for (branch_type = IBL_BRANCH_TYPE_START;
                  branch_type < IBL_BRANCH_TYPE_END; branch_type++) {
                 ibl_table_t *ibtable = GET_IBT_TABLE(pt, f->flags, branch_type);
-                /* currently we don't have shared ib target tables,
-                 * otherwise a write lock would come in the picture here
-                 */
-                ASSERT(!TEST(FRAG_TABLE_SHARED, ibtable->table_flags));
-                hashtable_ibl_replace(fe, new_fe, ibtable);
+                if (!TEST(FRAG_TABLE_SHARED, ibtable->table_flags))
+                    hashtable_ibl_replace(fe, new_fe, ibtable);
             }
         }
     } else
         ASSERT_NOT_REACHED();
     TABLE_RWLOCK(table, write, unlock);
+    /* Shared ib target tables have their own lock, which we cannot nest inside
+     * the lookup table's.  Lookups racing with us find either f or new_f, and
+     * f stays valid until it is lazily deleted.
+     */
+    if (found && IS_IBL_TARGET(f->flags)) {
+        for (branch_type = IBL_BRANCH_TYPE_START;
+             branch_type < IBL_BRANCH_TYPE_END; branch_type++) {
+            ibl_table_t *ibtable = GET_IBT_TABLE(pt, f->flags, branch_type);
+            if (TEST(FRAG_TABLE_SHARED, ibtable->table_flags)) {
+                TABLE_RWLOCK(ibtable, write, lock);
+                hashtable_ibl_replace(fe, new_fe, ibtable);
+                TABLE_RWLOCK(ibtable, write, unlock);
+            }
+        }
+    }
 
     /* tell monitor f has disappeared, but do not delete from incoming table
      * or from fcache, also do not dump to trace file
@@ -6128,6 +6268,12 @@ flush_fragments_synchall_start(dcontext_t *ignored, app_pc base, size_t size,
             }
             if (dcontext == my_dcontext || thread_synch_successful(flush_threads[i])) {
                 last_exit_deleted(dcontext);
+#if defined(X86) && defined(X64)
+                /* shared fragments are freed below without waiting for this
+                 * thread to sign off
+                 */
+                fragment_shadow_ret_stack_invalidate(dcontext);
+#endif
                 /* case 7394: need to abort other threads' trace building
                  * since the reset xfer to dispatch will disrupt it.
                  * also, with PR 299808, we now have thread-shared
@@ -6137,7 +6283,7 @@ flush_fragments_synchall_start(dcontext_t *ignored, app_pc base, size_t size,
                 if (is_building_trace(dcontext)) {
                     LOG(THREAD, LOG_FRAGMENT, 2,
                         "\tsquashing trace of thread #%d\n", i);
-                    trace_abort(dcontext);
+                    trace_abort_no_backoff(dcontext);
                 }
             }
             /* Since coarse fragments never cross coarse/non-coarse executable region
@@ -6251,7 +6397,7 @@ flush_fragments_thread_unlink(dcontext_t *dcontext, int thread_index,
                              flush_base+flush_size)) {
             LOG(THREAD, LOG_FRAGMENT, 2,
                 "\tsquashing trace of thread "TIDFMT"\n", tgt_dcontext->owning_thread);
-            trace_abort(tgt_dcontext);
+            trace_abort_no_backoff(tgt_dcontext);
         }
     }
 
@@ -6888,6 +7034,8 @@ flush_fragments_in_region_start(dcontext_t *dcontext, app_pc base, size_t size,
     if (free_futures) {
         flush_fragments_free_futures(base, size);
     }
+    /* the -ib_target_cache profiles of the flushed bbs are stale as well */
+    ib_target_site_range_remove(base, base + size);
 
     executable_areas_lock();
 }
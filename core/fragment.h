@@ -522,6 +522,14 @@ typedef struct _per_thread_t {
      * not used while not flushing.
      */
     bool           at_syscall_at_flush;
+#if defined(X86) && defined(X64)
+    /* -shadow_return_stack ring, over-allocated so it can be size-aligned */
+    byte          *shadow_ret_stack;
+    /* the ring must be cleared before the next cache entry */
+    bool           shadow_ret_stale;
+    /* flushtime_last_update when the ring was last cleared */
+    uint           shadow_ret_flushtime;
+#endif
 } per_thread_t;
 
 
@@ -614,6 +622,19 @@ fragment_thread_exit(dcontext_t *dcontext);
 bool
 fragment_thread_exited(dcontext_t *dcontext);
 
+#if defined(X86) && defined(X64)
+/* Called on every cache entry: empties the -shadow_return_stack ring if a
+ * fragment holding one of its landing pcs may have been freed since it was
+ * last emptied.
+ */
+void
+fragment_shadow_ret_stack_check(dcontext_t *dcontext);
+
+/* Makes the next fragment_shadow_ret_stack_check() empty the ring */
+void
+fragment_shadow_ret_stack_invalidate(dcontext_t *dcontext);
+#endif
+
 /* re-initializes non-persistent memory */
 void
 fragment_thread_reset_init(dcontext_t *dcontext);
@@ -678,6 +699,9 @@ fragment_record_translation_info(dcontext_t *dcontext, fragment_t *f, instrlist_
 void
 fragment_remove_shared_no_flush(dcontext_t *dcontext, fragment_t *f);
 
+bool
+fragment_replace_shared_no_flush(dcontext_t *dcontext, fragment_t *f, fragment_t *new_f);
+
 void
 fragment_unlink_for_deletion(dcontext_t *dcontext, fragment_t *f);
 
@@ -70,6 +70,11 @@
 #define HASHTABLE_READ_ONLY             0x00000040
 /* Align the main table to the cache line */
 #define HASHTABLE_ALIGN_TABLE           0x00000080
+/* Only hash to the first entry of each cache line, so that a probe scans the
+ * rest of its home line before touching the next one.  Requires
+ * HASHTABLE_ALIGN_TABLE.
+ */
+#define HASHTABLE_ALIGN_BUCKETS         0x00000100
 
 /* Specific tables can add their own flags starting with this value
  * FIXME: any better way? how know when hit limit with <<?
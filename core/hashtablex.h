@@ -346,6 +346,17 @@ HTNAME(hashtable_,NAME_KEY,_init_internal)
     table->hash_func = func;
     table->hash_mask_offset = hash_mask_offset;
     table->hash_mask = HASH_MASK(table->hash_bits) << hash_mask_offset;
+    if (TEST(HASHTABLE_ALIGN_BUCKETS, table->table_flags)) {
+        /* Clear the index bits selecting an entry within a cache line.  Lookups
+         * and removals all go through HASH_FUNC and linear probing, so they
+         * simply start at the head of the line; the table stays power-of-2 sized.
+         */
+        uint per_line = proc_get_cache_line_size() / sizeof(ENTRY_TYPE);
+        ASSERT(TEST(HASHTABLE_ALIGN_TABLE, table->table_flags));
+        if (per_line > 1 && HASHTABLE_SIZE(table->hash_bits) > per_line) {
+            table->hash_mask &= ~((ptr_uint_t)(per_line - 1) << hash_mask_offset);
+        }
+    }
     table->capacity = HASHTABLE_SIZE(table->hash_bits);
 
     /*
@@ -1736,6 +1747,11 @@ HTNAME(hashtable_,NAME_KEY,_study)(dcontext_t *dcontext,
     uint overwraps = 0;
     ENTRY_TYPE e;
     bool lockless_access = TEST(HASHTABLE_LOCKLESS_ACCESS, table->table_flags);
+    /* probe length distribution: 1, 2, 3-4, 5-8, 9+ entries */
+    uint len_hist[5] = {0,};
+    /* cache lines touched by successful probes, assuming an aligned table */
+    uint per_line = proc_get_cache_line_size() / sizeof(ENTRY_TYPE);
+    uint total_lines = 0;
 
     if (!INTERNAL_OPTION(hashtable_study))
         return;
@@ -1798,6 +1814,21 @@ HTNAME(hashtable_,NAME_KEY,_study)(dcontext_t *dcontext,
                 max = len;
             total_len += len;
             num++;
+            if (len <= 2)
+                len_hist[len - 1]++;
+            else if (len <= 4)
+                len_hist[2]++;
+            else if (len <= 8)
+                len_hist[3]++;
+            else
+                len_hist[4]++;
+            if (per_line == 0)
+                total_lines += len;
+            else if (i < hindex) {
+                total_lines += (table->capacity - 1) / per_line - hindex / per_line + 1;
+                total_lines += i / per_line + 1;
+            } else
+                total_lines += i / per_line - hindex / per_line + 1;
             if (len > 1) {
                 num_collisions++;
                 colliding_frags += len;
@@ -1813,6 +1844,15 @@ HTNAME(hashtable_,NAME_KEY,_study)(dcontext_t *dcontext,
             "%s %s hashtable statistics: num=%d, max=%d, #>1=%d, st.avg=%u.%.2u\n",
             entries_inc == 0 ? "Total" : "Current", name,
             num, max, num_collisions, st_top, st_bottom);
+        if (num != 0)
+            divide_uint64_print(total_lines, num, false, 2, &st_top, &st_bottom);
+        LOG(THREAD, LOG_HTABLE|LOG_STATS, 1,
+            "%s %s hashtable probe lengths: 1=%u 2=%u 3-4=%u 5-8=%u 9+=%u, "
+            "lines.avg=%u.%.2u%s\n",
+            entries_inc == 0 ? "Total" : "Current", name,
+            len_hist[0], len_hist[1], len_hist[2], len_hist[3], len_hist[4],
+            st_top, st_bottom,
+            TEST(HASHTABLE_ALIGN_BUCKETS, table->table_flags) ? " (buckets)" : "");
     });
 
     /* static average length is supposed to be under 5 even up
@@ -160,6 +160,11 @@
     STATS_DEF("Interpreted far indirect jmps", num_far_ind_jmps)
     STATS_DEF("Interpreted far rets", num_far_rets)
     STATS_DEF("Interpreted irets", num_irets)
+    STATS_DEF("Shadow return stack pushes mangled", num_shadow_ret_pushes)
+    STATS_DEF("Shadow return stack pops mangled", num_shadow_ret_pops)
+    STATS_DEF("Shadow return stack predictions hit", num_shadow_ret_hits)
+    STATS_DEF("Shadow return stack predictions missed", num_shadow_ret_misses)
+    STATS_DEF("Shadow return stack clears", num_shadow_ret_clears)
     STATS_DEF("Decoded jcc branch hints", num_branch_hints)
 
     STATS_DEF("Dynamic option synchronizations", option_synchronizations)
@@ -392,6 +397,17 @@
     STATS_DEF("32-bit trace fragments generated", num_32bit_traces)
     STATS_DEF("32-bit instructions translated to 64-bit", num_32bit_instrs_translated)
 #endif
+    STATS_DEF("Traces changed by -opt_traces", num_traces_optimized)
+    STATS_DEF("Trace opt: app nops removed", num_trace_opt_nops_removed)
+    STATS_DEF("Trace opt: stack adjustments folded", num_trace_opt_stack_adjusts_folded)
+    STATS_DEF("Trace opt: redundant stack loads removed", num_trace_opt_loads_removed)
+    STATS_DEF("Trace opt: folds skipped at local cti targets",
+              num_trace_opt_local_targets_skipped)
+    STATS_DEF("Trace opt: hot traces unlinked to be optimized", num_traces_opt_marked)
+    STATS_DEF("Trace opt sideline: traces queued", num_traces_sideline_queued)
+    STATS_DEF("Trace opt sideline: queue full, not optimized", num_traces_sideline_dropped)
+    STATS_DEF("Trace opt sideline: optimized traces swapped in", num_traces_sideline_swapped)
+    STATS_DEF("Trace opt sideline: stale, not swapped in", num_traces_sideline_stale)
     STATS_DEF("Trace fragments aborted for any reason", num_aborted_traces)
     STATS_DEF("Trace fragments aborted: shared race", num_aborted_traces_race)
     STATS_DEF("Trace fragments aborted: client bad mod", num_aborted_traces_client)
@@ -411,10 +427,28 @@
     STATS_DEF("Shared trace links shifted back to trace head", links_shared_trace_to_head)
     STATS_DEF("Shadowed trace head deleted", shadowed_trace_head_deleted)
     STATS_DEF("Trace head counters reset on trace deletion", th_counter_reset)
+    STATS_DEF("Trace reform: traces unlinked to be re-formed", num_traces_reform_marked)
+    STATS_DEF("Trace reform: traces re-formed", num_traces_reformed)
+    STATS_DEF("Trace reform: private traces deleted", num_fragments_deleted_trace_reform)
+    RSTATS_DEF("Adaptive threshold: raised after abort", th_adapt_abort_raises)
+    RSTATS_DEF("Adaptive threshold: aborts not held against the head",
+               th_adapt_aborts_excused)
+    RSTATS_DEF("Adaptive threshold: epochs raised", th_adapt_epoch_raises)
+    RSTATS_DEF("Adaptive threshold: epochs lowered", th_adapt_epoch_lowers)
+    RSTATS_DEF("Adaptive threshold: trace exits", th_adapt_trace_exits)
+    RSTATS_DEF("Adaptive threshold: IBL misses", th_adapt_ibl_misses)
+    RSTATS_DEF("IB target cache: sites inlined", ib_target_cache_sites)
+    RSTATS_DEF("IB target cache: targets inlined", ib_target_cache_targets)
+    RSTATS_DEF("IB target cache: hits", ib_target_cache_hits)
+    RSTATS_DEF("IB target cache: misses", ib_target_cache_misses)
+    RSTATS_DEF("IB target cache: hit rate (percent)", ib_target_cache_hit_percent)
+    RSTATS_DEF("IB target cache: sites pruned by flushes", ib_target_cache_sites_pruned)
     STATS_DEF("Trace heads re-marked", trace_head_remark)
     STATS_DEF("Future fragments generated", num_future_fragments)
     STATS_DEF("Shared fragments generated", num_shared_fragments)
     STATS_DEF("Shared bbs generated", num_shared_bbs)
+    STATS_DEF("Shared bbs built outside the bb building lock", num_bb_builds_parallel)
+    STATS_DEF("Shared bbs discarded: lost parallel build race", num_bb_build_races)
     STATS_DEF("Shared traces generated", num_shared_traces)
     STATS_DEF("Private fragments generated", num_private_fragments)
     STATS_DEF("Private bbs generated", num_private_bbs)
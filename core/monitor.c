@@ -45,7 +45,7 @@
 #include "emit.h"
 #include "fcache.h"
 #include "monitor.h"
-#ifdef CUSTOM_TRACES
+#if defined(CUSTOM_TRACES) || defined(CLIENT_SIDELINE)
 #  include "instrument.h"
 #endif
 #include <string.h> /* for memset */
@@ -97,14 +97,89 @@ extern bool mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_
          heap_free(dc, p, __VA_ARGS__))
 
 static void reset_trace_state(dcontext_t *dcontext, bool grab_link_lock);
+static void ib_target_site_free(dcontext_t *dcontext, void *p);
+static void ib_target_sites_free_retired(void);
+#ifdef CUSTOM_TRACES
+static void trace_reform_counter_free(dcontext_t *dcontext, void *p);
+#endif
 
 /* synchronization of shared traces */
 DECLARE_CXTSWPROT_VAR(mutex_t trace_building_lock, INIT_LOCK_FREE(trace_building_lock));
 
+#ifdef CLIENT_SIDELINE
+/* -opt_traces_sideline: end_and_emit_trace() emits shared traces unoptimized
+ * and queues a copy of each trace's final ilist here.  A DR-created client
+ * thread runs optimize_hot_trace() on the copy and swaps the result in for
+ * the original trace, keeping the passes off the application threads.
+ */
+typedef struct _trace_sideline_entry_t {
+    app_pc tag;
+    instrlist_t *ilist; /* allocated with GLOBAL_DCONTEXT */
+    uint flags;
+    uint num_bbs;
+    trace_bb_info_t *bbs;
+    uint flushtime; /* flushtime_global when queued */
+    struct _trace_sideline_entry_t *next;
+} trace_sideline_entry_t;
+
+/* bounds the memory held in copies the helper thread has not reached yet */
+#define TRACE_SIDELINE_MAX_QUEUED 64
+
+DECLARE_CXTSWPROT_VAR(static mutex_t trace_sideline_lock,
+                      INIT_LOCK_FREE(trace_sideline_lock));
+/* the queue is protected by trace_sideline_lock */
+DECLARE_CXTSWPROT_VAR(static trace_sideline_entry_t *trace_sideline_head, NULL);
+DECLARE_CXTSWPROT_VAR(static trace_sideline_entry_t *trace_sideline_tail, NULL);
+DECLARE_CXTSWPROT_VAR(static uint trace_sideline_count, 0);
+/* 0 = helper thread not yet created, 1 = created, -1 = creation failed */
+DECLARE_CXTSWPROT_VAR(static int trace_sideline_thread_state, 0);
+static event_t trace_sideline_event;
+
+static void trace_sideline_drain(void);
+#endif
+
+/* -ib_target_cache: ib_target_site_t records keyed by bb tag */
+static generic_table_t *ib_target_sites;
+#define INIT_HTABLE_SIZE_IB_TARGET_SITES 8 /* 256 buckets */
+
+#ifdef CUSTOM_TRACES
+/* -trace_reform: the side exit counter of each trace, keyed by trace tag.  The
+ * counters are written by the cache, so they are never freed before exit: a
+ * re-formed or recreated trace finds the same counter as the one it replaces.
+ */
+static generic_table_t *trace_reform_counts;
+#define INIT_HTABLE_SIZE_TRACE_REFORM_COUNTS 8 /* 256 buckets */
+
+/* -opt_trace_threshold: traces are emitted unoptimized, counting their
+ * executions in this table, and re-formed and optimized once hot
+ */
+#define OPT_TRACES_DEFERRED() \
+    (DYNAMO_OPTION(opt_traces) && DYNAMO_OPTION(opt_trace_threshold) > 0)
+/* the execution counter of each trace, keyed by trace tag, kept like
+ * trace_reform_counts
+ */
+static generic_table_t *trace_entry_counts;
+#endif
+
 /* For clearing counters on trace deletion we follow a lazy strategy
  * using a sentinel value to determine whether we've built a trace or not
  */
-#define TH_COUNTER_CREATED_TRACE_VALUE() (INTERNAL_OPTION(trace_threshold) + 1U)
+#define TH_COUNTER_CREATED_TRACE_VALUE(ctr) ((ctr)->threshold + 1U)
+
+/* -adaptive_trace_threshold: a thread re-evaluates the threshold it hands to
+ * new trace heads each time it has emitted this many traces.
+ */
+#define TH_ADAPT_EPOCH_TRACES 32
+/* Raise the threshold when at least 1 in TH_ADAPT_ABORT_RATIO traces aborted
+ * or when traces averaged at least TH_ADAPT_EXITS_PER_TRACE direct exits back
+ * to dispatch: both mean heads became hot before their paths settled.
+ */
+#define TH_ADAPT_ABORT_RATIO 4
+#define TH_ADAPT_EXITS_PER_TRACE 8
+/* Lower it when traces are stable but indirect branch lookups keep missing,
+ * i.e., hot code is still running as bbs: we are selecting traces too late.
+ */
+#define TH_ADAPT_IBL_MISSES_PER_TRACE 16
 
 static void
 delete_private_copy(dcontext_t *dcontext)
@@ -304,6 +379,45 @@ monitor_init()
      * this does not include exit stubs
      */
     ASSERT(MAX_TRACE_BUFFER_SIZE <= MAX_FRAGMENT_SIZE);
+#ifdef CLIENT_SIDELINE
+    if (DYNAMO_OPTION(opt_traces_sideline))
+        trace_sideline_event = create_event();
+#endif
+    if (DYNAMO_OPTION(ib_target_cache) > 0) {
+        ib_target_sites =
+            generic_hash_create(GLOBAL_DCONTEXT, INIT_HTABLE_SIZE_IB_TARGET_SITES,
+                                80 /* load factor: not perf-critical */,
+                                HASHTABLE_SHARED | HASHTABLE_PERSISTENT,
+                                ib_target_site_free _IF_DEBUG("ib target sites"));
+    }
+#ifdef CUSTOM_TRACES
+    if (DYNAMO_OPTION(trace_reform)) {
+        trace_reform_counts =
+            generic_hash_create(GLOBAL_DCONTEXT, INIT_HTABLE_SIZE_TRACE_REFORM_COUNTS,
+                                80 /* load factor: not perf-critical */,
+                                HASHTABLE_SHARED | HASHTABLE_PERSISTENT,
+                                trace_reform_counter_free
+                                _IF_DEBUG("trace reform counts"));
+    }
+    if (OPT_TRACES_DEFERRED()) {
+        trace_entry_counts =
+            generic_hash_create(GLOBAL_DCONTEXT, INIT_HTABLE_SIZE_TRACE_REFORM_COUNTS,
+                                80 /* load factor: not perf-critical */,
+                                HASHTABLE_SHARED | HASHTABLE_PERSISTENT,
+                                trace_reform_counter_free
+                                _IF_DEBUG("trace entry counts"));
+    }
+#endif
+}
+
+/* frees all non-persistent global memory */
+void
+monitor_reset_free(void)
+{
+#ifdef CLIENT_SIDELINE
+    /* every queued trace is about to be thrown out */
+    trace_sideline_drain();
+#endif
 }
 
 /* re-initializes non-persistent memory */
@@ -323,7 +437,7 @@ void
 trace_abort_and_delete(dcontext_t *dcontext)
 {
     /* remove any MultiEntries */
-    trace_abort(dcontext);
+    trace_abort_no_backoff(dcontext);
     /* case 8083: we have to explicitly remove last copy since it can't be
      * removed in trace_abort (at least until -safe_translate_flushed is on)
      */
@@ -335,6 +449,29 @@ monitor_exit()
 {
     LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1,
         "Trace fragments generated: %d\n", GLOBAL_STAT(num_traces));
+#ifdef CLIENT_SIDELINE
+    /* the helper thread, if any, was terminated along with the other threads */
+    if (DYNAMO_OPTION(opt_traces_sideline)) {
+        trace_sideline_drain();
+        destroy_event(trace_sideline_event);
+    }
+    DELETE_LOCK(trace_sideline_lock);
+#endif
+    if (ib_target_sites != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, ib_target_sites);
+        ib_target_sites = NULL;
+        ib_target_sites_free_retired();
+    }
+#ifdef CUSTOM_TRACES
+    if (trace_reform_counts != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, trace_reform_counts);
+        trace_reform_counts = NULL;
+    }
+    if (trace_entry_counts != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, trace_entry_counts);
+        trace_entry_counts = NULL;
+    }
+#endif
     DELETE_LOCK(trace_building_lock);
 }
 
@@ -354,6 +491,7 @@ monitor_thread_init(dcontext_t *dcontext)
     dcontext->monitor_field = (void *) md;
     memset(md, 0, sizeof(monitor_data_t));
     reset_trace_state(dcontext, false /* link lock not needed */);
+    md->th_threshold = INTERNAL_OPTION(trace_threshold);
 
     /* case 7966: don't initialize un-needed things for hotp_only & thin_client
      * FIXME: could set initial sizes to 0 for all configurations, instead
@@ -422,11 +560,281 @@ thcounter_add(dcontext_t *dcontext, app_pc tag)
                           HEAPACCT(ACCT_THCOUNTER));
         e->tag = tag;
         e->counter = 0;
+        e->threshold = md->th_threshold;
+        e->reforms = 0;
+        e->reform_pending = false;
+        e->reform_optimize = false;
         generic_hash_add(dcontext, md->thead_table, (ptr_uint_t) tag, e);
     }
     return e;
 }
 
+static uint
+th_adapt_clamp(uint threshold)
+{
+    if (threshold < DYNAMO_OPTION(adaptive_trace_threshold_min))
+        return DYNAMO_OPTION(adaptive_trace_threshold_min);
+    if (threshold > DYNAMO_OPTION(adaptive_trace_threshold_max))
+        return DYNAMO_OPTION(adaptive_trace_threshold_max);
+    return threshold;
+}
+
+/* -adaptive_trace_threshold: counts the way we reached dispatch from the cache */
+static void
+th_adapt_note_cache_exit(dcontext_t *dcontext, monitor_data_t *md)
+{
+    if (dcontext->last_exit == NULL)
+        return;
+    if (LINKSTUB_INDIRECT(dcontext->last_exit->flags)) {
+        md->th_epoch_ibl_misses++;
+        RSTATS_INC(th_adapt_ibl_misses);
+    } else if (dcontext->last_fragment != NULL &&
+               TEST(FRAG_IS_TRACE, dcontext->last_fragment->flags) &&
+               !LINKSTUB_FAKE(dcontext->last_exit)) {
+        md->th_epoch_trace_exits++;
+        RSTATS_INC(th_adapt_trace_exits);
+    }
+}
+
+/* -adaptive_trace_threshold: an aborted trace wasted the work of building it,
+ * so make its head wait longer before trying again.
+ */
+static void
+th_adapt_trace_aborted(dcontext_t *dcontext, monitor_data_t *md)
+{
+    trace_head_counter_t *ctr = thcounter_lookup(dcontext, md->trace_tag);
+    md->th_epoch_aborts++;
+    /* the counter may have been removed or re-added by a flush */
+    if (ctr == NULL || ctr->counter != TH_COUNTER_CREATED_TRACE_VALUE(ctr))
+        return;
+    ctr->threshold = th_adapt_clamp(ctr->threshold * 2);
+    /* move the sentinel along with the threshold */
+    ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE(ctr);
+    RSTATS_INC(th_adapt_abort_raises);
+    LOG(THREAD, LOG_MONITOR, 3, "trace head "PFX" threshold raised to %d\n",
+        md->trace_tag, ctr->threshold);
+}
+
+/* -adaptive_trace_threshold: called after each emitted trace; once per epoch,
+ * moves the threshold for this thread's new trace heads.
+ */
+static void
+th_adapt_trace_emitted(dcontext_t *dcontext, monitor_data_t *md)
+{
+    uint old_threshold = md->th_threshold;
+    uint traces = ++md->th_epoch_traces;
+    if (traces < TH_ADAPT_EPOCH_TRACES)
+        return;
+    if (md->th_epoch_aborts * TH_ADAPT_ABORT_RATIO >= traces + md->th_epoch_aborts ||
+        md->th_epoch_trace_exits >= traces * TH_ADAPT_EXITS_PER_TRACE) {
+        md->th_threshold = th_adapt_clamp(old_threshold + old_threshold / 2 + 1);
+        if (md->th_threshold != old_threshold)
+            RSTATS_INC(th_adapt_epoch_raises);
+    } else if (md->th_epoch_ibl_misses >= traces * TH_ADAPT_IBL_MISSES_PER_TRACE) {
+        md->th_threshold = th_adapt_clamp(old_threshold - old_threshold / 4);
+        if (md->th_threshold != old_threshold)
+            RSTATS_INC(th_adapt_epoch_lowers);
+    }
+    LOG(THREAD, LOG_MONITOR, 2,
+        "adaptive trace threshold: %d traces, %d aborts, %d trace exits, "
+        "%d ibl misses => threshold %d\n", traces, md->th_epoch_aborts,
+        md->th_epoch_trace_exits, md->th_epoch_ibl_misses, md->th_threshold);
+    md->th_epoch_traces = 0;
+    md->th_epoch_aborts = 0;
+    md->th_epoch_trace_exits = 0;
+    md->th_epoch_ibl_misses = 0;
+}
+
+/* -ib_target_cache: a site removed from the table, by a flush or as the
+ * table is destroyed at exit, may still be referenced by a trace that is
+ * being built or that a thread has yet to leave, so it is only put on this
+ * list.  Protected by the ib_target_sites write lock.
+ */
+DECLARE_NEVERPROT_VAR(static ib_target_site_t *ib_target_sites_retired, NULL);
+
+static void
+ib_target_site_free(dcontext_t *dcontext, void *p)
+{
+    ib_target_site_t *site = (ib_target_site_t *) p;
+    site->next_retired = ib_target_sites_retired;
+    ib_target_sites_retired = site;
+}
+
+/* -ib_target_cache: folds the in-cache counters of each retired site into the
+ * totals and frees it.  Only called at exit.
+ */
+static void
+ib_target_sites_free_retired(void)
+{
+    ib_target_site_t *site, *next;
+    uint i, hits, total_hits = 0, total_misses = 0;
+    for (site = ib_target_sites_retired; site != NULL; site = next) {
+        next = site->next_retired;
+        if (DYNAMO_OPTION(ib_target_cache_stats) && site->num_inlined > 0) {
+            for (i = 0, hits = 0; i < site->num_inlined; i++)
+                hits += site->hits[i];
+            total_hits += hits;
+            total_misses += site->misses;
+            LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1,
+                "ib target cache site "PFX": %d targets, %u hits, %u misses\n",
+                site->tag, site->num_inlined, hits, site->misses);
+        }
+        HEAP_TYPE_FREE(GLOBAL_DCONTEXT, site, ib_target_site_t, ACCT_TRACE,
+                       UNPROTECTED);
+    }
+    ib_target_sites_retired = NULL;
+    if (total_hits + total_misses > 0) {
+        RSTATS_ADD(ib_target_cache_hits, total_hits);
+        RSTATS_ADD(ib_target_cache_misses, total_misses);
+        RSTATS_ADD(ib_target_cache_hit_percent,
+                   (uint) (((uint64) total_hits * 100) /
+                           (total_hits + total_misses)));
+    }
+}
+
+/* -ib_target_cache: drops the records of the bbs in [start,end) from the
+ * table, so that new code there starts its profile afresh
+ */
+void
+ib_target_site_range_remove(app_pc start, app_pc end)
+{
+    uint removed;
+    if (ib_target_sites == NULL)
+        return;
+    TABLE_RWLOCK(ib_target_sites, write, lock);
+    removed = generic_hash_range_remove(GLOBAL_DCONTEXT, ib_target_sites,
+                                        (ptr_uint_t) start, (ptr_uint_t) end);
+    TABLE_RWLOCK(ib_target_sites, write, unlock);
+    if (removed > 0) {
+        RSTATS_ADD(ib_target_cache_sites_pruned, removed);
+        LOG(GLOBAL, LOG_MONITOR, 2, "ib target cache: %d sites in "PFX"-"PFX
+            " pruned\n", removed, start, end);
+    }
+}
+
+ib_target_site_t *
+ib_target_site_lookup(app_pc tag)
+{
+    ib_target_site_t *site;
+    if (ib_target_sites == NULL)
+        return NULL;
+    TABLE_RWLOCK(ib_target_sites, read, lock);
+    site = (ib_target_site_t *)
+        generic_hash_lookup(GLOBAL_DCONTEXT, ib_target_sites, (ptr_uint_t) tag);
+    TABLE_RWLOCK(ib_target_sites, read, unlock);
+    /* records are only freed at exit, even if pruned, so we can hand out
+     * the pointer
+     */
+    return site;
+}
+
+/* caller must hold the ib_target_sites write lock */
+static ib_target_site_t *
+ib_target_site_add(app_pc tag)
+{
+    ib_target_site_t *site = (ib_target_site_t *)
+        generic_hash_lookup(GLOBAL_DCONTEXT, ib_target_sites, (ptr_uint_t) tag);
+    if (site == NULL) {
+        /* unprotected: the cache writes the hit and miss counters */
+        site = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, ib_target_site_t, ACCT_TRACE,
+                               UNPROTECTED);
+        memset(site, 0, sizeof(*site));
+        site->tag = tag;
+        generic_hash_add(GLOBAL_DCONTEXT, ib_target_sites, (ptr_uint_t) tag, site);
+    }
+    return site;
+}
+
+/* -ib_target_cache: called on entry to dispatch to record target as reached
+ * by the indirect call or jump ending the last bb.  On x86 bbs only look up
+ * trace targets in-cache by default, so until their targets become traces,
+ * bb indirect branches come through here on every execution.  To keep every
+ * thread from serializing on the table's write lock there, each thread only
+ * records one in IB_TARGET_SITE_SAMPLE of them: the hottest targets stay the
+ * hottest in the sample.
+ */
+static void
+ib_target_site_record(dcontext_t *dcontext, monitor_data_t *md, app_pc target)
+{
+    fragment_t *src = dcontext->last_fragment;
+    linkstub_t *l = dcontext->last_exit;
+    ib_target_site_t *site;
+    uint i, coldest = 0;
+    if (src == NULL || l == NULL || src->tag == NULL ||
+        TEST(FRAG_IS_TRACE, src->flags) || LINKSTUB_FAKE(l) ||
+        !LINKSTUB_INDIRECT(l->flags) || TEST(LINK_RETURN, l->flags))
+        return;
+    if (md->ib_site_sample > 0) {
+        md->ib_site_sample--;
+        return;
+    }
+    md->ib_site_sample = IB_TARGET_SITE_SAMPLE - 1;
+    /* once a trace fixed the site's targets there is nothing left to record */
+    site = ib_target_site_lookup(src->tag);
+    if (site != NULL && site->frozen)
+        return;
+    TABLE_RWLOCK(ib_target_sites, write, lock);
+    site = ib_target_site_add(src->tag);
+    if (!site->frozen) {
+        for (i = 0; i < IB_TARGET_SITE_SLOTS; i++) {
+            if (site->seen[i] == target) {
+                site->seen_count[i]++;
+                break;
+            }
+            if (site->seen_count[i] < site->seen_count[coldest])
+                coldest = i;
+        }
+        if (i == IB_TARGET_SITE_SLOTS) {
+            /* evict the coldest target: a phase change will push the new
+             * targets past stale ones with low counts
+             */
+            site->seen[coldest] = target;
+            site->seen_count[coldest] = 1;
+        }
+    }
+    TABLE_RWLOCK(ib_target_sites, write, unlock);
+}
+
+/* -ib_target_cache: returns the site for the bb with tag, fixing its inlined
+ * targets as its -ib_target_cache hottest recorded ones if this is the first
+ * trace to end there.  speculate, if non-NULL, is used when nothing was
+ * recorded.
+ */
+ib_target_site_t *
+ib_target_site_freeze(dcontext_t *dcontext, app_pc tag, app_pc speculate)
+{
+    ib_target_site_t *site;
+    uint i, j, best;
+    TABLE_RWLOCK(ib_target_sites, write, lock);
+    site = ib_target_site_add(tag);
+    if (!site->frozen) {
+        site->frozen = true;
+        for (j = 0; j < DYNAMO_OPTION(ib_target_cache); j++) {
+            best = IB_TARGET_SITE_SLOTS;
+            for (i = 0; i < IB_TARGET_SITE_SLOTS; i++) {
+                if (site->seen_count[i] > 0 &&
+                    (best == IB_TARGET_SITE_SLOTS ||
+                     site->seen_count[i] > site->seen_count[best]))
+                    best = i;
+            }
+            if (best == IB_TARGET_SITE_SLOTS)
+                break;
+            site->inlined[site->num_inlined++] = site->seen[best];
+            site->seen_count[best] = 0;
+        }
+        if (site->num_inlined == 0 && speculate != NULL)
+            site->inlined[site->num_inlined++] = speculate;
+        if (site->num_inlined > 0) {
+            RSTATS_INC(ib_target_cache_sites);
+            RSTATS_ADD(ib_target_cache_targets, site->num_inlined);
+        }
+        LOG(THREAD, LOG_MONITOR, 2, "ib target cache site "PFX": %d targets\n",
+            tag, site->num_inlined);
+    }
+    TABLE_RWLOCK(ib_target_sites, write, unlock);
+    return site;
+}
+
 /* Deletes all trace head entries in [start,end) */
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end)
@@ -473,6 +881,8 @@ reset_trace_state(dcontext_t *dcontext, bool grab_link_lock)
     md->unmangled_bb_ilist = NULL;
 #endif
     md->trace_buf_top = 0;
+    md->trace_reform = false;
+    md->trace_reform_optimize = false;
     ASSERT(md->trace_vmlist == NULL);
     for (i = 0; i < md->num_blks; i++) {
         vm_area_destroy_list(dcontext, md->blk_info[i].vmlist);
@@ -606,7 +1016,7 @@ monitor_remove_fragment(dcontext_t *dcontext, fragment_t *f)
                 "Aborting current trace since F%d was deleted\n",
                 f->id);
             /* abort current trace, we've lost a link */
-            trace_abort(dcontext);
+            trace_abort_no_backoff(dcontext);
         }
         /* trace_abort clears last_fragment -- and if not in trace-building
          * mode, it should not be set!
@@ -1181,6 +1591,499 @@ trace_flags_from_trace_head_flags(uint head_flags)
     return trace_flags;
 }
 
+#ifdef CLIENT_SIDELINE
+static bool
+trace_sideline_enabled(uint trace_flags)
+{
+    return (DYNAMO_OPTION(opt_traces_sideline) && TEST(FRAG_SHARED, trace_flags) &&
+            trace_sideline_thread_state >= 0);
+}
+
+static void
+trace_sideline_free_entry(trace_sideline_entry_t *e)
+{
+    instrlist_clear_and_destroy(GLOBAL_DCONTEXT, e->ilist);
+    HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, e->bbs, trace_bb_info_t, e->num_bbs,
+                    ACCT_TRACE, PROTECTED);
+    HEAP_TYPE_FREE(GLOBAL_DCONTEXT, e, trace_sideline_entry_t, ACCT_TRACE, PROTECTED);
+}
+
+static void
+trace_sideline_drain(void)
+{
+    trace_sideline_entry_t *e, *next_e;
+    mutex_lock(&trace_sideline_lock);
+    e = trace_sideline_head;
+    trace_sideline_head = NULL;
+    trace_sideline_tail = NULL;
+    trace_sideline_count = 0;
+    mutex_unlock(&trace_sideline_lock);
+    for (; e != NULL; e = next_e) {
+        next_e = e->next;
+        trace_sideline_free_entry(e);
+    }
+}
+
+static trace_sideline_entry_t *
+trace_sideline_dequeue(void)
+{
+    trace_sideline_entry_t *e;
+    mutex_lock(&trace_sideline_lock);
+    e = trace_sideline_head;
+    if (e != NULL) {
+        trace_sideline_head = e->next;
+        if (trace_sideline_head == NULL)
+            trace_sideline_tail = NULL;
+        trace_sideline_count--;
+    }
+    mutex_unlock(&trace_sideline_lock);
+    return e;
+}
+
+/* Is the live trace f still the one e was copied from?  We hold off flushes
+ * while asking, so a trace built from the same blocks after no flush has the
+ * same code even if it is not the very same fragment.
+ */
+static bool
+trace_sideline_matches(trace_sideline_entry_t *e, fragment_t *f)
+{
+    trace_only_t *t;
+    uint i;
+    if (f == NULL || !TESTALL(FRAG_IS_TRACE | FRAG_SHARED, f->flags) ||
+        TEST(FRAG_WAS_DELETED, f->flags) || e->flushtime != flushtime_global)
+        return false;
+    t = TRACE_FIELDS(f);
+    if (t->num_bbs != e->num_bbs)
+        return false;
+    for (i = 0; i < e->num_bbs; i++) {
+        if (t->bbs[i].tag != e->bbs[i].tag)
+            return false;
+    }
+    return true;
+}
+
+static void
+trace_sideline_optimize(dcontext_t *dcontext, trace_sideline_entry_t *e)
+{
+    fragment_t *f, *new_f;
+    trace_only_t *t;
+    void *vmlist = NULL;
+    bool replaced;
+
+    if (!optimize_hot_trace(GLOBAL_DCONTEXT, e->tag, e->ilist))
+        return;
+    /* Being couldbelinking holds off flushes until we are done. */
+    enter_couldbelinking(dcontext, NULL, false);
+    mutex_lock(&trace_building_lock);
+    f = fragment_lookup_trace(dcontext, e->tag);
+    if (!trace_sideline_matches(e, f) ||
+        !vm_area_add_to_list(dcontext, e->tag, &vmlist, e->flags, f, false)) {
+        mutex_unlock(&trace_building_lock);
+        STATS_INC(num_traces_sideline_stale);
+        LOG(THREAD, LOG_MONITOR, 2, "trace sideline: "PFX" is stale\n", e->tag);
+        enter_nolinking(dcontext, NULL, false);
+        return;
+    }
+    new_f = emit_invisible_fragment(dcontext, e->tag, e->ilist, e->flags, vmlist);
+    t = TRACE_FIELDS(new_f);
+    t->num_bbs = e->num_bbs;
+    t->bbs = (trace_bb_info_t *)
+        nonpersistent_heap_alloc(GLOBAL_DCONTEXT, e->num_bbs*sizeof(trace_bb_info_t)
+                                 HEAPACCT(ACCT_TRACE));
+    memcpy(t->bbs, e->bbs, e->num_bbs*sizeof(trace_bb_info_t));
+    replaced = fragment_replace_shared_no_flush(dcontext, f, new_f);
+    mutex_unlock(&trace_building_lock);
+    STATS_INC(num_traces_sideline_swapped);
+    DOLOG(2, LOG_MONITOR, {
+        LOG(THREAD, LOG_MONITOR, 2, "trace sideline: replaced F%d with F%d\n",
+            f->id, new_f->id);
+        disassemble_fragment(dcontext, new_f, stats->loglevel < 3);
+    });
+    if (replaced)
+        add_to_lazy_deletion_list(dcontext, f);
+    enter_nolinking(dcontext, NULL, false);
+}
+
+static void
+trace_sideline_thread(void *arg)
+{
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    trace_sideline_entry_t *e;
+    ASSERT(IS_CLIENT_THREAD(dcontext));
+    LOG(THREAD, LOG_MONITOR, 1, "trace sideline thread started\n");
+    while (true) {
+        /* We hold no locks or queued traces while waiting or yielding, so
+         * synchall may suspend or terminate us there.
+         */
+        dcontext->client_data->client_thread_safe_for_synch = true;
+        wait_for_event(trace_sideline_event);
+        dcontext->client_data->client_thread_safe_for_synch = false;
+        while ((e = trace_sideline_dequeue()) != NULL) {
+            trace_sideline_optimize(dcontext, e);
+            trace_sideline_free_entry(e);
+            dcontext->client_data->client_thread_safe_for_synch = true;
+            os_thread_yield();
+            dcontext->client_data->client_thread_safe_for_synch = false;
+        }
+    }
+}
+
+/* Copies the final ilist of a shared trace for the helper thread.  This must
+ * happen before emit, which pads and annotates the ilist it is given.
+ */
+static trace_sideline_entry_t *
+trace_sideline_copy(monitor_data_t *md)
+{
+    trace_sideline_entry_t *e;
+    instr_t *in, *copy;
+    uint i;
+    if (trace_sideline_count >= TRACE_SIDELINE_MAX_QUEUED) {
+        /* racy read, but it is only a bound */
+        STATS_INC(num_traces_sideline_dropped);
+        return NULL;
+    }
+    e = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, trace_sideline_entry_t, ACCT_TRACE, PROTECTED);
+    e->tag = md->trace_tag;
+    /* the optimized copy cannot be re-created */
+    e->flags = md->trace_flags | FRAG_HAS_TRANSLATION_INFO;
+    e->ilist = instrlist_clone(GLOBAL_DCONTEXT, &md->trace);
+    /* The buffers our raw bits may point into are about to be reused, and
+     * instr_clone() drops the mangling marks that translation relies on.
+     */
+    for (in = instrlist_first(&md->trace), copy = instrlist_first(e->ilist);
+         in != NULL; in = instr_get_next(in), copy = instr_get_next(copy)) {
+        instr_make_persistent(GLOBAL_DCONTEXT, copy);
+        instr_set_our_mangling(copy, instr_is_our_mangling(in));
+    }
+    e->num_bbs = md->num_blks;
+    e->bbs = HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, trace_bb_info_t, e->num_bbs,
+                              ACCT_TRACE, PROTECTED);
+    for (i = 0; i < md->num_blks; i++)
+        e->bbs[i] = md->blk_info[i].info;
+    e->next = NULL;
+    return e;
+}
+
+/* Hands e to the helper thread, creating it on first use.  Called once the
+ * unoptimized trace is visible.
+ */
+static void
+trace_sideline_enqueue(trace_sideline_entry_t *e)
+{
+    if (trace_sideline_thread_state == 0 &&
+        atomic_compare_exchange_int(&trace_sideline_thread_state, 0, 1)) {
+        if (!dr_create_client_thread(trace_sideline_thread, NULL)) {
+            SYSLOG_INTERNAL_WARNING("failed to create trace sideline thread: "
+                                    "optimizing traces inline");
+            trace_sideline_thread_state = -1;
+            trace_sideline_free_entry(e);
+            return;
+        }
+    }
+    /* Any flush from here on makes e stale. */
+    e->flushtime = flushtime_global;
+    mutex_lock(&trace_sideline_lock);
+    if (trace_sideline_tail == NULL)
+        trace_sideline_head = e;
+    else
+        trace_sideline_tail->next = e;
+    trace_sideline_tail = e;
+    trace_sideline_count++;
+    mutex_unlock(&trace_sideline_lock);
+    STATS_INC(num_traces_sideline_queued);
+    signal_event(trace_sideline_event);
+}
+#endif /* CLIENT_SIDELINE */
+
+#ifdef CUSTOM_TRACES
+/* Returns the bb for the tag of the trace f, which shadows it.  If there is
+ * none, builds one: an official bb (we DO want to call the client bb hook,
+ * right?) with f's sharing, which we do not link.
+ */
+static fragment_t *
+lookup_or_build_shadowed_bb(dcontext_t *dcontext, monitor_data_t *md, fragment_t *f)
+{
+    fragment_t *head = NULL;
+    ASSERT(TEST(FRAG_IS_TRACE, f->flags));
+    if (USE_BB_BUILDING_LOCK())
+        mutex_lock(&bb_building_lock);
+    if (DYNAMO_OPTION(coarse_units)) {
+        /* the existing lookup routines will shadow a coarse bb so we do
+         * a custom lookup
+         */
+        head = fragment_coarse_lookup_wrapper(dcontext, f->tag, &md->wrapper);
+    }
+    if (head == NULL)
+        head = fragment_lookup_bb(dcontext, f->tag);
+    if (head == NULL) {
+        LOG(THREAD, LOG_MONITOR, 3, "Trace "PFX" requiring shadow bb\n", f->tag);
+        SELF_PROTECT_LOCAL(dcontext, WRITABLE);
+        /* We need to mark as trace head to hit the shadowing checks
+         * and asserts when adding to fragment htable and unlinking
+         * on delete.
+         */
+        head = build_basic_block_fragment
+            (dcontext, f->tag, FRAG_IS_TRACE_HEAD, false/*do not link*/,
+             true/*visible*/ _IF_CLIENT(true/*for trace*/) _IF_CLIENT(NULL));
+        SELF_PROTECT_LOCAL(dcontext, READONLY);
+        STATS_INC(custom_traces_bbs_built);
+        ASSERT(head != NULL);
+        /* If it's not shadowing we should have linked before htable add.
+         * We shouldn't end up w/ a bb of different sharing than the
+         * trace: CUSTOM_TRACES rules out private traces and shared bbs,
+         * and if circumstances changed since the original trace head bb
+         * was made then the trace should have been flushed.
+         */
+        ASSERT((head->flags & FRAG_SHARED) == (f->flags & FRAG_SHARED));
+        if (TEST(FRAG_COARSE_GRAIN, head->flags)) {
+            /* we need a local copy before releasing the lock.
+             * FIXME: share this code sequence w/ dispatch().
+             */
+            ASSERT(USE_BB_BUILDING_LOCK());
+            fragment_coarse_wrapper(&md->wrapper, f->tag, FCACHE_ENTRY_PC(head));
+            md->wrapper.flags |= FRAG_IS_TRACE_HEAD;
+            head = &md->wrapper;
+        }
+    }
+    if (USE_BB_BUILDING_LOCK())
+        mutex_unlock(&bb_building_lock);
+    return head;
+}
+
+#ifdef CUSTOM_TRACES
+static void
+trace_reform_counter_free(dcontext_t *dcontext, void *p)
+{
+    HEAP_TYPE_FREE(GLOBAL_DCONTEXT, p, uint, ACCT_TRACE, UNPROTECTED);
+}
+
+static uint *
+trace_counter_lookup(generic_table_t *table, app_pc tag)
+{
+    uint *count;
+    TABLE_RWLOCK(table, read, lock);
+    count = (uint *) generic_hash_lookup(GLOBAL_DCONTEXT, table, (ptr_uint_t) tag);
+    TABLE_RWLOCK(table, read, unlock);
+    return count;
+}
+
+/* Returns the counter for tag in table, creating it if necessary. */
+static uint *
+trace_counter_lookup_or_add(generic_table_t *table, app_pc tag)
+{
+    uint *count = trace_counter_lookup(table, tag);
+    if (count != NULL)
+        return count;
+    TABLE_RWLOCK(table, write, lock);
+    count = (uint *) generic_hash_lookup(GLOBAL_DCONTEXT, table, (ptr_uint_t) tag);
+    if (count == NULL) {
+        /* unprotected: the cache writes it */
+        count = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, uint, ACCT_TRACE, UNPROTECTED);
+        *count = 0;
+        generic_hash_add(GLOBAL_DCONTEXT, table, (ptr_uint_t) tag, count);
+    }
+    TABLE_RWLOCK(table, write, unlock);
+    return count;
+}
+
+/* -trace_reform: returns the counter that the side exits of the trace with tag
+ * increment in the cache, creating it if necessary
+ */
+uint *
+trace_reform_exit_counter(app_pc tag)
+{
+    ASSERT(trace_reform_counts != NULL);
+    return trace_counter_lookup_or_add(trace_reform_counts, tag);
+}
+
+/* -opt_trace_threshold: returns the counter that the trace with tag
+ * increments on each execution, creating it if necessary
+ */
+uint *
+trace_entry_counter(app_pc tag)
+{
+    ASSERT(trace_entry_counts != NULL);
+    return trace_counter_lookup_or_add(trace_entry_counts, tag);
+}
+
+/* Returns the trace head counter for trace_f's tag, creating one if trace_f
+ * is a shared trace built by another thread.
+ */
+static trace_head_counter_t *
+trace_reform_head_counter(dcontext_t *dcontext, fragment_t *trace_f)
+{
+    trace_head_counter_t *ctr = thcounter_lookup(dcontext, trace_f->tag);
+    if (ctr == NULL) {
+        ctr = thcounter_add(dcontext, trace_f->tag);
+        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE(ctr);
+    }
+    return ctr;
+}
+
+/* Unlinks trace_f's incoming links so that its next execution passes through
+ * monitor_cache_enter(), where trace_reform_start() rebuilds it.  If optimize,
+ * the rebuilt trace goes through optimize_hot_trace().
+ */
+static void
+trace_reform_mark(dcontext_t *dcontext, fragment_t *trace_f, trace_head_counter_t *ctr,
+                  bool optimize)
+{
+    SHARED_FLAGS_RECURSIVE_LOCK(trace_f->flags, acquire, change_linking_lock);
+    if (!TEST(FRAG_WAS_DELETED, trace_f->flags) &&
+        TEST(FRAG_LINKED_INCOMING, trace_f->flags)) {
+        LOG(THREAD, LOG_MONITOR, 2, "trace F%d ("PFX"): unlinking to re-form%s\n",
+            trace_f->id, trace_f->tag, optimize ? " and optimize" : "");
+        unlink_fragment_incoming(dcontext, trace_f);
+        ctr->reform_pending = true;
+        ctr->reform_optimize = optimize;
+        if (optimize)
+            STATS_INC(num_traces_opt_marked);
+        else
+            STATS_INC(num_traces_reform_marked);
+    }
+    SHARED_FLAGS_RECURSIVE_LOCK(trace_f->flags, release, change_linking_lock);
+    SELF_PROTECT_CACHE(dcontext, NULL, READONLY);
+}
+
+/* -trace_reform: called on entry to dispatch for trace_f, the trace just left
+ * or the one about to be entered.  The trace's side exits count themselves in
+ * the cache (see append_trace_side_exit_counts()), linked or not.  Once they
+ * have been taken -trace_reform_threshold times, unlinks the trace's incoming
+ * links so that its next execution passes through monitor_cache_enter(),
+ * where trace_reform_start() rebuilds it.
+ */
+static void
+trace_reform_note_side_exits(dcontext_t *dcontext, monitor_data_t *md,
+                             fragment_t *trace_f)
+{
+    trace_head_counter_t *ctr;
+    uint *count;
+    count = trace_counter_lookup(trace_reform_counts, trace_f->tag);
+    if (count == NULL || *count < DYNAMO_OPTION(trace_reform_threshold))
+        return;
+    ctr = trace_reform_head_counter(dcontext, trace_f);
+    if (ctr->reform_pending || ctr->reforms >= DYNAMO_OPTION(trace_reform_max))
+        return;
+    LOG(THREAD, LOG_MONITOR, 2, "trace F%d ("PFX") left via %d side exits\n",
+        trace_f->id, trace_f->tag, *count);
+    /* start over for the next trace with this tag */
+    *count = 0;
+    trace_reform_mark(dcontext, trace_f, ctr, false/*!optimize*/);
+}
+
+/* -opt_trace_threshold: called like trace_reform_note_side_exits().  A trace
+ * emitted unoptimized counts its executions in the cache (see
+ * prepend_trace_entry_count()).  Once it has run -opt_trace_threshold times,
+ * marks it to be re-formed and optimized.
+ */
+static void
+trace_opt_note_entries(dcontext_t *dcontext, monitor_data_t *md, fragment_t *trace_f)
+{
+    trace_head_counter_t *ctr;
+    uint *count;
+    count = trace_counter_lookup(trace_entry_counts, trace_f->tag);
+    if (count == NULL || *count < DYNAMO_OPTION(opt_trace_threshold))
+        return;
+    ctr = trace_reform_head_counter(dcontext, trace_f);
+    if (ctr->reform_pending)
+        return;
+    LOG(THREAD, LOG_MONITOR, 2, "trace F%d ("PFX") executed %d times\n",
+        trace_f->id, trace_f->tag, *count);
+    /* the optimized trace stops counting; a rebuilt one starts over */
+    *count = 0;
+    trace_reform_mark(dcontext, trace_f, ctr, true/*optimize*/);
+}
+
+/* -trace_reform and -opt_trace_threshold: checks the counts that the trace
+ * trace_f keeps in the cache.
+ */
+static void
+trace_reform_note_counts(dcontext_t *dcontext, monitor_data_t *md, fragment_t *trace_f)
+{
+    ASSERT(TEST(FRAG_IS_TRACE, trace_f->flags));
+    if (TEST(FRAG_TEMP_PRIVATE, trace_f->flags))
+        return;
+    if (DYNAMO_OPTION(trace_reform))
+        trace_reform_note_side_exits(dcontext, md, trace_f);
+    if (OPT_TRACES_DEFERRED())
+        trace_opt_note_entries(dcontext, md, trace_f);
+}
+#endif
+
+/* -trace_reform: if the trace *f_inout was marked by
+ * trace_reform_mark(), relinks it and points *f_inout at its head bb,
+ * from which the caller is to start building its replacement.
+ */
+static bool
+trace_reform_start(dcontext_t *dcontext, monitor_data_t *md, fragment_t **f_inout,
+                   trace_head_counter_t **ctr_out)
+{
+    fragment_t *trace_f = *f_inout;
+    fragment_t *head;
+    trace_head_counter_t *ctr = thcounter_lookup(dcontext, trace_f->tag);
+    bool optimize;
+    if (ctr == NULL || !ctr->reform_pending)
+        return false;
+    optimize = ctr->reform_optimize;
+    ctr->reform_pending = false;
+    ctr->reform_optimize = false;
+    /* only re-forming along a new path counts against -trace_reform_max */
+    if (!optimize)
+        ctr->reforms++;
+    /* we're couldbelinking, so no flush can be unlinking trace_f right now */
+    SHARED_FLAGS_RECURSIVE_LOCK(trace_f->flags, acquire, change_linking_lock);
+    if (!TEST(FRAG_WAS_DELETED, trace_f->flags) &&
+        !TEST(FRAG_LINKED_INCOMING, trace_f->flags))
+        link_fragment_incoming(dcontext, trace_f, false/*not new*/);
+    SHARED_FLAGS_RECURSIVE_LOCK(trace_f->flags, release, change_linking_lock);
+    SELF_PROTECT_CACHE(dcontext, NULL, READONLY);
+    head = lookup_or_build_shadowed_bb(dcontext, md, trace_f);
+    if (head == NULL || TEST(FRAG_CANNOT_BE_TRACE, head->flags) ||
+        !TEST(FRAG_IS_TRACE_HEAD, head->flags))
+        return false;
+    LOG(THREAD, LOG_MONITOR, 2, "Re-forming trace F%d ("PFX") from F%d\n",
+        trace_f->id, trace_f->tag, head->id);
+    md->trace_reform_bbs = TRACE_FIELDS(trace_f)->num_bbs;
+    md->trace_reform_optimize = optimize;
+    /* the trace-starting code below expects a counter that just became hot */
+    ctr->counter = ctr->threshold;
+    *f_inout = head;
+    *ctr_out = ctr;
+    return true;
+}
+
+/* -trace_reform: emits the re-formed trace in place of old_f, the trace that
+ * currently has our tag.  The caller must hold the trace_building_lock for
+ * shared traces, and must pass *lazy_delete_f, if set, to
+ * add_to_lazy_deletion_list() once it holds no locks.
+ */
+static fragment_t *
+trace_reform_emit(dcontext_t *dcontext, monitor_data_t *md, app_pc tag,
+                  fragment_t *old_f, fragment_t **lazy_delete_f)
+{
+    fragment_t *trace_f = emit_invisible_fragment(dcontext, tag, &md->trace,
+                                                  md->trace_flags, md->trace_vmlist);
+    ASSERT(TEST(FRAG_IS_TRACE, old_f->flags));
+    if (TEST(FRAG_SHARED, old_f->flags)) {
+        ASSERT(OWN_MUTEX(&trace_building_lock));
+        if (fragment_replace_shared_no_flush(dcontext, old_f, trace_f))
+            *lazy_delete_f = old_f;
+    } else {
+        SHARED_RECURSIVE_LOCK(acquire, change_linking_lock);
+        /* links trace_f's exits before redirecting old_f's incoming links to it */
+        shift_links_to_new_fragment(dcontext, old_f, trace_f);
+        fragment_replace(dcontext, old_f, trace_f);
+        SHARED_RECURSIVE_LOCK(release, change_linking_lock);
+        fragment_delete(dcontext, old_f, FRAGDEL_NO_OUTPUT | FRAGDEL_NO_UNLINK |
+                        FRAGDEL_NO_HTABLE | FRAGDEL_NO_MONITOR);
+        STATS_INC(num_fragments_deleted_trace_reform);
+    }
+    SELF_PROTECT_CACHE(dcontext, NULL, READONLY);
+    STATS_INC(num_traces_reformed);
+    return trace_f;
+}
+#endif /* CUSTOM_TRACES */
+
 /* Be careful with the case where the current fragment f to be executed
  * has the same tag as the one we're emitting as a trace.
  */
@@ -1201,6 +2104,16 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     /* was the trace passed through optimizations or the client interface? */
     bool externally_mangled = false;
 #endif
+#ifdef CLIENT_SIDELINE
+    trace_sideline_entry_t *sideline_copy = NULL;
+#endif
+#ifdef CUSTOM_TRACES
+    /* -trace_reform: the trace we are replacing, and whether it needs a lazy delete */
+    fragment_t *reform_f = NULL;
+    fragment_t *reform_lazy_delete_f = NULL;
+#endif
+    /* -opt_trace_threshold defers -opt_traces until a trace is hot */
+    bool optimize = DYNAMO_OPTION(opt_traces);
     /* we cannot simply upgrade a basic block fragment
      * to a trace b/c traces have prefixes that basic blocks don't!
      */
@@ -1249,6 +2162,25 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     }
 #endif
 
+#ifdef CUSTOM_TRACES
+    if (DYNAMO_OPTION(trace_reform)) {
+        /* each counted side exit keeps its stub, so only the body grows;
+         * recreate_fragment_ilist() reproduces this
+         */
+        md->emitted_size += append_trace_side_exit_counts(dcontext, trace, tag,
+                                                          false);
+    }
+    if (OPT_TRACES_DEFERRED()) {
+        if (md->trace_reform_optimize) {
+            /* recreate_fragment_ilist() would add the count we leave out */
+            md->trace_flags |= FRAG_HAS_TRANSLATION_INFO;
+        } else {
+            md->emitted_size += prepend_trace_entry_count(dcontext, trace, tag, true);
+            optimize = false;
+        }
+    }
+#endif
+
     if (INTERNAL_OPTION(cbr_single_stub) &&
         final_exit_shares_prev_stub(dcontext, trace, md->trace_flags)) {
         /* while building, we re-add shared stub since not sure if
@@ -1261,6 +2193,26 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         md->emitted_size -= local_exit_stub_size(dcontext, target, md->trace_flags);
     }
 
+    if (DYNAMO_OPTION(ib_target_cache) > 0) {
+        /* The targets are fixed per site and do not depend on whether the
+         * last block has executed yet, so recreate_fragment_ilist() can
+         * reproduce this.
+         */
+        app_pc site_tag = md->blk_info[md->num_blks - 1].info.tag;
+        uint i, added =
+            append_trace_ib_target_cache(dcontext, trace, site_tag,
+                                         TEST(FRAG_MUST_END_TRACE, cur_f->flags) ?
+                                         NULL : dcontext->next_tag, false);
+        if (added > 0) {
+            ib_target_site_t *site = ib_target_site_lookup(site_tag);
+            md->emitted_size += added;
+            for (i = 0; i < site->num_inlined; i++) {
+                md->emitted_size += local_exit_stub_size(dcontext, site->inlined[i],
+                                                         md->trace_flags);
+            }
+        }
+    }
+
     if (DYNAMO_OPTION(speculate_last_exit)
 #ifdef HASHTABLE_STATISTICS
         || INTERNAL_OPTION(speculate_last_exit_stats)
@@ -1348,6 +2300,27 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     }
 #endif /* INTERNAL */
 
+#ifdef CLIENT_SIDELINE
+    if (optimize && trace_sideline_enabled(md->trace_flags)) {
+        sideline_copy = trace_sideline_copy(md);
+        /* Swapping the copy in records the original's translation info, which
+         * must not re-create it on the helper thread if that would run client
+         * hooks there, so with hooks the original stores it up front.
+         */
+        if (sideline_copy != NULL && (dr_bb_hook_exists() || dr_trace_hook_exists()))
+            md->trace_flags |= FRAG_HAS_TRANSLATION_INFO;
+    } else
+#endif
+    if (optimize && optimize_hot_trace(dcontext, tag, trace)) {
+        /* These optimizations are not re-applied by recreate_fragment_ilist(),
+         * so we store the translation info for the optimized trace instead.
+         */
+        md->trace_flags |= FRAG_HAS_TRANSLATION_INFO;
+#if defined(DEBUG) || defined(INTERNAL) || defined(CLIENT_INTERFACE)
+        externally_mangled = true;
+#endif
+    }
+
 #ifdef PROFILE_RDTSC
     if (dynamo_options.profile_times) {
         /* space was already reserved in buffer and in md->emitted_size */
@@ -1387,11 +2360,23 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         mutex_lock(&trace_building_lock);
         /* we left the bb there, so we rely on any shared trace shadowing it */
         trace_f = fragment_lookup_trace(dcontext, tag);
+#ifdef CUSTOM_TRACES
+        if (trace_f != NULL && md->trace_reform) {
+            /* we're re-forming this trace, or a copy another thread swapped in */
+            reform_f = trace_f;
+            trace_f = NULL;
+        }
+#endif
         if (trace_f != NULL) {
             /* someone beat us to it!  tough luck -- throw it all away */
             ASSERT(TEST(FRAG_IS_TRACE, trace_f->flags));
             mutex_unlock(&trace_building_lock);
-            trace_abort(dcontext);
+#ifdef CLIENT_SIDELINE
+            if (sideline_copy != NULL)
+                trace_sideline_free_entry(sideline_copy);
+#endif
+            /* the path is fine, we just lost the race for it */
+            trace_abort_no_backoff(dcontext);
             STATS_INC(num_aborted_traces_race);
 #ifdef DEBUG
             /* We expect to see this very rarely since we expect to detect
@@ -1419,8 +2404,10 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
      * lookup, tries to mess w/ trace head's links?
      */
     if (cur_f != NULL && cur_f->tag == tag) {
-        /* Optimization: could repeat for shared as well but we don't bother */
-        if (!TEST(FRAG_SHARED, cur_f->flags))
+        /* Optimization: could repeat for shared as well but we don't bother.
+         * cur_f is only a trace if we're re-forming it.
+         */
+        if (!TEST(FRAG_SHARED, cur_f->flags) && !TEST(FRAG_IS_TRACE, cur_f->flags))
             trace_head_f = cur_f;
         /* Yipes, we're deleting the fragment we're supposed to execute next.
          * Set cur_f to NULL even if not deleted, since we want to
@@ -1431,6 +2418,16 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     /* remove private trace head fragment, if any */
     if (trace_head_f == NULL) /* from cur_f */
         trace_head_f = fragment_lookup_same_sharing(dcontext, tag, 0/*FRAG_PRIVATE*/);
+#ifdef CUSTOM_TRACES
+    if (trace_head_f != NULL && TEST(FRAG_IS_TRACE, trace_head_f->flags)) {
+        /* -trace_reform of a private trace, which shadows the private head */
+        ASSERT(md->trace_reform && !TEST(FRAG_SHARED, md->trace_flags));
+        reform_f = trace_head_f;
+        trace_head_f = fragment_lookup_bb(dcontext, tag);
+        if (trace_head_f != NULL && TEST(FRAG_SHARED, trace_head_f->flags))
+            trace_head_f = NULL;
+    }
+#endif
     /* We do not go through other threads and delete their private trace heads,
      * presuming that they have them for a reason and don't want this shared trace
      */
@@ -1499,6 +2496,11 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     ASSERT(md->trace_tag == tag);
 
     /* emit trace fragment into fcache with tag value */
+#ifdef CUSTOM_TRACES
+    if (reform_f != NULL) {
+        trace_f = trace_reform_emit(dcontext, md, tag, reform_f, &reform_lazy_delete_f);
+    } else
+#endif
     if (replace_trace_head) {
 #ifndef CUSTOM_TRACES
         ASSERT(TEST(FRAG_SHARED, md->trace_flags));
@@ -1537,7 +2539,14 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     if (TEST(FRAG_SHARED, md->trace_flags))
         mutex_unlock(&trace_building_lock);
 
+#ifdef CLIENT_SIDELINE
+    if (sideline_copy != NULL)
+        trace_sideline_enqueue(sideline_copy);
+#endif
+
     RSTATS_INC(num_traces);
+    if (DYNAMO_OPTION(adaptive_trace_threshold))
+        th_adapt_trace_emitted(dcontext, md);
     DOSTATS({IF_X86_64(if (FRAG_IS_32(trace_f->flags)) {STATS_INC(num_32bit_traces);})});
     STATS_ADD(num_bbs_in_all_traces, md->num_blks);
     STATS_TRACK_MAX(max_bbs_in_a_trace, md->num_blks);
@@ -1564,6 +2573,11 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     md->trace_vmlist = NULL;
     md->trace_tag = NULL;
 
+#ifdef CUSTOM_TRACES
+    /* no locks can be held when calling this */
+    if (reform_lazy_delete_f != NULL)
+        add_to_lazy_deletion_list(dcontext, reform_lazy_delete_f);
+#endif
     /* these calls to fragment_remove_shared_no_flush may become
      * nolinking, meaning we need to hold no locks here, and that when
      * we get back our local fragment_t pointers may be invalid.
@@ -1916,6 +2930,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 #endif
     trace_head_counter_t *ctr;
     uint add_size = 0, prev_mangle_size = 0; /* NOTE these aren't set if end_trace */
+    bool reform = false; /* -trace_reform */
 
     if (DYNAMO_OPTION(disable_traces) || f == NULL) {
         /* nothing to do */
@@ -1948,6 +2963,14 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
                      TEST(FRAG_IS_TRACE, f->flags ) ||
                      TEST(FRAG_IS_TRACE_HEAD, f->flags));
 #ifdef CUSTOM_TRACES
+        /* -trace_reform: follow the new path through the heads that the old
+         * trace's side exits led to, until it loops back to our own head.
+         * We allow up to twice the old trace's blocks, as the new path may
+         * never come back.
+         */
+        if (md->trace_reform && !md->trace_reform_optimize && end_trace &&
+            f->tag != md->trace_tag && md->num_blks < 2 * md->trace_reform_bbs)
+            end_trace = false;
         if (dr_end_trace_hook_exists()) {
             client = instrument_end_trace(dcontext, md->trace_tag, f->tag);
             /* Return values:
@@ -1993,58 +3016,8 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 #ifdef CUSTOM_TRACES
             /* we need a regular bb here, not a trace */
             if (TEST(FRAG_IS_TRACE, f->flags)) {
-                /* We create an official, shared bb (we DO want to call the client bb
-                 * hook, right?).  We do not link the new, shadowed bb.
-                 */
-                fragment_t *head = NULL;
-                if (USE_BB_BUILDING_LOCK())
-                    mutex_lock(&bb_building_lock);
-                if (DYNAMO_OPTION(coarse_units)) {
-                    /* the existing lookup routines will shadow a coarse bb so we do
-                     * a custom lookup
-                     */
-                    head = fragment_coarse_lookup_wrapper(dcontext, f->tag,
-                                                          &md->wrapper);
-                }
-                if (head == NULL)
-                    head = fragment_lookup_bb(dcontext, f->tag);
-                if (head == NULL) {
-                    LOG(THREAD, LOG_MONITOR, 3,
-                        "Client custom trace 0x%08x requiring shadow bb 0x%08x\n",
-                        md->trace_tag, f->tag);
-                    SELF_PROTECT_LOCAL(dcontext, WRITABLE);
-                    /* We need to mark as trace head to hit the shadowing checks
-                     * and asserts when adding to fragment htable and unlinking
-                     * on delete.
-                     */
-                    head = build_basic_block_fragment
-                        (dcontext, f->tag, FRAG_IS_TRACE_HEAD, false/*do not link*/,
-                         true/*visible*/ _IF_CLIENT(true/*for trace*/) _IF_CLIENT(NULL));
-                    SELF_PROTECT_LOCAL(dcontext, READONLY);
-                    STATS_INC(custom_traces_bbs_built);
-                    ASSERT(head != NULL);
-                    /* If it's not shadowing we should have linked before htable add.
-                     * We shouldn't end up w/ a bb of different sharing than the
-                     * trace: CUSTOM_TRACES rules out private traces and shared bbs,
-                     * and if circumstances changed since the original trace head bb
-                     * was made then the trace should have been flushed.
-                     */
-                    ASSERT((head->flags & FRAG_SHARED) == (f->flags & FRAG_SHARED));
-                    if (TEST(FRAG_COARSE_GRAIN, head->flags)) {
-                        /* we need a local copy before releasing the lock.
-                         * FIXME: share this code sequence w/ dispatch().
-                         */
-                        ASSERT(USE_BB_BUILDING_LOCK());
-                        fragment_coarse_wrapper(&md->wrapper, f->tag,
-                                                FCACHE_ENTRY_PC(head));
-                        md->wrapper.flags |= FRAG_IS_TRACE_HEAD;
-                        head = &md->wrapper;
-                    }
-                }
-                if (USE_BB_BUILDING_LOCK())
-                    mutex_unlock(&bb_building_lock);
                 /* use the bb from here on out */
-                f = head;
+                f = lookup_or_build_shadowed_bb(dcontext, md, f);
             }
 #endif
             if (TEST(FRAG_COARSE_GRAIN, f->flags) || TEST(FRAG_SHARED, f->flags)
@@ -2131,7 +3104,33 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 
     /* searching for a hot trace head */
 
+    if (DYNAMO_OPTION(adaptive_trace_threshold))
+        th_adapt_note_cache_exit(dcontext, md);
+    if (DYNAMO_OPTION(ib_target_cache) > 0)
+        ib_target_site_record(dcontext, md, f->tag);
+#ifdef CUSTOM_TRACES
+    if (DYNAMO_OPTION(trace_reform) || OPT_TRACES_DEFERRED()) {
+        /* a trace whose exits are all linked only comes back here once something
+         * else sends it to dispatch, so we check the traces on both sides
+         */
+        if (dcontext->last_fragment != NULL &&
+            TEST(FRAG_IS_TRACE, dcontext->last_fragment->flags) &&
+            dcontext->last_exit != NULL && !LINKSTUB_FAKE(dcontext->last_exit))
+            trace_reform_note_counts(dcontext, md, dcontext->last_fragment);
+        if (TEST(FRAG_IS_TRACE, f->flags) && f != dcontext->last_fragment)
+            trace_reform_note_counts(dcontext, md, f);
+    }
+#endif
+
     if (TEST(FRAG_IS_TRACE, f->flags)) {
+#ifdef CUSTOM_TRACES
+        if ((DYNAMO_OPTION(trace_reform) || OPT_TRACES_DEFERRED()) &&
+            trace_reform_start(dcontext, md, &f, &ctr)) {
+            start_trace = true;
+            reform = true;
+            goto start_trace_at_head;
+        }
+#endif
         /* nothing to do */
         dcontext->whereami = WHERE_DISPATCH;
         return f;
@@ -2193,7 +3192,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
         ctr = thcounter_add(dcontext, f->tag);
     ASSERT(ctr != NULL);
 
-    if (ctr->counter == TH_COUNTER_CREATED_TRACE_VALUE()) {
+    if (ctr->counter == TH_COUNTER_CREATED_TRACE_VALUE(ctr)) {
         /* trace_t head counter values are persistent, so we do not remove them on
          * deletion.  However, when a trace is deleted we clear the counter, to
          * prevent the new bb from immediately being considered hot, to help
@@ -2208,7 +3207,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 
     ctr->counter++;
     /* Should never be > here (assert is down below) but we check just in case */
-    if (ctr->counter >= INTERNAL_OPTION(trace_threshold)) {
+    if (ctr->counter >= ctr->threshold) {
         /* if cannot delete fragment, do not start trace -- wait until
          * can delete it (w/ exceptions, deletion status changes). */
         if (!TEST(FRAG_CANNOT_DELETE, f->flags)) {
@@ -2243,10 +3242,13 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
              * that our one-up sentinel works for lazy clearing.
              */
             ctr->counter--;
-            ASSERT(ctr->counter < INTERNAL_OPTION(trace_threshold));
+            ASSERT(ctr->counter < ctr->threshold);
         }
     }
 
+#ifdef CUSTOM_TRACES
+ start_trace_at_head:
+#endif
 #ifdef CLIENT_INTERFACE
     if (start_trace) {
         /* We need to set pass_to_client before cloning */
@@ -2282,8 +3284,8 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
     if (start_trace) {
         KSTART(trace_building);
         /* ensure our sentinel counter value for counter clearing will work */
-        ASSERT(ctr->counter == INTERNAL_OPTION(trace_threshold));
-        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE();
+        ASSERT(ctr->counter == ctr->threshold);
+        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE(ctr);
         /* Found a hot trace head.  Switch this thread into trace
            selection mode, and initialize the instrlist_t for the new
            trace fragment with this block fragment.  Leave the
@@ -2300,6 +3302,9 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
          */
 #endif
         md->trace_tag = f->tag;
+        md->trace_reform = reform;
+        if (!reform)
+            md->trace_reform_optimize = false;
         md->trace_flags = trace_flags_from_trace_head_flags(f->flags);
         md->emitted_size = fragment_prefix_size(md->trace_flags);
 #ifdef PROFILE_RDTSC
@@ -2369,9 +3374,11 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
  * If calling on another thread, caller should be synchronized with that thread
  * (either via flushing synch or thread_synch methods) FIXME : verify all users
  * on other threads are properly synchronized
+ * backoff says whether -adaptive_trace_threshold should hold the abort against
+ * the trace head.
  */
-void
-trace_abort(dcontext_t *dcontext)
+static void
+trace_abort_common(dcontext_t *dcontext, bool backoff)
 {
     monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
     instrlist_t *trace;
@@ -2420,12 +3427,30 @@ trace_abort(dcontext_t *dcontext)
     }
     STATS_INC(num_aborted_traces);
     STATS_ADD(num_bbs_in_all_aborted_traces, md->num_blks);
+    if (DYNAMO_OPTION(adaptive_trace_threshold) && md->trace_tag != NULL) {
+        if (backoff)
+            th_adapt_trace_aborted(dcontext, md);
+        else
+            RSTATS_INC(th_adapt_aborts_excused);
+    }
     reset_trace_state(dcontext, true /* might need change_linking_lock */);
 
     if (!prevlinking)
         enter_nolinking(dcontext, NULL, false/*not a cache transition*/);
 }
 
+void
+trace_abort(dcontext_t *dcontext)
+{
+    trace_abort_common(dcontext, true);
+}
+
+void
+trace_abort_no_backoff(dcontext_t *dcontext)
+{
+    trace_abort_common(dcontext, false);
+}
+
 #if defined(RETURN_AFTER_CALL) || defined(RCT_IND_BRANCH)
 /* PR 204770: use trace component bb tag for RCT source address */
 app_pc
@@ -49,6 +49,7 @@ extern mutex_t trace_building_lock;
 
 void monitor_init(void);
 void monitor_exit(void);
+void monitor_reset_free(void);
 void monitor_thread_init(dcontext_t *dcontext);
 void monitor_thread_exit(dcontext_t *dcontext);
 
@@ -95,6 +96,12 @@ void * cur_trace_vmlist(dcontext_t *dcontext);
  */
 void trace_abort(dcontext_t *dcontext);
 
+/* Equivalent to trace_abort, for aborts that are no fault of the trace's path,
+ * such as flushes and races with other threads: -adaptive_trace_threshold does
+ * not raise the head's threshold for them.
+ */
+void trace_abort_no_backoff(dcontext_t *dcontext);
+
 /* Equivalent to trace_abort, except that lazily deleted fragments are cleaned
  * up eagerly.  Can only be called at safe points when we know the app is not
  * executing in the fragment, such as thread termination or reset events.
@@ -118,8 +125,76 @@ mangle_trace_at_end(void);
 typedef struct _trace_head_counter_t {
     app_pc tag;
     uint   counter;
+    uint   threshold; /* hot threshold for this head (-adaptive_trace_threshold) */
+    /* -trace_reform: the number of times this head's trace was re-formed,
+     * and whether the trace is unlinked waiting to be re-formed, which
+     * -opt_trace_threshold also uses to have a hot trace re-formed and optimized
+     */
+    uint   reforms;
+    bool   reform_pending;
+    bool   reform_optimize;
 } trace_head_counter_t;
 
+/* -ib_target_cache: the most targets compared against in-line at one site */
+#define IB_TARGET_CACHE_MAX 3
+/* targets tracked per site while profiling */
+#define IB_TARGET_SITE_SLOTS (IB_TARGET_CACHE_MAX + 1)
+/* each thread profiles one in this many of its bb indirect branch misses */
+#define IB_TARGET_SITE_SAMPLE 8
+
+/* -ib_target_cache: targets seen from the indirect call or jump ending the bb
+ * with this tag.  Once a trace ends in that bb the inlined targets are fixed
+ * for good, so that every trace ending there, and every recreation of one,
+ * emits the same code.  A flush of the bb's region removes the record from
+ * the lookup table, but traces still in the cache may bump its counters, so
+ * the memory is only freed at exit.
+ */
+typedef struct _ib_target_site_t {
+    app_pc tag;
+    app_pc seen[IB_TARGET_SITE_SLOTS];
+    uint   seen_count[IB_TARGET_SITE_SLOTS];
+    bool   frozen;
+    uint   num_inlined;
+    app_pc inlined[IB_TARGET_CACHE_MAX];
+    /* bumped from the cache under -ib_target_cache_stats */
+    uint   hits[IB_TARGET_CACHE_MAX];
+    uint   misses;
+    struct _ib_target_site_t *next_retired;
+} ib_target_site_t;
+
+ib_target_site_t *
+ib_target_site_lookup(app_pc tag);
+
+ib_target_site_t *
+ib_target_site_freeze(dcontext_t *dcontext, app_pc tag, app_pc speculate);
+
+void
+ib_target_site_range_remove(app_pc start, app_pc end);
+
+#ifdef CUSTOM_TRACES
+uint *
+trace_reform_exit_counter(app_pc tag);
+
+uint *
+trace_entry_counter(app_pc tag);
+#endif
+
+/* in arch/interp.c */
+int
+append_trace_ib_target_cache(dcontext_t *dcontext, instrlist_t *trace,
+                             app_pc site_tag, app_pc speculate,
+                             bool record_translation);
+
+#ifdef CUSTOM_TRACES
+int
+append_trace_side_exit_counts(dcontext_t *dcontext, instrlist_t *trace,
+                              app_pc tag, bool record_translation);
+
+int
+prepend_trace_entry_count(dcontext_t *dcontext, instrlist_t *trace, app_pc tag,
+                          bool record_translation);
+#endif
+
 typedef struct _trace_bb_build_t {
     trace_bb_info_t info;
     /* PR 299808: we need to check bb bounds at emit time.  Also used
@@ -150,6 +225,9 @@ typedef struct _monitor_data_t {
     trace_bb_build_t *blk_info;           /* info for all basic blocks making up trace */
     uint             blk_info_length;     /* length of blk_info array */
     uint             emitted_size;        /* calculated final trace size once emitted */
+    bool             trace_reform;        /* rebuilding an existing trace (-trace_reform) */
+    uint             trace_reform_bbs;    /* number of blocks in the trace being rebuilt */
+    bool             trace_reform_optimize; /* rebuilding it to optimize it */
 
     /* private copy of shared bb for trace building only
      * equals the previous last_fragment that was shared
@@ -163,6 +241,18 @@ typedef struct _monitor_data_t {
      */
     generic_table_t  *thead_table;
 
+    /* -adaptive_trace_threshold: the threshold given to new trace heads, and
+     * the feedback gathered since it was last adjusted
+     */
+    uint             th_threshold;
+    uint             th_epoch_traces;     /* traces emitted */
+    uint             th_epoch_aborts;     /* traces aborted */
+    uint             th_epoch_trace_exits; /* direct trace exits to dispatch */
+    uint             th_epoch_ibl_misses; /* indirect branch lookup misses */
+
+    /* -ib_target_cache: bb indirect branch misses until the next profiled one */
+    uint             ib_site_sample;
+
 #ifdef CLIENT_INTERFACE
     /* PR 299808: we re-build each bb and pass to the client */
     instrlist_t      unmangled_ilist;
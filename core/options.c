@@ -956,6 +956,40 @@ check_option_compatibility_helper(int recurse_count)
         SET_DEFAULT_VALUE(trace_counter_on_delete);
         changed_options = true;
     }
+    if (DYNAMO_OPTION(adaptive_trace_threshold) && !DYNAMO_OPTION(disable_traces)) {
+#ifdef TRACE_HEAD_CACHE_INCR
+        /* the cache increment routine compares against a single threshold */
+        USAGE_ERROR("-adaptive_trace_threshold not supported with "
+                    "TRACE_HEAD_CACHE_INCR, disabling");
+        dynamo_options.adaptive_trace_threshold = false;
+        changed_options = true;
+#endif
+        if (DYNAMO_OPTION(adaptive_trace_threshold_max) > USHRT_MAX) {
+            USAGE_ERROR("-adaptive_trace_threshold_max must be <= USHRT_MAX (%d), "
+                        "setting to max", USHRT_MAX);
+            dynamo_options.adaptive_trace_threshold_max = USHRT_MAX;
+            changed_options = true;
+        }
+        if (DYNAMO_OPTION(adaptive_trace_threshold_min) == 0 ||
+            DYNAMO_OPTION(adaptive_trace_threshold_min) >
+            INTERNAL_OPTION(trace_threshold) ||
+            DYNAMO_OPTION(adaptive_trace_threshold_min) <=
+            INTERNAL_OPTION(trace_counter_on_delete)) {
+            USAGE_ERROR("-adaptive_trace_threshold_min must be > trace_counter_on_delete"
+                        " and <= trace_threshold, setting to trace_threshold");
+            dynamo_options.adaptive_trace_threshold_min =
+                INTERNAL_OPTION(trace_threshold);
+            changed_options = true;
+        }
+        if (DYNAMO_OPTION(adaptive_trace_threshold_max) <
+            INTERNAL_OPTION(trace_threshold)) {
+            USAGE_ERROR("-adaptive_trace_threshold_max must be >= trace_threshold, "
+                        "setting to trace_threshold");
+            dynamo_options.adaptive_trace_threshold_max =
+                INTERNAL_OPTION(trace_threshold);
+            changed_options = true;
+        }
+    }
     if (INTERNAL_OPTION(alt_hash_func) >= HASH_FUNCTION_ENUM_MAX) {
         USAGE_ERROR("Invalid selection (%d) for shared cache hash func, must be < %d",
                     INTERNAL_OPTION(alt_hash_func),
@@ -1398,6 +1432,111 @@ check_option_compatibility_helper(int recurse_count)
         changed_options = true;
     }
 #endif
+    if (DYNAMO_OPTION(opt_traces_sideline)) {
+#if defined(CLIENT_SIDELINE) && !defined(MACOS) /* no client threads on Mac yet */
+        if (!DYNAMO_OPTION(opt_traces)) {
+            USAGE_ERROR("-opt_traces_sideline requires -opt_traces, enabling");
+            dynamo_options.opt_traces = true;
+            changed_options = true;
+        }
+        /* The helper thread swaps traces in place, which needs every thread to
+         * share the trace ibl tables.
+         */
+        if (DYNAMO_OPTION(shared_traces) && !DYNAMO_OPTION(shared_trace_ibt_tables)) {
+            USAGE_ERROR("-opt_traces_sideline requires -shared_trace_ibt_tables, "
+                        "enabling");
+            dynamo_options.shared_trace_ibt_tables = true;
+            changed_options = true;
+        }
+#else
+        USAGE_ERROR("-opt_traces_sideline not supported in this build, disabling");
+        dynamo_options.opt_traces_sideline = false;
+        changed_options = true;
+#endif
+    }
+    if (DYNAMO_OPTION(trace_reform)) {
+#ifdef CUSTOM_TRACES
+        /* A re-formed shared trace is swapped in without a flush, which needs
+         * every thread to share the trace ibl tables.
+         */
+        if (DYNAMO_OPTION(shared_traces) && !DYNAMO_OPTION(shared_trace_ibt_tables)) {
+            USAGE_ERROR("-trace_reform requires -shared_trace_ibt_tables, enabling");
+            dynamo_options.shared_trace_ibt_tables = true;
+            changed_options = true;
+        }
+#else
+        /* we need shadowed trace heads to build through trace boundaries */
+        USAGE_ERROR("-trace_reform not supported in this build, disabling");
+        dynamo_options.trace_reform = false;
+        changed_options = true;
+#endif
+    }
+    if (DYNAMO_OPTION(opt_trace_threshold) > 0) {
+#if defined(CUSTOM_TRACES) && defined(X86)
+        if (!DYNAMO_OPTION(opt_traces)) {
+            USAGE_ERROR("-opt_trace_threshold requires -opt_traces, enabling");
+            dynamo_options.opt_traces = true;
+            changed_options = true;
+        }
+        /* hot traces are re-formed in place, as for -trace_reform */
+        if (DYNAMO_OPTION(shared_traces) && !DYNAMO_OPTION(shared_trace_ibt_tables)) {
+            USAGE_ERROR("-opt_trace_threshold requires -shared_trace_ibt_tables, "
+                        "enabling");
+            dynamo_options.shared_trace_ibt_tables = true;
+            changed_options = true;
+        }
+#else
+        /* the execution counts are x86-only and traces are re-formed to be
+         * optimized
+         */
+        USAGE_ERROR("-opt_trace_threshold not supported in this build, disabling");
+        dynamo_options.opt_trace_threshold = 0;
+        changed_options = true;
+#endif
+    }
+    if (DYNAMO_OPTION(ib_target_cache) > 0) {
+#ifdef X86
+        if (DYNAMO_OPTION(ib_target_cache) > IB_TARGET_CACHE_MAX) {
+            USAGE_ERROR("-ib_target_cache can be at most %d", IB_TARGET_CACHE_MAX);
+            dynamo_options.ib_target_cache = IB_TARGET_CACHE_MAX;
+            changed_options = true;
+        }
+        /* both would add exits after the final indirect branch of a trace */
+        if (DYNAMO_OPTION(speculate_last_exit)) {
+            USAGE_ERROR("-ib_target_cache supersedes -speculate_last_exit, disabling "
+                        "the latter");
+            dynamo_options.speculate_last_exit = false;
+            changed_options = true;
+        }
+#else
+        /* FIXME i#1551, i#1569: no traces on ARM/AArch64 yet */
+        USAGE_ERROR("-ib_target_cache not supported on this platform, disabling");
+        dynamo_options.ib_target_cache = 0;
+        changed_options = true;
+#endif
+    }
+    if (DYNAMO_OPTION(shadow_return_stack)) {
+#if defined(UNIX) && defined(X86) && defined(X64)
+        /* landing pads are extra mid-bb exits, which coarse bbs cannot have,
+         * and trace building relies on decode_fragment(), which does not
+         * support -x86_to_x64
+         */
+        if (DYNAMO_OPTION(coarse_units) || DYNAMO_OPTION(x86_to_x64)) {
+            USAGE_ERROR("-shadow_return_stack incompatible with -coarse_units and "
+                        "-x86_to_x64, disabling");
+            dynamo_options.shadow_return_stack = false;
+            changed_options = true;
+        }
+#else
+        /* Landing pcs are materialized rip-relative so that decode_fragment()
+         * can retarget them when a bb is copied into a trace.
+         */
+        USAGE_ERROR("-shadow_return_stack only supported on 64-bit x86 Linux, "
+                    "disabling");
+        dynamo_options.shadow_return_stack = false;
+        changed_options = true;
+#endif
+    }
 #ifdef WINDOWS
     if (DYNAMO_OPTION(shared_fragment_shared_syscalls) &&
         !DYNAMO_OPTION(shared_syscalls)) {
@@ -1903,6 +2042,16 @@ check_option_compatibility_helper(int recurse_count)
     }
 #endif
 
+#ifdef AARCHXX
+    if (DYNAMO_OPTION(coarse_units)) {
+        /* i#1575: coarse-grain units, and so persisted caches, are NYI on ARM
+         * and AArch64.  This also undoes -persist and, on Linux, -persist_dir.
+         */
+        USAGE_ERROR("-coarse_units not supported on this platform, disabling");
+        dynamo_options.coarse_units = false;
+        changed_options = true;
+    }
+#endif
     if (DYNAMO_OPTION(coarse_units)) {
 #ifdef CUSTOM_EXIT_STUBS
         USAGE_ERROR("-coarse_units incompatible with CUSTOM_EXIT_STUBS: disabling");
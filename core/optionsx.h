@@ -734,6 +734,29 @@
     OPTION_INTERNAL(bool, nop_initial_bblock,
                     "nop bb building lock until 2nd thread is created")
 
+    /* Release-mode hot trace optimizations: see optimize_hot_trace().
+     * Each pass is individually controllable; -opt_traces enables the stage.
+     */
+    OPTION_DEFAULT(bool, opt_traces, false, "optimize hot traces as they are emitted")
+    OPTION_DEFAULT(bool, opt_trace_nops, true,
+                   "with -opt_traces, remove app nops from traces")
+    OPTION_DEFAULT(bool, opt_trace_stack_adjust, true,
+                   "with -opt_traces, fold adjacent stack pointer adjustments in traces")
+    OPTION_DEFAULT(bool, opt_trace_redundant_loads, true,
+                   "with -opt_traces, replace reloads of stack slots with register copies")
+    /* Emits traces unoptimized, counting their executions in the cache, and
+     * re-forms and optimizes each one that runs this many times.  0 optimizes
+     * every trace as it is built.  Requires -shared_trace_ibt_tables.
+     */
+    OPTION_DEFAULT(uint, opt_trace_threshold, 0,
+                   "with -opt_traces, optimize a trace once it has run this many times")
+    /* Moves the -opt_traces passes for shared traces onto a DR-owned helper
+     * thread, which swaps each optimized copy in for the original trace.
+     * Requires -shared_trace_ibt_tables.
+     */
+    OPTION_DEFAULT(bool, opt_traces_sideline, false,
+                   "with -opt_traces, optimize shared traces on a helper thread")
+
      /* INTERNAL options */
      /* These options should be used with a wrapper INTERNAL_OPTION(opt) which in external */
      /* builds is turned into the default value, hence all non-default code is dead.  */
@@ -764,6 +787,30 @@
      }, "enable trace creation", STATIC, OP_PCACHE_GLOBAL)
     OPTION_DEFAULT_INTERNAL(uint, trace_counter_on_delete, 0U,
         "trace head counter will be reset to this value upon trace deletion")
+    /* Gives each trace head its own hot threshold, starting from -trace_threshold.
+     * An aborted trace raises its head's threshold, and every few traces a thread
+     * moves the starting threshold for its new heads based on its recent trace
+     * exit, trace abort, and indirect branch lookup miss rates.
+     */
+    OPTION_DEFAULT(bool, adaptive_trace_threshold, false,
+        "adapt per-trace-head hot thresholds from runtime feedback")
+    OPTION_DEFAULT(uint, adaptive_trace_threshold_min, 8U,
+        "lowest hot threshold -adaptive_trace_threshold will use")
+    OPTION_DEFAULT(uint, adaptive_trace_threshold_max, 1024U,
+        "highest hot threshold -adaptive_trace_threshold will use")
+    /* Has the conditional side exits of each trace count themselves in the
+     * cache.  Once a trace has taken -trace_reform_threshold of them, it is
+     * rebuilt from its head the next time it is entered or left through
+     * dispatch, along the path now being executed, continuing through other
+     * trace heads, and the new trace replaces the old one in place.
+     * Requires -shared_trace_ibt_tables.
+     */
+    OPTION_DEFAULT(bool, trace_reform, false,
+        "rebuild traces that are mostly left via side exits")
+    OPTION_DEFAULT(uint, trace_reform_threshold, 64U,
+        "side exits after which -trace_reform rebuilds a trace")
+    OPTION_DEFAULT(uint, trace_reform_max, 2U,
+        "maximum number of times -trace_reform rebuilds one trace")
 
     OPTION_DEFAULT(uint, max_elide_jmp,  16,
         "maximum direct jumps to elide in a basic block")
@@ -792,6 +839,9 @@
     /* PR 361894: if no TLS available, we fall back to thread-private */
     PC_OPTION_DEFAULT(bool, shared_bbs, IF_HAVE_TLS_ELSE(true, false),
                       "use thread-shared basic blocks")
+    OPTION_DEFAULT(bool, parallel_bb_build, false,
+        "build shared basic blocks in parallel, holding the bb building lock "
+        "only to emit them into the cache")
     /* Note that if we want traces off by default we would have to turn
      * off -shared_traces to avoid tripping over un-initialized ibl tables
      * PR 361894: if no TLS available, we fall back to thread-private
@@ -821,7 +871,7 @@
         options->finite_bb_cache = !options->thread_private;
         options->finite_trace_cache = !options->thread_private;
         if (options->thread_private && options->indirect_stubs)
-            IF_NOT_ARM(options->coarse_units = true); /* i#1575: coarse NYI on ARM */
+            IF_NOT_AARCHXX(options->coarse_units = true); /* i#1575: coarse NYI on ARM */
         IF_NOT_X64_OR_ARM(options->private_ib_in_tls = !options->thread_private;)
         options->atomic_inlined_linking = !options->thread_private;
         options->shared_trace_ibl_routine = !options->thread_private;
@@ -930,6 +980,13 @@
     OPTION_DEFAULT(bool, ibl_table_in_tls, IF_HAVE_TLS_ELSE(true, false),
         "use TLS to hold IBL table addresses & masks")
 
+    /* Hashes each IBL target to the start of a cache line so that a lookup and
+     * its first few collisions share one line; the x86 collision path also
+     * prefetches the following line.
+     */
+    OPTION_DEFAULT(bool, ibl_table_buckets, false,
+        "hash IBL table entries to cache-line sized buckets")
+
     /* FIXME i#1551, i#1569: enable traces on ARM/AArch64 once we have them working */
     OPTION_DEFAULT(bool, bb_ibl_targets, IF_X86_ELSE(false, true), "enable BB to BB IBL")
 
@@ -987,6 +1044,21 @@
                    "share ibl routine for traces")
     OPTION_DEFAULT(bool, speculate_last_exit, false,
         "enable speculative linking of trace last IB exit")
+    /* Indirect calls and jumps ending a bb record the targets they miss the
+     * IBL on; when such a bb ends a trace, up to this many of its top targets
+     * are compared against in-line, each with its own direct exit, before
+     * falling back to the IBL.
+     */
+    OPTION_DEFAULT(uint, ib_target_cache, 0,
+        "inline this many (max 3) profiled targets of a trace's final indirect branch")
+    OPTION_DEFAULT(bool, ib_target_cache_stats, false,
+        "count -ib_target_cache hits and misses per site in the cache")
+    /* Mangled calls push (return address, landing pc) onto a per-thread ring
+     * and mangled returns pop it; the return IBL checks the popped entry
+     * before hashing and on a match jumps to a direct exit in the caller.
+     */
+    OPTION_DEFAULT(bool, shadow_return_stack, false,
+        "predict returns with a per-thread shadow stack of call sites")
 
     OPTION_DEFAULT(uint, max_trace_bbs, 128, "maximum number of basic blocks in a trace")
 
@@ -2164,27 +2236,41 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     OPTION_DEFAULT(bool, persist_trust_textrel, true,
         "if textrel flag is not set, assume module has no text relocs")
 #endif
+    /* The convenience option -persist below.  We define it here so that
+     * -persist_dir can use it.
+     */
+#   define ENABLE_PERSIST(prefix)                                              \
+    {                                                                          \
+            (prefix)->persist = true;                                          \
+            ENABLE_COARSE_UNITS(prefix);                                       \
+            (prefix)->coarse_enable_freeze = true;                             \
+            (prefix)->coarse_freeze_at_exit = true;                            \
+            (prefix)->coarse_freeze_at_unload = true;                          \
+            (prefix)->use_persisted = true;                                    \
+            /* these two are for correctness */                                \
+            IF_UNIX((prefix)->coarse_split_calls = true;)                      \
+            IF_X64((prefix)->coarse_split_riprel = true;)                      \
+            /* FIXME: i#660: not compatible w/ Probe API */                    \
+            IF_CLIENT_INTERFACE(DISABLE_PROBE_API(prefix);)                    \
+            /* i#1051: disable reset until we decide how it interacts w/ pcaches */\
+            DISABLE_RESET(prefix);                                             \
+    }
     /* the DYNAMORIO_VAR_PERSCACHE_ROOT config var takes precedence over this */
-    OPTION_DEFAULT(pathstring_t, persist_dir, EMPTY_STRING,
-        "base per-user directory for persistent caches")
+    OPTION_COMMAND(pathstring_t, persist_dir, EMPTY_STRING, "persist_dir", {
+        /* On UNIX, naming a cache directory is enough to turn on persistence:
+         * nothing else there needs the directory.  A later -no_persist still
+         * turns it off.
+         */
+        IF_UNIX(if (options->persist_dir[0] != '\0' && !options->persist)
+                    ENABLE_PERSIST(options);)
+     }, "base per-user directory for persistent caches", STATIC, OP_PCACHE_NOP)
     /* the DYNAMORIO_VAR_PERSCACHE_SHARED config var takes precedence over this */
     OPTION_DEFAULT(pathstring_t, persist_shared_dir, EMPTY_STRING,
         "base shared directory for persistent caches")
     /* convenience option */
     OPTION_COMMAND(bool, persist, false, "persist", {
         if (options->persist) {
-            ENABLE_COARSE_UNITS(options);
-            options->coarse_enable_freeze = true;
-            options->coarse_freeze_at_exit = true;
-            options->coarse_freeze_at_unload = true;
-            options->use_persisted = true;
-            /* these two are for correctness */
-            IF_UNIX(options->coarse_split_calls = true;)
-            IF_X64(options->coarse_split_riprel = true;)
-            /* FIXME: i#660: not compatible w/ Probe API */
-            IF_CLIENT_INTERFACE(DISABLE_PROBE_API(options);)
-            /* i#1051: disable reset until we decide how it interacts w/ pcaches */
-            DISABLE_RESET(options);
+            ENABLE_PERSIST(options);
         } else {
             options->coarse_enable_freeze = false;
             options->use_persisted = false;
@@ -111,38 +111,34 @@ coarse_unit_mark_primary(coarse_info_t *info)
 {
     if (!info->in_use)
         return;
-#ifdef WINDOWS
-    /* FIXME PR 295529: put in for Linux once we have per-module flags */
     /* Go ahead and get write lock up front; else have to check again; not
      * frequently called so don't need perf opt here.
      */
     os_get_module_info_write_lock();
     if (!os_module_get_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE)) {
-        os_module_set_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE);
-        ASSERT(os_module_get_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE));
+        /* A unit outside of any module (possible on UNIX, where units are
+         * not restricted to images) has nothing to coordinate with.
+         */
+        DEBUG_DECLARE(bool found =)
+            os_module_set_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE);
+        ASSERT(IF_UNIX(!found ||)
+               os_module_get_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE));
         info->primary_for_module = true;
         LOG(GLOBAL, LOG_CACHE, 1, "marking "PFX"-"PFX" as primary coarse for %s\n",
             info->base_pc, info->end_pc, info->module);
     }
     os_get_module_info_write_unlock();
-#else
-    info->primary_for_module = true;
-#endif
 }
 
 static void
 coarse_unit_unmark_primary(coarse_info_t *info)
 {
-#ifdef WINDOWS
-    /* FIXME PR 295529: put in for Linux once we have per-module flags */
     if (info->primary_for_module && info->in_use) {
-        ASSERT(os_module_get_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE));
+        ASSERT(os_module_get_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE)
+               IF_UNIX(|| !pc_is_in_module(info->base_pc)));
         os_module_clear_flag(info->base_pc, MODULE_HAS_PRIMARY_COARSE);
-        info->primary_for_module = false;
     }
-#else
     info->primary_for_module = false;
-#endif
 }
 
 void
@@ -4108,7 +4104,10 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
     info->frozen = true;
     info->persisted = true;
     info->has_persist_info = true;
-    info->persist_base = pers->modinfo.base;
+    /* Persisted stubs hold persist-time app pcs for targets in this unit,
+     * which dispatch and stub lookups shift by mod_shift.
+     */
+    info->persist_base = pers->modinfo.base + pers->start_offs;
     info->mod_shift = (pers->modinfo.base - modbase);
     info->mmap_pc = map;
     if (map2 != NULL) {
@@ -4416,3 +4415,74 @@ mark_module_exempted(app_pc pc)
     }
 }
 
+
+/****************************************************************************
+ * Tests
+ */
+
+#if defined(STANDALONE_UNIT_TEST) && defined(UNIX)
+
+static void
+test_init_unit(coarse_info_t *info, app_pc base_pc)
+{
+    memset(info, 0, sizeof(*info));
+    info->base_pc = base_pc;
+    info->end_pc = base_pc + PAGE_SIZE;
+    info->in_use = true;
+    DODEBUG({ info->module = "test"; });
+}
+
+/* Only one unit per module may be primary, which is what keeps two units of the
+ * same module from persisting to the same file.
+ */
+static void
+test_mark_primary(void)
+{
+    /* Our own image is the module: it is the only one we know is mapped.
+     * Standalone init does not set up the module list, so we do.
+     */
+    app_pc base = get_dynamorio_dll_start();
+    size_t size = get_dynamorio_dll_end() - base;
+    coarse_info_t first, second, outside;
+    int on_stack;
+
+    modules_init();
+    module_list_add(base, size, false/*!at_map*/, "unit_tests", 0/*inode*/);
+    test_init_unit(&first, base);
+    test_init_unit(&second, base + PAGE_SIZE);
+    test_init_unit(&outside, (app_pc) ALIGN_BACKWARD(&on_stack, PAGE_SIZE));
+    EXPECT(pc_is_in_module(outside.base_pc), false);
+
+    coarse_unit_mark_primary(&first);
+    EXPECT(first.primary_for_module, true);
+    EXPECT(os_module_get_flag(base, MODULE_HAS_PRIMARY_COARSE), true);
+    coarse_unit_mark_primary(&second);
+    EXPECT(second.primary_for_module, false);
+
+    /* Giving up primary status lets the next unit take it. */
+    coarse_unit_unmark_primary(&first);
+    EXPECT(first.primary_for_module, false);
+    EXPECT(os_module_get_flag(base, MODULE_HAS_PRIMARY_COARSE), false);
+    coarse_unit_mark_primary(&second);
+    EXPECT(second.primary_for_module, true);
+    coarse_unit_unmark_primary(&second);
+
+    /* A unit outside of any module has nothing to coordinate with. */
+    coarse_unit_mark_primary(&outside);
+    EXPECT(outside.primary_for_module, true);
+    coarse_unit_unmark_primary(&outside);
+    EXPECT(outside.primary_for_module, false);
+
+    /* This also drops our module, without the unload processing of
+     * module_list_remove() that needs a full DR.
+     */
+    modules_exit();
+}
+
+void
+unit_test_perscache(void)
+{
+    test_mark_primary();
+}
+
+#endif /* STANDALONE_UNIT_TEST && UNIX */
@@ -39,6 +39,10 @@ void unit_test_io(void);
 #ifdef UNIX
 void unit_test_string(void);
 void unit_test_os(void);
+void unit_test_perscache(void);
+#endif
+#ifdef LINUX
+void unit_test_module_elf(void);
 #endif
 void unit_test_options(void);
 void unit_test_vmareas(void);
@@ -63,6 +67,10 @@ main(int argc, char **argv, char **envp)
 #ifdef UNIX
     unit_test_string();
     unit_test_os();
+    unit_test_perscache();
+#endif
+#ifdef LINUX
+    unit_test_module_elf();
 #endif
     unit_test_utils();
     unit_test_options();
@@ -512,7 +512,14 @@ memcache_handle_mmap(dcontext_t *dcontext, app_pc base, size_t size,
             area_start, area_end, info->prot);
         /* can't hold lock across call to app_memory_protection_change */
         memcache_unlock();
-        if (info->prot != memprot) {
+        if (info->prot != memprot &&
+            /* The loader maps each ELF segment over its initial non-executable
+             * reservation of the whole module.  Nothing there can be on the
+             * executable list, and treating the text segment as data made
+             * executable would add it as non-image code, which in turn keeps
+             * process_mmap() from adding it as a coarse-grain module region.
+             */
+            (!image || TEST(MEMPROT_EXEC, info->prot))) {
             /* We detect some alloc-based prot changes here.  app_memory_pre_alloc()
              * should have already processed these (i#1175) but no harm calling
              * app_memory_protection_change() again just in case.
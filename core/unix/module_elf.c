@@ -357,6 +357,41 @@ module_segment_prot_to_osprot(ELF_PROGRAM_HEADER_TYPE *prog_hdr)
 
 #ifndef NOT_DYNAMORIO_CORE_PROPER
 
+/* PR 295534: if the module has a GNU build-id note, we use it as the module
+ * checksum for persisted cache naming and validation.  Unlike the first-page crc
+ * used otherwise, it changes on any rebuild and is stable across runs and
+ * load addresses.
+ */
+static bool
+module_fill_build_id(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_NOTE entry */
+                     app_pc base, size_t view_size, bool at_map,
+                     ptr_int_t load_delta, OUT os_module_data_t *out_data)
+{
+    app_pc note = at_map ? base + prog_hdr->p_offset :
+        (app_pc)prog_hdr->p_vaddr + load_delta;
+    app_pc note_end = note + prog_hdr->p_filesz;
+    ASSERT(prog_hdr->p_type == PT_NOTE);
+    /* Only the view we were handed is guaranteed to be accessible. */
+    if (note < base || note_end > base + view_size)
+        return false;
+    while (note + sizeof(ELF_NOTE_TYPE) <= note_end) {
+        ELF_NOTE_TYPE *nhdr = (ELF_NOTE_TYPE *) note;
+        app_pc name = note + sizeof(*nhdr);
+        app_pc desc = name + ALIGN_FORWARD(nhdr->n_namesz, 4);
+        if (desc + nhdr->n_descsz > note_end)
+            break;
+        if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+            memcmp(name, "GNU", 4) == 0 && nhdr->n_descsz > 0) {
+            out_data->checksum = crc32((const char *)desc, nhdr->n_descsz);
+            LOG(GLOBAL, LOG_VMAREAS, 2, "%s: build-id checksum "PIFX"\n",
+                __FUNCTION__, out_data->checksum);
+            return true;
+        }
+        note = desc + ALIGN_FORWARD(nhdr->n_descsz, 4);
+    }
+    return false;
+}
+
 /* common code to fill os_module_data_t for loader and module_area_t */
 static bool
 module_fill_os_data(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_DYNAMIC entry */
@@ -561,6 +596,17 @@ module_walk_program_headers(app_pc base, size_t view_size, bool at_map, bool dyn
                 });
             }
         }
+        /* We look for a build-id after the dynamic section so that it takes
+         * precedence over DT_CHECKSUM.
+         */
+        for (i = 0; out_data != NULL && i < elf_hdr->e_phnum; i++) {
+            ELF_PROGRAM_HEADER_TYPE *prog_hdr = (ELF_PROGRAM_HEADER_TYPE *)
+                (base + elf_hdr->e_phoff + i * elf_hdr->e_phentsize);
+            if (prog_hdr->p_type == PT_NOTE &&
+                module_fill_build_id(prog_hdr, base, view_size, at_map,
+                                     load_delta, out_data))
+                break;
+        }
     }
     ASSERT_CURIOSITY(found_load && mod_base != (app_pc)POINTER_MAX &&
                      max_end != (app_pc)0);
@@ -2188,3 +2234,75 @@ elf_loader_find_pt_interp(elf_loader_t *elf)
     return NULL;
 }
 
+
+/****************************************************************************
+ * Tests
+ */
+
+#ifdef STANDALONE_UNIT_TEST
+
+/* Appends a note with the given name and descriptor at *pos. */
+static void
+test_add_note(byte **pos, uint type, const char *name, const byte *desc,
+              uint desc_size)
+{
+    ELF_NOTE_TYPE *nhdr = (ELF_NOTE_TYPE *) *pos;
+    byte *name_pos = *pos + sizeof(*nhdr);
+    byte *desc_pos;
+    nhdr->n_namesz = (uint) strlen(name) + 1;
+    nhdr->n_descsz = desc_size;
+    nhdr->n_type = type;
+    memcpy(name_pos, name, nhdr->n_namesz);
+    desc_pos = name_pos + ALIGN_FORWARD(nhdr->n_namesz, 4);
+    memcpy(desc_pos, desc, desc_size);
+    *pos = desc_pos + ALIGN_FORWARD(desc_size, 4);
+}
+
+static void
+test_build_id(void)
+{
+    static const byte id[] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+                               0x0f, 0xed, 0xcb, 0xa9, 0x87, 0x65, 0x43, 0x21,
+                               0x11, 0x22, 0x33, 0x44 };
+    static const byte abi[] = { 0, 0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0 };
+    ptr_uint_t buf[64]; /* pointer-sized for note alignment */
+    byte *image = (byte *) buf;
+    byte *pos = image + 0x40;
+    ELF_PROGRAM_HEADER_TYPE phdr;
+    os_module_data_t data;
+
+    memset(buf, 0, sizeof(buf));
+    /* An unrelated note first, as in most binaries. */
+    test_add_note(&pos, NT_GNU_ABI_TAG, "GNU", abi, sizeof(abi));
+    test_add_note(&pos, NT_GNU_BUILD_ID, "GNU", id, sizeof(id));
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type = PT_NOTE;
+    phdr.p_offset = 0x40;
+    phdr.p_filesz = pos - (image + 0x40);
+
+    memset(&data, 0, sizeof(data));
+    EXPECT(module_fill_build_id(&phdr, image, sizeof(buf), true/*at_map*/, 0,
+                                &data), true);
+    EXPECT(data.checksum == crc32((const char *)id, sizeof(id)), true);
+
+    /* A build-id cut off by the end of the segment is ignored. */
+    memset(&data, 0, sizeof(data));
+    phdr.p_filesz -= 4;
+    EXPECT(module_fill_build_id(&phdr, image, sizeof(buf), true/*at_map*/, 0,
+                                &data), false);
+    EXPECT(data.checksum, 0);
+    phdr.p_filesz += 4;
+
+    /* So is a note segment beyond the view we can read. */
+    EXPECT(module_fill_build_id(&phdr, image, 0x40, true/*at_map*/, 0,
+                                &data), false);
+    EXPECT(data.checksum, 0);
+}
+
+void
+unit_test_module_elf(void)
+{
+    test_build_id();
+}
+
+#endif /* STANDALONE_UNIT_TEST */
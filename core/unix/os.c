@@ -4308,10 +4308,28 @@ os_rename_file(const char *orig_name, const char *new_name, bool replace)
 {
     ptr_int_t res;
     if (!replace) {
-        /* SYS_rename replaces so we must test beforehand => could have race */
-        /* _LARGEFILE64_SOURCE should make libc struct match kernel (see top of file) */
+        /* SYS_rename replaces, so to avoid racing with a concurrent writer
+         * (e.g., two processes persisting the same module) we first try a
+         * hard link, which fails atomically with EEXIST, and then remove
+         * the original name.
+         */
         struct stat64 st;
-        ptr_int_t res = dynamorio_syscall_stat(new_name, &st);
+#ifdef SYS_link
+        res = dynamorio_syscall(SYS_link, 2, orig_name, new_name);
+#else
+        res = dynamorio_syscall(SYS_linkat, 5, AT_FDCWD, orig_name,
+                                AT_FDCWD, new_name, 0);
+#endif
+        if (res == 0) {
+            os_delete_file(orig_name);
+            return true;
+        } else if (res == -EEXIST)
+            return false;
+        /* Hard links are not supported everywhere (e.g., FAT or some network
+         * filesystems), so we fall back to a test that could have a race.
+         */
+        /* _LARGEFILE64_SOURCE should make libc struct match kernel (see top of file) */
+        res = dynamorio_syscall_stat(new_name, &st);
         if (res == 0)
             return false;
         else if (res != -ENOENT) {
@@ -8867,6 +8885,21 @@ find_executable_vm_areas(void)
     count = find_vm_areas_via_probe();
 #else
     memquery_iter_t iter;
+# ifndef HAVE_MEMINFO_QUERY
+    if (DYNAMO_OPTION(use_persisted)) {
+        /* Loading a persisted cache for a module found below digests the
+         * module's later segments, which the walk has not reached yet, so we
+         * give all_memory_areas every region up front.  The walk then sets
+         * each region's type.
+         */
+        memquery_iterator_start(&iter, NULL, true/*may alloc*/);
+        while (memquery_iterator_next(&iter)) {
+            memcache_update_locked(iter.vm_start, iter.vm_end, iter.prot,
+                                   DR_MEMTYPE_DATA, false/*!exists*/);
+        }
+        memquery_iterator_stop(&iter);
+    }
+# endif
     memquery_iterator_start(&iter, NULL, true/*may alloc*/);
     while (memquery_iterator_next(&iter)) {
         bool image = false;
@@ -10434,10 +10467,71 @@ test_uint64_divmod(void)
 #endif /* X86_32 */
 }
 
+static void
+test_rename_write_file(const char *name, char contents)
+{
+    file_t f = os_open(name, OS_OPEN_WRITE);
+    EXPECT(f != INVALID_FILE, true);
+    EXPECT(os_write(f, &contents, 1), 1);
+    os_close(f);
+}
+
+static char
+test_rename_read_file(const char *name)
+{
+    char contents = '\0';
+    file_t f = os_open(name, OS_OPEN_READ);
+    EXPECT(f != INVALID_FILE, true);
+    EXPECT(os_read(f, &contents, 1), 1);
+    os_close(f);
+    return contents;
+}
+
+/* The persisted cache code relies on a no-replace rename failing, rather than
+ * clobbering, when another process has already published the same file.
+ */
+static void
+test_rename_no_replace(void)
+{
+    char orig[MAXIMUM_PATH];
+    char other[MAXIMUM_PATH];
+    char target[MAXIMUM_PATH];
+    snprintf(orig, BUFFER_SIZE_ELEMENTS(orig), "/tmp/dr_rename.%d.orig",
+             get_process_id());
+    NULL_TERMINATE_BUFFER(orig);
+    snprintf(other, BUFFER_SIZE_ELEMENTS(other), "/tmp/dr_rename.%d.other",
+             get_process_id());
+    NULL_TERMINATE_BUFFER(other);
+    snprintf(target, BUFFER_SIZE_ELEMENTS(target), "/tmp/dr_rename.%d.target",
+             get_process_id());
+    NULL_TERMINATE_BUFFER(target);
+    os_delete_file(target);
+
+    /* Publishing to a new name moves the file. */
+    test_rename_write_file(orig, 'a');
+    EXPECT(os_rename_file(orig, target, false/*do not replace*/), true);
+    EXPECT(os_file_exists(orig, false), false);
+    EXPECT(test_rename_read_file(target), 'a');
+
+    /* A second writer loses and keeps its own file. */
+    test_rename_write_file(other, 'b');
+    EXPECT(os_rename_file(other, target, false/*do not replace*/), false);
+    EXPECT(os_file_exists(other, false), true);
+    EXPECT(test_rename_read_file(target), 'a');
+
+    /* Replacing is still allowed when asked for. */
+    EXPECT(os_rename_file(other, target, true/*replace*/), true);
+    EXPECT(os_file_exists(other, false), false);
+    EXPECT(test_rename_read_file(target), 'b');
+
+    EXPECT(os_delete_file(target), true);
+}
+
 void
 unit_test_os(void)
 {
     test_uint64_divmod();
+    test_rename_no_replace();
 }
 
 #endif /* STANDALONE_UNIT_TEST */
@@ -42,12 +42,13 @@
  */
 #if defined(UNIX) && defined(X86)
 # ifdef X64
+/* These include spill_state_t.shadow_ret_top. */
 #  ifdef HASHTABLE_STATISTICS
+#   define TLS_MAGIC_OFFSET_ASM  112
+#   define TLS_SELF_OFFSET_ASM   104
+#  else
 #   define TLS_MAGIC_OFFSET_ASM  104
 #   define TLS_SELF_OFFSET_ASM    96
-#  else
-#   define TLS_MAGIC_OFFSET_ASM   96
-#   define TLS_SELF_OFFSET_ASM    88
 #  endif
 #  define TLS_APP_SELF_OFFSET_ASM 16
 # else
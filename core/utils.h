@@ -518,6 +518,9 @@ enum {
 #endif
 #ifdef WINDOWS
     LOCK_RANK(alt_tls_lock),
+#endif
+#ifdef CLIENT_SIDELINE
+    LOCK_RANK(trace_sideline_lock),
 #endif
     /* ADD HERE a lock around section that may allocate memory */
 
@@ -886,6 +889,15 @@ extern bool dr_modload_hook_exists(void); /* hard to include instrument.h here *
     if (USE_BB_BUILDING_LOCK() && bb_building_lock.lock_requests > LOCK_FREE_STATE) \
         mutex_unlock(&(bb_building_lock));                                   \
 } while (0)
+/* With -parallel_bb_build, dispatch does not acquire the bb_building_lock
+ * up front: build_basic_block_fragment() decodes, instruments, and mangles
+ * without it and only acquires it to emit and add to the table.  We keep
+ * full serialization when first-execution module load events must precede
+ * every bb event in that module (i#884).
+ */
+#define PARALLEL_BB_BUILD()                                                  \
+    (DYNAMO_OPTION(parallel_bb_build) && USE_BB_BUILDING_LOCK() &&            \
+     !dr_modload_hook_exists())
 /* we assume dynamo_resetting is only done w/ all threads suspended */
 #define NEED_SHARED_LOCK(flags)                                          \
     (TEST(FRAG_SHARED, (flags)) && !INTERNAL_OPTION(single_thread_in_DR) \
@@ -5999,6 +5999,20 @@ app_memory_pre_alloc(dcontext_t *dcontext, byte *base, size_t size, uint prot,
                  */
                 return false;
             }
+#ifdef UNIX
+            /* The loader maps each ELF segment over its initial non-executable
+             * reservation of the whole module.  There is nothing to flush, and
+             * we leave it to process_mmap() to add the text segment as part of
+             * the module: treating it here as data made executable would add it
+             * as non-image, fine-grained code.
+             */
+            if (!TEST(MEMPROT_EXEC, info.prot) && pc_is_in_module(pb)) {
+                if (POINTER_OVERFLOW_ON_ADD(info.base_pc, info.size))
+                    break;
+                pb = info.base_pc + info.size;
+                continue;
+            }
+#endif
             res = app_memory_protection_change(dcontext, pb, change_sz, prot,
                                                &subset_memprot, NULL);
             if (res != DO_APP_MEM_PROT_CHANGE) {
@@ -0,0 +1,609 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Containers DynamoRIO Extension: DrHashmap */
+
+#include "dr_api.h"
+#include "drhashmap.h"
+#include "containers_private.h"
+#include <stddef.h> /* offsetof */
+#include <string.h> /* memset */
+
+/* A slot is empty while its key is NULL.  Once a key is stored in a slot it
+ * never changes for the life of that table: removal just clears the payload,
+ * and a later add of the same key reuses the slot.  Readers can thus match a
+ * key and then read its payload without ever seeing another key's payload.
+ * Removed slots are dropped when the table is next rebuilt.
+ */
+typedef struct _map_slot_t {
+    void * volatile key;
+    void * volatile payload;
+} map_slot_t;
+
+typedef struct _map_table_t {
+    uint bits;
+    uint used; /* slots holding a key, including removed ones */
+    struct _map_table_t *next_retired;
+    ptr_uint_t retire_epoch; /* map epoch that retired this table */
+    map_slot_t slots[1]; /* variable-length */
+} map_table_t;
+
+#define MAP_CAPACITY(bits) (1U << (bits))
+#define MAP_TABLE_SIZE(bits) \
+    (offsetof(map_table_t, slots) + MAP_CAPACITY(bits) * sizeof(map_slot_t))
+/* Beyond this % of used slots we rebuild even if resizing is disabled, as
+ * probe sequences would grow without bound and a full table never ends a miss.
+ */
+#define MAP_MAX_LOAD 90
+
+/* Each thread that looks up in a map gets its own record, on its own cache line,
+ * in which it publishes the map epoch it saw for the duration of a lookup.  A
+ * retired table is tagged with the epoch that retired it, and can be freed once
+ * no thread is in a lookup that started with an older epoch.  Lookups thus only
+ * write to their own thread's line, and a lookup that starts after a table is
+ * retired never holds it up, so reclamation cannot be starved by a steady stream
+ * of lookups.
+ */
+#define MAP_CACHE_LINE 64
+
+typedef struct _map_thread_t {
+    volatile ptr_uint_t epoch; /* 0 while not in a lookup */
+    void *drcontext;
+    void *alloc; /* the unaligned allocation holding this record */
+} map_thread_t;
+
+/* An open-addressed set of thread records keyed by drcontext.  Records are only
+ * ever added, so readers probe it without a lock.  Once half full it is not
+ * added to any more: a larger one is chained after it instead.
+ */
+typedef struct _map_registry_t {
+    uint bits;
+    uint used;
+    struct _map_registry_t * volatile next;
+    map_thread_t * volatile threads[1]; /* variable-length */
+} map_registry_t;
+
+#define MAP_REGISTRY_INIT_BITS 5
+#define MAP_REGISTRY_SIZE(bits) \
+    (offsetof(map_registry_t, threads) + MAP_CAPACITY(bits) * sizeof(map_thread_t *))
+
+static map_table_t *
+map_table_create(uint bits)
+{
+    map_table_t *t = (map_table_t *) dr_global_alloc(MAP_TABLE_SIZE(bits));
+    memset(t, 0, MAP_TABLE_SIZE(bits));
+    t->bits = bits;
+    return t;
+}
+
+static void
+map_table_free(map_table_t *t)
+{
+    dr_global_free(t, MAP_TABLE_SIZE(t->bits));
+}
+
+static map_registry_t *
+map_registry_create(uint bits)
+{
+    map_registry_t *r = (map_registry_t *) dr_global_alloc(MAP_REGISTRY_SIZE(bits));
+    memset(r, 0, MAP_REGISTRY_SIZE(bits));
+    r->bits = bits;
+    return r;
+}
+
+/* Fibonacci hashing: multiplying by 2^N/phi and keeping the top bits spreads
+ * keys that differ only in their high bits, such as aligned pointers, which
+ * an identity hash masked to the low bits clusters into a few slots.
+ */
+static inline uint
+map_hash_value(ptr_uint_t h, uint bits)
+{
+#ifdef X64
+    return (uint) ((h * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+#else
+    return (uint) ((h * 0x9e3779b9U) >> (32 - bits));
+#endif
+}
+
+static inline uint
+map_hash(drhashmap_t *map, void *key, uint bits)
+{
+    ptr_uint_t h = (map->hash_key_func != NULL) ?
+        (ptr_uint_t) map->hash_key_func(key) : (ptr_uint_t) key;
+    return map_hash_value(h, bits);
+}
+
+/* Returns the calling thread's record, or NULL if it has none yet. */
+static inline map_thread_t *
+map_thread_find(drhashmap_t *map, void *drcontext)
+{
+    map_registry_t *r;
+    for (r = (map_registry_t *) map->threads; r != NULL; r = r->next) {
+        uint mask = MAP_CAPACITY(r->bits) - 1;
+        uint i;
+        for (i = map_hash_value((ptr_uint_t) drcontext, r->bits); ;
+             i = (i + 1) & mask) {
+            map_thread_t *thread = r->threads[i];
+            if (thread == NULL)
+                break;
+            /* pairs with the fence in map_thread_register() */
+            ACQUIRE_FENCE();
+            if (thread->drcontext == drcontext)
+                return thread;
+        }
+    }
+    return NULL;
+}
+
+/* Adds a record for the calling thread.  A dead thread's drcontext may be
+ * reused by a new thread, which then simply takes over the dead thread's record.
+ */
+static map_thread_t *
+map_thread_register(drhashmap_t *map, void *drcontext)
+{
+    map_registry_t *r;
+    map_thread_t *thread;
+    void *alloc;
+    uint mask, i;
+    dr_mutex_lock(map->threads_lock);
+    thread = map_thread_find(map, drcontext);
+    if (thread != NULL) {
+        dr_mutex_unlock(map->threads_lock);
+        return thread;
+    }
+    for (r = (map_registry_t *) map->threads; r->next != NULL; r = r->next)
+        ; /* nothing */
+    if ((r->used + 1) * 2 > MAP_CAPACITY(r->bits)) {
+        map_registry_t *bigger = map_registry_create(r->bits + 1);
+        RELEASE_FENCE();
+        r->next = bigger;
+        r = bigger;
+    }
+    /* Padding to a full line keeps other threads' records off of ours. */
+    alloc = dr_global_alloc(2 * MAP_CACHE_LINE);
+    thread = (map_thread_t *) ALIGN_FORWARD(alloc, MAP_CACHE_LINE);
+    thread->epoch = 0;
+    thread->drcontext = drcontext;
+    thread->alloc = alloc;
+    mask = MAP_CAPACITY(r->bits) - 1;
+    for (i = map_hash_value((ptr_uint_t) drcontext, r->bits); r->threads[i] != NULL;
+         i = (i + 1) & mask)
+        ; /* nothing */
+    RELEASE_FENCE();
+    r->threads[i] = thread;
+    r->used++;
+    dr_mutex_unlock(map->threads_lock);
+    return thread;
+}
+
+static void
+map_registry_free(drhashmap_t *map)
+{
+    map_registry_t *r, *next;
+    uint i;
+    for (r = (map_registry_t *) map->threads; r != NULL; r = next) {
+        next = r->next;
+        for (i = 0; i < MAP_CAPACITY(r->bits); i++) {
+            if (r->threads[i] != NULL)
+                dr_global_free(r->threads[i]->alloc, 2 * MAP_CACHE_LINE);
+        }
+        dr_global_free(r, MAP_REGISTRY_SIZE(r->bits));
+    }
+    map->threads = NULL;
+}
+
+/* Returns the slot holding key, or else the empty slot that ends its probe
+ * sequence.  Callers must ensure the table has an empty slot.
+ */
+static map_slot_t *
+map_find_slot(drhashmap_t *map, map_table_t *t, void *key)
+{
+    uint mask = MAP_CAPACITY(t->bits) - 1;
+    uint i;
+    for (i = map_hash(map, key, t->bits); ; i = (i + 1) & mask) {
+        void *k = t->slots[i].key;
+        if (k == key || k == NULL)
+            return &t->slots[i];
+    }
+}
+
+void
+drhashmap_init_ex(drhashmap_t *map, uint num_bits, void (*free_payload_func)(void*),
+                  uint (*hash_key_func)(void*))
+{
+    DR_ASSERT(map != NULL && num_bits > 0 && num_bits < 32);
+    map->table = map_table_create(num_bits);
+    map->retired = NULL;
+    map->threads = map_registry_create(MAP_REGISTRY_INIT_BITS);
+    map->threads_lock = dr_mutex_create();
+    map->epoch = 1;
+    map->lock = dr_recurlock_create();
+    map->free_payload_func = free_payload_func;
+    map->hash_key_func = hash_key_func;
+    map->entries = 0;
+    map->config.size = sizeof(map->config);
+    map->config.resizable = true;
+    /* Linear probing degrades faster than chaining as the load goes up. */
+    map->config.resize_threshold = 60;
+}
+
+void
+drhashmap_init(drhashmap_t *map, uint num_bits)
+{
+    drhashmap_init_ex(map, num_bits, NULL, NULL);
+}
+
+void
+drhashmap_configure(drhashmap_t *map, hashtable_config_t *config)
+{
+    DR_ASSERT(map != NULL && config != NULL);
+    /* Ignoring size of field: shouldn't be in between */
+    if (config->size > offsetof(hashtable_config_t, resizable))
+        map->config.resizable = config->resizable;
+    if (config->size > offsetof(hashtable_config_t, resize_threshold)) {
+        map->config.resize_threshold = config->resize_threshold;
+        if (map->config.resize_threshold > MAP_MAX_LOAD)
+            map->config.resize_threshold = MAP_MAX_LOAD;
+    }
+}
+
+void
+drhashmap_lock(drhashmap_t *map)
+{
+    dr_recurlock_lock(map->lock);
+}
+
+void
+drhashmap_unlock(drhashmap_t *map)
+{
+    dr_recurlock_unlock(map->lock);
+}
+
+uint
+drhashmap_num_entries(drhashmap_t *map)
+{
+    return map->entries;
+}
+
+static inline void *
+map_table_lookup(drhashmap_t *map, map_table_t *t, void *key)
+{
+    uint mask = MAP_CAPACITY(t->bits) - 1;
+    uint i;
+    for (i = map_hash(map, key, t->bits); ; i = (i + 1) & mask) {
+        void *k = t->slots[i].key;
+        if (k == key) {
+            /* pairs with the fence in map_publish_slot() */
+            ACQUIRE_FENCE();
+            return t->slots[i].payload;
+        }
+        if (k == NULL)
+            return NULL;
+    }
+}
+
+void *
+drhashmap_lookup(drhashmap_t *map, void *key)
+{
+    void *drcontext = dr_get_current_drcontext();
+    map_thread_t *thread;
+    map_table_t *t;
+    ptr_uint_t outer_epoch;
+    void *payload;
+    if (drcontext == NULL) {
+        /* Without a drcontext we have no record, so we exclude writers instead. */
+        dr_recurlock_lock(map->lock);
+        payload = map_table_lookup(map, (map_table_t *) map->table, key);
+        dr_recurlock_unlock(map->lock);
+        return payload;
+    }
+    thread = map_thread_find(map, drcontext);
+    if (thread == NULL)
+        thread = map_thread_register(map, drcontext);
+    /* A lookup nested inside another, from a hash callback, keeps the outer
+     * lookup's older epoch.
+     */
+    outer_epoch = thread->epoch;
+    if (outer_epoch == 0) {
+        thread->epoch = map->epoch;
+        /* Our epoch must be visible before we load the table: see map_reclaim(). */
+        FULL_FENCE();
+    }
+    t = (map_table_t *) map->table;
+    ACQUIRE_FENCE();
+    payload = map_table_lookup(map, t, key);
+    /* Our reads of t must complete before we leave the lookup. */
+    RELEASE_FENCE();
+    thread->epoch = outer_epoch;
+    return payload;
+}
+
+/* Caller must hold the lock.  Frees each retired table that no lookup can still
+ * be using.  A lookup publishes the epoch it read before loading the table, and
+ * map_publish_table() stores the new table before advancing the epoch, so a
+ * lookup that saw an epoch at or beyond a table's retire_epoch loaded a newer
+ * table.  A lookup whose epoch store we do not yet see is ordered by the fences
+ * to load the table after its replacement, and so cannot hold a retired one.
+ */
+static void
+map_reclaim(drhashmap_t *map)
+{
+    map_registry_t *r;
+    map_table_t *t, *next, **prev;
+    ptr_uint_t oldest = (ptr_uint_t) -1;
+    uint i;
+    if (map->retired == NULL)
+        return;
+    /* orders the epoch and table stores before the loads of thread epochs */
+    FULL_FENCE();
+    for (r = (map_registry_t *) map->threads; r != NULL; r = r->next) {
+        for (i = 0; i < MAP_CAPACITY(r->bits); i++) {
+            map_thread_t *thread = r->threads[i];
+            ptr_uint_t epoch;
+            if (thread == NULL)
+                continue;
+            epoch = thread->epoch;
+            if (epoch != 0 && epoch < oldest)
+                oldest = epoch;
+        }
+    }
+    prev = (map_table_t **) &map->retired;
+    for (t = (map_table_t *) map->retired; t != NULL; t = next) {
+        next = t->next_retired;
+        if (t->retire_epoch <= oldest) {
+            *prev = next;
+            map_table_free(t);
+        } else
+            prev = &t->next_retired;
+    }
+}
+
+/* Caller must hold the lock.  Readers may still be using the old table, so it
+ * is retired and freed once they are done.
+ */
+static void
+map_publish_table(drhashmap_t *map, map_table_t *new_table)
+{
+    map_table_t *old = (map_table_t *) map->table;
+    RELEASE_FENCE();
+    map->table = new_table;
+    /* The new table must be visible before the epoch that tells lookups
+     * they cannot be holding the old one.
+     */
+    FULL_FENCE();
+    map->epoch++;
+    old->retire_epoch = map->epoch;
+    old->next_retired = (map_table_t *) map->retired;
+    map->retired = old;
+    map_reclaim(map);
+}
+
+/* Caller must hold the lock.  Rebuilds the table without its removed slots,
+ * doubling it if the live entries alone would exceed half the threshold.
+ * Without resizing, the threshold is MAP_MAX_LOAD, so we only grow when
+ * dropping the removed slots would not free up enough space.
+ */
+static void
+map_rebuild(drhashmap_t *map)
+{
+    map_table_t *old = (map_table_t *) map->table;
+    map_table_t *new_table;
+    uint bits = old->bits, i;
+    uint threshold = map->config.resizable ?
+        map->config.resize_threshold : MAP_MAX_LOAD;
+    if (map->entries * 200 > threshold * MAP_CAPACITY(bits))
+        bits++;
+    new_table = map_table_create(bits);
+    for (i = 0; i < MAP_CAPACITY(old->bits); i++) {
+        map_slot_t *src = &old->slots[i];
+        if (src->key != NULL && src->payload != NULL) {
+            map_slot_t *dst = map_find_slot(map, new_table, src->key);
+            dst->key = src->key;
+            dst->payload = src->payload;
+            new_table->used++;
+        }
+    }
+    map_publish_table(map, new_table);
+}
+
+/* Caller must hold the lock.  Fills an empty slot: the payload must be
+ * visible before the key that makes readers look at it.
+ */
+static void
+map_publish_slot(map_table_t *t, map_slot_t *slot, void *key, void *payload)
+{
+    slot->payload = payload;
+    RELEASE_FENCE();
+    slot->key = key;
+    t->used++;
+}
+
+/* Caller must hold the lock.  Returns the slot for key, rebuilding the table
+ * first if key is new and the table is too full to take it.
+ */
+static map_slot_t *
+map_slot_for_add(drhashmap_t *map, void *key)
+{
+    map_table_t *t = (map_table_t *) map->table;
+    map_slot_t *slot = map_find_slot(map, t, key);
+    if (slot->key == NULL) {
+        uint capacity = MAP_CAPACITY(t->bits);
+        uint threshold = map->config.resizable ?
+            map->config.resize_threshold : MAP_MAX_LOAD;
+        /* avoid fp ops */
+        if ((t->used + 1) * 100 > threshold * capacity) {
+            map_rebuild(map);
+            t = (map_table_t *) map->table;
+            slot = map_find_slot(map, t, key);
+        }
+    }
+    return slot;
+}
+
+bool
+drhashmap_add(drhashmap_t *map, void *key, void *payload)
+{
+    map_slot_t *slot;
+    bool res = true;
+    /* NULL marks empty slots, and a NULL payload a lookup failure */
+    DR_ASSERT(key != NULL && payload != NULL);
+    dr_recurlock_lock(map->lock);
+    map_reclaim(map);
+    slot = map_slot_for_add(map, key);
+    if (slot->key == NULL) {
+        map_publish_slot((map_table_t *) map->table, slot, key, payload);
+        map->entries++;
+    } else if (slot->payload == NULL) {
+        /* re-adding a removed key */
+        slot->payload = payload;
+        map->entries++;
+    } else
+        res = false;
+    dr_recurlock_unlock(map->lock);
+    return res;
+}
+
+void *
+drhashmap_add_replace(drhashmap_t *map, void *key, void *payload)
+{
+    map_slot_t *slot;
+    void *old_payload = NULL;
+    DR_ASSERT(key != NULL && payload != NULL);
+    dr_recurlock_lock(map->lock);
+    map_reclaim(map);
+    slot = map_slot_for_add(map, key);
+    if (slot->key == NULL) {
+        map_publish_slot((map_table_t *) map->table, slot, key, payload);
+        map->entries++;
+    } else {
+        old_payload = slot->payload;
+        slot->payload = payload;
+        if (old_payload == NULL)
+            map->entries++;
+    }
+    dr_recurlock_unlock(map->lock);
+    return old_payload;
+}
+
+bool
+drhashmap_remove(drhashmap_t *map, void *key)
+{
+    map_slot_t *slot;
+    void *payload = NULL;
+    if (key == NULL)
+        return false;
+    dr_recurlock_lock(map->lock);
+    map_reclaim(map);
+    slot = map_find_slot(map, (map_table_t *) map->table, key);
+    if (slot->key != NULL && slot->payload != NULL) {
+        payload = slot->payload;
+        slot->payload = NULL;
+        map->entries--;
+    }
+    dr_recurlock_unlock(map->lock);
+    if (payload != NULL && map->free_payload_func != NULL)
+        map->free_payload_func(payload);
+    return payload != NULL;
+}
+
+bool
+drhashmap_remove_range(drhashmap_t *map, void *start, void *end)
+{
+    map_table_t *t;
+    uint i;
+    bool res = false;
+    dr_recurlock_lock(map->lock);
+    map_reclaim(map);
+    t = (map_table_t *) map->table;
+    for (i = 0; i < MAP_CAPACITY(t->bits); i++) {
+        map_slot_t *slot = &t->slots[i];
+        void *payload = slot->payload;
+        if (slot->key != NULL && payload != NULL &&
+            (ptr_uint_t)slot->key >= (ptr_uint_t)start &&
+            (ptr_uint_t)slot->key < (ptr_uint_t)end) {
+            slot->payload = NULL;
+            map->entries--;
+            if (map->free_payload_func != NULL)
+                map->free_payload_func(payload);
+            res = true;
+        }
+    }
+    dr_recurlock_unlock(map->lock);
+    return res;
+}
+
+static void
+map_table_free_payloads(drhashmap_t *map, map_table_t *t)
+{
+    uint i;
+    if (map->free_payload_func == NULL)
+        return;
+    for (i = 0; i < MAP_CAPACITY(t->bits); i++) {
+        if (t->slots[i].key != NULL && t->slots[i].payload != NULL)
+            map->free_payload_func(t->slots[i].payload);
+    }
+}
+
+void
+drhashmap_clear(drhashmap_t *map)
+{
+    map_table_t *old;
+    dr_recurlock_lock(map->lock);
+    old = (map_table_t *) map->table;
+    /* Emptying the slots in place could let a reader match a key and then
+     * read the payload of a different key added afterward, so we switch to
+     * a fresh table instead.
+     */
+    map_publish_table(map, map_table_create(old->bits));
+    map->entries = 0;
+    map_table_free_payloads(map, old);
+    dr_recurlock_unlock(map->lock);
+}
+
+void
+drhashmap_delete(drhashmap_t *map)
+{
+    map_table_t *t, *next;
+    /* No lookups may be in progress, so all retired tables can go. */
+    for (t = (map_table_t *) map->retired; t != NULL; t = next) {
+        next = t->next_retired;
+        map_table_free(t);
+    }
+    map->retired = NULL;
+    t = (map_table_t *) map->table;
+    map_table_free_payloads(map, t);
+    map_table_free(t);
+    map->table = NULL;
+    map_registry_free(map);
+    dr_mutex_destroy(map->threads_lock);
+    dr_recurlock_destroy(map->lock);
+}
@@ -0,0 +1,199 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Containers DynamoRIO Extension: DrHashmap */
+
+#ifndef _DRHASHMAP_H_
+#define _DRHASHMAP_H_ 1
+
+/**
+ * @file drhashmap.h
+ * @brief Header for DynamoRIO DrHashmap Extension
+ */
+
+#include "hashtable.h" /* hashtable_config_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************************
+ * DRHASHMAP
+ */
+
+/**
+ * \addtogroup drcontainers Container Data Structures
+ */
+/*@{*/ /* begin doxygen group */
+
+/**
+ * An open-addressing table of pointer-sized keys with lock-free lookups.
+ * Keys and payloads are stored inline in the table's slots.  The fields are
+ * internal: use the drhashmap_ routines.
+ */
+typedef struct _drhashmap_t {
+    void * volatile table;
+    void *retired;
+    void * volatile threads;
+    void *threads_lock;
+    volatile ptr_uint_t epoch;
+    void *lock;
+    void (*free_payload_func)(void*);
+    uint (*hash_key_func)(void*);
+    uint entries;
+    hashtable_config_t config;
+} drhashmap_t;
+
+/**
+ * Initializes a drhashmap with the given initial size.  Equivalent to
+ * drhashmap_init_ex() with no callbacks.
+ */
+void
+drhashmap_init(drhashmap_t *map, uint num_bits);
+
+/**
+ * Initializes a drhashmap.
+ *
+ * Keys are pointer-sized values compared by value, as with #HASH_INTPTR in
+ * hashtable_t.  NULL is reserved to mark empty slots and is not a valid key.
+ *
+ * drhashmap_lookup() does not wait for writers.  Each thread records the
+ * map's current epoch in its own per-thread record while it looks up, so
+ * concurrent lookups do not write to any shared cache line.  A thread's
+ * first lookup in a map briefly takes a lock to add its record, and a
+ * lookup from a thread with no drcontext takes the lock that writers hold.
+ * Operations that modify the table are serialized by an internal lock.  A
+ * resize or clear publishes a new table without waiting for readers: the
+ * old table is retired, and the next modification after every lookup that
+ * started before the retirement has finished frees it.
+ *
+ * @param[out] map        The drhashmap to be initialized.
+ * @param[in]  num_bits   The initial number of bits to use for the hash key,
+ *   which determines the initial number of slots.
+ * @param[in]  free_payload_func   A callback for freeing each payload.
+ *   Leave it NULL if no callback is needed.  Lookups do not hold a lock, so
+ *   a payload freed by drhashmap_remove() may still be in use by a reader
+ *   that looked it up earlier: the caller must ensure that cannot happen.
+ * @param[in]  hash_key_func       A callback for hashing a key.
+ *   Leave it NULL to hash the key value itself.  The result is mixed before
+ *   use, so the callback need not spread its values.
+ */
+void
+drhashmap_init_ex(drhashmap_t *map, uint num_bits, void (*free_payload_func)(void*),
+                  uint (*hash_key_func)(void*));
+
+/**
+ * Configures optional parameters of drhashmap operation.  The same fields as
+ * hashtable_configure() are honored.  When resizing is disabled, removed
+ * slots are still reclaimed by rebuilding the table in place, and the table
+ * is only grown if it would otherwise become full, since a full table
+ * would never end the probe for a missing key.
+ */
+void
+drhashmap_configure(drhashmap_t *map, hashtable_config_t *config);
+
+/**
+ * Returns the payload for the given key, or NULL if the key is not found.
+ * Safe to call concurrently with any other drhashmap_ routine except
+ * drhashmap_delete().  Apart from a thread's first lookup in the map, or a
+ * lookup from a thread with no drcontext, it never blocks.
+ */
+void *
+drhashmap_lookup(drhashmap_t *map, void *key);
+
+/**
+ * Adds a new entry.  Returns false if an entry for \p key already exists.
+ * \note Never use NULL as a payload as that is used for a lookup failure.
+ */
+bool
+drhashmap_add(drhashmap_t *map, void *key, void *payload);
+
+/**
+ * Adds a new entry, replacing an existing entry if any.
+ * Returns the old payload, or NULL if there was no existing entry.
+ * \note Never use NULL as a payload as that is used for a lookup failure.
+ */
+void *
+drhashmap_add_replace(drhashmap_t *map, void *key, void *payload);
+
+/**
+ * Removes the entry for key.  If free_payload_func was specified calls it
+ * for the payload being removed.  Returns false if no such entry exists.
+ */
+bool
+drhashmap_remove(drhashmap_t *map, void *key);
+
+/**
+ * Removes all entries with key in [start..end).  If free_payload_func
+ * was specified calls it for each payload being removed.  Returns
+ * false if no such entry exists.
+ */
+bool
+drhashmap_remove_range(drhashmap_t *map, void *start, void *end);
+
+/**
+ * Removes all entries from the map.  If free_payload_func was specified
+ * calls it for each payload.
+ */
+void
+drhashmap_clear(drhashmap_t *map);
+
+/**
+ * Destroys all storage for the map, including all retired tables.  If
+ * free_payload_func was specified calls it for each payload.
+ */
+void
+drhashmap_delete(drhashmap_t *map);
+
+/** Returns the number of entries in the map. */
+uint
+drhashmap_num_entries(drhashmap_t *map);
+
+/**
+ * Acquires the lock that serializes modifications, allowing the caller to
+ * make a lookup and a following add atomic with respect to other writers.
+ * Lookups by other threads are not blocked.
+ */
+void
+drhashmap_lock(drhashmap_t *map);
+
+/** Releases the lock acquired by drhashmap_lock(). */
+void
+drhashmap_unlock(drhashmap_t *map);
+
+/*@}*/ /* end doxygen group */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRHASHMAP_H_ */
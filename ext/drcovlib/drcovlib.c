@@ -35,7 +35,8 @@
  * Collects information about basic blocks that have been executed.
  * It simply stores the information of basic blocks seen in bb callback event
  * into a table without any instrumentation, and dumps the buffer into log files
- * on thread/process exit.
+ * on thread/process exit.  With DRCOVLIB_HIT_COUNTS it also inlines a counter
+ * increment into each basic block.
  *
  * There are pros and cons to creating this coverage library as opposed to other
  * tools using the drcov client straight-up as a 2nd client: DR has support for
@@ -53,6 +54,7 @@
 #include "dr_api.h"
 #include "drmgr.h"
 #include "drx.h"
+#include "drreg.h"
 #include "drcovlib.h"
 #include "hashtable.h"
 #include "drtable.h"
@@ -85,6 +87,13 @@ static int sysnum_execve = IF_X64_ELSE(59, 11);
 static volatile bool go_native;
 static int tls_idx = -1;
 static int drcovlib_init_count;
+/* For DRCOVLIB_HIT_COUNTS: indexed by bb table index modulo the size.
+ * We only free the array if we allocated it.
+ */
+static byte *hit_counts;
+static size_t num_hit_counts;
+static bool hit_counts_owned;
+#define HIT_COUNTS_ALLOC_FLAGS (DR_ALLOC_NON_HEAP | DR_ALLOC_CACHE_REACHABLE)
 
 /****************************************************************************
  * Utility Functions
@@ -149,9 +158,10 @@ bb_table_print(void *drcontext, per_thread_t *data)
 }
 
 static void
-bb_table_entry_add(void *drcontext, per_thread_t *data, app_pc start, uint size)
+bb_table_entry_add(void *drcontext, per_thread_t *data, app_pc start, uint size,
+                   OUT ptr_uint_t *idx)
 {
-    bb_entry_t *bb_entry = drtable_alloc(data->bb_table, 1, NULL);
+    bb_entry_t *bb_entry = drtable_alloc(data->bb_table, 1, idx);
     uint mod_id;
     app_pc mod_start;
     drcovlib_status_t res = drmodtrack_lookup(drcontext, start, &mod_id, &mod_start);
@@ -188,6 +198,31 @@ bb_table_destroy(void *table, void *data)
     drtable_destroy(table, data);
 }
 
+/* The counters are dumped in bb table order, so entries past the size of
+ * hit_counts repeat its contents.
+ */
+static void
+hit_counts_print(per_thread_t *data)
+{
+    ptr_uint_t num_bbs = drtable_num_entries(data->bb_table);
+    ptr_uint_t i;
+    dr_fprintf(data->log, "BB Hit Counts: %u bbs\n", (uint)num_bbs);
+    if (TEST(DRCOVLIB_DUMP_AS_TEXT, options.flags)) {
+        dr_fprintf(data->log, "bb id, hit count:\n");
+        for (i = 0; i < num_bbs; i++) {
+            dr_fprintf(data->log, "%u, %u\n", (uint)i,
+                       hit_counts[i % num_hit_counts]);
+        }
+    } else {
+        for (i = 0; i < num_bbs; i += num_hit_counts) {
+            size_t len = (size_t)(num_bbs - i);
+            if (len > num_hit_counts)
+                len = num_hit_counts;
+            dr_write_file(data->log, hit_counts, len);
+        }
+    }
+}
+
 static void
 version_print(file_t log)
 {
@@ -203,6 +238,68 @@ version_print(file_t log)
     dr_fprintf(log, "DRCOV FLAVOR: %s\n", DRCOV_FLAVOR);
 }
 
+/* For DRCOVLIB_DUMP_INDEXED.  The header is written last, once the tables
+ * are out and their offsets and sizes are known.
+ */
+static void
+dump_drcov_index(per_thread_t *data)
+{
+    drcov_index_header_t header;
+    static const char pad[sizeof(uint64)];
+    int64 base = dr_file_tell(data->log);
+    size_t size = 64 * MAXIMUM_PATH;
+    size_t wrote, i;
+    char *buf;
+    drcovlib_status_t res;
+    if (base < 0) {
+        ASSERT(false, "failed to query log file position");
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DRCOV_INDEX_MAGIC, sizeof(header.magic));
+    header.version = DRCOV_INDEX_VERSION;
+    header.header_size = sizeof(header);
+    dr_snprintf(header.flavor, BUFFER_SIZE_ELEMENTS(header.flavor), "%s", DRCOV_FLAVOR);
+    /* Reserve room for the header. */
+    dr_write_file(data->log, &header, sizeof(header));
+
+    do {
+        buf = dr_global_alloc(size);
+        res = drmodtrack_dump_buf(buf, size, &wrote);
+        if (res == DRCOVLIB_SUCCESS) {
+            header.modules_offset = sizeof(header);
+            header.modules_size = wrote;
+            dr_write_file(data->log, buf, wrote);
+        }
+        dr_global_free(buf, size);
+        size *= 2;
+    } while (res == DRCOVLIB_ERROR_BUF_TOO_SMALL);
+    ASSERT(res == DRCOVLIB_SUCCESS, "failed to dump module table");
+
+    header.bbs_offset = ALIGN_FORWARD(header.modules_offset + header.modules_size,
+                                      sizeof(uint64));
+    dr_write_file(data->log, pad, (size_t)(header.bbs_offset - header.modules_offset -
+                                           header.modules_size));
+    header.num_bbs = drtable_dump_entries(data->bb_table, data->log);
+
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags)) {
+        header.hit_counts_offset = header.bbs_offset + header.num_bbs * sizeof(bb_entry_t);
+        for (i = 0; i < header.num_bbs; i += num_hit_counts) {
+            size_t len = (size_t)(header.num_bbs - i);
+            if (len > num_hit_counts)
+                len = num_hit_counts;
+            dr_write_file(data->log, hit_counts, len);
+        }
+    }
+
+    if (!dr_file_seek(data->log, base, DR_SEEK_SET)) {
+        ASSERT(false, "failed to seek log file");
+        return;
+    }
+    dr_write_file(data->log, &header, sizeof(header));
+    dr_file_seek(data->log, 0, DR_SEEK_END);
+}
+
 static void
 dump_drcov_data(void *drcontext, per_thread_t *data)
 {
@@ -214,9 +311,15 @@ dump_drcov_data(void *drcontext, per_thread_t *data)
         ASSERT(false, "invalid log file");
         return;
     }
+    if (TEST(DRCOVLIB_DUMP_INDEXED, options.flags)) {
+        dump_drcov_index(data);
+        return;
+    }
     version_print(data->log);
     drmodtrack_dump(data->log);
     bb_table_print(drcontext, data);
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags))
+        hit_counts_print(data);
 }
 
 /****************************************************************************
@@ -329,7 +432,9 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
     per_thread_t *data;
     instr_t *instr;
     app_pc start_pc, end_pc;
+    ptr_uint_t idx;
 
+    *user_data = NULL;
     /* do nothing for translation */
     if (translating)
         return DR_EMIT_DEFAULT;
@@ -361,7 +466,9 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
      * 4. The duplication can be easily handled in a post-processing step,
      *    which is required anyway.
      */
-    bb_table_entry_add(drcontext, data, start_pc, (uint)(end_pc - start_pc));
+    bb_table_entry_add(drcontext, data, start_pc, (uint)(end_pc - start_pc), &idx);
+    /* The table index doubles as the dense index of the bb's hit counter. */
+    *user_data = (void *)idx;
 
     if (go_native)
         return DR_EMIT_GO_NATIVE;
@@ -369,6 +476,39 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
         return DR_EMIT_DEFAULT;
 }
 
+/* For DRCOVLIB_HIT_COUNTS, inserts a saturating increment of the bb's counter. */
+static dr_emit_flags_t
+event_basic_block_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                         bool for_trace, bool translating, void *user_data)
+{
+#ifdef X86
+    ptr_uint_t idx = (ptr_uint_t)user_data;
+    opnd_t counter;
+    if (!drmgr_is_first_instr(drcontext, instr))
+        return DR_EMIT_DEFAULT;
+    /* When translating we have no index and use slot 0.  Translation only
+     * needs the same instruction lengths, and as the array is reachable every
+     * slot's address has the same encoding size.
+     */
+    counter = OPND_CREATE_ABSMEM(hit_counts + (idx % num_hit_counts),
+                                 OPSZ_1);
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        ASSERT(false, "failed to reserve aflags");
+        return DR_EMIT_DEFAULT;
+    }
+    /* The add sets CF when the counter wraps to 0 and the sbb then takes it
+     * back to 255.
+     */
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_add
+                             (drcontext, counter, OPND_CREATE_INT8(1)));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_sbb
+                             (drcontext, counter, OPND_CREATE_INT8(0)));
+    if (drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS)
+        ASSERT(false, "failed to unreserve aflags");
+#endif
+    return DR_EMIT_DEFAULT;
+}
+
 static void
 event_thread_exit(void *drcontext)
 {
@@ -486,6 +626,18 @@ drcovlib_dump(void *drcontext)
     return DRCOVLIB_SUCCESS;
 }
 
+drcovlib_status_t
+drcovlib_hit_counts(OUT byte **counts, OUT size_t *num_counts)
+{
+    if (counts == NULL || num_counts == NULL)
+        return DRCOVLIB_ERROR_INVALID_PARAMETER;
+    if (hit_counts == NULL)
+        return DRCOVLIB_ERROR_INVALID_SETUP;
+    *counts = hit_counts;
+    *num_counts = num_hit_counts;
+    return DRCOVLIB_SUCCESS;
+}
+
 drcovlib_status_t
 drcovlib_exit(void)
 {
@@ -497,11 +649,20 @@ drcovlib_exit(void)
         dump_drcov_data(NULL, global_data);
         global_data_destroy(global_data);
     }
+    if (hit_counts != NULL) {
+        if (hit_counts_owned) {
+            dr_custom_free(NULL, HIT_COUNTS_ALLOC_FLAGS, hit_counts,
+                           num_hit_counts);
+        }
+        hit_counts = NULL;
+    }
     /* destroy module table */
     drmodtrack_exit();
 
     drmgr_unregister_tls_field(tls_idx);
 
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags))
+        drreg_exit();
     drx_exit();
     drmgr_exit();
 
@@ -525,6 +686,28 @@ event_init(void)
     if (res != DRCOVLIB_SUCCESS)
         return res;
 
+    /* The counters must be reachable from the code cache so that the inlined
+     * increment can use an absolute or rip-relative operand.  A caller's array
+     * is documented to be reachable and is left as it is, as another process
+     * may already be reading it.
+     */
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags)) {
+        if (options.hit_counts != NULL) {
+            hit_counts = options.hit_counts;
+            num_hit_counts = options.num_hit_counts;
+            hit_counts_owned = false;
+        } else {
+            num_hit_counts = DRCOVLIB_HIT_COUNT_SLOTS;
+            hit_counts = dr_custom_alloc(NULL, HIT_COUNTS_ALLOC_FLAGS,
+                                         num_hit_counts,
+                                         DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+            if (hit_counts == NULL)
+                return DRCOVLIB_ERROR;
+            memset(hit_counts, 0, num_hit_counts);
+            hit_counts_owned = true;
+        }
+    }
+
     /* create process data if whole process bb coverage. */
     if (!drcov_per_thread)
         global_data = global_data_create();
@@ -540,8 +723,21 @@ drcovlib_init(drcovlib_options_t *ops)
 
     if (ops->struct_size != sizeof(options))
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
-    if ((ops->flags & (~(DRCOVLIB_DUMP_AS_TEXT|DRCOVLIB_THREAD_PRIVATE))) != 0)
+    if ((ops->flags & (~(DRCOVLIB_DUMP_AS_TEXT|DRCOVLIB_THREAD_PRIVATE|
+                         DRCOVLIB_HIT_COUNTS|DRCOVLIB_DUMP_INDEXED))) != 0)
+        return DRCOVLIB_ERROR_INVALID_PARAMETER;
+    if (TESTALL(DRCOVLIB_DUMP_AS_TEXT|DRCOVLIB_DUMP_INDEXED, ops->flags))
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
+    if (TEST(DRCOVLIB_HIT_COUNTS, ops->flags)) {
+        /* The counters are process-wide and the bb table index is their key. */
+        if (TEST(DRCOVLIB_THREAD_PRIVATE, ops->flags))
+            return DRCOVLIB_ERROR_INVALID_PARAMETER;
+        if (ops->hit_counts != NULL && ops->num_hit_counts == 0)
+            return DRCOVLIB_ERROR_INVALID_PARAMETER;
+#ifndef X86
+        return DRCOVLIB_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+    }
     if (TEST(DRCOVLIB_THREAD_PRIVATE, ops->flags)) {
         if (!dr_using_all_private_caches())
             return DRCOVLIB_ERROR_INVALID_SETUP;
@@ -559,6 +755,12 @@ drcovlib_init(drcovlib_options_t *ops)
 
     drmgr_init();
     drx_init();
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags)) {
+        drreg_options_t drreg_ops = {sizeof(drreg_ops), 1 /*aflags*/, false, NULL,
+                                     true/*do_not_sum_slots*/};
+        if (drreg_init(&drreg_ops) != DRREG_SUCCESS)
+            return DRCOVLIB_ERROR;
+    }
 
     /* We follow a simple model of the caller requesting the coverage dump,
      * either via calling the exit routine, using its own soft_kills nudge, or
@@ -570,7 +772,9 @@ drcovlib_init(drcovlib_options_t *ops)
 
     drmgr_register_thread_init_event(event_thread_init);
     drmgr_register_thread_exit_event(event_thread_exit);
-    drmgr_register_bb_instrumentation_event(event_basic_block_analysis, NULL, NULL);
+    drmgr_register_bb_instrumentation_event(event_basic_block_analysis,
+                                            TEST(DRCOVLIB_HIT_COUNTS, options.flags) ?
+                                            event_basic_block_insert : NULL, NULL);
     dr_register_filter_syscall_event(event_filter_syscall);
     drmgr_register_pre_syscall_event(event_pre_syscall);
 #ifdef UNIX
@@ -78,8 +78,37 @@ typedef enum {
      * drcovlib's own thread exit events rather than in drcovlib_exit().
      */
     DRCOVLIB_THREAD_PRIVATE  = 0x0002,
+    /**
+     * Requests execution counts in addition to the default record of which
+     * basic blocks were built.  Each basic block table entry is given a
+     * saturating 8-bit counter in a process-wide array of
+     * #DRCOVLIB_HIT_COUNT_SLOTS bytes, which is incremented inline on every
+     * execution of the block.  Table entries past the size of the array share
+     * counters modulo its size.  The counters are dumped after the basic
+     * block table, and can also be read or reset at any time via
+     * drcovlib_hit_counts().  The array can instead be supplied by the
+     * caller via the \p hit_counts field of #drcovlib_options_t, e.g., to
+     * share it with another process.  This flag is not compatible with
+     * #DRCOVLIB_THREAD_PRIVATE and is currently only supported on x86.
+     */
+    DRCOVLIB_HIT_COUNTS      = 0x0004,
+    /**
+     * Requests that the log file be dumped in the indexed binary format
+     * described by #drcov_index_header_t rather than the default version
+     * #DRCOV_VERSION format.  Each table sits at a fixed offset recorded in
+     * the header, so a post-processor can map the file and locate the tables
+     * without parsing it line by line.  This flag is not compatible with
+     * #DRCOVLIB_DUMP_AS_TEXT.
+     */
+    DRCOVLIB_DUMP_INDEXED    = 0x0008,
 } drcovlib_flags_t;
 
+/**
+ * The number of counters allocated for #DRCOVLIB_HIT_COUNTS when the caller
+ * does not supply its own array.
+ */
+#define DRCOVLIB_HIT_COUNT_SLOTS (1U << 20)
+
 /** Specifies the options when initializing drcovlib. */
 typedef struct _drcovlib_options_t {
     /** Set this to the size of this structure. */
@@ -97,6 +126,18 @@ typedef struct _drcovlib_options_t {
      * option, is created.  This option only works under Windows.
      */
     int native_until_thread;
+    /**
+     * For #DRCOVLIB_HIT_COUNTS, an optional caller-provided counter array of
+     * \p num_hit_counts bytes to use in place of the one drcovlib allocates.
+     * This allows the counters to live in a named shared mapping read by
+     * another process, such as a fuzzer.  The array must be reachable from
+     * the code cache: e.g., mapped with #DR_MAP_CACHE_REACHABLE or allocated
+     * with #DR_ALLOC_CACHE_REACHABLE.  drcovlib neither clears nor frees it,
+     * and it must remain valid until drcovlib_exit() returns.
+     */
+    byte *hit_counts;
+    /** The number of entries in \p hit_counts.  Ignored if it is NULL. */
+    size_t num_hit_counts;
 } drcovlib_options_t;
 
 /***************************************************************************
@@ -137,6 +178,32 @@ typedef struct _bb_entry_t {
     ushort mod_id;
 } bb_entry_t;
 
+/** The first bytes of a #DRCOVLIB_DUMP_INDEXED log file (not NUL-terminated). */
+#define DRCOV_INDEX_MAGIC "DRCOVIDX"
+
+/** The version of the #drcov_index_header_t layout. */
+#define DRCOV_INDEX_VERSION 1
+
+/**
+ * The header at offset 0 of a #DRCOVLIB_DUMP_INDEXED log file.  All offsets are
+ * from the start of the header.  The module table is the same text produced by
+ * drmodtrack_dump() and can be handed to drmodtrack_offline_read() in place.
+ * The basic block table is an array of \p num_bbs #bb_entry_t, aligned to 8
+ * bytes.  The hit counts, if present, are \p num_bbs bytes as described under
+ * #DRCOVLIB_HIT_COUNTS.
+ */
+typedef struct _drcov_index_header_t {
+    char magic[8];            /**< #DRCOV_INDEX_MAGIC. */
+    uint version;             /**< #DRCOV_INDEX_VERSION. */
+    uint header_size;         /**< The size of this structure. */
+    char flavor[16];          /**< #DRCOV_FLAVOR, padded with NUL bytes. */
+    uint64 modules_offset;    /**< The offset of the NUL-terminated module table. */
+    uint64 modules_size;      /**< The size of the module table, including the NUL. */
+    uint64 bbs_offset;        /**< The offset of the basic block table. */
+    uint64 num_bbs;           /**< The number of entries in the basic block table. */
+    uint64 hit_counts_offset; /**< The offset of the hit counts, or 0 if absent. */
+} drcov_index_header_t;
+
 /***************************************************************************
  * Coverage interface
  */
@@ -201,6 +268,23 @@ DR_EXPORT
 drcovlib_status_t
 drcovlib_dump(void *drcontext);
 
+DR_EXPORT
+/**
+ * Returns the array of execution counters used when #DRCOVLIB_HIT_COUNTS is
+ * in effect: either the caller's \p hit_counts from #drcovlib_options_t or
+ * an array of #DRCOVLIB_HIT_COUNT_SLOTS entries.  Entry \p i holds the
+ * saturating execution count of entry \p i (modulo \p num_counts) of the
+ * basic block table.  The caller may
+ * clear the array, e.g., between fuzzing iterations.
+ *
+ * @param[out] counts  The counter array.
+ * @param[out] num_counts  The number of entries in \p counts.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drcovlib_status_t
+drcovlib_hit_counts(OUT byte **counts, OUT size_t *num_counts);
+
 /***************************************************************************
  * Module tracking
  */
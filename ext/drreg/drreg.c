@@ -70,12 +70,40 @@
 
 #define AFLAGS_SLOT 0 /* always */
 
-/* We support using GPR registers only: [DR_REG_START_GPR..DR_REG_STOP_GPR] */
+/* The number of app instrs we examine at each successor of a block for
+ * ops.cross_block_liveness, and the most bytes any one of them can occupy.
+ */
+#define MAX_SUCCESSOR_INSTRS 32
+#define MAX_APP_INSTR_LENGTH IF_X86_ELSE(17, 4)
+
+/* We support using GPR registers: [DR_REG_START_GPR..DR_REG_STOP_GPR], and
+ * separately the SIMD registers that dr_mcontext_t holds, so that we can restore
+ * them on a fault.  We index the latter from 0 to NUM_SIMD_SLOTS-1.
+ */
 
 #define REG_DEAD ((void*)(ptr_uint_t)0)
 #define REG_LIVE ((void*)(ptr_uint_t)1)
 #define REG_UNKNOWN ((void*)(ptr_uint_t)2) /* only used outside drmgr insert phase */
 
+/* SIMD live vector entries hold these bits.  On x86 the low part is the xmm
+ * register and the high part is the rest of the ymm register.
+ */
+#define SIMD_LIVE_LOW  0x1
+#define SIMD_LIVE_HIGH 0x2
+#define SIMD_LIVE_ALL (IF_X86_ELSE(SIMD_LIVE_LOW | SIMD_LIVE_HIGH, SIMD_LIVE_LOW))
+
+/* There is no DR slot fallback for SIMD registers: each needs at most a slot
+ * for the app value and a slot for the tool value.
+ */
+#define MAX_SIMD_SPILLS (NUM_SIMD_SLOTS * 2)
+
+#ifdef AARCH64
+/* The scaled offsets of Q register loads and stores need 16-byte alignment. */
+# define SIMD_SLOT_ALIGN 16
+#else
+# define SIMD_SLOT_ALIGN sizeof(reg_t)
+#endif
+
 typedef struct _reg_info_t {
     /* XXX: better to flip around and store bitvector of registers per instr
      * in a single drvector_t?
@@ -93,6 +121,18 @@ typedef struct _reg_info_t {
      * reservation).
      */
     bool ever_spilled;
+    /* With ops.cross_block_liveness, live entries below this index are dead only
+     * because of the block's successors.
+     */
+    int succ_dead_idx;
+    /* With ops.coalesce_spills, a native reg keeps the slot it was restored from
+     * until the end of the bb, as drreg_event_restore_state() keeps treating that
+     * slot as holding the app value until it sees a doubled restore (see
+     * restore_reg()).  cache_valid says whether the slot is up to date, in which
+     * case a new reservation need not spill.
+     */
+    bool cached;
+    bool cache_valid;
 
     /* Where is the app value for this reg? */
     bool native;   /* app value is in original app reg */
@@ -100,6 +140,17 @@ typedef struct _reg_info_t {
     int slot;      /* if !native && xchg==REG_NULL, value is in this TLS slot # */
 } reg_info_t;
 
+typedef struct _simd_info_t {
+    /* Like reg_info_t.live, but each entry holds SIMD_LIVE_* bits. */
+    drvector_t live;
+    bool in_use;
+    uint app_uses;
+    bool ever_spilled;
+    bool native;      /* app value is in original app reg */
+    opnd_size_t size; /* if !native, width of the app value in the slot */
+    int slot;         /* if !native, app value is in this SIMD slot # */
+} simd_info_t;
+
 /* We use this in per_thread_t.slot_use[] and other places */
 #define DR_REG_EFLAGS DR_REG_INVALID
 
@@ -112,11 +163,16 @@ typedef struct _per_thread_t {
     reg_info_t aflags;
     reg_id_t slot_use[MAX_SPILLS]; /* holds the reg_id_t of which reg is inside */
     int pending_unreserved; /* count of to-be-lazily-restored unreserved regs */
+    simd_info_t simd[NUM_SIMD_SLOTS];
+    reg_id_t simd_slot_use[MAX_SIMD_SPILLS];
+    int pending_simd_unreserved;
+    int simd_reserved; /* count of reserved SIMD regs */
     /* We store the linear address of our TLS for access from another thread: */
     byte *tls_seg_base;
     /* bb-local values */
     drreg_bb_properties_t bb_props;
     bool bb_has_internal_flow;
+    bool bb_for_trace;
 } per_thread_t;
 
 static drreg_options_t ops;
@@ -124,10 +180,24 @@ static drreg_options_t ops;
 static int tls_idx = -1;
 static uint tls_slot_offs;
 static reg_id_t tls_seg;
+/* The SIMD slots are a separate dr_raw_tls_calloc() allocation of simd_tls_slots
+ * pointer-sized slots starting at simd_tls_offs, within which our
+ * ops.num_spill_simd_slots slots start at simd_slot_offs.
+ */
+static uint simd_tls_offs;
+static uint simd_tls_slots;
+static uint simd_slot_offs;
+static uint simd_slot_size;
 
 #ifdef DEBUG
 static uint stats_max_slot;
 #endif
+static int stats_cross_block_spills_avoided;
+static int stats_spills_coalesced;
+static int stats_coalesce_write_backs;
+
+static per_thread_t *
+get_pt(void *drcontext);
 
 static drreg_status_t
 drreg_restore_reg_now(void *drcontext, instrlist_t *ilist, instr_t *inst,
@@ -174,6 +244,62 @@ find_free_slot(per_thread_t *pt)
     return MAX_SPILLS;
 }
 
+/* Gives up the slot kept by a native reg under ops.coalesce_spills. */
+static void
+drop_cached_slot(per_thread_t *pt, reg_id_t reg)
+{
+    reg_info_t *info = &pt->reg[GPR_IDX(reg)];
+    if (!info->cached)
+        return;
+    ASSERT(info->native && !info->in_use, "cached reg must be native and unreserved");
+    ASSERT(pt->slot_use[info->slot] == reg, "internal tracking error");
+    pt->slot_use[info->slot] = DR_REG_NULL;
+    info->cached = false;
+    info->cache_valid = false;
+}
+
+/* Like find_free_slot() but may take a slot kept under ops.coalesce_spills.  The
+ * caller must spill to the returned slot, which tells drreg_event_restore_state()
+ * that the slot no longer holds the prior reg's app value.
+ */
+static uint
+find_slot_for_spill(per_thread_t *pt)
+{
+    uint slot = find_free_slot(pt);
+    reg_id_t reg;
+    int pass;
+    if (slot < MAX_SPILLS)
+        return slot;
+    /* Prefer slots that are out of date and thus of no further use. */
+    for (pass = 0; pass < 2; pass++) {
+        for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
+            reg_info_t *info = &pt->reg[GPR_IDX(reg)];
+            if (info->cached && (pass > 0 || !info->cache_valid)) {
+                slot = info->slot;
+                drop_cached_slot(pt, reg);
+                return slot;
+            }
+        }
+    }
+    return MAX_SPILLS;
+}
+
+/* Whether a restore may keep its slot under ops.coalesce_spills, and whether a
+ * reservation may then reuse it without spilling.  Like lazy restores, this relies
+ * on linear control flow.  We only track app writes to a kept reg in the insertion
+ * phase.  We also avoid traces: drreg_event_restore_state() sees a trace as one
+ * fragment, where a slot kept to the end of one component would still be treated
+ * as holding the app value in the next.
+ */
+static bool
+coalescing_allowed(void *drcontext, per_thread_t *pt)
+{
+    return ops.coalesce_spills && !pt->bb_for_trace &&
+        drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION &&
+        !((pt->bb_has_internal_flow && !TEST(DRREG_IGNORE_CONTROL_FLOW, pt->bb_props)) ||
+          TEST(DRREG_CONTAINS_SPANNING_CONTROL_FLOW, pt->bb_props));
+}
+
 /* Up to caller to update pt->reg, including .ever_spilled.
  * This routine updates pt->slot_use.
  */
@@ -203,7 +329,25 @@ spill_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
 #endif
 }
 
-/* Up to caller to update pt->reg.  This routine updates pt->slot_use if release==true. */
+static void
+insert_restore(void *drcontext, reg_id_t reg, uint slot, instrlist_t *ilist,
+               instr_t *where)
+{
+    if (slot < ops.num_spill_slots) {
+        dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                               tls_slot_offs + slot*sizeof(reg_t), reg);
+    } else {
+        dr_spill_slot_t DR_slot = (dr_spill_slot_t)(slot - ops.num_spill_slots);
+        dr_restore_reg(drcontext, ilist, where, reg, DR_slot);
+    }
+}
+
+/* Up to caller to update pt->reg.  This routine updates pt->slot_use if release==true.
+ * Under ops.coalesce_spills, drreg_event_restore_state() keeps treating the slot as
+ * holding reg's app value after a restore, as it may be re-reserved without a new
+ * spill.  We thus encode a restore that releases the slot as two back-to-back
+ * loads, which drreg_event_restore_state() takes as the end of the reg's claim.
+ */
 static void
 restore_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
             instrlist_t *ilist, instr_t *where, bool release)
@@ -217,20 +361,16 @@ restore_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
            "internal tracking error");
     if (release)
         pt->slot_use[slot] = DR_REG_NULL;
-    if (slot < ops.num_spill_slots) {
-        dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
-                               tls_slot_offs + slot*sizeof(reg_t), reg);
-    } else {
-        dr_spill_slot_t DR_slot = (dr_spill_slot_t)(slot - ops.num_spill_slots);
-        dr_restore_reg(drcontext, ilist, where, reg, DR_slot);
-    }
+    insert_restore(drcontext, reg, slot, ilist, where);
+    if (release && ops.coalesce_spills && slot != AFLAGS_SLOT)
+        insert_restore(drcontext, reg, slot, ilist, where);
 }
 
 static reg_t
 get_spilled_value(void *drcontext, uint slot)
 {
     if (slot < ops.num_spill_slots) {
-        per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+        per_thread_t *pt = get_pt(drcontext);
         return *(reg_t *)
             (pt->tls_seg_base + tls_slot_offs + slot*sizeof(reg_t));
     } else {
@@ -239,6 +379,134 @@ get_spilled_value(void *drcontext, uint slot)
     }
 }
 
+static reg_id_t
+simd_reg(uint idx, opnd_size_t size)
+{
+#ifdef X86
+    return (size == OPSZ_32 ? DR_REG_START_YMM : DR_REG_START_XMM) + (reg_id_t)idx;
+#else
+    return DR_REG_Q0 + (reg_id_t)idx;
+#endif
+}
+
+/* Returns NUM_SIMD_SLOTS if reg is not a SIMD register that we support. */
+static uint
+simd_index(reg_id_t reg, OUT opnd_size_t *size)
+{
+    uint idx = NUM_SIMD_SLOTS;
+    opnd_size_t sz = OPSZ_16;
+#ifdef X86
+    if (reg >= DR_REG_START_YMM && reg <= DR_REG_STOP_YMM) {
+        idx = reg - DR_REG_START_YMM;
+        sz = OPSZ_32;
+    } else if (reg >= DR_REG_START_XMM && reg <= DR_REG_STOP_XMM)
+        idx = reg - DR_REG_START_XMM;
+#elif defined(AARCH64)
+    if (reg >= DR_REG_Q0 && reg <= DR_REG_Q31)
+        idx = reg - DR_REG_Q0;
+#endif
+    if (idx >= NUM_SIMD_SLOTS)
+        return NUM_SIMD_SLOTS;
+    if (size != NULL)
+        *size = sz;
+    return idx;
+}
+
+static uint
+simd_size_bits(opnd_size_t size)
+{
+    return (size == OPSZ_32 ? SIMD_LIVE_ALL : SIMD_LIVE_LOW);
+}
+
+static uint
+find_free_simd_slot(per_thread_t *pt)
+{
+    uint i;
+    for (i = 0; i < ops.num_spill_simd_slots; i++) {
+        if (pt->simd_slot_use[i] == DR_REG_NULL)
+            return i;
+    }
+    return MAX_SIMD_SPILLS;
+}
+
+static opnd_t
+simd_slot_opnd(uint slot, opnd_size_t size)
+{
+    uint offs = simd_slot_offs + slot*simd_slot_size;
+#ifdef X86
+    return opnd_create_far_base_disp_ex(tls_seg, DR_REG_NULL, DR_REG_NULL, 0, offs,
+                                        size, false, true, false);
+#else
+    return opnd_create_base_disp(tls_seg, DR_REG_NULL, 0, offs, size);
+#endif
+}
+
+/* Up to caller to update pt->simd.  This routine updates pt->simd_slot_use. */
+static void
+spill_simd_reg(void *drcontext, per_thread_t *pt, uint idx, opnd_size_t size,
+               uint slot, instrlist_t *ilist, instr_t *where)
+{
+    reg_id_t reg = simd_reg(idx, size);
+    LOG(drcontext, LOG_ALL, 3,
+        "%s @%d."PFX" %s %d\n", __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
+        get_register_name(reg), slot);
+    ASSERT(pt->simd_slot_use[slot] == DR_REG_NULL || pt->simd_slot_use[slot] == reg,
+           "internal tracking error");
+    pt->simd_slot_use[slot] = reg;
+#ifdef X86
+    if (size == OPSZ_32) {
+        PRE(ilist, where, INSTR_CREATE_vmovdqu
+            (drcontext, simd_slot_opnd(slot, size), opnd_create_reg(reg)));
+    } else {
+        PRE(ilist, where, INSTR_CREATE_movdqu
+            (drcontext, simd_slot_opnd(slot, size), opnd_create_reg(reg)));
+    }
+#elif defined(AARCH64)
+    PRE(ilist, where, INSTR_CREATE_str
+        (drcontext, simd_slot_opnd(slot, size), opnd_create_reg(reg)));
+#else
+    /* XXX: add NEON support for 32-bit ARM. */
+    ASSERT(false, "SIMD spills are not supported on this platform");
+#endif
+}
+
+/* Up to caller to update pt->simd.  This routine updates pt->simd_slot_use if
+ * release==true.
+ */
+static void
+restore_simd_reg(void *drcontext, per_thread_t *pt, uint idx, opnd_size_t size,
+                 uint slot, instrlist_t *ilist, instr_t *where, bool release)
+{
+    reg_id_t reg = simd_reg(idx, size);
+    LOG(drcontext, LOG_ALL, 3,
+        "%s @%d."PFX" %s slot=%d release=%d\n", __FUNCTION__, pt->live_idx,
+        instr_get_app_pc(where), get_register_name(reg), slot, release);
+    ASSERT(pt->simd_slot_use[slot] == reg, "internal tracking error");
+    if (release)
+        pt->simd_slot_use[slot] = DR_REG_NULL;
+#ifdef X86
+    if (size == OPSZ_32) {
+        PRE(ilist, where, INSTR_CREATE_vmovdqu
+            (drcontext, opnd_create_reg(reg), simd_slot_opnd(slot, size)));
+    } else {
+        PRE(ilist, where, INSTR_CREATE_movdqu
+            (drcontext, opnd_create_reg(reg), simd_slot_opnd(slot, size)));
+    }
+#elif defined(AARCH64)
+    PRE(ilist, where, INSTR_CREATE_ldr
+        (drcontext, opnd_create_reg(reg), simd_slot_opnd(slot, size)));
+#else
+    ASSERT(false, "SIMD spills are not supported on this platform");
+#endif
+}
+
+static byte *
+get_spilled_simd_value(void *drcontext, uint slot)
+{
+    per_thread_t *pt = get_pt(drcontext);
+    return pt->tls_seg_base + simd_slot_offs + slot*simd_slot_size;
+}
+
 drreg_status_t
 drreg_max_slots_used(OUT uint *max)
 {
@@ -252,6 +520,30 @@ drreg_max_slots_used(OUT uint *max)
 #endif
 }
 
+drreg_status_t
+drreg_get_stats(INOUT drreg_stats_t *stats)
+{
+    if (stats == NULL ||
+        stats->struct_size <= offsetof(drreg_stats_t, cross_block_spills_avoided))
+        return DRREG_ERROR_INVALID_PARAMETER;
+    stats->cross_block_spills_avoided = (uint64)(uint)stats_cross_block_spills_avoided;
+    if (stats->struct_size > offsetof(drreg_stats_t, spills_coalesced))
+        stats->spills_coalesced = (uint64)(uint)stats_spills_coalesced;
+    if (stats->struct_size > offsetof(drreg_stats_t, coalesce_write_backs))
+        stats->coalesce_write_backs = (uint64)(uint)stats_coalesce_write_backs;
+    return DRREG_SUCCESS;
+}
+
+/* Called when liveness lets us skip a spill, to attribute it to
+ * ops.cross_block_liveness if that is what made the value dead.
+ */
+static void
+note_spill_avoided(per_thread_t *pt, reg_info_t *info)
+{
+    if (pt->live_idx < info->succ_dead_idx)
+        dr_atomic_add32_return_sum(&stats_cross_block_spills_avoided, 1);
+}
+
 /***************************************************************************
  * ANALYSIS AND CROSS-APP-INSTR
  */
@@ -276,6 +568,181 @@ count_app_uses(per_thread_t *pt, opnd_t opnd)
     }
 }
 
+/* Returns the SIMD_LIVE_* bits of SIMD register idx that inst reads. */
+static uint
+simd_app_reads(instr_t *inst, uint idx)
+{
+    reg_id_t reg = simd_reg(idx, OPSZ_16);
+    uint bits = 0;
+    int i, j;
+#ifdef X86
+    switch (instr_get_opcode(inst)) {
+    case OP_fxsave32: case OP_fxsave64:
+    case OP_xsave32: case OP_xsave64:
+    case OP_xsaveopt32: case OP_xsaveopt64:
+        /* These read the SIMD registers without listing them as operands. */
+        return SIMD_LIVE_ALL;
+    }
+#endif
+    for (i = 0; i < instr_num_srcs(inst) + instr_num_dsts(inst); i++) {
+        bool is_src = i < instr_num_srcs(inst);
+        opnd_t opnd = is_src ? instr_get_src(inst, i) :
+            instr_get_dst(inst, i - instr_num_srcs(inst));
+        /* Registers used to address a memory destination are read, including
+         * the vector index of a VSIB operand.
+         */
+        if (!is_src && opnd_is_reg(opnd))
+            continue;
+        for (j = 0; j < opnd_num_regs_used(opnd); j++) {
+            reg_id_t used = opnd_get_reg_used(opnd, j);
+            if (reg_overlap(used, reg)) {
+#ifdef X86
+                if (reg_is_ymm(used))
+                    bits |= SIMD_LIVE_ALL;
+                else
+#endif
+                    bits |= SIMD_LIVE_LOW;
+            }
+        }
+    }
+    return bits;
+}
+
+/* Returns the SIMD_LIVE_* bits of SIMD register idx that inst fully writes.
+ * A write to a sub-register does not count, except that on x86 an xmm write
+ * counts for the low part.
+ */
+static uint
+simd_app_writes(instr_t *inst, uint idx, dr_opnd_query_flags_t flags)
+{
+#ifdef X86
+    if (instr_writes_to_exact_reg(inst, simd_reg(idx, OPSZ_32), flags))
+        return SIMD_LIVE_ALL;
+#endif
+    if (instr_writes_to_exact_reg(inst, simd_reg(idx, OPSZ_16), flags))
+        return SIMD_LIVE_LOW;
+    return 0;
+}
+
+/* Decodes the app instr at pc into inst, reading the app code safely as it may
+ * not have been executed yet.  Returns the pc of the next instr, or NULL on failure.
+ */
+static app_pc
+decode_app_instr_safely(void *drcontext, app_pc pc, instr_t *inst)
+{
+    byte buf[MAX_APP_INSTR_LENGTH];
+    size_t len;
+    byte *next;
+    /* XXX: we give up if the read crosses into unreadable memory even when
+     * the instr itself does not: that is conservative and rare.
+     */
+    if (!dr_safe_read(pc, sizeof(buf), buf, &len) || len != sizeof(buf))
+        return NULL;
+    next = decode_from_copy(drcontext, buf, pc, inst);
+    if (next == NULL || !instr_valid(inst))
+        return NULL;
+    return pc + (next - buf);
+}
+
+/* Adds into live[] and *aflags the registers and arithmetic flags that may be
+ * read on entry to the app code at pc.  We scan forward until the first control
+ * transfer and treat anything not written before that point as live.
+ */
+static void
+successor_liveness(void *drcontext, app_pc pc, void **live, uint *aflags)
+{
+    bool known[DR_NUM_GPR_REGS];
+    uint aflags_read = 0, aflags_known = 0;
+    uint num_known = 0;
+    reg_id_t reg;
+    instr_t inst;
+    int count;
+
+    memset(known, 0, sizeof(known));
+    instr_init(drcontext, &inst);
+    for (count = 0; count < MAX_SUCCESSOR_INSTRS; count++) {
+        ptr_uint_t aflags_new;
+        instr_reset(drcontext, &inst);
+        pc = decode_app_instr_safely(drcontext, pc, &inst);
+        if (pc == NULL || instr_is_cti(&inst) || instr_is_interrupt(&inst) ||
+            instr_is_syscall(&inst))
+            break;
+        for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
+            if (known[GPR_IDX(reg)])
+                continue;
+            /* We use the same tests as drreg_event_bb_analysis() */
+            if (instr_reads_from_reg(&inst, reg, DR_QUERY_INCLUDE_COND_SRCS))
+                live[GPR_IDX(reg)] = REG_LIVE;
+            else if (!instr_writes_to_exact_reg(&inst, reg, DR_QUERY_INCLUDE_COND_SRCS)
+                     IF_X86_64(&& !instr_writes_to_exact_reg(&inst, reg_64_to_32(reg),
+                                                             DR_QUERY_INCLUDE_COND_SRCS)))
+                continue;
+            known[GPR_IDX(reg)] = true;
+            num_known++;
+        }
+        aflags_new = instr_get_arith_flags(&inst, DR_QUERY_INCLUDE_COND_SRCS);
+        aflags_read |= (aflags_new & EFLAGS_READ_ARITH) & ~aflags_known;
+        aflags_known |= (aflags_new & EFLAGS_READ_ARITH) |
+            EFLAGS_WRITE_TO_READ(aflags_new & EFLAGS_WRITE_ARITH);
+        if (num_known == DR_NUM_GPR_REGS && aflags_known == EFLAGS_READ_ARITH)
+            break;
+    }
+    instr_free(drcontext, &inst);
+    for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
+        if (!known[GPR_IDX(reg)])
+            live[GPR_IDX(reg)] = REG_LIVE;
+    }
+    *aflags |= aflags_read | (EFLAGS_READ_ARITH & ~aflags_known);
+}
+
+/* For ops.cross_block_liveness, computes the liveness at the end of bb from its
+ * successors.  Returns false if the successors are not known, in which case
+ * everything must be considered live.
+ */
+static bool
+bb_successor_liveness(void *drcontext, instrlist_t *bb, void **live, uint *aflags)
+{
+    instr_t *last = instrlist_last(bb);
+    app_pc target = NULL;
+    reg_id_t reg;
+
+    if (!ops.cross_block_liveness || ops.conservative)
+        return false;
+    if (last == NULL || !instr_is_app(last) || instr_get_app_pc(last) == NULL)
+        return false;
+    if (instr_is_cti(last)) {
+        if ((!instr_is_ubr(last) && !instr_is_cbr(last) &&
+             !instr_is_call_direct(last)) ||
+            !opnd_is_pc(instr_get_target(last)))
+            return false;
+#ifdef ARM
+        /* We'd need to decode the target in the other mode. */
+        if (instr_get_opcode(last) == OP_blx)
+            return false;
+#endif
+        target = opnd_get_pc(instr_get_target(last));
+    } else if (instr_is_interrupt(last) || instr_is_syscall(last))
+        return false;
+
+    for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
+        live[GPR_IDX(reg)] = REG_DEAD;
+    *aflags = 0;
+    if (target != NULL)
+        successor_liveness(drcontext, target, live, aflags);
+    if (target == NULL || instr_is_cbr(last)) {
+        /* Re-decode the original app instr in case app2app changed its length. */
+        instr_t inst;
+        app_pc fall;
+        instr_init(drcontext, &inst);
+        fall = decode_app_instr_safely(drcontext, instr_get_app_pc(last), &inst);
+        instr_free(drcontext, &inst);
+        if (fall == NULL)
+            return false;
+        successor_liveness(drcontext, fall, live, aflags);
+    }
+    return true;
+}
+
 /* This event has to go last, to handle labels inserted by other components:
  * else our indices get off, and we can't simply skip labels in the
  * per-instr event b/c we need the liveness to advance at the label
@@ -285,16 +752,35 @@ static dr_emit_flags_t
 drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
                         bool for_trace, bool translating, OUT void **user_data)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     instr_t *inst;
     ptr_uint_t aflags_new, aflags_cur = 0;
     uint index = 0;
     reg_id_t reg;
+    /* Liveness beyond the end of the block, and which values are dead only due
+     * to it.
+     */
+    void *succ_live[DR_NUM_GPR_REGS];
+    uint succ_aflags = EFLAGS_READ_ARITH;
+    bool have_succ, succ_dead[DR_NUM_GPR_REGS];
+    uint aflags_succ_dead;
+    uint idx;
 
-    for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
+    have_succ = bb_successor_liveness(drcontext, bb, succ_live, &succ_aflags);
+    for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
         pt->reg[GPR_IDX(reg)].app_uses = 0;
+        pt->reg[GPR_IDX(reg)].succ_dead_idx = 0;
+        if (!have_succ)
+            succ_live[GPR_IDX(reg)] = REG_LIVE;
+        succ_dead[GPR_IDX(reg)] = (succ_live[GPR_IDX(reg)] == REG_DEAD);
+    }
+    pt->aflags.succ_dead_idx = 0;
+    aflags_succ_dead = EFLAGS_READ_ARITH & ~succ_aflags;
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++)
+        pt->simd[idx].app_uses = 0;
     /* pt->bb_props is set to 0 at thread init and after each bb */
     pt->bb_has_internal_flow = false;
+    pt->bb_for_trace = for_trace;
 
     /* Reverse scan is more efficient.  This means our indices are also reversed. */
     for (inst = instrlist_last(bb); inst != NULL; inst = instr_get_prev(inst)) {
@@ -321,18 +807,26 @@ drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
         for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
             void *value = REG_LIVE;
             /* DRi#1849: COND_SRCS here includes addressing regs in dsts */
-            if (instr_reads_from_reg(inst, reg, DR_QUERY_INCLUDE_COND_SRCS))
+            if (instr_reads_from_reg(inst, reg, DR_QUERY_INCLUDE_COND_SRCS)) {
                 value = REG_LIVE;
+                succ_dead[GPR_IDX(reg)] = false;
+            }
             /* make sure we don't consider writes to sub-regs */
             else if (instr_writes_to_exact_reg(inst, reg, DR_QUERY_INCLUDE_COND_SRCS)
                      /* a write to a 32-bit reg for amd64 zeroes the top 32 bits */
                      IF_X86_64(|| instr_writes_to_exact_reg(inst, reg_64_to_32(reg),
-                                                            DR_QUERY_INCLUDE_COND_SRCS)))
+                                                            DR_QUERY_INCLUDE_COND_SRCS))) {
                 value = REG_DEAD;
-            else if (xfer)
+                succ_dead[GPR_IDX(reg)] = false;
+            } else if (xfer && (index > 0 || !have_succ)) {
                 value = REG_LIVE;
-            else if (index > 0)
+                succ_dead[GPR_IDX(reg)] = false;
+            } else if (index > 0)
                 value = drvector_get_entry(&pt->reg[GPR_IDX(reg)].live, index-1);
+            else
+                value = succ_live[GPR_IDX(reg)];
+            if (succ_dead[GPR_IDX(reg)])
+                pt->reg[GPR_IDX(reg)].succ_dead_idx = index + 1;
             LOG(drcontext, LOG_ALL, 3, " %s=%d", get_register_name(reg),
                 (int)(ptr_uint_t)value);
             drvector_set_entry(&pt->reg[GPR_IDX(reg)].live, index, value);
@@ -340,13 +834,17 @@ drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
 
         /* aflags liveness */
         aflags_new = instr_get_arith_flags(inst, DR_QUERY_INCLUDE_COND_SRCS);
-        if (xfer)
+        if (xfer && (index > 0 || !have_succ)) {
             aflags_cur = EFLAGS_READ_ARITH; /* assume flags are read before written */
-        else {
+            aflags_succ_dead = 0;
+        } else {
             uint aflags_read, aflags_w2r;
-            if (index == 0)
-                aflags_cur = EFLAGS_READ_ARITH; /* assume flags are read before written */
-            else {
+            if (index == 0) {
+                /* Unless we know the successors, assume flags are read before
+                 * written.
+                 */
+                aflags_cur = succ_aflags;
+            } else {
                 aflags_cur = (uint)(ptr_uint_t)
                     drvector_get_entry(&pt->aflags.live, index-1);
             }
@@ -356,10 +854,34 @@ drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
             /* if a flag is written and not read by inst, clear the read bit */
             aflags_w2r = EFLAGS_WRITE_TO_READ(aflags_new & EFLAGS_WRITE_ARITH);
             aflags_cur &= ~(aflags_w2r & ~aflags_read);
+            aflags_succ_dead &= ~(aflags_read | aflags_w2r);
         }
+        if (aflags_succ_dead != 0)
+            pt->aflags.succ_dead_idx = index + 1;
         LOG(drcontext, LOG_ALL, 3, " flags=%d\n", aflags_cur);
         drvector_set_entry(&pt->aflags.live, index, (void *)(ptr_uint_t)aflags_cur);
 
+        /* SIMD liveness, which we only track if SIMD registers can be reserved.
+         * XXX: we do not apply ops.cross_block_liveness to these.
+         */
+        if (ops.num_spill_simd_slots > 0) {
+            for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+                uint value = SIMD_LIVE_ALL;
+                if (!xfer) {
+                    if (index > 0) {
+                        value = (uint)(ptr_uint_t)
+                            drvector_get_entry(&pt->simd[idx].live, index-1);
+                    }
+                    value &= ~simd_app_writes(inst, idx, DR_QUERY_INCLUDE_COND_SRCS);
+                }
+                value |= simd_app_reads(inst, idx);
+                drvector_set_entry(&pt->simd[idx].live, index,
+                                   (void *)(ptr_uint_t)value);
+                if (instr_is_app(inst) && instr_uses_reg(inst, simd_reg(idx, OPSZ_16)))
+                    pt->simd[idx].app_uses++;
+            }
+        }
+
         if (instr_is_app(inst)) {
             int i;
             for (i = 0; i < instr_num_dsts(inst); i++)
@@ -380,17 +902,103 @@ static dr_emit_flags_t
 drreg_event_bb_insert_early(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
                           bool for_trace, bool translating, void *user_data)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     pt->cur_instr = inst;
     pt->live_idx--; /* counts backward */
     return DR_EMIT_DEFAULT;
 }
 
+static void
+drreg_restore_simd_now(void *drcontext, instrlist_t *ilist, instr_t *inst,
+                       per_thread_t *pt, uint idx)
+{
+    simd_info_t *info = &pt->simd[idx];
+    if (info->ever_spilled) {
+        restore_simd_reg(drcontext, pt, idx, info->size, info->slot, ilist, inst, true);
+    } else {
+        /* still need to release slot */
+        pt->simd_slot_use[info->slot] = DR_REG_NULL;
+    }
+    info->native = true;
+}
+
+/* The SIMD counterpart of the GPR handling in drreg_event_bb_insert_late(). */
+static void
+drreg_simd_insert_late(void *drcontext, per_thread_t *pt, instrlist_t *bb,
+                       instr_t *inst)
+{
+    instr_t *next = instr_get_next(inst);
+    bool barrier = (pt->bb_has_internal_flow &&
+                    !TEST(DRREG_IGNORE_CONTROL_FLOW, pt->bb_props)) ||
+        TEST(DRREG_CONTAINS_SPANNING_CONTROL_FLOW, pt->bb_props);
+    uint idx;
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+        simd_info_t *info = &pt->simd[idx];
+        uint size_bits;
+        bool writes, needs_app_value;
+        if (info->native)
+            continue;
+        size_bits = simd_size_bits(info->size);
+        writes = instr_writes_to_reg(inst, simd_reg(idx, info->size),
+                                     DR_QUERY_INCLUDE_ALL);
+        /* As for GPRs, we treat a partial or conditional write as a read. */
+        needs_app_value = simd_app_reads(inst, idx) != 0 ||
+            (writes &&
+             !TESTALL(size_bits, simd_app_writes(inst, idx, DR_QUERY_DEFAULT)));
+        if (!info->in_use) {
+            if (drmgr_is_last_instr(drcontext, inst) || needs_app_value || barrier) {
+                LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": lazily restoring %s\n",
+                    __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
+                    get_register_name(simd_reg(idx, info->size)));
+                drreg_restore_simd_now(drcontext, bb, inst, pt, idx);
+                pt->pending_simd_unreserved--;
+            } else if (writes) {
+                /* The app value is replaced, so just drop the slot. */
+                info->ever_spilled = false;
+                drreg_restore_simd_now(drcontext, bb, inst, pt, idx);
+                pt->pending_simd_unreserved--;
+            }
+        } else if (needs_app_value || writes) {
+            /* The approach, which drreg_event_restore_state() relies on:
+             *   + spill reg (tool val) to new slot
+             *   + if the app reads: restore to reg (app val) from app slot
+             *   + <app instr>
+             *   + if the app writes a live value: spill reg (app val) to app slot
+             *   + restore to reg (tool val) from new slot
+             */
+            uint tmp_slot = find_free_simd_slot(pt);
+            if (tmp_slot == MAX_SIMD_SPILLS) {
+                drreg_report_error(DRREG_ERROR_OUT_OF_SLOTS,
+                                   "failed to preserve tool SIMD val around app use");
+                continue;
+            }
+            LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": preserving %s around app use\n",
+                __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
+                get_register_name(simd_reg(idx, info->size)));
+            spill_simd_reg(drcontext, pt, idx, info->size, tmp_slot, bb, inst);
+            if (needs_app_value) {
+                restore_simd_reg(drcontext, pt, idx, info->size, info->slot,
+                                 bb, inst, false/*keep slot*/);
+            }
+            if (writes &&
+                (ops.conservative || pt->live_idx == 0 ||
+                 TESTANY(size_bits, (uint)(ptr_uint_t)
+                         drvector_get_entry(&info->live, pt->live_idx-1)))) {
+                spill_simd_reg(drcontext, pt, idx, info->size, info->slot,
+                               bb, next/*after*/);
+                info->ever_spilled = true;
+            }
+            restore_simd_reg(drcontext, pt, idx, info->size, tmp_slot,
+                             bb, next/*after*/, true);
+        }
+    }
+}
+
 static dr_emit_flags_t
 drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
                            bool for_trace, bool translating, void *user_data)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     reg_id_t reg;
     instr_t *next = instr_get_next(inst);
     bool restored_for_read[DR_NUM_GPR_REGS];
@@ -445,9 +1053,21 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
                     LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": lazily restoring %s\n",
                         __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
                         get_register_name(reg));
-                    res = drreg_restore_reg_now(drcontext, bb, inst, pt, reg);
-                    if (res != DRREG_SUCCESS)
-                        drreg_report_error(res, "lazy restore failed");
+                    if (coalescing_allowed(drcontext, pt) &&
+                        !drmgr_is_last_instr(drcontext, inst) &&
+                        pt->reg[GPR_IDX(reg)].ever_spilled &&
+                        pt->reg[GPR_IDX(reg)].xchg == DR_REG_NULL) {
+                        /* Keep the slot for a later reservation of this reg. */
+                        restore_reg(drcontext, pt, reg, pt->reg[GPR_IDX(reg)].slot,
+                                    bb, inst, false/*keep slot*/);
+                        pt->reg[GPR_IDX(reg)].native = true;
+                        pt->reg[GPR_IDX(reg)].cached = true;
+                        pt->reg[GPR_IDX(reg)].cache_valid = true;
+                    } else {
+                        res = drreg_restore_reg_now(drcontext, bb, inst, pt, reg);
+                        if (res != DRREG_SUCCESS)
+                            drreg_report_error(res, "lazy restore failed");
+                    }
                     ASSERT(pt->pending_unreserved > 0, "should not go negative");
                     pt->pending_unreserved--;
                 } else if (pt->aflags.xchg == reg) {
@@ -460,7 +1080,7 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
                      * register).
                      * XXX: optimize via xchg w/ a dead reg.
                      */
-                    uint tmp_slot = find_free_slot(pt);
+                    uint tmp_slot = find_slot_for_spill(pt);
                     if (tmp_slot == MAX_SPILLS) {
                         drreg_report_error(DRREG_ERROR_OUT_OF_SLOTS,
                                            "failed to preserve tool val around app read");
@@ -551,7 +1171,7 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
                     "%s @%d."PFX": re-spilling %s after app write\n", __FUNCTION__,
                     pt->live_idx, instr_get_app_pc(inst), get_register_name(reg));
                 if (!restored_for_read[GPR_IDX(reg)]) {
-                    tmp_slot = find_free_slot(pt);
+                    tmp_slot = find_slot_for_spill(pt);
                     if (tmp_slot == MAX_SPILLS) {
                         drreg_report_error(DRREG_ERROR_OUT_OF_SLOTS,
                                            "failed to preserve tool val wrt app write");
@@ -579,11 +1199,36 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
             if (res != DRREG_SUCCESS)
                 drreg_report_error(res, "slot release on app write failed");
             pt->pending_unreserved--;
+        } else if (pt->reg[GPR_IDX(reg)].cached &&
+                   instr_writes_to_reg(inst, reg, DR_QUERY_INCLUDE_ALL)) {
+            /* Keep the kept slot up to date, as drreg_event_restore_state() will
+             * restore from it, unless the new value is dead.
+             */
+            if (!drmgr_is_last_instr(drcontext, inst) &&
+                (ops.conservative ||
+                 drvector_get_entry(&pt->reg[GPR_IDX(reg)].live,
+                                    pt->live_idx-1) == REG_LIVE)) {
+                LOG(drcontext, LOG_ALL, 3,
+                    "%s @%d."PFX": updating kept slot for %s after app write\n",
+                    __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
+                    get_register_name(reg));
+                spill_reg(drcontext, pt, reg, pt->reg[GPR_IDX(reg)].slot,
+                          bb, next/*after*/);
+                pt->reg[GPR_IDX(reg)].cache_valid = true;
+                dr_atomic_add32_return_sum(&stats_coalesce_write_backs, 1);
+            } else
+                pt->reg[GPR_IDX(reg)].cache_valid = false;
         }
     }
 
-    if (drmgr_is_last_instr(drcontext, inst))
+    if (pt->pending_simd_unreserved > 0 || pt->simd_reserved > 0)
+        drreg_simd_insert_late(drcontext, pt, bb, inst);
+
+    if (drmgr_is_last_instr(drcontext, inst)) {
+        for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
+            drop_cached_slot(pt, reg);
         pt->bb_props = 0;
+    }
 
 #ifdef DEBUG
     if (drmgr_is_last_instr(drcontext, inst)) {
@@ -599,6 +1244,10 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
             if (pt->slot_use[i] != DR_REG_NULL)
             ASSERT(pt->slot_use[i] == DR_REG_NULL, "user failed to unreserve a register");
         }
+        for (i = 0; i < NUM_SIMD_SLOTS; i++) {
+            ASSERT(!pt->simd[i].in_use && pt->simd[i].native,
+                   "user failed to unreserve a SIMD register");
+        }
     }
 #endif
 
@@ -620,16 +1269,26 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
 static drreg_status_t
 drreg_forward_analysis(void *drcontext, instr_t *start)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     instr_t *inst;
     ptr_uint_t aflags_new, aflags_cur = 0;
     reg_id_t reg;
+    uint idx;
+    /* The SIMD_LIVE_* bits found to be read, or written, before the other. */
+    uint simd_read[NUM_SIMD_SLOTS], simd_known[NUM_SIMD_SLOTS];
 
     /* We just use index 0 of the live vectors */
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
         pt->reg[GPR_IDX(reg)].app_uses = 0;
         drvector_set_entry(&pt->reg[GPR_IDX(reg)].live, 0, REG_UNKNOWN);
         pt->reg[GPR_IDX(reg)].ever_spilled = false;
+        pt->reg[GPR_IDX(reg)].succ_dead_idx = 0;
+    }
+    pt->aflags.succ_dead_idx = 0;
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+        pt->simd[idx].app_uses = 0;
+        simd_read[idx] = 0;
+        simd_known[idx] = 0;
     }
 
     /* We have to consider meta instrs as well */
@@ -663,6 +1322,19 @@ drreg_forward_analysis(void *drcontext, instr_t *start)
         aflags_new &= (~(EFLAGS_WRITE_TO_READ(aflags_cur)));
         aflags_cur |= aflags_new;
 
+        /* SIMD liveness */
+        for (idx = 0; ops.num_spill_simd_slots > 0 && idx < NUM_SIMD_SLOTS; idx++) {
+            uint unknown = SIMD_LIVE_ALL & ~simd_known[idx];
+            if (unknown == 0)
+                continue;
+            simd_read[idx] |= simd_app_reads(inst, idx) & unknown;
+            simd_known[idx] |=
+                (simd_app_reads(inst, idx) |
+                 simd_app_writes(inst, idx, DR_QUERY_INCLUDE_COND_SRCS)) & unknown;
+            if (instr_is_app(inst) && instr_uses_reg(inst, simd_reg(idx, OPSZ_16)))
+                pt->simd[idx].app_uses++;
+        }
+
         if (instr_is_app(inst)) {
             int i;
             for (i = 0; i < instr_num_dsts(inst); i++)
@@ -681,6 +1353,11 @@ drreg_forward_analysis(void *drcontext, instr_t *start)
     drvector_set_entry(&pt->aflags.live, 0, (void *)(ptr_uint_t)
                        /* set read bit if not written */
                        (EFLAGS_READ_ARITH & (~(EFLAGS_WRITE_TO_READ(aflags_cur)))));
+    for (idx = 0; ops.num_spill_simd_slots > 0 && idx < NUM_SIMD_SLOTS; idx++) {
+        /* Anything neither read nor written is unknown and thus live */
+        drvector_set_entry(&pt->simd[idx].live, 0, (void *)(ptr_uint_t)
+                           (simd_read[idx] | (SIMD_LIVE_ALL & ~simd_known[idx])));
+    }
     return DRREG_SUCCESS;
 }
 
@@ -703,6 +1380,11 @@ drreg_init_and_fill_vector(drvector_t *vec, bool allowed)
 drreg_status_t
 drreg_set_vector_entry(drvector_t *vec, reg_id_t reg, bool allowed)
 {
+    uint idx = simd_index(reg, NULL);
+    if (vec != NULL && idx < NUM_SIMD_SLOTS) {
+        drvector_set_entry(vec, idx, allowed ? (void *)(ptr_uint_t)1 : NULL);
+        return DRREG_SUCCESS;
+    }
     if (vec == NULL || reg < DR_REG_START_GPR || reg > DR_REG_STOP_GPR)
         return DRREG_ERROR_INVALID_PARAMETER;
     drvector_set_entry(vec, reg - DR_REG_START_GPR,
@@ -716,11 +1398,14 @@ drreg_reserve_reg_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
                            drvector_t *reg_allowed, bool only_if_no_spill,
                            OUT reg_id_t *reg_out)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     uint slot = MAX_SPILLS;
     uint min_uses = UINT_MAX;
     reg_id_t reg = DR_REG_STOP_GPR + 1, best_reg = DR_REG_NULL;
+    reg_id_t cached_reg = DR_REG_NULL;
     bool already_spilled = false;
+    bool coalesce = coalescing_allowed(drcontext, pt);
+    bool end_claim = false;
     if (reg_out == NULL)
         return DRREG_ERROR_INVALID_PARAMETER;
 
@@ -768,6 +1453,10 @@ drreg_reserve_reg_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
              */
             if (drvector_get_entry(&pt->reg[idx].live, pt->live_idx) == REG_DEAD)
                 break;
+            /* Next best is a reg whose app value is still in its kept slot. */
+            if (coalesce && pt->reg[idx].cached && pt->reg[idx].cache_valid &&
+                cached_reg == DR_REG_NULL)
+                cached_reg = reg;
             if (only_if_no_spill)
                 continue;
             if (pt->reg[idx].app_uses < min_uses) {
@@ -777,13 +1466,38 @@ drreg_reserve_reg_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
         }
     }
     if (reg > DR_REG_STOP_GPR) {
-        if (best_reg != DR_REG_NULL)
+        if (cached_reg != DR_REG_NULL)
+            reg = cached_reg;
+        else if (best_reg != DR_REG_NULL)
             reg = best_reg;
         else
             return DRREG_ERROR_REG_CONFLICT;
     }
-    if (slot == MAX_SPILLS) {
-        slot = find_free_slot(pt);
+    if (pt->reg[GPR_IDX(reg)].cached) {
+        slot = pt->reg[GPR_IDX(reg)].slot;
+        if (coalesce && pt->reg[GPR_IDX(reg)].cache_valid &&
+            (ops.conservative ||
+             drvector_get_entry(&pt->reg[GPR_IDX(reg)].live, pt->live_idx) == REG_LIVE)) {
+            LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": %s app value still in slot %d\n",
+                __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
+                get_register_name(reg), slot);
+            already_spilled = true;
+            pt->reg[GPR_IDX(reg)].ever_spilled = true;
+            dr_atomic_add32_return_sum(&stats_spills_coalesced, 1);
+        } else
+            end_claim = true;
+        pt->reg[GPR_IDX(reg)].cached = false;
+        pt->reg[GPR_IDX(reg)].cache_valid = false;
+    } else if (slot == MAX_SPILLS) {
+        if (ops.conservative ||
+            drvector_get_entry(&pt->reg[GPR_IDX(reg)].live, pt->live_idx) == REG_LIVE)
+            slot = find_slot_for_spill(pt);
+        else {
+            /* We won't spill, so we can't take a kept slot: see
+             * find_slot_for_spill().
+             */
+            slot = find_free_slot(pt);
+        }
         if (slot == MAX_SPILLS)
             return DRREG_ERROR_OUT_OF_SLOTS;
     }
@@ -806,6 +1520,15 @@ drreg_reserve_reg_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
                 get_register_name(reg), slot);
             pt->slot_use[slot] = reg;
             pt->reg[GPR_IDX(reg)].ever_spilled = false;
+            note_spill_avoided(pt, &pt->reg[GPR_IDX(reg)]);
+            if (end_claim) {
+                /* The kept slot may be stale, and we will not spill into it: tell
+                 * drreg_event_restore_state() it no longer holds the app value.
+                 * The reg is dead so we can clobber it.
+                 */
+                insert_restore(drcontext, reg, slot, ilist, where);
+                insert_restore(drcontext, reg, slot, ilist, where);
+            }
         }
     } else {
         LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": %s already spilled to slot %d\n",
@@ -849,7 +1572,7 @@ drreg_status_t
 drreg_get_app_value(void *drcontext, instrlist_t *ilist, instr_t *where,
                     reg_id_t app_reg, reg_id_t dst_reg)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (!reg_is_pointer_sized(app_reg) || !reg_is_pointer_sized(dst_reg))
         return DRREG_ERROR_INVALID_PARAMETER;
 
@@ -965,7 +1688,7 @@ drreg_status_t
 drreg_unreserve_register(void *drcontext, instrlist_t *ilist, instr_t *where,
                          reg_id_t reg)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (!pt->reg[GPR_IDX(reg)].in_use)
         return DRREG_ERROR_INVALID_PARAMETER;
     LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX" %s\n", __FUNCTION__,
@@ -991,7 +1714,7 @@ drreg_status_t
 drreg_reservation_info(void *drcontext, reg_id_t reg, opnd_t *opnd OUT,
                        bool *is_dr_slot OUT, uint *tls_offs OUT)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     uint slot;
     if (!pt->reg[GPR_IDX(reg)].in_use)
         return DRREG_ERROR_INVALID_PARAMETER;
@@ -1026,7 +1749,7 @@ drreg_reservation_info(void *drcontext, reg_id_t reg, opnd_t *opnd OUT,
 drreg_status_t
 drreg_is_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (dead == NULL)
         return DRREG_ERROR_INVALID_PARAMETER;
     if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
@@ -1042,7 +1765,7 @@ drreg_is_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead)
 drreg_status_t
 drreg_set_bb_properties(void *drcontext, drreg_bb_properties_t flags)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_APP2APP &&
         drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_ANALYSIS &&
         drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION)
@@ -1054,6 +1777,178 @@ drreg_set_bb_properties(void *drcontext, drreg_bb_properties_t flags)
     return DRREG_SUCCESS;
 }
 
+/***************************************************************************
+ * SIMD REGISTERS
+ */
+
+drreg_status_t
+drreg_init_and_fill_simd_vector(drvector_t *vec, bool allowed)
+{
+    uint idx;
+    if (vec == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    drvector_init(vec, NUM_SIMD_SLOTS, false/*!synch*/, NULL);
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++)
+        drvector_set_entry(vec, idx, allowed ? (void *)(ptr_uint_t)1 : NULL);
+    return DRREG_SUCCESS;
+}
+
+/* Assumes liveness info is already set up in per_thread_t */
+static drreg_status_t
+drreg_reserve_simd_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            opnd_size_t size, drvector_t *reg_allowed,
+                            OUT reg_id_t *reg_out)
+{
+    per_thread_t *pt = get_pt(drcontext);
+    uint size_bits = simd_size_bits(size);
+    uint idx = NUM_SIMD_SLOTS, best_idx = NUM_SIMD_SLOTS;
+    uint slot = MAX_SIMD_SPILLS;
+    uint min_uses = UINT_MAX;
+    bool already_spilled = false;
+    simd_info_t *info;
+
+    /* First, try to use a previously unreserved but not yet lazily restored reg
+     * whose slot is wide enough, as for GPRs.
+     */
+    if (pt->pending_simd_unreserved > 0) {
+        for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+            info = &pt->simd[idx];
+            if (!info->native && !info->in_use &&
+                (reg_allowed == NULL || drvector_get_entry(reg_allowed, idx) != NULL) &&
+                TESTALL(size_bits, simd_size_bits(info->size))) {
+                slot = info->slot;
+                pt->pending_simd_unreserved--;
+                already_spilled = info->ever_spilled;
+                LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": using un-restored %s slot %d\n",
+                    __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
+                    get_register_name(simd_reg(idx, info->size)), slot);
+                break;
+            }
+        }
+    }
+
+    if (idx == NUM_SIMD_SLOTS) {
+        /* Look for a dead register, or the least-used register */
+        for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+            info = &pt->simd[idx];
+            /* Skip regs still holding a slot as well as reserved regs. */
+            if (info->in_use || !info->native)
+                continue;
+            if (reg_allowed != NULL && drvector_get_entry(reg_allowed, idx) == NULL)
+                continue;
+            if (!TESTANY(size_bits, (uint)(ptr_uint_t)
+                         drvector_get_entry(&info->live, pt->live_idx)))
+                break;
+            if (info->app_uses < min_uses) {
+                best_idx = idx;
+                min_uses = info->app_uses;
+            }
+        }
+        if (idx == NUM_SIMD_SLOTS) {
+            if (best_idx == NUM_SIMD_SLOTS)
+                return DRREG_ERROR_REG_CONFLICT;
+            idx = best_idx;
+        }
+        slot = find_free_simd_slot(pt);
+        if (slot == MAX_SIMD_SPILLS)
+            return DRREG_ERROR_OUT_OF_SLOTS;
+        pt->simd[idx].size = size;
+    }
+
+    info = &pt->simd[idx];
+    ASSERT(!info->in_use, "overlapping uses");
+    info->in_use = true;
+    pt->simd_reserved++;
+    if (!already_spilled) {
+        /* Even if dead now, we need to own a slot in case reserved past dead point */
+        if (ops.conservative ||
+            TESTANY(simd_size_bits(info->size), (uint)(ptr_uint_t)
+                    drvector_get_entry(&info->live, pt->live_idx))) {
+            spill_simd_reg(drcontext, pt, idx, info->size, slot, ilist, where);
+            info->ever_spilled = true;
+        } else {
+            LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": no need to spill %s to slot %d\n",
+                __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
+                get_register_name(simd_reg(idx, info->size)), slot);
+            pt->simd_slot_use[slot] = simd_reg(idx, info->size);
+            info->ever_spilled = false;
+        }
+    }
+    info->native = false;
+    info->slot = slot;
+    *reg_out = simd_reg(idx, size);
+    return DRREG_SUCCESS;
+}
+
+/* Returns whether SIMD registers of the given width can be reserved. */
+static bool
+simd_size_supported(opnd_size_t size)
+{
+    return ops.num_spill_simd_slots > 0 &&
+        (size == OPSZ_16 || (size == OPSZ_32 && simd_slot_size >= 32));
+}
+
+drreg_status_t
+drreg_reserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            opnd_size_t size, drvector_t *reg_allowed,
+                            OUT reg_id_t *reg_out)
+{
+    if (reg_out == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    if (!simd_size_supported(size))
+        return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        drreg_status_t res = drreg_forward_analysis(drcontext, where);
+        if (res != DRREG_SUCCESS)
+            return res;
+    }
+    return drreg_reserve_simd_internal(drcontext, ilist, where, size, reg_allowed,
+                                       reg_out);
+}
+
+drreg_status_t
+drreg_unreserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                              reg_id_t reg)
+{
+    per_thread_t *pt = get_pt(drcontext);
+    uint idx = simd_index(reg, NULL);
+    if (idx == NUM_SIMD_SLOTS || !pt->simd[idx].in_use)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX" %s\n", __FUNCTION__,
+        pt->live_idx, instr_get_app_pc(where), get_register_name(reg));
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        /* We have no way to lazily restore. */
+        drreg_restore_simd_now(drcontext, ilist, where, pt, idx);
+    } else {
+        /* We lazily restore in drreg_event_bb_insert_late(). */
+        pt->pending_simd_unreserved++;
+    }
+    pt->simd[idx].in_use = false;
+    pt->simd_reserved--;
+    return DRREG_SUCCESS;
+}
+
+drreg_status_t
+drreg_is_simd_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead)
+{
+    per_thread_t *pt = get_pt(drcontext);
+    opnd_size_t size;
+    uint idx = simd_index(reg, &size);
+    if (dead == NULL || idx == NUM_SIMD_SLOTS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    if (!simd_size_supported(size))
+        return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        drreg_status_t res = drreg_forward_analysis(drcontext, inst);
+        if (res != DRREG_SUCCESS)
+            return res;
+        ASSERT(pt->live_idx == 0, "non-drmgr-insert always uses 0 index");
+    }
+    *dead = !TESTANY(simd_size_bits(size), (uint)(ptr_uint_t)
+                     drvector_get_entry(&pt->simd[idx].live, pt->live_idx));
+    return DRREG_SUCCESS;
+}
+
 /***************************************************************************
  * ARITHMETIC FLAGS
  */
@@ -1088,8 +1983,12 @@ drreg_move_aflags_from_reg(void *drcontext, instrlist_t *ilist,
     if (ops.conservative ||
         drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live, pt->live_idx)
         == REG_LIVE) {
+        bool keep = coalescing_allowed(drcontext, pt);
         restore_reg(drcontext, pt, DR_REG_XAX,
-                    pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot, ilist, where, true);
+                    pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot, ilist, where, !keep);
+        /* As for a lazy restore, keep the slot under ops.coalesce_spills */
+        pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached = keep;
+        pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid = keep;
     } else
         pt->slot_use[pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot] = DR_REG_NULL;
     pt->reg[DR_REG_XAX-DR_REG_START_GPR].in_use = false;
@@ -1123,13 +2022,23 @@ drreg_spill_aflags(void *drcontext, instrlist_t *ilist, instr_t *where, per_thre
         LOG(drcontext, LOG_ALL, 3, "  using un-restored xax in slot %d\n",
             pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot);
     } else {
-        uint xax_slot = find_free_slot(pt);
+        uint xax_slot;
+        bool xax_live = ops.conservative ||
+            drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live,
+                               pt->live_idx) == REG_LIVE;
+        bool xax_in_slot = false;
+        if (pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached) {
+            /* Use the slot kept under ops.coalesce_spills */
+            xax_slot = pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot;
+            xax_in_slot = pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid;
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached = false;
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid = false;
+        } else
+            xax_slot = xax_live ? find_slot_for_spill(pt) : find_free_slot(pt);
         if (xax_slot == MAX_SPILLS)
             return DRREG_ERROR_OUT_OF_SLOTS;
         if (pt->aflags.xchg != DR_REG_XAX) {
-            if (ops.conservative ||
-                drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live,
-                                   pt->live_idx) == REG_LIVE)
+            if (xax_live && !xax_in_slot)
                 spill_reg(drcontext, pt, DR_REG_XAX, xax_slot, ilist, where);
             else
                 pt->slot_use[xax_slot] = DR_REG_XAX;
@@ -1174,6 +2083,9 @@ drreg_restore_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
 #ifdef X86
     uint aflags = (uint)(ptr_uint_t) drvector_get_entry(&pt->aflags.live, pt->live_idx);
     uint temp_slot = 0;
+    bool xax_live = ops.conservative ||
+        drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live, pt->live_idx)
+        == REG_LIVE;
     LOG(drcontext, LOG_ALL, 3,
         "%s @%d."PFX": release=%d xax-in-use=%d,slot=%d xchg=%s\n", __FUNCTION__,
         pt->live_idx, instr_get_app_pc(where), release,
@@ -1183,19 +2095,26 @@ drreg_restore_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
     if (pt->aflags.xchg == DR_REG_XAX) {
         ASSERT(pt->reg[DR_REG_XAX-DR_REG_START_GPR].in_use, "eflags-in-xax error");
     } else {
-        temp_slot = find_free_slot(pt);
         if (pt->reg[DR_REG_XAX-DR_REG_START_GPR].in_use) {
             /* XXX i#511: pick an unreserved reg, spill it, and put xax there
              * temporarily.
              */
             return DRREG_ERROR_REG_CONFLICT;
         }
-        if (temp_slot == MAX_SPILLS)
-            return DRREG_ERROR_OUT_OF_SLOTS;
-        if (ops.conservative ||
-            drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live, pt->live_idx)
-            == REG_LIVE)
-            spill_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where);
+        if (pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached) {
+            /* Use the slot kept under ops.coalesce_spills */
+            temp_slot = pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot;
+            if (xax_live && !pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid) {
+                spill_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where);
+                pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid = true;
+            }
+        } else {
+            temp_slot = xax_live ? find_slot_for_spill(pt) : find_free_slot(pt);
+            if (temp_slot == MAX_SPILLS)
+                return DRREG_ERROR_OUT_OF_SLOTS;
+            if (xax_live)
+                spill_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where);
+        }
         restore_reg(drcontext, pt, DR_REG_XAX, AFLAGS_SLOT, ilist, where, release);
     }
     if (TEST(EFLAGS_READ_OF, aflags)) {
@@ -1212,10 +2131,21 @@ drreg_restore_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
             pt->aflags.xchg = DR_REG_NULL;
             pt->reg[DR_REG_XAX-DR_REG_START_GPR].in_use = false;
         }
-    } else {
-        if (ops.conservative ||
-            drvector_get_entry(&pt->reg[DR_REG_XAX-DR_REG_START_GPR].live, pt->live_idx)
-            == REG_LIVE)
+    } else if (pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached) {
+        if (xax_live) {
+            restore_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where,
+                        false/*keep slot*/);
+        }
+    } else if (xax_live) {
+        if (coalescing_allowed(drcontext, pt) &&
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].native) {
+            /* Keep the slot, as for a lazy restore */
+            restore_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where,
+                        false/*keep slot*/);
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].slot = temp_slot;
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].cached = true;
+            pt->reg[DR_REG_XAX-DR_REG_START_GPR].cache_valid = true;
+        } else
             restore_reg(drcontext, pt, DR_REG_XAX, temp_slot, ilist, where, true);
     }
 #elif defined(AARCHXX)
@@ -1236,7 +2166,7 @@ drreg_restore_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
 drreg_status_t
 drreg_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     drreg_status_t res;
     uint aflags;
     if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
@@ -1255,6 +2185,7 @@ drreg_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
             pt->slot_use[AFLAGS_SLOT] = DR_REG_NULL;
         pt->aflags.in_use = true;
         pt->aflags.native = true;
+        note_spill_avoided(pt, &pt->aflags);
         LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": aflags are dead\n",
             __FUNCTION__, pt->live_idx, instr_get_app_pc(where));
         return DRREG_SUCCESS;
@@ -1290,7 +2221,7 @@ drreg_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
 drreg_status_t
 drreg_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (!pt->aflags.in_use)
         return DRREG_ERROR_INVALID_PARAMETER;
     pt->aflags.in_use = false;
@@ -1317,7 +2248,7 @@ drreg_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
 drreg_status_t
 drreg_aflags_liveness(void *drcontext, instr_t *inst, OUT uint *value)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     if (value == NULL)
         return DRREG_ERROR_INVALID_PARAMETER;
     if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
@@ -1346,7 +2277,7 @@ drreg_are_aflags_dead(void *drcontext, instr_t *inst, bool *dead)
 drreg_status_t
 drreg_restore_app_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
 {
-    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *pt = get_pt(drcontext);
     drreg_status_t res = DRREG_SUCCESS;
     if (!pt->aflags.native) {
         LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": restoring app aflags as requested\n",
@@ -1360,6 +2291,56 @@ drreg_restore_app_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
  * RESTORE STATE
  */
 
+/* Recognizes the SIMD spills and restores from spill_simd_reg() and
+ * restore_simd_reg().
+ */
+static bool
+instr_is_simd_spill_or_restore(instr_t *inst, OUT bool *spill, OUT uint *idx,
+                               OUT opnd_size_t *size, OUT uint *slot)
+{
+    opnd_t mem, reg;
+    uint offs;
+    int opc = instr_get_opcode(inst);
+#ifdef X86
+    if (opc != OP_movdqu && opc != OP_vmovdqu)
+        return false;
+#elif defined(AARCH64)
+    if (opc != OP_str && opc != OP_ldr)
+        return false;
+#else
+    return false;
+#endif
+    if (instr_num_dsts(inst) != 1 || instr_num_srcs(inst) != 1)
+        return false;
+    if (opnd_is_reg(instr_get_src(inst, 0)) &&
+        opnd_is_base_disp(instr_get_dst(inst, 0))) {
+        *spill = true;
+        reg = instr_get_src(inst, 0);
+        mem = instr_get_dst(inst, 0);
+    } else if (opnd_is_reg(instr_get_dst(inst, 0)) &&
+               opnd_is_base_disp(instr_get_src(inst, 0))) {
+        *spill = false;
+        reg = instr_get_dst(inst, 0);
+        mem = instr_get_src(inst, 0);
+    } else
+        return false;
+    if (opnd_get_index(mem) != DR_REG_NULL ||
+        IF_X86_ELSE(opnd_get_segment(mem) != tls_seg ||
+                    opnd_get_base(mem) != DR_REG_NULL,
+                    opnd_get_base(mem) != tls_seg))
+        return false;
+    offs = (uint)opnd_get_disp(mem);
+    if (offs < simd_slot_offs ||
+        offs >= simd_slot_offs + ops.num_spill_simd_slots*simd_slot_size ||
+        (offs - simd_slot_offs) % simd_slot_size != 0)
+        return false;
+    *idx = simd_index(opnd_get_reg(reg), size);
+    if (*idx == NUM_SIMD_SLOTS)
+        return false;
+    *slot = (offs - simd_slot_offs) / simd_slot_size;
+    return true;
+}
+
 static bool
 drreg_event_restore_state(void *drcontext, bool restore_memory,
                           dr_restore_state_info_t *info)
@@ -1373,7 +2354,13 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
      * a spill of an already-spilled reg to a different slot.
      */
     uint spilled_to[DR_NUM_GPR_REGS];
+    /* The last instr's restore, for spotting doubled restores */
+    reg_id_t prev_restore_reg = DR_REG_NULL, last_restore_reg;
+    uint prev_restore_slot = MAX_SPILLS, last_restore_slot;
     uint spilled_to_aflags = MAX_SPILLS;
+    uint simd_spilled_to[NUM_SIMD_SLOTS];
+    opnd_size_t simd_spilled_size[NUM_SIMD_SLOTS];
+    uint idx;
     reg_id_t reg;
     instr_t inst;
     byte *prev_pc, *pc = info->fragment_info.cache_start_pc;
@@ -1387,6 +2374,8 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
         return true; /* fault not in cache */
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
         spilled_to[GPR_IDX(reg)] = MAX_SPILLS;
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++)
+        simd_spilled_to[idx] = MAX_SIMD_SPILLS;
     LOG(drcontext, LOG_ALL, 3, "%s: processing fault @"PFX": decoding from "PFX"\n",
         __FUNCTION__, info->raw_mcontext->pc, pc);
     instr_init(drcontext, &inst);
@@ -1394,6 +2383,33 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
         instr_reset(drcontext, &inst);
         prev_pc = pc;
         pc = decode(drcontext, pc, &inst);
+        last_restore_reg = prev_restore_reg;
+        last_restore_slot = prev_restore_slot;
+        prev_restore_reg = DR_REG_NULL;
+
+        if (ops.num_spill_simd_slots > 0) {
+            uint slot;
+            opnd_size_t size;
+            if (instr_is_simd_spill_or_restore(&inst, &spill, &idx, &size, &slot)) {
+                LOG(drcontext, LOG_ALL, 3, "%s @"PFX" found SIMD %s to slot %d\n",
+                    __FUNCTION__, prev_pc, spill ? "spill" : "restore", slot);
+                /* We use the same scheme as for GPRs below. */
+                if (spill) {
+                    uint other;
+                    for (other = 0; other < NUM_SIMD_SLOTS; other++) {
+                        if (other != idx && simd_spilled_to[other] == slot)
+                            simd_spilled_to[other] = MAX_SIMD_SPILLS;
+                    }
+                    if (simd_spilled_to[idx] == MAX_SIMD_SPILLS ||
+                        simd_spilled_to[idx] == slot) {
+                        simd_spilled_to[idx] = slot;
+                        simd_spilled_size[idx] = size;
+                    }
+                } else if (simd_spilled_to[idx] == slot)
+                    simd_spilled_to[idx] = MAX_SIMD_SPILLS;
+                continue;
+            }
+        }
 
         /* XXX i#511: if we add xchg to our arsenal we'll have to detect it here */
         if (instr_is_reg_spill_or_restore(drcontext, &inst, &tls, &spill, &reg, &offs)) {
@@ -1423,6 +2439,14 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
             LOG(drcontext, LOG_ALL, 3, "%s @"PFX" found %s to %s offs=0x%x => slot %d\n",
                 __FUNCTION__, prev_pc, spill ? "spill" : "restore",
                 get_register_name(reg), offs, slot);
+            if (spill && slot != AFLAGS_SLOT) {
+                /* The slot no longer holds any other reg's app value. */
+                reg_id_t other;
+                for (other = DR_REG_START_GPR; other <= DR_REG_STOP_GPR; other++) {
+                    if (other != reg && spilled_to[GPR_IDX(other)] == slot)
+                        spilled_to[GPR_IDX(other)] = MAX_SPILLS;
+                }
+            }
             if (spill) {
                 if (slot == AFLAGS_SLOT) {
                     spilled_to_aflags = slot;
@@ -1440,9 +2464,17 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
             } else {
                 if (slot == AFLAGS_SLOT && spilled_to_aflags == slot)
                     spilled_to_aflags = MAX_SPILLS;
-                else if (spilled_to[GPR_IDX(reg)] == slot)
-                    spilled_to[GPR_IDX(reg)] = MAX_SPILLS;
-                else {
+                else if (spilled_to[GPR_IDX(reg)] == slot) {
+                    /* With ops.coalesce_spills the slot keeps holding the app
+                     * value, as the reg may be re-reserved without spilling,
+                     * unless restore_reg() doubled the restore to release it.
+                     */
+                    if (!ops.coalesce_spills ||
+                        (last_restore_reg == reg && last_restore_slot == slot))
+                        spilled_to[GPR_IDX(reg)] = MAX_SPILLS;
+                    prev_restore_reg = reg;
+                    prev_restore_slot = slot;
+                } else {
                     LOG(drcontext, LOG_ALL, 3, "%s @"PFX": ignoring restore\n",
                         __FUNCTION__, pc);
                 }
@@ -1497,6 +2529,21 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
             reg_set_value(reg, info->mcontext, val);
         }
     }
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+        if (simd_spilled_to[idx] < MAX_SIMD_SPILLS &&
+            TEST(DR_MC_MULTIMEDIA, info->mcontext->flags)) {
+            byte *val = get_spilled_simd_value(drcontext, simd_spilled_to[idx]);
+            LOG(drcontext, LOG_ALL, 3, "%s: restoring %s\n", __FUNCTION__,
+                get_register_name(simd_reg(idx, simd_spilled_size[idx])));
+#ifdef X86
+            memcpy(&info->mcontext->ymm[idx], val,
+                   opnd_size_in_bytes(simd_spilled_size[idx]));
+#else
+            memcpy(&info->mcontext->simd[idx], val,
+                   opnd_size_in_bytes(simd_spilled_size[idx]));
+#endif
+        }
+    }
 
     return true;
 }
@@ -1512,6 +2559,7 @@ drreg_thread_init(void *drcontext)
 {
     per_thread_t *pt = (per_thread_t *) dr_thread_alloc(drcontext, sizeof(*pt));
     reg_id_t reg;
+    uint idx;
     drmgr_set_tls_field(drcontext, tls_idx, (void *) pt);
 
     memset(pt, 0, sizeof(*pt));
@@ -1522,18 +2570,42 @@ drreg_thread_init(void *drcontext)
         pt->reg[GPR_IDX(reg)].native = true;
     }
     drvector_init(&pt->aflags.live, 20, false/*!synch*/, NULL);
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++) {
+        drvector_init(&pt->simd[idx].live, 20, false/*!synch*/, NULL);
+        pt->simd[idx].native = true;
+    }
     pt->tls_seg_base = dr_get_dr_segment_base(tls_seg);
 }
 
+/* A thread that was already running when drreg was initialized (e.g., by a
+ * library that initializes drreg lazily) missed our thread init event, so we
+ * set up its state on first use.
+ */
+static per_thread_t *
+get_pt(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (pt == NULL) {
+        drreg_thread_init(drcontext);
+        pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    }
+    return pt;
+}
+
 static void
 drreg_thread_exit(void *drcontext)
 {
     per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     reg_id_t reg;
+    uint idx;
+    if (pt == NULL) /* drreg was initialized after this thread did nothing */
+        return;
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
         drvector_delete(&pt->reg[GPR_IDX(reg)].live);
     }
     drvector_delete(&pt->aflags.live);
+    for (idx = 0; idx < NUM_SIMD_SLOTS; idx++)
+        drvector_delete(&pt->simd[idx].live);
     dr_thread_free(drcontext, pt, sizeof(*pt));
 }
 
@@ -1606,6 +2678,20 @@ drreg_init(drreg_options_t *ops_in)
     /* If anyone wants to be conservative, then be conservative. */
     ops.conservative = ops.conservative || ops_in->conservative;
 
+    if (ops_in->struct_size > offsetof(drreg_options_t, cross_block_liveness))
+        ops.cross_block_liveness = ops.cross_block_liveness ||
+            ops_in->cross_block_liveness;
+    if (ops_in->struct_size > offsetof(drreg_options_t, coalesce_spills))
+        ops.coalesce_spills = ops.coalesce_spills || ops_in->coalesce_spills;
+    /* The SIMD slots are combined like the GPR slots. */
+    if (ops_in->struct_size > offsetof(drreg_options_t, num_spill_simd_slots)) {
+        if (ops.do_not_sum_slots) {
+            if (ops_in->num_spill_simd_slots > ops.num_spill_simd_slots)
+                ops.num_spill_simd_slots = ops_in->num_spill_simd_slots;
+        } else
+            ops.num_spill_simd_slots += ops_in->num_spill_simd_slots;
+    }
+
     /* The first callback wins. */
     if (ops_in->struct_size > offsetof(drreg_options_t, error_callback) &&
         ops.error_callback == NULL)
@@ -1619,6 +2705,33 @@ drreg_init(drreg_options_t *ops_in)
     if (!dr_raw_tls_calloc(&tls_seg, &tls_slot_offs, ops.num_spill_slots, 0))
         return DRREG_ERROR_OUT_OF_SLOTS;
 
+    if (ops.num_spill_simd_slots > 0) {
+#if defined(X86) || defined(AARCH64)
+        reg_id_t simd_seg;
+        if (ops.num_spill_simd_slots > MAX_SIMD_SPILLS)
+            return DRREG_ERROR_OUT_OF_SLOTS;
+        if (simd_tls_slots > 0) {
+            if (!dr_raw_tls_cfree(simd_tls_offs, simd_tls_slots))
+                return DRREG_ERROR;
+            simd_tls_slots = 0;
+        }
+        /* We size the slots for ymm only if AVX state is saved by the kernel. */
+        simd_slot_size = IF_X86_ELSE(proc_avx_enabled() ? 32 : 16, 16);
+        /* dr_raw_tls_calloc() cannot align a multi-slot range, so we pad instead. */
+        simd_tls_slots = (ops.num_spill_simd_slots*simd_slot_size +
+                          SIMD_SLOT_ALIGN - sizeof(reg_t)) / sizeof(reg_t);
+        if (!dr_raw_tls_calloc(&simd_seg, &simd_tls_offs, simd_tls_slots, 0)) {
+            simd_tls_slots = 0;
+            return DRREG_ERROR_OUT_OF_SLOTS;
+        }
+        ASSERT(simd_seg == tls_seg, "raw TLS register should not vary");
+        simd_slot_offs = (uint)ALIGN_FORWARD(simd_tls_offs, SIMD_SLOT_ALIGN);
+#else
+        /* XXX: add NEON support for 32-bit ARM. */
+        return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+    }
+
     return DRREG_SUCCESS;
 }
 
@@ -1645,9 +2758,17 @@ drreg_exit(void)
         if (!dr_raw_tls_cfree(tls_slot_offs, ops.num_spill_slots))
             return DRREG_ERROR;
     }
+    if (simd_tls_slots > 0) {
+        if (!dr_raw_tls_cfree(simd_tls_offs, simd_tls_slots))
+            return DRREG_ERROR;
+        simd_tls_slots = 0;
+    }
 
     /* Support re-attach */
     memset(&ops, 0, sizeof(ops));
+    stats_cross_block_spills_avoided = 0;
+    stats_spills_coalesced = 0;
+    stats_coalesce_write_backs = 0;
 
     return DRREG_SUCCESS;
 }
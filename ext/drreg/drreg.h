@@ -167,6 +167,64 @@ typedef struct _drreg_options_t {
      * needed.
      */
     bool do_not_sum_slots;
+    /**
+     * By default, drreg assumes that every register and the arithmetic flags
+     * are live at the end of each basic block, so a scratch register reserved
+     * near the end of a block is always spilled and restored.  If this flag is
+     * set, drreg additionally examines the application code at the successors
+     * of each block whose final instruction is a direct branch or call or is
+     * not a control transfer, and considers a register dead at the end of the
+     * block if it is written before being read on every successor.
+     *
+     * This relies on the successor code not being modified and on control not
+     * being redirected elsewhere (e.g., via drwrap_replace() or
+     * dr_redirect_execution()) without the block itself being flushed.  It is
+     * ignored if \p conservative is set.  The number of spills avoided is
+     * available from drreg_get_stats().
+     *
+     * If multiple drreg_init() calls are made, this field is combined by
+     * logical OR.
+     */
+    bool cross_block_liveness;
+    /**
+     * By default, when an application instruction reads a spilled scratch
+     * register that is no longer reserved, drreg restores the application
+     * value and gives up the spill slot, so reserving that register again
+     * for the next application instruction spills it again.  If this flag
+     * is set, the register keeps its slot until the end of the block, and
+     * the slot is kept up to date with respect to application writes
+     * while the register is live.  A later reservation of that register
+     * then reuses the slot without spilling, so that dense instrumentation
+     * spills a given register about once per block.  These slots are given
+     * up as needed when no other slot is free.  The number of spills saved
+     * is available from drreg_get_stats().
+     *
+     * Slots are only kept for reservations made during drmgr's insertion
+     * phase, and not in blocks built for traces.  No spill is elided in a
+     * block containing internal control flow that drreg is not told to
+     * ignore (see drreg_set_bb_properties()).  To let fault-time state
+     * restoration tell a kept slot from a released one, a restore that
+     * releases a slot is emitted as two loads in this mode.
+     *
+     * If multiple drreg_init() calls are made, this field is combined by
+     * logical OR.
+     */
+    bool coalesce_spills;
+    /**
+     * The number of TLS spill slots to use for SIMD registers reserved with
+     * drreg_reserve_simd_register().  Unlike general-purpose registers, there
+     * is no fallback to DR's slots for SIMD registers, so this must cover all
+     * simultaneously reserved SIMD registers, plus one for each that is held
+     * across application instructions.  Each slot is as wide as the widest
+     * SIMD register supported (16 or 32 bytes on x86, depending on whether
+     * AVX is enabled, and 16 bytes on AArch64) and consumes the corresponding
+     * number of pointer-sized slots from dr_raw_tls_calloc().  SIMD register
+     * reservation is not supported on 32-bit ARM.
+     *
+     * When drreg_init() is called multiple times, the number of slots is
+     * summed or maximized just like \p num_spill_slots.
+     */
+    uint num_spill_simd_slots;
 } drreg_options_t;
 
 DR_EXPORT
@@ -208,6 +266,44 @@ DR_EXPORT
 drreg_status_t
 drreg_max_slots_used(OUT uint *max);
 
+/** Statistics returned by drreg_get_stats(). */
+typedef struct _drreg_stats_t {
+    /** Set this to the size of this structure. */
+    size_t struct_size;
+    /**
+     * The number of register and arithmetic flag spills that were not
+     * inserted because drreg_options_t.cross_block_liveness showed the
+     * application value to be dead beyond the end of the block.  This is a
+     * count over the blocks instrumented, not over their executions.
+     */
+    uint64 cross_block_spills_avoided;
+    /**
+     * The number of spills that were not inserted because
+     * drreg_options_t.coalesce_spills kept an up-to-date application value
+     * in the register's slot.  This is a count over the blocks
+     * instrumented, not over their executions.
+     */
+    uint64 spills_coalesced;
+    /**
+     * The number of stores that drreg_options_t.coalesce_spills added after
+     * application writes to keep a slot up to date.  This should be
+     * subtracted from \p spills_coalesced to obtain the net savings.
+     */
+    uint64 coalesce_write_backs;
+} drreg_stats_t;
+
+DR_EXPORT
+/**
+ * Returns statistics on the optimizations applied by drreg.  Unlike
+ * drreg_max_slots_used(), this is available in all builds.
+ *
+ * @param[in,out] stats  The statistics are written here.  The caller must
+ *   set \p struct_size.
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_get_stats(INOUT drreg_stats_t *stats);
+
 /***************************************************************************
  * ARITHMETIC FLAGS
  */
@@ -374,7 +470,9 @@ DR_EXPORT
  * Sets the entry in \p vec at index \p reg minus #DR_REG_START_GPR to
  * NULL if \p allowed is false or a non-NULL value if \p allowed is
  * true.  This is intendend as a convenience routine for setting up
- * the \p reg_allowed parameter to drreg_reserve_register().
+ * the \p reg_allowed parameter to drreg_reserve_register().  If \p reg
+ * is a SIMD register, the entry for it in a vector set up by
+ * drreg_init_and_fill_simd_vector() is set instead.
  *
  * @return whether successful or an error code on failure.
  */
@@ -482,6 +580,75 @@ DR_EXPORT
 drreg_status_t
 drreg_is_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead);
 
+DR_EXPORT
+/**
+ * Requests exclusive use of an application SIMD register, spilling the
+ * application value at \p where in \p ilist if necessary.  The register
+ * chosen is returned in \p reg.  This requires a non-zero
+ * drreg_options_t.num_spill_simd_slots.
+ *
+ * On x86, \p size must be #OPSZ_16 to obtain an xmm register or #OPSZ_32
+ * to obtain a ymm register, which requires that AVX be enabled.  Only the
+ * low 128 bits of the underlying register are preserved for an xmm
+ * reservation, so instrumentation must not use VEX-encoded instructions to
+ * write to it, as they zero the upper bits.  On AArch64, \p size must be
+ * #OPSZ_16 and a full 128-bit Q register is returned.
+ *
+ * As with drreg_reserve_register(), the application value is spilled only
+ * if the register is live, and when called during drmgr's insertion phase
+ * the restore is deferred until an application instruction uses the
+ * register or the end of the block is reached.  If called during drmgr's
+ * insertion phase, \p where must be the current application instruction.
+ *
+ * If \p reg_allowed is non-NULL, only registers from the specified set will
+ * be considered, where \p reg_allowed must be a vector set up by
+ * drreg_init_and_fill_simd_vector() with one entry per SIMD register.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_reserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            opnd_size_t size, drvector_t *reg_allowed,
+                            OUT reg_id_t *reg);
+
+DR_EXPORT
+/**
+ * Terminates exclusive use of the SIMD register \p reg, which must have
+ * been returned by drreg_reserve_simd_register().  Restores the application
+ * value at \p where in \p ilist, if necessary.  If called during drmgr's
+ * insertion phase, \p where must be the current application instruction.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_unreserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                              reg_id_t reg);
+
+DR_EXPORT
+/**
+ * Returns in \p dead whether the SIMD register \p reg is dead at the point
+ * of \p inst.  On x86, \p reg may be an xmm register, in which case only
+ * its low 128 bits are considered, or a ymm register.  This requires a
+ * non-zero drreg_options_t.num_spill_simd_slots.  If called during drmgr's
+ * insertion phase, \p inst must be the current application instruction.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_is_simd_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead);
+
+DR_EXPORT
+/**
+ * Initializes \p vec to hold one entry per SIMD register that
+ * drreg_reserve_simd_register() can return, each either set to NULL if \p
+ * allowed is false or a non-NULL value if \p allowed is true.  Entries can
+ * then be changed with drreg_set_vector_entry().
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_init_and_fill_simd_vector(drvector_t *vec, bool allowed);
+
 DR_EXPORT
 /**
  * May only be called during drmgr's app2app, analysis, or insertion phase.
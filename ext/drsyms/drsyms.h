@@ -240,6 +240,51 @@ drsym_error_t
 drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *info /*INOUT*/,
                      uint flags);
 
+/**
+ * Type for drsym_lookup_address_batch callback function.
+ * Returns whether to continue with the rest of the batch.
+ *
+ * @param[in] index   The index into the batch of the address looked up.
+ * @param[in] info    The result of the lookup, as drsym_lookup_address() would
+ *   fill it in.  The callback must not modify \p info as it is reused for the
+ *   next lookup.
+ * @param[in] status  What drsym_lookup_address() would have returned.
+ * @param[in] data    User parameter passed to drsym_lookup_address_batch().
+ */
+typedef bool (*drsym_lookup_batch_cb)(size_t index, drsym_info_t *info,
+                                      drsym_error_t status, void *data);
+
+DR_EXPORT
+/**
+ * Looks up each of an array of offsets within one module, calling \p callback
+ * with the result for each in turn.  This is equivalent to calling
+ * drsym_lookup_address() on each offset but is much faster when the offsets are
+ * sorted in ascending order: on Linux and Mac, a run of offsets within one
+ * symbol is only named and demangled once, and the module's line table is
+ * walked forward once rather than searched for each offset.  Unsorted offsets
+ * are supported but do not benefit.
+ *
+ * On Linux and Mac, lookups (batched or not) in different modules may proceed
+ * in parallel on different threads.  Lookups in the same module are
+ * serialized.
+ *
+ * @param[in] modpath  The full path to the module to be queried.
+ * @param[in] modoffs  The offsets from the base of the module to query.
+ * @param[in] count    The number of entries in \p modoffs.
+ * @param[in,out] info Space for the result of each lookup, initialized as for
+ *   drsym_lookup_address().
+ * @param[in] callback Function to call with the result of each lookup.
+ * @param[in] data     User parameter passed to \p callback.
+ * @param[in] flags    Options for the operation as for drsym_lookup_address().
+ *
+ * \return DRSYM_SUCCESS if the module was loaded and the batch was processed,
+ * regardless of the status of each lookup, which is passed to \p callback.
+ */
+drsym_error_t
+drsym_lookup_address_batch(const char *modpath, const size_t *modoffs, size_t count,
+                           drsym_info_t *info /*INOUT*/, drsym_lookup_batch_cb callback,
+                           void *data, uint flags);
+
 enum {
     DRSYM_TYPE_OTHER,  /**< Unknown type, cannot downcast. */
     DRSYM_TYPE_INT,    /**< Integer, cast to drsym_int_type_t. */
@@ -670,11 +715,29 @@ DR_EXPORT
  *
  * \note When called from within a callback for drsym_enumerate_symbols()
  * or drsym_search_symbols(), will fail with DRSYM_ERROR_RECURSIVE as it
- * is not safe to free resources while iterating.
+ * is not safe to free resources while iterating.  On Linux and Mac this
+ * only applies to the module being iterated over.
  */
 drsym_error_t
 drsym_free_resources(const char *modpath);
 
+DR_EXPORT
+/**
+ * Requests that the line number index drsyms builds for a module with DWARF
+ * debug information be saved in \p dir and reused by later loads of the same
+ * build of that module, including in other processes.  The index is built the
+ * first time drsym_lookup_address() is called on a module, and replaces a
+ * per-compilation-unit search of the line tables with a binary search.
+ * Cache files are keyed by the module's build id, so modules without one
+ * (currently, anything other than ELF) are only indexed in memory.
+ * Pass NULL to disable the cache, which is the default.  Only affects
+ * modules loaded after the call.
+ *
+ * @param[in] dir   An existing directory in which to store index files, or NULL.
+ */
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir);
+
 /***************************************************************************
  * Line iteration
  */
@@ -32,8 +32,9 @@
 
 /* DRSyms benchmarking standalone app. */
 
-/* This is a standalone app for benchmarking drsyms.  Currently we just time
- * symbol enumeration of an arbitrary object file.
+/* This is a standalone app for benchmarking drsyms.  We time symbol
+ * enumeration of an arbitrary object file, and then address lookups of the
+ * start of every symbol found plus a few offsets into each.
  */
 
 #include <stdio.h>
@@ -45,6 +46,14 @@
 
 static char sym_buf[4096];
 
+/* Module offsets to look up, gathered during enumeration. */
+static size_t *lookup_offs;
+static uint num_lookup_offs;
+static uint max_lookup_offs;
+
+/* Offsets into each symbol to look up in addition to its start. */
+#define LOOKUPS_PER_SYM 4
+
 static int
 usage(const char *msg)
 {
@@ -58,7 +67,7 @@ usage(const char *msg)
     if (msg != NULL && msg[0] != '\0') {
         dr_fprintf(STDERR, "%s\n", msg);
     }
-    dr_fprintf(STDERR, "usage: bench <modpath>\n");
+    dr_fprintf(STDERR, "usage: bench <modpath> [index_cache_dir]\n");
     return 1;
 }
 
@@ -86,6 +95,59 @@ sym_callback(const char *name, size_t modoffs, void *data)
     return true;
 }
 
+static bool
+offs_callback(const char *name, size_t modoffs, void *data)
+{
+    uint i;
+    if (num_lookup_offs + LOOKUPS_PER_SYM > max_lookup_offs) {
+        uint new_max = max_lookup_offs == 0 ? 4096 : max_lookup_offs * 2;
+        size_t *grown = (size_t *) malloc(new_max * sizeof(*grown));
+        if (grown == NULL)
+            return false;
+        if (lookup_offs != NULL) {
+            memcpy(grown, lookup_offs, num_lookup_offs * sizeof(*grown));
+            free(lookup_offs);
+        }
+        lookup_offs = grown;
+        max_lookup_offs = new_max;
+    }
+    for (i = 0; i < LOOKUPS_PER_SYM; i++)
+        lookup_offs[num_lookup_offs++] = modoffs + i * 4;
+    return true;
+}
+
+static void
+lookup_addresses(const char *modpath)
+{
+    uint64 start, end, time;
+    uint i, found = 0;
+    char name[256];
+    char file[MAXIMUM_PATH];
+    drsym_info_t info;
+
+    dr_printf("Beginning %u address lookups\n", num_lookup_offs);
+    start = dr_get_milliseconds();
+    for (i = 0; i < num_lookup_offs; i++) {
+        drsym_error_t res;
+        info.struct_size = sizeof(info);
+        info.name = name;
+        info.name_size = sizeof(name);
+        info.file = file;
+        info.file_size = sizeof(file);
+        res = drsym_lookup_address(modpath, lookup_offs[i], &info, DRSYM_DEFAULT_FLAGS);
+        if (res == DRSYM_SUCCESS || res == DRSYM_ERROR_LINE_NOT_AVAILABLE)
+            found++;
+    }
+    end = dr_get_milliseconds();
+    dr_printf("Finished address lookups: %u found.\n", found);
+
+    time = end - start;
+    dr_printf("Took %d.%03d seconds: %d lookups/sec.\n",
+              (int)(time / 1000), (int)(time % 1000),
+              (int)(time == 0 ? num_lookup_offs * 1000ULL :
+                    num_lookup_offs * 1000ULL / time));
+}
+
 static void
 enumerate_with_flags(const char *modpath, drsym_flags_t flags)
 {
@@ -115,10 +177,12 @@ main(int argc, char **argv)
     dr_standalone_init();
     drsym_init(0);
 
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         return usage(NULL);
     }
     modpath = argv[1];
+    if (argc == 3 && drsym_set_index_cache_dir(argv[2]) != DRSYM_SUCCESS)
+        return usage("Invalid index cache directory.");
 #ifdef WINDOWS
     /* Work around i#289. */
     if (GetFullPathName(modpath, sizeof(full_path), full_path, NULL) == 0) {
@@ -136,5 +200,13 @@ main(int argc, char **argv)
     enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
     enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
 
+    /* The first round of lookups includes building the indices, or loading
+     * them from the cache directory if one was given.
+     */
+    drsym_enumerate_symbols(modpath, offs_callback, NULL, DRSYM_LEAVE_MANGLED);
+    lookup_addresses(modpath);
+    lookup_addresses(modpath);
+    free(lookup_offs);
+
     drsym_exit();
 }
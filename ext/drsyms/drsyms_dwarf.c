@@ -37,6 +37,7 @@
 #include "dr_api.h"
 #include "drsyms.h"
 #include "drsyms_private.h"
+#include "hashtable.h"
 
 #include "dwarf.h"
 #include "libdwarf.h"
@@ -53,6 +54,49 @@ static bool verbose = false;
     } \
 } while (0)
 
+/* An entry in the module-wide line index.  The file is an offset into the
+ * index's file name table so the whole index can be written to and mapped
+ * from a cache file as is.  An entry marking the end of a sequence, i.e., the
+ * first address past a contiguous range of code, has LINE_END_SEQUENCE as its
+ * file, so that an address in a gap between sequences is not attributed to
+ * the last line of the preceding sequence.
+ */
+typedef struct _line_entry_t {
+    Dwarf_Addr addr;
+    uint file;
+    uint line;
+} line_entry_t;
+
+#define LINE_END_SEQUENCE ((uint)-1)
+
+/* The layout of a line index cache file: this header, then the entries, then
+ * the NUL-separated file names.  The pointer size and architecture of the
+ * drsyms that wrote the file must match ours, as a cache directory can be
+ * shared by tools of different bitwidths or architectures.
+ */
+#define LINE_INDEX_MAGIC "DRSYMLIX"
+#define LINE_INDEX_VERSION 2
+#ifdef X86
+# ifdef X64
+#  define LINE_INDEX_ARCH DR_ISA_AMD64
+# else
+#  define LINE_INDEX_ARCH DR_ISA_IA32
+# endif
+#elif defined(AARCH64)
+# define LINE_INDEX_ARCH DR_ISA_ARM_A64
+#else
+# define LINE_INDEX_ARCH DR_ISA_ARM_A32
+#endif
+typedef struct _line_index_header_t {
+    char magic[8];
+    uint version;
+    uint pointer_size;
+    uint arch; /* a dr_isa_mode_t */
+    uint num_entries;
+    uint files_size;
+    uint padding; /* keeps the entries 8-byte aligned */
+} line_index_header_t;
+
 typedef struct _dwarf_module_t {
     byte *load_base;
     Dwarf_Debug dbg;
@@ -62,6 +106,22 @@ typedef struct _dwarf_module_t {
     Dwarf_Signed num_lines;
     /* Amount to adjust all offsets for __PAGEZERO + PIE (i#1365) */
     ssize_t offs_adjust;
+    /* All lines of all CUs sorted by address, built on the first lookup.
+     * The arrays are either heap-allocated, with the given capacities, or
+     * point into index_map.
+     */
+    bool index_attempted;
+    line_entry_t *line_index;
+    uint index_entries;
+    uint index_capacity;
+    char *index_files;
+    uint index_files_size;
+    uint index_files_capacity;
+    file_t index_file;
+    void *index_map;
+    size_t index_map_size;
+    /* Cache file for the index: empty if none */
+    char index_path[MAXIMUM_PATH];
 } dwarf_module_t;
 
 typedef enum {
@@ -74,6 +134,10 @@ static search_result_t
 search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
                        drsym_info_t *sym_info INOUT);
 
+static Dwarf_Signed
+get_lines_from_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
+                  Dwarf_Line **lines_out OUT);
+
 /******************************************************************************
  * DWARF parsing code.
  */
@@ -181,10 +245,265 @@ compare_lines(const void *a_in, const void *b_in)
     return 0;
 }
 
+/******************************************************************************
+ * Module-wide line index.
+ */
+
+static int
+compare_line_entries(const void *a_in, const void *b_in)
+{
+    const line_entry_t *a = (const line_entry_t *) a_in;
+    const line_entry_t *b = (const line_entry_t *) b_in;
+    if (a->addr > b->addr)
+        return 1;
+    if (a->addr < b->addr)
+        return -1;
+    /* A sequence can start where another ends: the start must come last so
+     * that it is the entry found for its address.
+     */
+    if (a->file == LINE_END_SEQUENCE && b->file != LINE_END_SEQUENCE)
+        return -1;
+    if (a->file != LINE_END_SEQUENCE && b->file == LINE_END_SEQUENCE)
+        return 1;
+    return 0;
+}
+
+/* Returns the offset of file in index_files, adding it if not yet present. */
+static uint
+line_index_add_file(dwarf_module_t *mod, hashtable_t *files, const char *file)
+{
+    size_t len = strlen(file) + 1;
+    uint offs = (uint)(ptr_uint_t) hashtable_lookup(files, (void *)file);
+    if (offs != 0)
+        return offs - 1; /* stored biased by 1 to distinguish from not found */
+    if (mod->index_files_size + len > mod->index_files_capacity) {
+        uint capacity = mod->index_files_capacity == 0 ?
+            4096 : mod->index_files_capacity * 2;
+        char *grown;
+        while (mod->index_files_size + len > capacity)
+            capacity *= 2;
+        grown = dr_global_alloc(capacity);
+        if (mod->index_files != NULL) {
+            memcpy(grown, mod->index_files, mod->index_files_size);
+            dr_global_free(mod->index_files, mod->index_files_capacity);
+        }
+        mod->index_files = grown;
+        mod->index_files_capacity = capacity;
+    }
+    offs = mod->index_files_size;
+    memcpy(mod->index_files + offs, file, len);
+    mod->index_files_size += (uint) len;
+    hashtable_add(files, (void *)file, (void *)(ptr_uint_t)(offs + 1));
+    return offs;
+}
+
+static void
+line_index_add_line(dwarf_module_t *mod, Dwarf_Addr addr, uint file, uint line)
+{
+    if (mod->index_entries == mod->index_capacity) {
+        uint capacity = mod->index_capacity == 0 ? 1024 : mod->index_capacity * 2;
+        line_entry_t *grown = dr_global_alloc(capacity * sizeof(*grown));
+        if (mod->line_index != NULL) {
+            memcpy(grown, mod->line_index, mod->index_entries * sizeof(*grown));
+            dr_global_free(mod->line_index, mod->index_capacity * sizeof(*grown));
+        }
+        mod->line_index = grown;
+        mod->index_capacity = capacity;
+    }
+    mod->line_index[mod->index_entries].addr = addr;
+    mod->line_index[mod->index_entries].file = file;
+    mod->line_index[mod->index_entries].line = line;
+    mod->index_entries++;
+}
+
+/* Reads the lines of every CU once, rather than re-reading a CU's lines whenever
+ * a lookup lands in a different CU than the last one.
+ */
+static void
+line_index_build(dwarf_module_t *mod)
+{
+    Dwarf_Error de; /* expensive to init (DrM#1770) */
+    Dwarf_Die cu_die;
+    Dwarf_Unsigned cu_offset = 0;
+    Dwarf_Line *lines;
+    Dwarf_Signed num_lines, i;
+    hashtable_t files;
+
+    /* We copy the keys as libdwarf may free a CU's strings with its lines. */
+    hashtable_init(&files, 8, HASH_STRING, true/*strdup*/);
+    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
+                                &cu_offset, &de) == DW_DLV_OK) {
+        cu_die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
+        if (cu_die == NULL)
+            continue;
+        num_lines = get_lines_from_cu(mod, cu_die, &lines);
+        for (i = 0; i < num_lines; i++) {
+            char *file;
+            Dwarf_Unsigned lineno;
+            Dwarf_Addr lineaddr;
+            Dwarf_Bool end_sequence;
+            if (dwarf_lineaddr(lines[i], &lineaddr, &de) != DW_DLV_OK ||
+                dwarf_lineendsequence(lines[i], &end_sequence, &de) != DW_DLV_OK) {
+                NOTIFY_DWARF(de);
+                continue;
+            }
+            if (end_sequence) {
+                line_index_add_line(mod, lineaddr, LINE_END_SEQUENCE, 0);
+                continue;
+            }
+            if (dwarf_linesrc(lines[i], &file, &de) != DW_DLV_OK ||
+                dwarf_lineno(lines[i], &lineno, &de) != DW_DLV_OK) {
+                NOTIFY_DWARF(de);
+                continue;
+            }
+            line_index_add_line(mod, lineaddr, line_index_add_file(mod, &files, file),
+                                (uint) lineno);
+        }
+    }
+    /* The loop above ran dwarf_next_cu_header() until it wrapped around, so
+     * the next iteration by another routine starts at the first CU again.
+     */
+    hashtable_delete(&files);
+    if (mod->line_index != NULL) {
+        qsort(mod->line_index, mod->index_entries, sizeof(*mod->line_index),
+              compare_line_entries);
+    }
+    NOTIFY("%s: indexed %u lines\n", __FUNCTION__, mod->index_entries);
+}
+
+static bool
+line_index_load(dwarf_module_t *mod)
+{
+    line_index_header_t *header;
+    uint64 file_size;
+    file_t f = dr_open_file(mod->index_path, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return false;
+    if (!dr_file_size(f, &file_size) || file_size < sizeof(*header)) {
+        dr_close_file(f);
+        return false;
+    }
+    mod->index_map_size = (size_t) file_size;
+    mod->index_map = dr_map_file(f, &mod->index_map_size, 0, NULL, DR_MEMPROT_READ,
+                                 DR_MAP_PRIVATE);
+    header = (line_index_header_t *) mod->index_map;
+    if (header == NULL || mod->index_map_size < file_size ||
+        memcmp(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != LINE_INDEX_VERSION ||
+        header->pointer_size != sizeof(void *) || header->arch != LINE_INDEX_ARCH ||
+        file_size != sizeof(*header) +
+        (uint64) header->num_entries * sizeof(line_entry_t) + header->files_size ||
+        (header->files_size > 0 &&
+         ((char *) mod->index_map)[file_size - 1] != '\0')) {
+        NOTIFY("%s: ignoring invalid index %s\n", __FUNCTION__, mod->index_path);
+        if (header != NULL)
+            dr_unmap_file(mod->index_map, mod->index_map_size);
+        mod->index_map = NULL;
+        dr_close_file(f);
+        return false;
+    }
+    mod->index_file = f;
+    mod->line_index = (line_entry_t *) (header + 1);
+    mod->index_entries = header->num_entries;
+    mod->index_files = (char *) (mod->line_index + header->num_entries);
+    mod->index_files_size = header->files_size;
+    NOTIFY("%s: loaded %u lines from %s\n", __FUNCTION__, mod->index_entries,
+           mod->index_path);
+    return true;
+}
+
+static void
+line_index_save(dwarf_module_t *mod)
+{
+    line_index_header_t header;
+    char tmp_path[MAXIMUM_PATH];
+    file_t f;
+    /* Write to a private name and rename so concurrent readers never see a
+     * partial index.
+     */
+    dr_snprintf(tmp_path, BUFFER_SIZE_ELEMENTS(tmp_path), "%s.%d.tmp",
+                mod->index_path, dr_get_process_id());
+    NULL_TERMINATE_BUFFER(tmp_path);
+    f = dr_open_file(tmp_path, DR_FILE_WRITE_OVERWRITE);
+    if (f == INVALID_FILE) {
+        NOTIFY("%s: unable to write %s\n", __FUNCTION__, tmp_path);
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic));
+    header.version = LINE_INDEX_VERSION;
+    header.pointer_size = sizeof(void *);
+    header.arch = LINE_INDEX_ARCH;
+    header.num_entries = mod->index_entries;
+    header.files_size = mod->index_files_size;
+    dr_write_file(f, &header, sizeof(header));
+    dr_write_file(f, mod->line_index, mod->index_entries * sizeof(*mod->line_index));
+    dr_write_file(f, mod->index_files, mod->index_files_size);
+    dr_close_file(f);
+    if (!dr_rename_file(tmp_path, mod->index_path, true/*replace*/))
+        dr_delete_file(tmp_path);
+}
+
+/* If cursor is non-NULL it holds the entry found by the previous lookup.
+ * When pc is at or past that entry, as for ascending queries, we gallop
+ * forward from it, so a sorted batch costs about one pass over the index
+ * rather than a full binary search per address.
+ */
+static bool
+search_addr2line_in_index(dwarf_module_t *mod, Dwarf_Addr pc,
+                          drsym_info_t *sym_info INOUT, uint *cursor INOUT)
+{
+    line_entry_t *entry;
+    const char *file;
+    uint min = 0, max = mod->index_entries;
+
+    if (cursor != NULL && *cursor < mod->index_entries &&
+        mod->line_index[*cursor].addr <= pc) {
+        uint step = 1;
+        min = *cursor;
+        while (min + step < mod->index_entries &&
+               mod->line_index[min + step].addr <= pc) {
+            min += step;
+            step *= 2;
+        }
+        if (min + step < max)
+            max = min + step;
+        min++; /* min - 1 is known to start at or below pc */
+    }
+    /* Find the last line starting at or below pc. */
+    while (min < max) {
+        uint mid = min + (max - min) / 2;
+        if (mod->line_index[mid].addr <= pc)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    if (min == 0)
+        return false;
+    if (cursor != NULL)
+        *cursor = min - 1;
+    entry = &mod->line_index[min - 1];
+    if (entry->file == LINE_END_SEQUENCE)
+        return false; /* pc is past the end of its nearest sequence */
+    if (entry->file >= mod->index_files_size)
+        return false; /* corrupt cache file */
+    file = mod->index_files + entry->file;
+    sym_info->file_available_size = strlen(file);
+    if (sym_info->file != NULL) {
+        strncpy(sym_info->file, file, sym_info->file_size);
+        sym_info->file[sym_info->file_size - 1] = '\0';
+    }
+    sym_info->line = entry->line;
+    sym_info->line_offs = (size_t) (pc - entry->addr);
+    return true;
+}
+
 /* Given a function DIE and a PC, fill out sym_info with line information.
+ * cursor, if non-NULL, carries the index position across a batch of lookups.
  */
 bool
-drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT)
+drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT,
+                             uint *cursor INOUT)
 {
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
     Dwarf_Error de; /* expensive to init (DrM#1770) */
@@ -203,6 +522,17 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info
     sym_info->line = 0;
     sym_info->line_offs = 0;
 
+    if (!mod->index_attempted) {
+        mod->index_attempted = true;
+        if (mod->index_path[0] == '\0' || !line_index_load(mod)) {
+            line_index_build(mod);
+            if (mod->index_path[0] != '\0' && mod->index_entries > 0)
+                line_index_save(mod);
+        }
+    }
+    if (mod->index_entries > 0)
+        return search_addr2line_in_index(mod, pc, sym_info, cursor);
+
     /* First try cutting down the search space by finding the CU (i.e., the .c
      * file) that this function belongs to.
      */
@@ -446,6 +776,7 @@ drsym_dwarf_init(Dwarf_Debug dbg)
     dwarf_module_t *mod = (dwarf_module_t *) dr_global_alloc(sizeof(*mod));
     memset(mod, 0, sizeof(*mod));
     mod->dbg = dbg;
+    mod->index_file = INVALID_FILE;
     return mod;
 }
 
@@ -455,6 +786,15 @@ drsym_dwarf_exit(void *mod_in)
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
     if (mod->lines != NULL)
         dwarf_srclines_dealloc(mod->dbg, mod->lines, mod->num_lines);
+    if (mod->index_map != NULL) {
+        dr_unmap_file(mod->index_map, mod->index_map_size);
+        dr_close_file(mod->index_file);
+    } else {
+        if (mod->line_index != NULL)
+            dr_global_free(mod->line_index, mod->index_capacity * sizeof(line_entry_t));
+        if (mod->index_files != NULL)
+            dr_global_free(mod->index_files, mod->index_files_capacity);
+    }
     dwarf_finish(mod->dbg, NULL);
     dr_global_free(mod, sizeof(*mod));
 }
@@ -473,6 +813,14 @@ drsym_dwarf_set_load_base(void *mod_in, byte *load_base)
     mod->load_base = load_base;
 }
 
+void
+drsym_dwarf_set_index_path(void *mod_in, const char *path)
+{
+    dwarf_module_t *mod = (dwarf_module_t *) mod_in;
+    dr_snprintf(mod->index_path, BUFFER_SIZE_ELEMENTS(mod->index_path), "%s", path);
+    NULL_TERMINATE_BUFFER(mod->index_path);
+}
+
 #if defined(WINDOWS) && defined(STATIC_LIB)
 /* if we build as a static library with "/MT /link /nodefaultlib libcmt.lib",
  * somehow we're missing strdup
@@ -43,6 +43,7 @@
 #include "dwarf.h"
 #include "libdwarf.h"
 
+#include <stdlib.h> /* qsort */
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -114,6 +115,17 @@ static bool verbose = 0;
 # define ELF_ST_TYPE ELF32_ST_TYPE
 #endif
 
+/* An entry in the address index of the symbol table.  max_hi is the largest
+ * hi of this and all prior entries, which bounds how far back an address
+ * lookup must walk to find every symbol containing the address.
+ */
+typedef struct _addr_entry_t {
+    size_t lo;
+    size_t hi;
+    size_t max_hi;
+    uint idx;
+} addr_entry_t;
+
 typedef struct _elf_info_t {
     Elf *elf;
     Elf_Sym *syms;
@@ -122,6 +134,8 @@ typedef struct _elf_info_t {
     byte *map_base;
     ptr_uint_t load_base;
     drsym_debug_kind_t debug_kind;
+    /* syms sorted by address, built on the first address lookup */
+    addr_entry_t *addr_index;
 } elf_info_t;
 
 /* Looks for a section with real data, not just a section with a header */
@@ -290,6 +304,8 @@ drsym_obj_mod_exit(void *mod_in)
         return;
     if (mod->elf != NULL)
         elf_end(mod->elf);
+    if (mod->addr_index != NULL)
+        dr_global_free(mod->addr_index, mod->num_syms * sizeof(*mod->addr_index));
     dr_global_free(mod, sizeof(*mod));
 }
 
@@ -378,46 +394,103 @@ drsym_obj_symbol_offs(void *mod_in, uint idx, size_t *offs_start OUT,
     return DRSYM_SUCCESS;
 }
 
+static int
+compare_addr_entries(const void *a_in, const void *b_in)
+{
+    const addr_entry_t *a = (const addr_entry_t *) a_in;
+    const addr_entry_t *b = (const addr_entry_t *) b_in;
+    if (a->lo != b->lo)
+        return (a->lo < b->lo) ? -1 : 1;
+    /* Keep symbol table order among equal addresses so lookups prefer the
+     * same symbol that a linear walk of the table would find first.
+     */
+    if (a->idx != b->idx)
+        return (a->idx < b->idx) ? -1 : 1;
+    return 0;
+}
+
+static void
+build_addr_index(elf_info_t *mod)
+{
+    int i;
+    size_t max_hi = 0;
+    mod->addr_index = dr_global_alloc(mod->num_syms * sizeof(*mod->addr_index));
+    for (i = 0; i < mod->num_syms; i++) {
+        mod->addr_index[i].lo = mod->syms[i].st_value - mod->load_base;
+        mod->addr_index[i].hi = mod->addr_index[i].lo + mod->syms[i].st_size;
+        mod->addr_index[i].idx = i;
+    }
+    qsort(mod->addr_index, mod->num_syms, sizeof(*mod->addr_index),
+          compare_addr_entries);
+    for (i = 0; i < mod->num_syms; i++) {
+        if (mod->addr_index[i].hi > max_hi)
+            max_hi = mod->addr_index[i].hi;
+        mod->addr_index[i].max_hi = max_hi;
+    }
+    NOTIFY(1, "%s: indexed %d symbols\n", __FUNCTION__, mod->num_syms);
+}
+
 drsym_error_t
 drsym_obj_addrsearch_symtab(void *mod_in, size_t modoffs, uint *idx OUT)
 {
     elf_info_t *mod = (elf_info_t *) mod_in;
-    int i;
-    int closest_idx = -1;
-    size_t closest_diff = SIZE_T_MAX;
+    addr_entry_t *index;
+    int min, max, last, i;
+    int found = -1;
 
     if (mod == NULL || mod->syms == NULL || idx == NULL)
         return DRSYM_ERROR;
+    if (mod->num_syms <= 0)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    if (mod->addr_index == NULL)
+        build_addr_index(mod);
+    index = mod->addr_index;
 
     NOTIFY(1, "%s: +"PIFX"\n", __FUNCTION__, modoffs);
+    /* Binary search for the last symbol starting at or below modoffs. */
+    min = 0;
+    max = mod->num_syms;
+    while (min < max) {
+        int mid = min + (max - min) / 2;
+        if (index[mid].lo <= modoffs)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    last = min - 1;
+    if (last < 0)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+
     /* XXX: if a function is split into non-contiguous pieces, will it
      * have multiple entries?
+     * Symbols may overlap, so walk back over every entry that could still
+     * contain modoffs and take the one earliest in the symbol table.
      */
-    for (i = 0; i < mod->num_syms; i++) {
-        size_t lo_offs = mod->syms[i].st_value - mod->load_base;
-        size_t hi_offs = lo_offs + mod->syms[i].st_size;
-        NOTIFY(3, "\tcomparing +"PIFX" to "PIFX"-"PIFX"\n", modoffs, lo_offs, hi_offs);
-        if (lo_offs <= modoffs && modoffs < hi_offs) {
-            NOTIFY(2, "\tfound +"PIFX" in "PIFX"-"PIFX"\n", modoffs, lo_offs, hi_offs);
-            *idx = i;
-            return DRSYM_SUCCESS;
-        }
-        /* i#1337: handle st_size==0 asm routines */
-        if (modoffs >= lo_offs) {
-            if (modoffs - lo_offs < closest_diff) {
-                closest_idx = i;
-                closest_diff = modoffs - lo_offs;
-                NOTIFY(3, "\tclosest diff is now "PIFX"\n", closest_diff);
-            }
-        }
+    for (i = last; i >= 0 && index[i].max_hi > modoffs; i--) {
+        NOTIFY(3, "\tcomparing +"PIFX" to "PIFX"-"PIFX"\n", modoffs,
+               index[i].lo, index[i].hi);
+        if (modoffs < index[i].hi && (found < 0 || index[i].idx < index[found].idx))
+            found = i;
+    }
+    if (found >= 0) {
+        NOTIFY(2, "\tfound +"PIFX" in "PIFX"-"PIFX"\n", modoffs,
+               index[found].lo, index[found].hi);
+        *idx = index[found].idx;
+        return DRSYM_SUCCESS;
     }
 
-    if (closest_idx >= 0 && mod->syms[closest_idx].st_size == 0) {
+    /* i#1337: handle st_size==0 asm routines by using the closest preceding
+     * symbol, earliest in the symbol table among those at the same address.
+     */
+    for (i = last; i > 0 && index[i - 1].lo == index[last].lo; i--)
+        ; /* nothing */
+    if (mod->syms[index[i].idx].st_size == 0) {
         /* i#1337: rule out anything without a name */
-        const char *name = drsym_obj_symbol_name(mod_in, closest_idx);
-        NOTIFY(2, "\tusing closest +"PIFX" diff "PIFX"\n", modoffs, closest_diff);
+        const char *name = drsym_obj_symbol_name(mod_in, index[i].idx);
+        NOTIFY(2, "\tusing closest +"PIFX" diff "PIFX"\n", modoffs,
+               modoffs - index[i].lo);
         if (name != NULL && name[0] != '\0') {
-            *idx = closest_idx;
+            *idx = index[i].idx;
             return DRSYM_SUCCESS;
         }
     }
@@ -425,6 +498,30 @@ drsym_obj_addrsearch_symtab(void *mod_in, size_t modoffs, uint *idx OUT)
     return DRSYM_ERROR_SYMBOL_NOT_FOUND;
 }
 
+/* Returns the contents of the GNU build id note, or NULL if there is none. */
+const byte *
+drsym_obj_build_id(void *mod_in, size_t *size OUT)
+{
+    elf_info_t *mod = (elf_info_t *) mod_in;
+    Elf_Shdr *section_header;
+    Elf_Note *note;
+    Elf_Scn *scn = find_elf_section_by_name(mod->elf, ".note.gnu.build-id");
+    if (scn == NULL)
+        return NULL;
+    section_header = elf_getshdr(scn);
+    if (section_header == NULL || section_header->sh_size < sizeof(*note)) {
+        NOTIFY_ELF("elf_getshdr .note.gnu.build-id");
+        return NULL;
+    }
+    note = (Elf_Note *)(((char*) mod->map_base) + section_header->sh_offset);
+    if (note->n_type != NT_GNU_BUILD_ID ||
+        sizeof(*note) + ALIGN_FORWARD(note->n_namesz, 4) + note->n_descsz >
+        section_header->sh_size)
+        return NULL;
+    *size = note->n_descsz;
+    return ((byte *) (note + 1)) + ALIGN_FORWARD(note->n_namesz, 4);
+}
+
 /******************************************************************************
  * Linux-specific helpers
  */
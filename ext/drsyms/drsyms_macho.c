@@ -634,3 +634,10 @@ drsym_obj_debug_path(void)
 {
     return "/usr/lib/debug";
 }
+
+const byte *
+drsym_obj_build_id(void *mod_in, size_t *size OUT)
+{
+    /* XXX: we could use the LC_UUID load command. */
+    return NULL;
+}
@@ -101,6 +101,10 @@ drsym_obj_same_file(const char *path1, const char *path2);
 const char *
 drsym_obj_debug_path(void);
 
+/* Returns a unique id for the object's build, or NULL if it has none. */
+const byte *
+drsym_obj_build_id(void *mod_in, size_t *size OUT);
+
 /***************************************************************************
  * DWARF
  */
@@ -117,8 +121,18 @@ drsym_dwarf_set_obj_offs(void *mod_in, ssize_t adjust);
 void
 drsym_dwarf_set_load_base(void *mod_in, byte *load_base);
 
+/* Sets the file from which the module's line index is loaded, or to which
+ * it is saved once built.
+ */
+void
+drsym_dwarf_set_index_path(void *mod_in, const char *path);
+
+/* cursor may be NULL.  Otherwise it should start at 0 and be passed
+ * unchanged to each lookup in a series, which is fastest in ascending order.
+ */
 bool
-drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT);
+drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT,
+                             uint *cursor INOUT);
 
 drsym_error_t
 drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data);
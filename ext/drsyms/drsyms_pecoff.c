@@ -666,3 +666,9 @@ drsym_obj_debug_path(void)
     /* XXX: also search mingw debug path */
     return "c:\\cygwin\\lib\\debug";
 }
+
+const byte *
+drsym_obj_build_id(void *mod_in, size_t *size OUT)
+{
+    return NULL;
+}
@@ -90,6 +90,9 @@ drsym_unix_init(void);
 void
 drsym_unix_exit(void);
 
+drsym_error_t
+drsym_unix_set_index_cache_dir(const char *dir);
+
 void *
 drsym_unix_load(const char *modpath);
 
@@ -100,6 +103,11 @@ drsym_error_t
 drsym_unix_lookup_address(void *moddata, size_t modoffs,
                           drsym_info_t *out INOUT, uint flags);
 
+drsym_error_t
+drsym_unix_lookup_address_batch(void *moddata, const size_t *modoffs, size_t count,
+                                drsym_info_t *out INOUT, drsym_lookup_batch_cb callback,
+                                void *data, uint flags);
+
 drsym_error_t
 drsym_unix_lookup_symbol(void *moddata, const char *symbol, size_t *modoffs OUT,
                          uint flags);
@@ -43,6 +43,7 @@
 #include "libdwarf.h"
 
 #include <string.h> /* strlen */
+#include <limits.h> /* UINT_MAX */
 #include <errno.h>
 #include <stddef.h> /* offsetof */
 
@@ -58,6 +59,11 @@
 /* For debugging */
 static bool verbose = false;
 
+/* Directory holding line index caches: empty if caching is disabled.
+ * We're protected by symbol_lock.
+ */
+static char index_cache_dir[MAXIMUM_PATH];
+
 typedef struct _dbg_module_t {
     file_t fd;
     size_t file_size;
@@ -78,6 +84,7 @@ typedef struct _dbg_module_t {
  */
 
 static void unload_module(dbg_module_t *mod);
+static void set_index_path(dbg_module_t *mod);
 static bool follow_debuglink(const char * modpath, dbg_module_t *mod,
                              const char *debuglink, char debug_modpath[MAXIMUM_PATH]);
 
@@ -199,6 +206,8 @@ load_module(const char *modpath)
             /* i#1433: obj_info->load_base is initialized in drsym_obj_mod_init_post */
             drsym_dwarf_set_load_base(mod->dwarf_info,
                                       drsym_obj_load_base(mod->obj_info));
+            if (index_cache_dir[0] != '\0')
+                set_index_path(mod);
         }
     }
 
@@ -283,6 +292,35 @@ follow_debuglink(const char *modpath, dbg_module_t *mod, const char *debuglink,
     return false;
 }
 
+/* Names the module's line index cache file after its build id, so that a
+ * rebuilt binary at the same path does not pick up a stale index.
+ */
+static void
+set_index_path(dbg_module_t *mod)
+{
+    static const char hex[] = "0123456789abcdef";
+    char id_str[2 * 64 + 1];
+    char index_path[MAXIMUM_PATH];
+    size_t id_size, i;
+    const byte *id = drsym_obj_build_id(mod->obj_info, &id_size);
+    if (id == NULL || id_size == 0) {
+        NOTIFY("%s: no build id: not caching the index\n", __FUNCTION__);
+        return;
+    }
+    if (id_size > (sizeof(id_str) - 1) / 2)
+        id_size = (sizeof(id_str) - 1) / 2;
+    for (i = 0; i < id_size; i++) {
+        id_str[2 * i] = hex[id[i] >> 4];
+        id_str[2 * i + 1] = hex[id[i] & 0xf];
+    }
+    id_str[2 * id_size] = '\0';
+    if (dr_snprintf(index_path, BUFFER_SIZE_ELEMENTS(index_path), "%s/%s.drsymidx",
+                    index_cache_dir, id_str) <= 0)
+        return;
+    NULL_TERMINATE_BUFFER(index_path);
+    drsym_dwarf_set_index_path(mod->dwarf_info, index_path);
+}
+
 /* Free all resources associated with the debug module and the object itself.
  */
 static void
@@ -393,15 +431,23 @@ symsearch_symtab(dbg_module_t *mod, drsym_enumerate_cb callback,
     return res;
 }
 
+/* If last_idx is non-NULL, it holds the symbol found by the previous lookup
+ * into the same info, whose name and bounds we then need not fill in again.
+ */
 static drsym_error_t
 addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
-                  uint flags)
+                  uint flags, uint *last_idx INOUT)
 {
     const char *symbol;
     size_t name_len = 0;
     uint idx;
     drsym_error_t res = drsym_obj_addrsearch_symtab(mod->obj_info, modoffs, &idx);
 
+    if (last_idx != NULL) {
+        if (res == DRSYM_SUCCESS && idx == *last_idx)
+            return DRSYM_SUCCESS;
+        *last_idx = UINT_MAX;
+    }
     if (res != DRSYM_SUCCESS)
         return res;
 
@@ -423,7 +469,10 @@ addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
 
     info->name_available_size = name_len;
 
-    return drsym_obj_symbol_offs(mod->obj_info, idx, &info->start_offs, &info->end_offs);
+    res = drsym_obj_symbol_offs(mod->obj_info, idx, &info->start_offs, &info->end_offs);
+    if (res == DRSYM_SUCCESS && last_idx != NULL)
+        *last_idx = idx;
+    return res;
 }
 
 /******************************************************************************
@@ -442,6 +491,20 @@ drsym_unix_exit(void)
     /* nothing */
 }
 
+drsym_error_t
+drsym_unix_set_index_cache_dir(const char *dir)
+{
+    if (dir == NULL) {
+        index_cache_dir[0] = '\0';
+        return DRSYM_SUCCESS;
+    }
+    if (!dr_directory_exists(dir))
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    dr_snprintf(index_cache_dir, BUFFER_SIZE_ELEMENTS(index_cache_dir), "%s", dir);
+    NULL_TERMINATE_BUFFER(index_cache_dir);
+    return DRSYM_SUCCESS;
+}
+
 void *
 drsym_unix_load(const char *modpath)
 {
@@ -552,12 +615,14 @@ drsym_unix_lookup_symbol(void *mod_in, const char *symbol, size_t *modoffs OUT,
     return DRSYM_SUCCESS;
 }
 
-drsym_error_t
-drsym_unix_lookup_address(void *mod_in, size_t modoffs,
-                          drsym_info_t *out INOUT, uint flags)
+/* last_idx and line_cursor carry state between the lookups of a batch, or
+ * are NULL for a single lookup.
+ */
+static drsym_error_t
+lookup_address_helper(dbg_module_t *mod, size_t modoffs, drsym_info_t *out INOUT,
+                      uint flags, uint *last_idx INOUT, uint *line_cursor INOUT)
 {
-    dbg_module_t *mod = (dbg_module_t *) mod_in;
-    drsym_error_t r = addrsearch_symtab(mod, modoffs, out, flags);
+    drsym_error_t r = addrsearch_symtab(mod, modoffs, out, flags, last_idx);
 
     /* If we did find an address for the symbol, go look for its line number
      * information.
@@ -573,7 +638,7 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs,
         if (mod4line->dwarf_info == NULL ||
             !drsym_dwarf_search_addr2line
             (mod4line->dwarf_info, (Dwarf_Addr)(ptr_uint_t)
-             (drsym_obj_load_base(mod->obj_info) + modoffs), out)) {
+             (drsym_obj_load_base(mod->obj_info) + modoffs), out, line_cursor)) {
             r = DRSYM_ERROR_LINE_NOT_AVAILABLE;
         }
     }
@@ -587,6 +652,32 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs,
     return r;
 }
 
+drsym_error_t
+drsym_unix_lookup_address(void *mod_in, size_t modoffs,
+                          drsym_info_t *out INOUT, uint flags)
+{
+    dbg_module_t *mod = (dbg_module_t *) mod_in;
+    return lookup_address_helper(mod, modoffs, out, flags, NULL, NULL);
+}
+
+drsym_error_t
+drsym_unix_lookup_address_batch(void *mod_in, const size_t *modoffs, size_t count,
+                                drsym_info_t *out INOUT, drsym_lookup_batch_cb callback,
+                                void *data, uint flags)
+{
+    dbg_module_t *mod = (dbg_module_t *) mod_in;
+    uint last_idx = UINT_MAX;
+    uint line_cursor = 0;
+    size_t i;
+    for (i = 0; i < count; i++) {
+        drsym_error_t r = lookup_address_helper(mod, modoffs[i], out, flags,
+                                                &last_idx, &line_cursor);
+        if (!(*callback)(i, out, r, data))
+            break;
+    }
+    return DRSYM_SUCCESS;
+}
+
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
 {
@@ -47,15 +47,32 @@
 #include "drsyms_private.h"
 #include "hashtable.h"
 
-/* Guards our internal state and libdwarf's modifications of mod->dbg.
- * We use a recursive lock to allow queries to be called from enumerate callbacks.
+/* Guards modtable and module loading.  Each module's queries, including
+ * libdwarf's modifications of mod->dbg, are instead guarded by that module's
+ * own lock, so that queries on different modules can run in parallel.
+ * We use recursive locks to allow queries to be called from enumerate callbacks.
+ * XXX: two threads making nested queries on each other's modules from
+ * enumerate callbacks can deadlock.
  */
 static void *symbol_lock;
 
-/* We have to restrict operations when operating in a nested query from a callback */
-static bool recursive_context;
-
-/* Hashtable for mapping module paths to dbg_module_t*. */
+/* An entry in modtable. */
+typedef struct _modentry_t {
+    void *mod;
+    void *lock;
+    /* One for modtable's reference plus one per query in progress.  Guarded by
+     * symbol_lock.
+     */
+    int refcount;
+    /* We have to restrict operations when operating in a nested query from a
+     * callback.  This counts the enumerations of this module in progress.
+     * Guarded by lock, so it is only meaningful to a thread that owns lock,
+     * which is what tells a nested query apart from another thread's.
+     */
+    int enumerating;
+} modentry_t;
+
+/* Hashtable for mapping module paths to modentry_t*. */
 #define MODTABLE_HASH_BITS 8
 static hashtable_t modtable;
 
@@ -68,17 +85,62 @@ static int shmid;
  * Linux lookup layer
  */
 
-static void *
-lookup_or_load(const char *modpath)
+/* The caller must hold symbol_lock. */
+static void
+modentry_release(modentry_t *entry)
+{
+    entry->refcount--;
+    if (entry->refcount == 0) {
+        drsym_unix_unload(entry->mod);
+        dr_recurlock_destroy(entry->lock);
+        dr_global_free(entry, sizeof(*entry));
+    }
+}
+
+/* Called by modtable on removal.  An entry still in use by a query is freed
+ * when that query finishes.
+ */
+static void
+modentry_free(void *p)
+{
+    modentry_release((modentry_t *) p);
+}
+
+/* Returns the entry for modpath with its lock held, loading it if necessary,
+ * or NULL on failure.  The caller must pass the entry to module_release().
+ */
+static modentry_t *
+module_acquire(const char *modpath)
 {
-    void *mod = hashtable_lookup(&modtable, (void*)modpath);
-    if (mod == NULL) {
-        mod = drsym_unix_load(modpath);
+    modentry_t *entry;
+    dr_recurlock_lock(symbol_lock);
+    entry = (modentry_t *) hashtable_lookup(&modtable, (void*)modpath);
+    if (entry == NULL) {
+        void *mod = drsym_unix_load(modpath);
         if (mod != NULL) {
-            hashtable_add(&modtable, (void*)modpath, mod);
+            entry = (modentry_t *) dr_global_alloc(sizeof(*entry));
+            entry->mod = mod;
+            entry->lock = dr_recurlock_create();
+            entry->refcount = 1;
+            entry->enumerating = 0;
+            hashtable_add(&modtable, (void*)modpath, entry);
         }
     }
-    return mod;
+    if (entry != NULL)
+        entry->refcount++;
+    dr_recurlock_unlock(symbol_lock);
+    if (entry != NULL)
+        dr_recurlock_lock(entry->lock);
+    return entry;
+}
+
+static void
+module_release(modentry_t *entry)
+{
+    dr_recurlock_unlock(entry->lock);
+    dr_recurlock_lock(symbol_lock);
+    modentry_release(entry);
+    dr_recurlock_unlock(symbol_lock);
 }
 
 static drsym_error_t
@@ -86,24 +148,22 @@ drsym_enumerate_symbols_local(const char *modpath, drsym_enumerate_cb callback,
                               drsym_enumerate_ex_cb callback_ex, size_t info_size,
                               void *data, uint flags)
 {
-    void *mod;
+    modentry_t *entry;
     drsym_error_t r;
 
     if (modpath == NULL || (callback == NULL && callback_ex == NULL))
         return DRSYM_ERROR_INVALID_PARAMETER;
 
-    dr_recurlock_lock(symbol_lock);
-    mod = lookup_or_load(modpath);
-    if (mod == NULL) {
-        dr_recurlock_unlock(symbol_lock);
+    entry = module_acquire(modpath);
+    if (entry == NULL)
         return DRSYM_ERROR_LOAD_FAILED;
-    }
 
-    recursive_context = true;
-    r = drsym_unix_enumerate_symbols(mod, callback, callback_ex, info_size, data, flags);
-    recursive_context = false;
+    entry->enumerating++;
+    r = drsym_unix_enumerate_symbols(entry->mod, callback, callback_ex, info_size,
+                                     data, flags);
+    entry->enumerating--;
 
-    dr_recurlock_unlock(symbol_lock);
+    module_release(entry);
     return r;
 }
 
@@ -111,22 +171,19 @@ static drsym_error_t
 drsym_lookup_symbol_local(const char *modpath, const char *symbol,
                           size_t *modoffs OUT, uint flags)
 {
-    void *mod;
+    modentry_t *entry;
     drsym_error_t r;
 
     if (modpath == NULL || symbol == NULL || modoffs == NULL)
         return DRSYM_ERROR_INVALID_PARAMETER;
 
-    dr_recurlock_lock(symbol_lock);
-    mod = lookup_or_load(modpath);
-    if (mod == NULL) {
-        dr_recurlock_unlock(symbol_lock);
+    entry = module_acquire(modpath);
+    if (entry == NULL)
         return DRSYM_ERROR_LOAD_FAILED;
-    }
 
-    r = drsym_unix_lookup_symbol(mod, symbol, modoffs, flags);
+    r = drsym_unix_lookup_symbol(entry->mod, symbol, modoffs, flags);
 
-    dr_recurlock_unlock(symbol_lock);
+    module_release(entry);
     return r;
 }
 
@@ -134,7 +191,7 @@ static drsym_error_t
 drsym_lookup_address_local(const char *modpath, size_t modoffs,
                            drsym_info_t *out INOUT, uint flags)
 {
-    void *mod;
+    modentry_t *entry;
     drsym_error_t r;
 
     if (modpath == NULL || out == NULL)
@@ -143,16 +200,38 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
     if (out->struct_size != sizeof(*out))
         return DRSYM_ERROR_INVALID_SIZE;
 
-    dr_recurlock_lock(symbol_lock);
-    mod = lookup_or_load(modpath);
-    if (mod == NULL) {
-        dr_recurlock_unlock(symbol_lock);
+    entry = module_acquire(modpath);
+    if (entry == NULL)
         return DRSYM_ERROR_LOAD_FAILED;
-    }
 
-    r = drsym_unix_lookup_address(mod, modoffs, out, flags);
+    r = drsym_unix_lookup_address(entry->mod, modoffs, out, flags);
 
-    dr_recurlock_unlock(symbol_lock);
+    module_release(entry);
+    return r;
+}
+
+static drsym_error_t
+drsym_lookup_address_batch_local(const char *modpath, const size_t *modoffs,
+                                 size_t count, drsym_info_t *out INOUT,
+                                 drsym_lookup_batch_cb callback, void *data, uint flags)
+{
+    modentry_t *entry;
+    drsym_error_t r;
+
+    if (modpath == NULL || (modoffs == NULL && count > 0) || out == NULL ||
+        callback == NULL)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    if (out->struct_size != sizeof(*out))
+        return DRSYM_ERROR_INVALID_SIZE;
+
+    entry = module_acquire(modpath);
+    if (entry == NULL)
+        return DRSYM_ERROR_LOAD_FAILED;
+
+    r = drsym_unix_lookup_address_batch(entry->mod, modoffs, count, out, callback,
+                                        data, flags);
+
+    module_release(entry);
     return r;
 }
 
@@ -160,22 +239,19 @@ static drsym_error_t
 drsym_enumerate_lines_local(const char *modpath, drsym_enumerate_lines_cb callback,
                             void *data)
 {
-    void *mod;
+    modentry_t *entry;
     drsym_error_t res;
 
     if (modpath == NULL || callback == NULL)
         return DRSYM_ERROR_INVALID_PARAMETER;
 
-    dr_recurlock_lock(symbol_lock);
-    mod = lookup_or_load(modpath);
-    if (mod == NULL) {
-        dr_recurlock_unlock(symbol_lock);
+    entry = module_acquire(modpath);
+    if (entry == NULL)
         return DRSYM_ERROR_LOAD_FAILED;
-    }
 
-    res = drsym_unix_enumerate_lines(mod, callback, data);
+    res = drsym_unix_enumerate_lines(entry->mod, callback, data);
 
-    dr_recurlock_unlock(symbol_lock);
+    module_release(entry);
     return res;
 }
 
@@ -208,7 +284,7 @@ drsym_init(int shmid_in)
     } else {
         hashtable_init_ex(&modtable, MODTABLE_HASH_BITS, HASH_STRING,
                           true/*strdup*/, false/*!synch: using symbol_lock*/,
-                          (generic_func_t)drsym_unix_unload, NULL, NULL);
+                          modentry_free, NULL, NULL);
     }
     return DRSYM_SUCCESS;
 }
@@ -246,6 +322,20 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_address_batch(const char *modpath, const size_t *modoffs, size_t count,
+                           drsym_info_t *info INOUT, drsym_lookup_batch_cb callback,
+                           void *data, uint flags)
+{
+    if (IS_SIDELINE) {
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    } else {
+        return drsym_lookup_address_batch_local(modpath, modoffs, count, info,
+                                                callback, data, flags);
+    }
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
@@ -325,16 +415,17 @@ drsym_get_module_debug_kind(const char *modpath, drsym_debug_kind_t *kind OUT)
     if (IS_SIDELINE) {
         return DRSYM_ERROR_NOT_IMPLEMENTED;
     } else {
-        void *mod;
+        modentry_t *entry;
         drsym_error_t r;
 
         if (modpath == NULL || kind == NULL)
             return DRSYM_ERROR_INVALID_PARAMETER;
 
-        dr_recurlock_lock(symbol_lock);
-        mod = lookup_or_load(modpath);
-        r = drsym_unix_get_module_debug_kind(mod, kind);
-        dr_recurlock_unlock(symbol_lock);
+        entry = module_acquire(modpath);
+        if (entry == NULL)
+            return drsym_unix_get_module_debug_kind(NULL, kind);
+        r = drsym_unix_get_module_debug_kind(entry->mod, kind);
+        module_release(entry);
         return r;
     }
 }
@@ -358,15 +449,19 @@ drsym_free_resources(const char *modpath)
         return DRSYM_ERROR_NOT_IMPLEMENTED;
     } else {
         bool found;
+        modentry_t *entry;
 
         if (modpath == NULL)
             return DRSYM_ERROR_INVALID_PARAMETER;
 
-        /* unsafe to free during iteration */
-        if (recursive_context)
-            return DRSYM_ERROR_RECURSIVE;
-
         dr_recurlock_lock(symbol_lock);
+        entry = (modentry_t *) hashtable_lookup(&modtable, (void *)modpath);
+        /* unsafe to free during iteration by this thread */
+        if (entry != NULL && dr_recurlock_self_owns(entry->lock) &&
+            entry->enumerating > 0) {
+            dr_recurlock_unlock(symbol_lock);
+            return DRSYM_ERROR_RECURSIVE;
+        }
         found = hashtable_remove(&modtable, (void *)modpath);
         dr_recurlock_unlock(symbol_lock);
 
@@ -384,3 +479,16 @@ drsym_enumerate_lines(const char *modpath, drsym_enumerate_lines_cb callback, vo
         return drsym_enumerate_lines_local(modpath, callback, data);
     }
 }
+
+DR_EXPORT
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir)
+{
+    drsym_error_t res;
+    if (IS_SIDELINE)
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    dr_recurlock_lock(symbol_lock);
+    res = drsym_unix_set_index_cache_dir(dir);
+    dr_recurlock_unlock(symbol_lock);
+    return res;
+}
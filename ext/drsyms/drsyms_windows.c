@@ -1495,6 +1495,42 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_address_batch(const char *modpath, const size_t *modoffs, size_t count,
+                           drsym_info_t *info INOUT, drsym_lookup_batch_cb callback,
+                           void *data, uint flags)
+{
+    if (IS_SIDELINE) {
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    } else {
+        mod_entry_t *mod;
+        drsym_error_t res = DRSYM_SUCCESS;
+        size_t i;
+        if (modpath == NULL || (modoffs == NULL && count > 0) || info == NULL ||
+            callback == NULL)
+            return DRSYM_ERROR_INVALID_PARAMETER;
+        dr_recurlock_lock(symbol_lock);
+        mod = lookup_or_load(modpath, true/*use dbghelp*/);
+        if (mod == NULL)
+            res = DRSYM_ERROR_LOAD_FAILED;
+        else if (mod->use_pecoff_symtable) {
+            res = drsym_unix_lookup_address_batch(mod->u.pecoff_data, modoffs, count,
+                                                  info, callback, data, flags);
+        } else {
+            /* dbghelp has no batch interface */
+            for (i = 0; i < count; i++) {
+                drsym_error_t r =
+                    drsym_lookup_address_local(modpath, modoffs[i], info, flags);
+                if (!(*callback)(i, info, r, data))
+                    break;
+            }
+        }
+        dr_recurlock_unlock(symbol_lock);
+        return res;
+    }
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
@@ -1917,3 +1953,19 @@ drsym_enumerate_lines(const char *modpath, drsym_enumerate_lines_cb callback, vo
         return drsym_enumerate_lines_local(modpath, callback, data);
     }
 }
+
+DR_EXPORT
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir)
+{
+    drsym_error_t res;
+    if (IS_SIDELINE)
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    /* Only applies to modules with DWARF information, which we read via the
+     * Unix code.
+     */
+    dr_recurlock_lock(symbol_lock);
+    res = drsym_unix_set_index_cache_dir(dir);
+    dr_recurlock_unlock(symbol_lock);
+    return res;
+}
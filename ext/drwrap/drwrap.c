@@ -27,7 +27,10 @@
 #include "dr_api.h"
 #include "drwrap.h"
 #include "drmgr.h"
+#include "drreg.h"
+#include "drx.h"
 #include "hashtable.h"
+#include "drhashmap.h"
 #include "drvector.h"
 #include "../ext_utils.h"
 #include <string.h>
@@ -170,6 +173,57 @@ wrap_entry_free(void *v)
     }
 }
 
+/* Inline wrap requests: at most one per target address.  The pre and post
+ * actions are copied from the client and valid only if pre_set/post_set.
+ */
+typedef struct _inline_entry_t {
+    drwrap_inline_t pre;
+    drwrap_inline_t post;
+    bool pre_set;
+    bool post_set;
+    drwrap_callconv_t callconv;
+} inline_entry_t;
+
+#define INLINE_TABLE_HASH_BITS 6
+/* Maps the wrapped function to an inline_entry_t.  Protected by wrap_lock. */
+static hashtable_t inline_table;
+
+#define INLINE_POST_TABLE_HASH_BITS 8
+/* Maps the return address of each direct call to an inline-wrapped function
+ * with a post action to the function.  Protected by wrap_lock.
+ */
+static hashtable_t inline_post_table;
+
+/* Inline wraps use drreg for scratch registers (the buffer pointer, the
+ * recorded value, and the timestamp's upper half) and drx for buffers.
+ * Both are initialized on the first inline wrap request so that clients
+ * that never use inline wraps do not pay for them.  Protected by wrap_lock.
+ */
+static bool inline_deps_initialized;
+
+static bool
+drwrap_inline_init_deps(void)
+{
+    drreg_options_t drreg_ops = {sizeof(drreg_ops), 3, false, NULL,
+                                 true/*do_not_sum_slots*/};
+    if (inline_deps_initialized)
+        return true;
+    if (drreg_init(&drreg_ops) != DRREG_SUCCESS)
+        return false;
+    if (!drx_init()) {
+        drreg_exit();
+        return false;
+    }
+    inline_deps_initialized = true;
+    return true;
+}
+
+static void
+inline_entry_free(void *v)
+{
+    dr_global_free(v, sizeof(inline_entry_t));
+}
+
 /* TLS.  OK to be callback-shared: just more nesting. */
 static int tls_idx;
 
@@ -249,14 +303,21 @@ fast_safe_read(void *base, size_t size, void *out_buf)
 /* i#1689: we store the aligned (LSB=0) pc here */
 static hashtable_t call_site_table;
 
-/* Hashtable so we can remember post-call pcs (since
+/* Table so we can remember post-call pcs (since
  * post-cti-instrumentation is not supported by DR).
- * Synchronized externally to safeguard the externally-allocated payload,
- * using an rwlock b/c read on every instruction.
+ * Membership is checked on every wrapped call and every new bb, so it is a
+ * drhashmap_t whose lookups take no lock: past a thread's first lookup,
+ * which registers it with the table, a wrapped call writes only that
+ * thread's own epoch record and reads the shared table.  Adds and removes
+ * are serialized by post_call_rwlock's write lock, and code that
+ * dereferences a payload must hold its read lock, as removal frees the
+ * payload.  Tables retired by a resize are freed by a later add or remove
+ * once every lookup that might still see them has finished, which includes
+ * the range removal on every module unload.
  */
 #define POST_CALL_TABLE_HASH_BITS 10
 /* i#1689: we store the aligned (LSB=0) pc here */
-static hashtable_t post_call_table;
+static drhashmap_t post_call_table;
 static void *post_call_rwlock;
 
 typedef struct _post_call_entry_t {
@@ -287,13 +348,6 @@ typedef struct _post_call_notify_t {
 /* protected by post_call_rwlock */
 post_call_notify_t *post_call_notify_list;
 
-/* FIFO cache read w/o a lock (which we assume is fine b/c it's word-aligned
- * and thus does not cross a cache line) and written under post_call_rwlock
- */
-static uint postcall_cache_idx;
-#define POSTCALL_CACHE_SIZE 8
-static app_pc postcall_cache[POSTCALL_CACHE_SIZE];
-
 static void
 post_call_entry_free(void *v)
 {
@@ -314,7 +368,7 @@ post_call_entry_add(app_pc postcall, bool external)
         /* notify client somehow?  we'll carry on and invalidate on next bb */
         memset(e->prior, 0, sizeof(e->prior));
     }
-    hashtable_add(&post_call_table, (void*)postcall, (void*)e);
+    drhashmap_add(&post_call_table, (void*)postcall, (void*)e);
     if (!external && post_call_notify_list != NULL) {
         post_call_notify_t *cb = post_call_notify_list;
         while (cb != NULL) {
@@ -349,11 +403,7 @@ post_call_consistent(app_pc postcall, post_call_entry_t *e)
 static bool
 post_call_lookup(app_pc pc)
 {
-    bool res = false;
-    dr_rwlock_read_lock(post_call_rwlock);
-    res = (hashtable_lookup(&post_call_table, (void*)pc) != NULL);
-    dr_rwlock_read_unlock(post_call_rwlock);
-    return res;
+    return (drhashmap_lookup(&post_call_table, (void*)pc) != NULL);
 }
 #endif
 
@@ -364,22 +414,16 @@ post_call_lookup_for_instru(app_pc pc)
     bool res = false;
     post_call_entry_t *e;
     dr_rwlock_read_lock(post_call_rwlock);
-    e = (post_call_entry_t *) hashtable_lookup(&post_call_table, (void*)pc);
+    e = (post_call_entry_t *) drhashmap_lookup(&post_call_table, (void*)pc);
     if (e != NULL) {
         res = post_call_consistent(pc, e);
         if (!res) {
-            int i;
             /* need the write lock */
             dr_rwlock_read_unlock(post_call_rwlock);
             e = NULL; /* no longer safe */
             dr_rwlock_write_lock(post_call_rwlock);
             /* might not be found now if racily removed: but that's fine */
-            hashtable_remove(&post_call_table, (void *)pc);
-            /* invalidate cache */
-            for (i = 0; i < POSTCALL_CACHE_SIZE; i++) {
-                if (pc == postcall_cache[i])
-                    postcall_cache[i] = NULL;
-            }
+            drhashmap_remove(&post_call_table, (void *)pc);
             dr_rwlock_write_unlock(post_call_rwlock);
             return res;
         } else {
@@ -927,9 +971,13 @@ drwrap_init(void)
                       NULL, NULL);
     hashtable_init_ex(&call_site_table, CALL_SITE_TABLE_HASH_BITS, HASH_INTPTR,
                       false/*!strdup*/, false/*!synch*/, NULL, NULL, NULL);
-    hashtable_init_ex(&post_call_table, POST_CALL_TABLE_HASH_BITS, HASH_INTPTR,
-                      false/*!str_dup*/, false/*!synch*/, post_call_entry_free,
+    drhashmap_init_ex(&post_call_table, POST_CALL_TABLE_HASH_BITS,
+                      post_call_entry_free, NULL);
+    hashtable_init_ex(&inline_table, INLINE_TABLE_HASH_BITS, HASH_INTPTR,
+                      false/*!strdup*/, false/*!synch*/, inline_entry_free,
                       NULL, NULL);
+    hashtable_init(&inline_post_table, INLINE_POST_TABLE_HASH_BITS,
+                   HASH_INTPTR, false/*!strdup*/);
     post_call_rwlock = dr_rwlock_create();
     wrap_lock = dr_recurlock_create();
     drmgr_register_module_unload_event(drwrap_event_module_unload);
@@ -978,9 +1026,16 @@ drwrap_exit(void)
     hashtable_delete(&replace_native_table);
     hashtable_delete(&wrap_table);
     hashtable_delete(&call_site_table);
-    hashtable_delete(&post_call_table);
+    drhashmap_delete(&post_call_table);
+    hashtable_delete(&inline_table);
+    hashtable_delete(&inline_post_table);
     dr_rwlock_destroy(post_call_rwlock);
     dr_recurlock_destroy(wrap_lock);
+    if (inline_deps_initialized) {
+        drx_exit();
+        drreg_exit();
+        inline_deps_initialized = false;
+    }
     drmgr_exit();
 
     while (post_call_notify_list != NULL) {
@@ -1646,7 +1701,7 @@ drwrap_mark_retaddr_for_instru(void *drcontext, app_pc decorated_pc,
      */
     /* Ensure we have the retaddr instrumented for post-call events */
     dr_rwlock_write_lock(post_call_rwlock);
-    e = (post_call_entry_t *) hashtable_lookup(&post_call_table, (void*)retaddr);
+    e = (post_call_entry_t *) drhashmap_lookup(&post_call_table, (void*)retaddr);
     /* PR 454616: we may have added an entry and started a flush
      * but not finished the flush, so we check not just the entry
      * but also the existing_instrumented flag.
@@ -1688,7 +1743,7 @@ drwrap_mark_retaddr_for_instru(void *drcontext, app_pc decorated_pc,
             /* another thread may have done a racy competing flush: should be fine */
             dr_rwlock_read_lock(post_call_rwlock);
             e = (post_call_entry_t *)
-                hashtable_lookup(&post_call_table, (void*)retaddr);
+                drhashmap_lookup(&post_call_table, (void*)retaddr);
             if (e != NULL) /* selfmod could disappear once have PR 408529 */
                 e->existing_instrumented = true;
             /* XXX DrMem i#553: if e==NULL, recursion count could get off */
@@ -1732,29 +1787,19 @@ drwrap_ensure_postcall(void *drcontext, wrap_entry_t *wrap,
 {
     app_pc retaddr = dr_app_pc_as_load_target(DR_ISA_ARM_THUMB, wrapcxt->retaddr);
     app_pc plain_pc = dr_app_pc_as_load_target(DR_ISA_ARM_THUMB, decorated_pc);
-    int i;
-    /* avoid lock and hashtable lookup by caching prior retaddrs */
-    for (i = 0; i < POSTCALL_CACHE_SIZE; i++) {
-        if (retaddr == postcall_cache[i])
-            return;
-    }
-
-    /* to write to the cache we need a write lock */
-    dr_rwlock_write_lock(post_call_rwlock);
-
-    /* add to FIFO cache */
-    postcall_cache_idx++;
-    if (postcall_cache_idx >= POSTCALL_CACHE_SIZE)
-        postcall_cache_idx = 0;
-    postcall_cache[postcall_cache_idx] = retaddr;
-
-    if (hashtable_lookup(&post_call_table, (void*)retaddr) == NULL) {
+    /* This is on every wrapped call, so we check without a lock: only a
+     * retaddr's first call goes on to take the write lock.  We used to keep
+     * a small FIFO cache of retaddrs in front of a locked hashtable, but its
+     * updates needed the write lock and bounced its cache line between threads.
+     */
+    if (retaddr == NULL) /* unreadable: not a valid drhashmap key either */
+        return;
+    if (drhashmap_lookup(&post_call_table, (void*)retaddr) == NULL) {
         bool enabled = wrap->enabled;
         /* this function may not return: but in that case it will redirect
          * and we'll come back here to do the wrapping.
          * release all locks.
          */
-        dr_rwlock_write_unlock(post_call_rwlock);
         if (!TEST(DRWRAP_NO_FRILLS, global_flags))
             dr_recurlock_unlock(wrap_lock);
         drwrap_mark_retaddr_for_instru(drcontext, decorated_pc, wrapcxt, enabled);
@@ -1762,8 +1807,7 @@ drwrap_ensure_postcall(void *drcontext, wrap_entry_t *wrap,
         if (!TEST(DRWRAP_NO_FRILLS, global_flags))
             dr_recurlock_lock(wrap_lock);
         wrap = wrap_table_lookup_normalized_pc(plain_pc);
-    } else
-        dr_rwlock_write_unlock(post_call_rwlock);
+    }
 }
 
 /* called via clean call at the top of callee */
@@ -2145,6 +2189,169 @@ drwrap_after_callee(app_pc retaddr, reg_t xsp)
     }
 }
 
+#ifdef X86
+/* Returns the location of argument arg at the entry to a function using
+ * callconv, mirroring drwrap_arg_addr().
+ */
+static opnd_t
+drwrap_inline_arg_opnd(drwrap_callconv_t callconv, uint arg)
+{
+    reg_id_t reg = DR_REG_NULL;
+    uint reg_arg_count = 0;
+    uint stack_arg_offset = 1/*retaddr*/;
+    switch (callconv) {
+# ifdef X64
+    case DRWRAP_CALLCONV_AMD64: {
+        static const reg_id_t regs[] = {DR_REG_RDI, DR_REG_RSI, DR_REG_RDX,
+                                        DR_REG_RCX, DR_REG_R8, DR_REG_R9};
+        reg_arg_count = BUFFER_SIZE_ELEMENTS(regs);
+        if (arg < reg_arg_count)
+            reg = regs[arg];
+        break;
+    }
+    case DRWRAP_CALLCONV_MICROSOFT_X64: {
+        static const reg_id_t regs[] = {DR_REG_RCX, DR_REG_RDX, DR_REG_R8, DR_REG_R9};
+        reg_arg_count = BUFFER_SIZE_ELEMENTS(regs);
+        stack_arg_offset += 4/*reserved*/;
+        if (arg < reg_arg_count)
+            reg = regs[arg];
+        break;
+    }
+# endif
+    case DRWRAP_CALLCONV_CDECL:
+        break;
+    case DRWRAP_CALLCONV_FASTCALL:
+        reg_arg_count = 2;
+        if (arg < reg_arg_count)
+            reg = (arg == 0) ? DR_REG_XCX : DR_REG_XDX;
+        break;
+    case DRWRAP_CALLCONV_THISCALL:
+        reg_arg_count = 1;
+        if (arg == 0)
+            reg = DR_REG_XCX;
+        break;
+    default:
+        ASSERT(false, "unknown or unsupported calling convention");
+        return opnd_create_null();
+    }
+    if (reg != DR_REG_NULL)
+        return opnd_create_reg(reg);
+    return OPND_CREATE_MEMPTR(DR_REG_XSP, (arg - reg_arg_count + stack_arg_offset) *
+                              sizeof(reg_t));
+}
+
+/* Appends a drwrap_inline_record_t holding src to action->buf. */
+static bool
+drwrap_insert_inline_record(void *drcontext, instrlist_t *bb, instr_t *inst,
+                            app_pc func, drwrap_inline_t *action, opnd_t src)
+{
+    drvector_t allowed;
+    reg_id_t val_reg, buf_ptr, scratch;
+    drreg_status_t res;
+    bool ok = false;
+
+    /* rdtsc writes xax and xdx so we reserve those two specifically. */
+    drreg_init_and_fill_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, DR_REG_XAX, true);
+    if (drreg_reserve_register(drcontext, bb, inst, &allowed, &val_reg) !=
+        DRREG_SUCCESS)
+        goto record_done;
+    /* Read the value before reserving anything else, which might claim
+     * a dead argument register.
+     */
+    if (opnd_is_reg(src)) {
+        res = drreg_get_app_value(drcontext, bb, inst, opnd_get_reg(src), val_reg);
+        if (res == DRREG_ERROR_NO_APP_VALUE) {
+            /* The register is dead here so its value is meaningless. */
+            instrlist_meta_preinsert(bb, inst, XINST_CREATE_load_int
+                                     (drcontext, opnd_create_reg(val_reg),
+                                      OPND_CREATE_INT32(0)));
+        } else if (res != DRREG_SUCCESS)
+            goto record_done;
+    } else {
+        instrlist_meta_preinsert(bb, inst, XINST_CREATE_load
+                                 (drcontext, opnd_create_reg(val_reg), src));
+    }
+    /* Keep xax and xdx for rdtsc. */
+    drvector_delete(&allowed);
+    drreg_init_and_fill_vector(&allowed, true);
+    drreg_set_vector_entry(&allowed, DR_REG_XAX, false);
+    drreg_set_vector_entry(&allowed, DR_REG_XDX, false);
+    if (drreg_reserve_register(drcontext, bb, inst, &allowed, &buf_ptr) !=
+        DRREG_SUCCESS)
+        goto record_done;
+    drx_buf_insert_load_buf_ptr(drcontext, action->buf, bb, inst, buf_ptr);
+    if (!drx_buf_insert_buf_store(drcontext, action->buf, bb, inst, buf_ptr,
+                                  DR_REG_NULL, opnd_create_reg(val_reg), OPSZ_PTR,
+                                  offsetof(drwrap_inline_record_t, value)) ||
+        !drx_buf_insert_buf_store(drcontext, action->buf, bb, inst, buf_ptr,
+                                  DR_REG_NULL, OPND_CREATE_INTPTR((ptr_int_t)func),
+                                  OPSZ_PTR, offsetof(drwrap_inline_record_t, func)))
+        goto record_done;
+
+    drvector_delete(&allowed);
+    drreg_init_and_fill_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, DR_REG_XDX, true);
+    if (drreg_reserve_register(drcontext, bb, inst, &allowed, &scratch) !=
+        DRREG_SUCCESS)
+        goto record_done;
+    instrlist_meta_preinsert(bb, inst, INSTR_CREATE_rdtsc(drcontext));
+    if (!drx_buf_insert_buf_store(drcontext, action->buf, bb, inst, buf_ptr,
+                                  DR_REG_NULL, opnd_create_reg(DR_REG_EAX), OPSZ_4,
+                                  offsetof(drwrap_inline_record_t, timestamp)) ||
+        !drx_buf_insert_buf_store(drcontext, action->buf, bb, inst, buf_ptr,
+                                  DR_REG_NULL, opnd_create_reg(DR_REG_EDX), OPSZ_4,
+                                  offsetof(drwrap_inline_record_t, timestamp) + 4))
+        goto record_done;
+    if (drreg_unreserve_register(drcontext, bb, inst, scratch) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, inst, val_reg) != DRREG_SUCCESS)
+        goto record_done;
+
+    /* The buffer update is an add. */
+    if (drreg_reserve_aflags(drcontext, bb, inst) != DRREG_SUCCESS)
+        goto record_done;
+    drx_buf_insert_update_buf_ptr(drcontext, action->buf, bb, inst, buf_ptr,
+                                  DR_REG_NULL, sizeof(drwrap_inline_record_t));
+    if (drreg_unreserve_aflags(drcontext, bb, inst) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, inst, buf_ptr) != DRREG_SUCCESS)
+        goto record_done;
+    ok = true;
+ record_done:
+    drvector_delete(&allowed);
+    return ok;
+}
+#endif
+
+static void
+drwrap_insert_inline(void *drcontext, instrlist_t *bb, instr_t *inst, app_pc func,
+                     drwrap_inline_t *action, drwrap_callconv_t callconv,
+                     bool is_post)
+{
+    bool ok = true;
+    switch (action->type) {
+    case DRWRAP_INLINE_CALLBACK:
+        (*action->insert_cb)(drcontext, bb, inst, func, action->user_data);
+        break;
+    case DRWRAP_INLINE_COUNTER:
+        ok = drx_insert_counter_update(drcontext, bb, inst, SPILL_SLOT_MAX+1,
+                                       action->counter, 1,
+                                       IF_X64_ELSE(DRX_COUNTER_64BIT, 0) |
+                                       (action->atomic ? DRX_COUNTER_LOCK : 0));
+        break;
+    case DRWRAP_INLINE_RECORD:
+#ifdef X86
+        ok = drwrap_insert_inline_record(drcontext, bb, inst, func, action,
+                                         is_post ? opnd_create_reg(DR_REG_XAX) :
+                                         drwrap_inline_arg_opnd(callconv, action->arg));
+#else
+        ok = false; /* rejected by drwrap_wrap_inline() */
+#endif
+        break;
+    }
+    if (!ok)
+        ASSERT(false, "failed to insert inline wrap instrumentation");
+}
+
 static dr_emit_flags_t
 drwrap_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
                          bool for_trace, bool translating, OUT void **user_data)
@@ -2165,6 +2372,10 @@ drwrap_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
      */
     app_pc pc = dr_app_pc_as_jump_target(instr_get_isa_mode(inst),
                                          instr_get_app_pc(inst));
+    inline_entry_t *inline_entry;
+    inline_entry_t inline_pre, inline_post;
+    app_pc inline_post_func = NULL;
+    bool do_inline_pre = false, do_inline_post = false;
 
     /* Strategy: we don't bother to look at call sites; we wait for the callee
      * and flush, under the assumption that we won't have already seen the
@@ -2190,8 +2401,50 @@ drwrap_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
                                 opnd_create_reg(DR_REG_XSP)
                                 _IF_NOT_X86(opnd_create_reg(DR_REG_LR)));
     }
+
+    /* Inline wraps: we copy the request so that we can insert without the
+     * lock, as the client callback may call back into drwrap.
+     */
+    inline_entry = hashtable_lookup(&inline_table, (void *)pc);
+    if (inline_entry != NULL && inline_entry->pre_set) {
+        inline_pre = *inline_entry;
+        do_inline_pre = true;
+    }
+    inline_post_func = hashtable_lookup(&inline_post_table, (void *)pc);
+    if (inline_post_func != NULL) {
+        inline_entry = hashtable_lookup(&inline_table, (void *)inline_post_func);
+        if (inline_entry != NULL && inline_entry->post_set) {
+            inline_post = *inline_entry;
+            do_inline_post = true;
+        }
+    }
+    /* Post actions go at the return address of direct calls.  We record it
+     * here, when the call is built, which is normally before the return
+     * point has been built; if not, we flush it.
+     */
+    if (!translating && instr_is_call_direct(inst)) {
+        app_pc target = opnd_get_pc(instr_get_target(inst));
+        inline_entry = hashtable_lookup(&inline_table, (void *)target);
+        if (inline_entry != NULL && inline_entry->post_set) {
+            app_pc retaddr = instr_get_app_pc(inst) + instr_length(drcontext, inst);
+            if (hashtable_add(&inline_post_table, (void *)retaddr, (void *)target) &&
+                dr_fragment_exists_at(drcontext, retaddr)) {
+                if (!dr_delay_flush_region(retaddr, 1, 0, NULL))
+                    ASSERT(false, "inline post-call flush failed");
+            }
+        }
+    }
     dr_recurlock_unlock(wrap_lock);
 
+    if (do_inline_pre) {
+        drwrap_insert_inline(drcontext, bb, inst, pc, &inline_pre.pre,
+                             inline_pre.callconv, false);
+    }
+    if (do_inline_post) {
+        drwrap_insert_inline(drcontext, bb, inst, inline_post_func, &inline_post.post,
+                             inline_post.callconv, true);
+    }
+
     if (post_call_lookup_for_instru(instr_get_app_pc(inst)/*normalized*/)) {
         /* XXX: for DRWRAP_FAST_CLEANCALLS we must preserve state b/c
          * our post-call points can be reached through non-return paths.
@@ -2220,8 +2473,15 @@ drwrap_event_module_unload(void *drcontext, const module_data_t *info)
      */
     hashtable_remove_range(&call_site_table, (void *)info->start, (void *)info->end);
 
+    dr_recurlock_lock(wrap_lock);
+    hashtable_remove_range(&inline_post_table, (void *)info->start, (void *)info->end);
+    dr_recurlock_unlock(wrap_lock);
+
+    /* This also frees any tables retired by resizes that no lookup is still
+     * using, even if the module had no post-call sites.
+     */
     dr_rwlock_write_lock(post_call_rwlock);
-    hashtable_remove_range(&post_call_table, (void *)info->start, (void *)info->end);
+    drhashmap_remove_range(&post_call_table, (void *)info->start, (void *)info->end);
     dr_rwlock_write_unlock(post_call_rwlock);
 }
 
@@ -2372,6 +2632,94 @@ drwrap_is_wrapped(app_pc func,
     return res;
 }
 
+static bool
+drwrap_inline_action_valid(const drwrap_inline_t *action)
+{
+    if (action == NULL)
+        return true;
+    if (action->struct_size != sizeof(*action))
+        return false;
+    switch (action->type) {
+    case DRWRAP_INLINE_CALLBACK: return action->insert_cb != NULL;
+    case DRWRAP_INLINE_COUNTER: return action->counter != NULL;
+#ifdef X86
+    case DRWRAP_INLINE_RECORD: return action->buf != NULL;
+#endif
+    default: return false;
+    }
+}
+
+DR_EXPORT
+bool
+drwrap_wrap_inline(app_pc func, const drwrap_inline_t *pre,
+                   const drwrap_inline_t *post, uint flags)
+{
+    inline_entry_t *entry;
+    bool ok;
+
+    if (func == NULL || (pre == NULL && post == NULL) ||
+        !drwrap_inline_action_valid(pre) || !drwrap_inline_action_valid(post))
+        return false;
+
+    dr_recurlock_lock(wrap_lock);
+    ok = drwrap_inline_init_deps();
+    dr_recurlock_unlock(wrap_lock);
+    if (!ok)
+        return false;
+
+    entry = dr_global_alloc(sizeof(*entry));
+    memset(entry, 0, sizeof(*entry));
+    if (pre != NULL) {
+        entry->pre = *pre;
+        entry->pre_set = true;
+    }
+    if (post != NULL) {
+        entry->post = *post;
+        entry->post_set = true;
+    }
+    entry->callconv = EXTRACT_CALLCONV(flags);
+    if (entry->callconv == 0)
+        entry->callconv = DRWRAP_CALLCONV_DEFAULT;
+
+    dr_recurlock_lock(wrap_lock);
+    hashtable_add_replace(&inline_table, (void *)func, (void *)entry);
+    dr_recurlock_unlock(wrap_lock);
+    /* XXX: we're assuming void* tag == pc */
+    if (dr_fragment_exists_at(dr_get_current_drcontext(), func)) {
+        /* we do not guarantee faster than a lazy flush */
+        if (!dr_unlink_flush_region(func, 1))
+            ASSERT(false, "inline wrap flush failed");
+    }
+    return true;
+}
+
+DR_EXPORT
+bool
+drwrap_unwrap_inline(app_pc func)
+{
+    bool res;
+    uint i;
+    dr_recurlock_lock(wrap_lock);
+    res = hashtable_remove(&inline_table, (void *)func);
+    if (res) {
+        if (!dr_delay_flush_region(func, 1, 0, NULL))
+            ASSERT(false, "inline unwrap flush failed");
+        /* We leave the post-call entries in place: they are ignored without
+         * an inline_table entry and are valid again if func is re-wrapped.
+         */
+        for (i = 0; i < HASHTABLE_SIZE(inline_post_table.table_bits); i++) {
+            hash_entry_t *he;
+            for (he = inline_post_table.table[i]; he != NULL; he = he->next) {
+                if (he->payload == (void *)func &&
+                    !dr_delay_flush_region((app_pc)he->key, 1, 0, NULL))
+                    ASSERT(false, "inline unwrap flush failed");
+            }
+        }
+    }
+    dr_recurlock_unlock(wrap_lock);
+    return res;
+}
+
 DR_EXPORT
 bool
 drwrap_is_post_wrap(app_pc pc)
@@ -2379,9 +2727,7 @@ drwrap_is_post_wrap(app_pc pc)
     bool res = false;
     if (pc == NULL)
         return false;
-    dr_rwlock_read_lock(post_call_rwlock);
-    res = (hashtable_lookup(&post_call_table, (void*)pc) != NULL);
-    dr_rwlock_read_unlock(post_call_rwlock);
+    res = (drhashmap_lookup(&post_call_table, (void*)pc) != NULL);
     return res;
 }
 
@@ -435,6 +435,114 @@ drwrap_unwrap(app_pc func,
               void (*pre_func_cb)(void *wrapcxt, OUT void **user_data),
               void (*post_func_cb)(void *wrapcxt, void *user_data));
 
+/** Values for the type field of #drwrap_inline_t. */
+typedef enum {
+    /**
+     * The insert_cb field of #drwrap_inline_t is called to add instrumentation
+     * to the code cache.
+     */
+    DRWRAP_INLINE_CALLBACK,
+    /**
+     * The pointer-sized counter pointed at by the counter field of
+     * #drwrap_inline_t is incremented.
+     */
+    DRWRAP_INLINE_COUNTER,
+    /**
+     * A #drwrap_inline_record_t is appended to the drx_buf trace buffer in
+     * the buf field of #drwrap_inline_t.  The recorded value is argument
+     * number arg for a pre-function action and the return value for a
+     * post-function action.  Currently only supported on x86.
+     */
+    DRWRAP_INLINE_RECORD,
+} drwrap_inline_type_t;
+
+struct _drx_buf_t;
+
+/** Describes one pre-function or post-function action for drwrap_wrap_inline(). */
+typedef struct _drwrap_inline_t {
+    /** Set to the size of this structure. */
+    size_t struct_size;
+    /** The kind of instrumentation to insert. */
+    drwrap_inline_type_t type;
+    /**
+     * For #DRWRAP_INLINE_CALLBACK, called from drwrap's drmgr insertion
+     * event to insert instrumentation prior to \p where, which is the
+     * application instruction at the wrap point.  The callback may use the
+     * drreg Extension to obtain scratch registers and must otherwise
+     * preserve all application state.  \p func is the wrapped function and
+     * \p user_data is the user_data field below.
+     */
+    void (*insert_cb)(void *drcontext, instrlist_t *ilist, instr_t *where,
+                      app_pc func, void *user_data);
+    /** Passed to \p insert_cb. */
+    void *user_data;
+    /** For #DRWRAP_INLINE_COUNTER, the counter to increment. */
+    ptr_uint_t *counter;
+    /**
+     * For #DRWRAP_INLINE_COUNTER, whether the increment should be atomic.
+     * A non-atomic increment is cheaper but may lose updates that race
+     * with other threads.
+     */
+    bool atomic;
+    /**
+     * For #DRWRAP_INLINE_RECORD, the trace buffer, which must have been
+     * created with drx_buf_create_trace_buffer() or
+     * drx_buf_create_circular_buffer().
+     */
+    struct _drx_buf_t *buf;
+    /** For a pre-function #DRWRAP_INLINE_RECORD, the 0-based argument to record. */
+    uint arg;
+} drwrap_inline_t;
+
+/** The entry written to the trace buffer by #DRWRAP_INLINE_RECORD. */
+typedef struct _drwrap_inline_record_t {
+    app_pc func;         /**< The wrapped function. */
+    ptr_uint_t value;    /**< The argument or return value. */
+    uint64 timestamp;    /**< The processor timestamp counter. */
+} drwrap_inline_record_t;
+
+DR_EXPORT
+/**
+ * Wraps \p func by inserting instrumentation directly into the code
+ * cache rather than through the clean call used by drwrap_wrap().
+ * This costs a few instructions per call and is meant for simple
+ * actions such as counting calls or recording an argument.
+ * Either of \p pre and \p post may be NULL but not both.
+ *
+ * The pre-function action is inserted at the entry of \p func.  The
+ * post-function action is inserted at the return address of each \em
+ * direct call to \p func that is built after this request; returns
+ * reached through indirect calls (including PLT stubs), tail calls, or
+ * \p longjmp are not instrumented.  Use drwrap_wrap() where every
+ * return must be seen.
+ *
+ * Only one inline request per function is kept: a second call for \p
+ * func replaces the first.  Inline and clean-call wraps of the same
+ * function are independent of each other.  \p flags may contain one
+ * #drwrap_callconv_t value, which selects the argument location for
+ * #DRWRAP_INLINE_RECORD.  As with drwrap_wrap(), a late request is
+ * only guaranteed to take effect once existing code for \p func is
+ * flushed.
+ *
+ * The first call initializes the drreg and drx Extensions, which the
+ * inline actions use, and they stay initialized until drwrap_exit().
+ *
+ * \return whether successful.
+ */
+bool
+drwrap_wrap_inline(app_pc func, const drwrap_inline_t *pre,
+                   const drwrap_inline_t *post, uint flags);
+
+DR_EXPORT
+/**
+ * Removes a request made by drwrap_wrap_inline() for \p func.  The
+ * instrumented code is flushed lazily via dr_delay_flush_region(), so
+ * the actions may execute a few more times after this returns.
+ * \return whether a request was found.
+ */
+bool
+drwrap_unwrap_inline(app_pc func);
+
 DR_EXPORT
 /**
  * Returns the DynamoRIO context.  This routine can be faster than
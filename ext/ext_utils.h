@@ -53,4 +53,26 @@
 #define ALIGN_BACKWARD(x, alignment) \
     (((ptr_uint_t)x) & (~((ptr_uint_t)(alignment)-1)))
 
+/* Ordering for lock-free readers of data published by a locked writer.
+ * Aligned pointer-sized loads and stores are atomic on all our platforms:
+ * a writer fills in data, issues RELEASE_FENCE(), then stores the pointer
+ * that publishes it; a reader loads that pointer, issues ACQUIRE_FENCE(),
+ * then reads the data.  FULL_FENCE() additionally orders earlier stores
+ * before later loads.
+ */
+#ifdef WINDOWS
+void _ReadWriteBarrier(void);
+# pragma intrinsic(_ReadWriteBarrier)
+void _mm_mfence(void);
+# pragma intrinsic(_mm_mfence)
+/* x86 does not reorder loads with loads or stores with stores */
+# define RELEASE_FENCE() _ReadWriteBarrier()
+# define ACQUIRE_FENCE() _ReadWriteBarrier()
+# define FULL_FENCE() _mm_mfence()
+#else
+# define RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+# define ACQUIRE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+# define FULL_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 #endif /* EXT_UTILS_H */
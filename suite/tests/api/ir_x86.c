@@ -739,6 +739,18 @@ test_nop_xchg(void *dc)
     decode(dc, buf, instr);
     ASSERT(instr_get_opcode(instr) == OP_xchg);
     instr_destroy(dc, instr);
+    /* targeting a 32-bit register zeroes the top bits, so these are not nops */
+    instr = INSTR_CREATE_xchg(dc, opnd_create_reg(REG_EAX), opnd_create_reg(REG_EAX));
+    ASSERT(!instr_is_nop(instr));
+    instr_destroy(dc, instr);
+    instr = INSTR_CREATE_lea(dc, opnd_create_reg(REG_ESI),
+                             opnd_create_base_disp(REG_ESI, REG_NULL, 0, 0, OPSZ_lea));
+    ASSERT(!instr_is_nop(instr));
+    instr_destroy(dc, instr);
+    instr = INSTR_CREATE_lea(dc, opnd_create_reg(REG_RSI),
+                             opnd_create_base_disp(REG_RSI, REG_NULL, 0, 0, OPSZ_lea));
+    ASSERT(instr_is_nop(instr));
+    instr_destroy(dc, instr);
 #endif
 }
 
@@ -35,6 +35,8 @@
 
 #include "dr_api.h"
 #include "drvector.h"
+#include "hashtable.h"
+#include "drhashmap.h"
 
 #define CHECK(x, msg) do {               \
     if (!(x)) {                          \
@@ -76,10 +78,171 @@ test_vector(void)
     CHECK(ok, "drvector_delete failed");
 }
 
+static int hashmap_payloads_freed;
+
+static void
+hashmap_free_payload(void *payload)
+{
+    hashmap_payloads_freed++;
+}
+
+/* Page-aligned keys, which an identity hash would pile into a single chain */
+#define HASHMAP_KEY(i) ((void *)(ptr_uint_t)(((i) + 1) << 12))
+#define HASHMAP_PAYLOAD(i) ((void *)(ptr_uint_t)((i) + 1))
+#define HASHMAP_TEST_ENTRIES 1000
+
+static void
+test_hashmap(void)
+{
+    drhashmap_t map;
+    uint i;
+    drhashmap_init_ex(&map, 4, hashmap_free_payload, NULL);
+    CHECK(drhashmap_num_entries(&map) == 0, "should start empty");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(0)) == NULL, "lookup in empty map");
+
+    /* Start small so we go through several resizes. */
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i++) {
+        bool ok = drhashmap_add(&map, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i));
+        CHECK(ok, "drhashmap_add failed");
+    }
+    CHECK(!drhashmap_add(&map, HASHMAP_KEY(0), HASHMAP_PAYLOAD(1)),
+          "duplicate add should fail");
+    CHECK(drhashmap_num_entries(&map) == HASHMAP_TEST_ENTRIES, "wrong entry count");
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i++) {
+        CHECK(drhashmap_lookup(&map, HASHMAP_KEY(i)) == HASHMAP_PAYLOAD(i),
+              "lookup after resize failed");
+    }
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(HASHMAP_TEST_ENTRIES)) == NULL,
+          "lookup of absent key should fail");
+
+    /* Remove every other entry, then re-add some with new payloads. */
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i += 2)
+        CHECK(drhashmap_remove(&map, HASHMAP_KEY(i)), "drhashmap_remove failed");
+    CHECK(hashmap_payloads_freed == HASHMAP_TEST_ENTRIES / 2, "payloads not freed");
+    CHECK(!drhashmap_remove(&map, HASHMAP_KEY(0)), "double remove should fail");
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i++) {
+        CHECK(drhashmap_lookup(&map, HASHMAP_KEY(i)) ==
+              (i % 2 == 0 ? NULL : HASHMAP_PAYLOAD(i)), "lookup after remove failed");
+    }
+    CHECK(drhashmap_add_replace(&map, HASHMAP_KEY(0), HASHMAP_PAYLOAD(7)) == NULL,
+          "re-add of removed key should return NULL");
+    CHECK(drhashmap_add_replace(&map, HASHMAP_KEY(1), HASHMAP_PAYLOAD(7)) ==
+          HASHMAP_PAYLOAD(1), "replace should return old payload");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(0)) == HASHMAP_PAYLOAD(7) &&
+          drhashmap_lookup(&map, HASHMAP_KEY(1)) == HASHMAP_PAYLOAD(7),
+          "lookup after replace failed");
+    CHECK(drhashmap_num_entries(&map) == HASHMAP_TEST_ENTRIES / 2 + 1,
+          "wrong entry count after remove");
+
+    /* Churn through many short-lived keys: removed slots must be reclaimed. */
+    for (i = HASHMAP_TEST_ENTRIES; i < 20 * HASHMAP_TEST_ENTRIES; i++) {
+        CHECK(drhashmap_add(&map, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i)), "churn add");
+        CHECK(drhashmap_remove(&map, HASHMAP_KEY(i)), "churn remove");
+    }
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(1)) == HASHMAP_PAYLOAD(7),
+          "lookup after churn failed");
+
+    /* Keys 1 and 3 remain in [KEY(1), KEY(4)); KEY(0) and KEY(5) are outside. */
+    CHECK(drhashmap_remove_range(&map, HASHMAP_KEY(1), HASHMAP_KEY(4)),
+          "drhashmap_remove_range failed");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(1)) == NULL &&
+          drhashmap_lookup(&map, HASHMAP_KEY(3)) == NULL, "range not removed");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(0)) == HASHMAP_PAYLOAD(7) &&
+          drhashmap_lookup(&map, HASHMAP_KEY(5)) == HASHMAP_PAYLOAD(5),
+          "remove_range removed too much");
+    CHECK(!drhashmap_remove_range(&map, HASHMAP_KEY(1), HASHMAP_KEY(4)),
+          "empty range should fail");
+
+    drhashmap_clear(&map);
+    CHECK(drhashmap_num_entries(&map) == 0, "clear should empty the map");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(5)) == NULL, "lookup after clear");
+    CHECK(drhashmap_add(&map, HASHMAP_KEY(1), HASHMAP_PAYLOAD(1)), "add after clear");
+    hashmap_payloads_freed = 0;
+    drhashmap_delete(&map);
+    CHECK(hashmap_payloads_freed == 1, "delete should free remaining payloads");
+}
+
+/* Without resizing the table must still take more entries than it started
+ * with and keep reusing removed slots.
+ */
+static void
+test_hashmap_fixed(void)
+{
+    drhashmap_t map;
+    hashtable_config_t config = {sizeof(config), false/*!resizable*/, 50};
+    uint i;
+    drhashmap_init(&map, 4);
+    drhashmap_configure(&map, &config);
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i++)
+        CHECK(drhashmap_add(&map, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i)), "fixed add");
+    for (i = 0; i < HASHMAP_TEST_ENTRIES; i++) {
+        CHECK(drhashmap_lookup(&map, HASHMAP_KEY(i)) == HASHMAP_PAYLOAD(i),
+              "fixed lookup failed");
+    }
+    for (i = HASHMAP_TEST_ENTRIES; i < 20 * HASHMAP_TEST_ENTRIES; i++) {
+        CHECK(drhashmap_add(&map, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i)), "fixed churn");
+        CHECK(drhashmap_remove(&map, HASHMAP_KEY(i)), "fixed churn remove");
+    }
+    CHECK(drhashmap_num_entries(&map) == HASHMAP_TEST_ENTRIES, "fixed entry count");
+    CHECK(drhashmap_lookup(&map, HASHMAP_KEY(HASHMAP_TEST_ENTRIES)) == NULL,
+          "fixed lookup of removed key");
+    drhashmap_delete(&map);
+}
+
+/* Microbenchmark: hit lookups of aligned keys in a synchronized hashtable_t,
+ * which takes its lock on every lookup, and in a drhashmap_t.  The timings are
+ * only logged, as they vary from run to run; run with -loglevel 1 to see them.
+ */
+#define BENCH_KEYS 4096
+#define BENCH_ROUNDS 64
+
+static void
+bench_hashmap(void)
+{
+    hashtable_t table;
+    drhashmap_t map;
+    uint i, round;
+    uint64 start, table_time, map_time;
+    ptr_uint_t sum = 0;
+
+    /* hashtable_init() synchronizes every operation */
+    hashtable_init(&table, 12, HASH_INTPTR, false/*!strdup*/);
+    drhashmap_init(&map, 12);
+    for (i = 0; i < BENCH_KEYS; i++) {
+        hashtable_add(&table, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i));
+        drhashmap_add(&map, HASHMAP_KEY(i), HASHMAP_PAYLOAD(i));
+    }
+
+    start = dr_get_microseconds();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < BENCH_KEYS; i++)
+            sum += (ptr_uint_t) hashtable_lookup(&table, HASHMAP_KEY(i));
+    }
+    table_time = dr_get_microseconds() - start;
+
+    start = dr_get_microseconds();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < BENCH_KEYS; i++)
+            sum -= (ptr_uint_t) drhashmap_lookup(&map, HASHMAP_KEY(i));
+    }
+    map_time = dr_get_microseconds() - start;
+
+    /* also keeps the loops from being optimized away */
+    CHECK(sum == 0, "hashtable and drhashmap disagree");
+    dr_log(NULL, LOG_ALL, 1, "%d lookups: locked hashtable %d us, drhashmap %d us\n",
+           BENCH_KEYS * BENCH_ROUNDS, (int)table_time, (int)map_time);
+
+    hashtable_delete(&table);
+    drhashmap_delete(&map);
+}
+
 DR_EXPORT void
 dr_init(client_id_t id)
 {
     test_vector();
+    test_hashmap();
+    test_hashmap_fixed();
+    bench_hashmap();
 
     /* XXX: test other data structures */
 }
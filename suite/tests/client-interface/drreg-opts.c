@@ -0,0 +1,154 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* App code for the drreg-opts test: each routine gives one of the drreg
+ * options under test something to optimize.
+ */
+
+#ifndef ASM_CODE_ONLY /* C code */
+#include "tools.h"
+#include "drreg-test-shared.h"
+
+/* asm routines */
+void test_cross_block();
+ptr_uint_t test_coalesce();
+#ifdef X86
+void test_simd();
+#endif
+
+int
+main(int argc, const char *argv[])
+{
+    print("drreg-opts running\n");
+
+    test_cross_block();
+
+    if (test_coalesce() != 0)
+        print("ERROR: spilled register value was not preserved!\n");
+
+#ifdef X86
+    test_simd();
+#endif
+
+    print("drreg-opts finished\n");
+    return 0;
+}
+
+#else /* asm code *************************************************************/
+#include "asm_defines.asm"
+#include "drreg-test-shared.h"
+START_FILE
+
+/* Both successors of the conditional branch write TEST_REG before reading it,
+ * so it is dead at the end of the first block.
+ */
+#define FUNCNAME test_cross_block
+        DECLARE_FUNC(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+#ifdef X86
+        cmp      REG_XAX, REG_XAX
+        je       cross_taken
+        mov      TEST_REG_ASM, 1
+        jmp      cross_done
+     cross_taken:
+        mov      TEST_REG_ASM, 2
+     cross_done:
+        ret
+#elif defined(ARM)
+        cmp      r0, r0
+        beq      cross_taken
+        movw     TEST_REG_ASM, 1
+        b        cross_done
+     cross_taken:
+        movw     TEST_REG_ASM, 2
+     cross_done:
+        bx       lr
+#elif defined(AARCH64)
+        cmp      x0, x0
+        b.eq     cross_taken
+        movz     TEST_REG_ASM, 1
+        b        cross_done
+     cross_taken:
+        movz     TEST_REG_ASM, 2
+     cross_done:
+        ret
+#endif
+        END_FUNC(FUNCNAME)
+#undef FUNCNAME
+
+/* Reads TEST_REG at each instr, so that with the client reserving it at each
+ * instr its slot can be reused.  Returns 0 if the app value was preserved.
+ */
+#define FUNCNAME test_coalesce
+        DECLARE_FUNC(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+#ifdef X86
+        mov      TEST_REG_ASM, REG_XSP
+        mov      REG_XAX, TEST_REG_ASM
+        mov      REG_XAX, TEST_REG_ASM
+        mov      REG_XAX, TEST_REG_ASM
+        sub      REG_XAX, REG_XSP
+        ret
+#elif defined(ARM)
+        mov      TEST_REG_ASM, sp
+        mov      r0, TEST_REG_ASM
+        mov      r0, TEST_REG_ASM
+        mov      r0, TEST_REG_ASM
+        mov      r1, sp
+        sub      r0, r0, r1
+        bx       lr
+#elif defined(AARCH64)
+        mov      TEST_REG_ASM, sp
+        mov      x0, TEST_REG_ASM
+        mov      x0, TEST_REG_ASM
+        mov      x0, TEST_REG_ASM
+        mov      x1, sp
+        sub      x0, x0, x1
+        ret
+#endif
+        END_FUNC(FUNCNAME)
+#undef FUNCNAME
+
+#ifdef X86
+/* Writes xmm1 before reading it, so it is dead at the write. */
+# define FUNCNAME test_simd
+        DECLARE_FUNC(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+        movaps   xmm1, xmm0
+        movaps   xmm0, xmm1
+        ret
+        END_FUNC(FUNCNAME)
+# undef FUNCNAME
+#endif
+
+END_FILE
+#endif
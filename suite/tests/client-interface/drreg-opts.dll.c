@@ -0,0 +1,216 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests drreg options that change its spill decisions.  The client argument
+ * selects the option, and the test checks that it took effect on the code in
+ * drreg-opts.c.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "client_tools.h"
+#include "drreg-test-shared.h"
+#include <string.h>
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+static bool test_cross_block;
+static bool test_coalesce;
+#ifdef X86
+static bool test_simd;
+/* The number of dead xmm reservations checked in and after the insertion phase */
+static int num_simd_insert_checks;
+static int num_simd_late_checks;
+#endif
+
+/* Reserves TEST_REG at where and writes a tool value to it, so that a wrong
+ * liveness decision breaks the app.
+ */
+static void
+clobber_test_reg(void *drcontext, instrlist_t *bb, instr_t *where)
+{
+    drvector_t allowed;
+    reg_id_t reg;
+    drreg_init_and_fill_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, TEST_REG, true);
+    if (drreg_reserve_register(drcontext, bb, where, &allowed, &reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to reserve");
+    drvector_delete(&allowed);
+    CHECK(reg == TEST_REG, "reserved the wrong register");
+    instrlist_insert_mov_immed_ptrsz(drcontext, 0xdead, opnd_create_reg(reg),
+                                     bb, where, NULL, NULL);
+    if (drreg_unreserve_register(drcontext, bb, where, reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to unreserve");
+}
+
+#ifdef X86
+/* Whether instr is the app's write to xmm1 that does not read it. */
+static bool
+is_xmm1_write(instr_t *instr)
+{
+    return instr_is_app(instr) && instr_get_opcode(instr) == OP_movaps &&
+        opnd_is_reg(instr_get_dst(instr, 0)) &&
+        opnd_get_reg(instr_get_dst(instr, 0)) == DR_REG_XMM1 &&
+        !instr_reads_from_reg(instr, DR_REG_XMM1, DR_QUERY_INCLUDE_ALL);
+}
+
+/* xmm1 is dead before instr, so reserving it there must not spill it. */
+static void
+reserve_dead_xmm1(void *drcontext, instrlist_t *bb, instr_t *instr)
+{
+    drvector_t allowed;
+    reg_id_t reg;
+    bool dead;
+    instr_t *prev = instr_get_prev(instr);
+    if (drreg_is_simd_register_dead(drcontext, DR_REG_XMM1, instr, &dead) !=
+        DRREG_SUCCESS)
+        CHECK(false, "failed to query SIMD liveness");
+    CHECK(dead, "xmm1 should be dead");
+    drreg_init_and_fill_simd_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, DR_REG_XMM1, true);
+    if (drreg_reserve_simd_register(drcontext, bb, instr, OPSZ_16, &allowed,
+                                    &reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to reserve SIMD reg");
+    drvector_delete(&allowed);
+    CHECK(reg == DR_REG_XMM1, "reserved the wrong SIMD register");
+    CHECK(instr_get_prev(instr) == prev, "dead xmm1 should not be spilled");
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_pxor
+                             (drcontext, opnd_create_reg(reg), opnd_create_reg(reg)));
+    if (drreg_unreserve_simd_register(drcontext, bb, instr, reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to unreserve SIMD reg");
+}
+#endif
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb,
+                      instr_t *instr, bool for_trace,
+                      bool translating, void *user_data)
+{
+    if (!instr_is_app(instr))
+        return DR_EMIT_DEFAULT;
+    /* Reservations at the end of a block depend on the successors' liveness,
+     * while reserving at every instr lets app reads in between keep the slot.
+     */
+    if ((test_cross_block && drmgr_is_last_instr(drcontext, instr)) || test_coalesce)
+        clobber_test_reg(drcontext, bb, instr);
+#ifdef X86
+    if (test_simd && is_xmm1_write(instr)) {
+        reserve_dead_xmm1(drcontext, bb, instr);
+        dr_atomic_add32_return_sum(&num_simd_insert_checks, 1);
+    }
+#endif
+    return DR_EMIT_DEFAULT;
+}
+
+#ifdef X86
+static dr_emit_flags_t
+event_instru2instru(void *drcontext, void *tag, instrlist_t *bb,
+                    bool for_trace, bool translating)
+{
+    /* Outside the insertion phase drreg computes liveness forward from where. */
+    instr_t *instr;
+    for (instr = instrlist_first(bb); instr != NULL; instr = instr_get_next(instr)) {
+        if (is_xmm1_write(instr)) {
+            reserve_dead_xmm1(drcontext, bb, instr);
+            dr_atomic_add32_return_sum(&num_simd_late_checks, 1);
+        }
+    }
+    return DR_EMIT_DEFAULT;
+}
+#endif
+
+static void
+event_exit(void)
+{
+    drreg_stats_t stats;
+    stats.struct_size = sizeof(stats);
+    if (drreg_get_stats(&stats) != DRREG_SUCCESS)
+        CHECK(false, "failed to get stats");
+    if (test_cross_block)
+        CHECK(stats.cross_block_spills_avoided > 0, "no cross-block spills avoided");
+    if (test_coalesce)
+        CHECK(stats.spills_coalesced > 0, "no spills coalesced");
+#ifdef X86
+    if (test_simd) {
+        CHECK(num_simd_insert_checks > 0 && num_simd_late_checks > 0,
+              "xmm1 write not found");
+    }
+    if (!drmgr_unregister_bb_instru2instru_event(event_instru2instru))
+        CHECK(false, "exit failed");
+#endif
+    if (!drmgr_unregister_bb_insertion_event(event_app_instruction) ||
+        drreg_exit() != DRREG_SUCCESS)
+        CHECK(false, "exit failed");
+    drmgr_exit();
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    drreg_options_t ops = {sizeof(ops), 1 /*max slots needed*/, false};
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cross_block_liveness") == 0)
+            test_cross_block = true;
+        else if (strcmp(argv[i], "-coalesce_spills") == 0)
+            test_coalesce = true;
+#ifdef X86
+        else if (strcmp(argv[i], "-simd") == 0)
+            test_simd = true;
+#endif
+        else
+            CHECK(false, "unknown option");
+    }
+    ops.cross_block_liveness = test_cross_block;
+    ops.coalesce_spills = test_coalesce;
+#ifdef X86
+    if (test_simd)
+        ops.num_spill_simd_slots = 1;
+#endif
+    if (!drmgr_init())
+        CHECK(false, "drmgr init failed");
+    if (drreg_init(&ops) != DRREG_SUCCESS)
+        CHECK(false, "drreg_init failed");
+    dr_register_exit_event(event_exit);
+    if (!drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL))
+        CHECK(false, "bb reg failed");
+#ifdef X86
+    if (!drmgr_register_bb_instru2instru_event(event_instru2instru, NULL))
+        CHECK(false, "instru2instru reg failed");
+#endif
+}
@@ -39,6 +39,9 @@
 
 #include <limits.h>
 #include <string.h>
+#ifdef LINUX
+# include <elf.h>
+#endif
 
 /* DR's build system usually disables warnings we're not interested in, but the
  * flags don't seem to make it to the compiler for this file, maybe because
@@ -50,6 +53,11 @@
 
 static void event_exit(void);
 static void lookup_exe_syms(void);
+#ifdef LINUX
+static void test_index_cache(const module_data_t *exe_data, size_t modoffs);
+#endif
+static void lookup_address_batch(const char *exe_path, size_t export_offs,
+                                 size_t public_offs);
 static void lookup_dll_syms(void *dc, const module_data_t *dll_data,
                             bool loaded);
 static void check_enumerate_dll_syms(const char *dll_path);
@@ -316,8 +324,12 @@ lookup_exe_syms(void)
     /* exe_public is a function in the exe we wouldn't be able to find without
      * drsyms and debug info.
      */
-    (void)lookup_and_wrap(exe_path, exe_base, appbase,
-                          "exe_public", DRSYM_DEFAULT_FLAGS);
+    exe_public_offs = lookup_and_wrap(exe_path, exe_base, appbase,
+                                      "exe_public", DRSYM_DEFAULT_FLAGS);
+    lookup_address_batch(exe_path, exe_export_offs, exe_public_offs);
+#ifdef LINUX
+    test_index_cache(exe_data, exe_public_offs);
+#endif
 
     /* Test symbol not found error handling. */
     r = drsym_lookup_symbol(exe_path, "nonexistent_sym", &exe_public_offs,
@@ -346,6 +358,205 @@ lookup_exe_syms(void)
     dr_free_module_data(exe_data);
 }
 
+typedef struct _batch_data_t {
+    const char *modpath;
+    const size_t *modoffs;
+    size_t count;
+} batch_data_t;
+
+static bool
+batch_cb(size_t index, drsym_info_t *info, drsym_error_t status, void *data)
+{
+    batch_data_t *batch = (batch_data_t *) data;
+    drsym_info_t single_info;
+    char name[MAX_FUNC_LEN];
+    char file[MAXIMUM_PATH];
+    drsym_error_t r;
+    ASSERT(index < batch->count);
+    batch->count--;
+    /* Each batched result should match a standalone lookup. */
+    single_info.struct_size = sizeof(single_info);
+    single_info.name = name;
+    single_info.name_size = MAX_FUNC_LEN;
+    single_info.file = file;
+    single_info.file_size = MAXIMUM_PATH;
+    r = drsym_lookup_address(batch->modpath, batch->modoffs[index], &single_info,
+                             DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == status);
+    if (r == DRSYM_SUCCESS || r == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
+        ASSERT(strcmp(info->name, single_info.name) == 0);
+        ASSERT(info->start_offs == single_info.start_offs);
+    }
+    if (r == DRSYM_SUCCESS) {
+        /* The batch's line-table cursor must find the same line. */
+        ASSERT(info->line == single_info.line);
+        ASSERT(info->line_offs == single_info.line_offs);
+        ASSERT(strcmp(info->file, single_info.file) == 0);
+    }
+    return true;
+}
+
+/* Test drsym_lookup_address_batch() against single lookups. */
+static void
+lookup_address_batch(const char *exe_path, size_t export_offs, size_t public_offs)
+{
+    size_t modoffs[4];
+    drsym_info_t info;
+    char name[MAX_FUNC_LEN];
+    char file[MAXIMUM_PATH];
+    batch_data_t batch;
+    drsym_error_t r;
+
+    /* Include a repeated offset and an out-of-order one. */
+    modoffs[0] = public_offs;
+    modoffs[1] = export_offs;
+    modoffs[2] = export_offs;
+    modoffs[3] = public_offs;
+    info.struct_size = sizeof(info);
+    info.name = name;
+    info.name_size = MAX_FUNC_LEN;
+    info.file = file;
+    info.file_size = MAXIMUM_PATH;
+    batch.modpath = exe_path;
+    batch.modoffs = modoffs;
+    batch.count = BUFFER_SIZE_ELEMENTS(modoffs);
+    r = drsym_lookup_address_batch(exe_path, modoffs, BUFFER_SIZE_ELEMENTS(modoffs),
+                                   &info, batch_cb, &batch, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_SUCCESS);
+    ASSERT(batch.count == 0);
+
+    r = drsym_lookup_address_batch(exe_path, modoffs, BUFFER_SIZE_ELEMENTS(modoffs),
+                                   &info, NULL, NULL, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_ERROR_INVALID_PARAMETER);
+}
+
+#ifdef LINUX
+# ifdef X64
+typedef Elf64_Ehdr elf_header_t;
+typedef Elf64_Phdr elf_program_header_t;
+# else
+typedef Elf32_Ehdr elf_header_t;
+typedef Elf32_Phdr elf_program_header_t;
+# endif
+
+/* Writes the hex build id from the mapped image's GNU build id note into buf,
+ * or returns false if it has none.
+ */
+static bool
+get_build_id(const module_data_t *data, char *buf, size_t buf_size)
+{
+    static const char hex[] = "0123456789abcdef";
+    elf_header_t *ehdr = (elf_header_t *) data->start;
+    elf_program_header_t *phdr = (elf_program_header_t *)
+        (data->start + ehdr->e_phoff);
+    ptr_uint_t min_vaddr = (ptr_uint_t) -1;
+    int i;
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr < min_vaddr)
+            min_vaddr = (ptr_uint_t) phdr[i].p_vaddr;
+    }
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        byte *note, *end;
+        if (phdr[i].p_type != PT_NOTE)
+            continue;
+        note = data->start + (phdr[i].p_vaddr - ALIGN_BACKWARD(min_vaddr, PAGE_SIZE));
+        end = note + phdr[i].p_memsz;
+        while (note + sizeof(Elf32_Nhdr) <= end) {
+            /* Both ELF classes use 32-bit note headers. */
+            Elf32_Nhdr *nhdr = (Elf32_Nhdr *) note;
+            byte *desc = note + sizeof(*nhdr) + ALIGN_FORWARD(nhdr->n_namesz, 4);
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                memcmp(note + sizeof(*nhdr), "GNU", 4) == 0 &&
+                2 * nhdr->n_descsz < buf_size) {
+                uint j;
+                for (j = 0; j < nhdr->n_descsz; j++) {
+                    buf[2 * j] = hex[desc[j] >> 4];
+                    buf[2 * j + 1] = hex[desc[j] & 0xf];
+                }
+                buf[2 * nhdr->n_descsz] = '\0';
+                return true;
+            }
+            note = desc + ALIGN_FORWARD(nhdr->n_descsz, 4);
+        }
+    }
+    return false;
+}
+
+static void
+lookup_line(const char *modpath, size_t modoffs, char *file, size_t file_size,
+            uint64 *line, size_t *line_offs)
+{
+    drsym_info_t info;
+    char name[MAX_FUNC_LEN];
+    drsym_error_t r;
+    info.struct_size = sizeof(info);
+    info.name = name;
+    info.name_size = MAX_FUNC_LEN;
+    info.file = file;
+    info.file_size = file_size;
+    r = drsym_lookup_address(modpath, modoffs, &info, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_SUCCESS);
+    *line = info.line;
+    *line_offs = info.line_offs;
+}
+
+/* Test drsym_set_index_cache_dir(): the index must be written to the cache
+ * on the first lookup after a load and read back on the next load, and both
+ * must give the same answer as an uncached lookup.
+ */
+static void
+test_index_cache(const module_data_t *exe_data, size_t modoffs)
+{
+    const char *exe_path = exe_data->full_path;
+    char dir[MAXIMUM_PATH], index_path[MAXIMUM_PATH], build_id[2 * 64 + 1];
+    char file[MAXIMUM_PATH], cached_file[MAXIMUM_PATH];
+    uint64 line, cached_line;
+    size_t line_offs, cached_line_offs;
+    bool have_build_id = get_build_id(exe_data, build_id, sizeof(build_id));
+    drsym_error_t r;
+
+    ASSERT(dr_get_current_directory(dir, BUFFER_SIZE_ELEMENTS(dir)));
+    dr_snprintf(dir + strlen(dir), BUFFER_SIZE_ELEMENTS(dir) - strlen(dir),
+                "/drsyms-test.%d", dr_get_process_id());
+    NULL_TERMINATE_BUFFER(dir);
+    r = drsym_set_index_cache_dir(dir);
+    ASSERT(r == DRSYM_ERROR_INVALID_PARAMETER); /* does not exist yet */
+    ASSERT(dr_create_dir(dir));
+
+    lookup_line(exe_path, modoffs, file, BUFFER_SIZE_ELEMENTS(file), &line, &line_offs);
+
+    r = drsym_set_index_cache_dir(dir);
+    ASSERT(r == DRSYM_SUCCESS);
+    /* The setting only applies to modules loaded after it. */
+    ASSERT(drsym_free_resources(exe_path) == DRSYM_SUCCESS);
+    lookup_line(exe_path, modoffs, cached_file, BUFFER_SIZE_ELEMENTS(cached_file),
+                &cached_line, &cached_line_offs);
+    ASSERT(cached_line == line && cached_line_offs == line_offs &&
+           strcmp(cached_file, file) == 0);
+    if (have_build_id) {
+        dr_snprintf(index_path, BUFFER_SIZE_ELEMENTS(index_path), "%s/%s.drsymidx",
+                    dir, build_id);
+        NULL_TERMINATE_BUFFER(index_path);
+        ASSERT(dr_file_exists(index_path));
+    }
+
+    /* This load maps the index from the cache file. */
+    ASSERT(drsym_free_resources(exe_path) == DRSYM_SUCCESS);
+    lookup_line(exe_path, modoffs, cached_file, BUFFER_SIZE_ELEMENTS(cached_file),
+                &cached_line, &cached_line_offs);
+    ASSERT(cached_line == line && cached_line_offs == line_offs &&
+           strcmp(cached_file, file) == 0);
+
+    r = drsym_set_index_cache_dir(NULL);
+    ASSERT(r == DRSYM_SUCCESS);
+    /* Unmap the cache file before deleting it. */
+    ASSERT(drsym_free_resources(exe_path) == DRSYM_SUCCESS);
+    if (have_build_id)
+        ASSERT(dr_delete_file(index_path));
+    ASSERT(dr_delete_dir(dir));
+}
+#endif
+
 #ifdef WINDOWS
 # define NUM_OVERLOADED_CLASS 3
 typedef struct _overloaded_params_t {
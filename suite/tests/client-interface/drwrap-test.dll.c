@@ -80,6 +80,7 @@ static app_pc addr_repeat;
 static app_pc addr_preonly;
 static app_pc addr_postonly;
 static app_pc addr_runlots;
+static ptr_uint_t runlots_count;
 
 static app_pc addr_long0;
 static app_pc addr_long1;
@@ -195,6 +196,15 @@ module_load_event(void *drcontext, const module_data_t *mod, bool loaded)
         wrap_addr(&addr_postonly, "postonly", mod, false, true);
         wrap_addr(&addr_runlots, "runlots", mod, false, true);
 
+        /* test inline wrapping alongside the clean-call wrap */
+        {
+            drwrap_inline_t counter = {sizeof(counter), DRWRAP_INLINE_COUNTER,};
+            counter.counter = &runlots_count;
+            runlots_count = 0;
+            ok = drwrap_wrap_inline(addr_runlots, &counter, NULL, 0);
+            CHECK(ok, "wrap_inline failed");
+        }
+
         /* test longjmp */
         wrap_unwindtest_addr(&addr_long0, "long0", mod);
         wrap_unwindtest_addr(&addr_long1, "long1", mod);
@@ -255,6 +265,9 @@ module_unload_event(void *drcontext, const module_data_t *mod)
         unwrap_addr(addr_tailcall, "makes_tailcall", mod, true, true);
         unwrap_addr(addr_preonly, "preonly", mod, true, false);
         /* skipme, postonly, and runlots were already unwrapped */
+        CHECK(runlots_count == 2048, "inline counter mismatch");
+        ok = drwrap_unwrap_inline(addr_runlots);
+        CHECK(ok, "unwrap_inline failed");
 
         /* test longjmp */
         unwrap_unwindtest_addr(addr_long0, "long0", mod);
@@ -0,0 +1,173 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Loop kernels in the style of SPEC CPU inner loops, for checking and
+ * timing -opt_traces: run natively, under DR, and under DR with -opt_traces,
+ * and compare.
+ */
+
+#ifndef ASM_CODE_ONLY /* C code */
+
+/* undefine this for a performance test */
+#ifndef NIGHTLY_REGRESSION
+# define NIGHTLY_REGRESSION
+#endif
+
+#include "tools.h"
+
+#ifdef NIGHTLY_REGRESSION
+#  define ITER 20
+#else
+#  define ITER 20*1000
+#endif
+
+#define N 64
+
+#ifdef X86
+/* asm routines */
+void adjust_loop(ptr_uint_t count);
+#endif
+
+static int a[N][N], b[N][N], c[N][N];
+static char text[N * N];
+
+/* Dense matrix multiply, as in many floating-point benchmarks. */
+static NOINLINE int
+matmul(void)
+{
+    int i, j, k, sum = 0;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            int t = 0;
+            for (k = 0; k < N; k++)
+                t += a[i][k] * b[k][j];
+            c[i][j] = t;
+            sum += t;
+        }
+    }
+    return sum;
+}
+
+/* A small leaf call in a loop, which a trace inlines along with its frame
+ * setup and teardown.
+ */
+static NOINLINE int
+mix(int x, int y)
+{
+    return (x << 5) ^ (x >> 3) ^ y;
+}
+
+static NOINLINE unsigned int
+hash_text(void)
+{
+    int i;
+    unsigned int h = 5381;
+    for (i = 0; i < N * N; i++)
+        h = mix(h, text[i]);
+    return h;
+}
+
+/* A data-dependent branch in a loop, as in compression benchmarks. */
+static NOINLINE int
+count_runs(void)
+{
+    int i, runs = 0;
+    for (i = 1; i < N * N; i++) {
+        if (text[i] != text[i - 1])
+            runs++;
+    }
+    return runs;
+}
+
+int
+main(int argc, char **argv)
+{
+    int i, j, iter;
+    unsigned int msum = 0;
+    int runs = 0;
+    unsigned int h = 0;
+
+    INIT();
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            a[i][j] = i + j;
+            b[i][j] = i - j;
+            text[i * N + j] = (char)('a' + (i * j) % 7);
+        }
+    }
+    for (iter = 0; iter < ITER; iter++) {
+        msum += matmul();
+        h = h * 31 + hash_text();
+        runs += count_runs();
+#ifdef X86
+        adjust_loop(N * N);
+#endif
+    }
+    print("matmul: 0x%x\n", msum);
+    print("hash: 0x%x\n", h);
+    print("runs: %d\n", runs);
+    return 0;
+}
+
+#else /* asm code *************************************************************/
+#include "asm_defines.asm"
+START_FILE
+
+#ifdef X86
+/* A loop whose body is padding and the frame setup and teardown of an
+ * inlined leaf call, with a spill and reload in between, each of which
+ * -opt_traces removes, folds, or replaces once the loop becomes a trace.
+ * The stack pointer is balanced on every iteration.
+ */
+#define FUNCNAME adjust_loop
+        DECLARE_FUNC(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+        mov      REG_XAX, ARG1
+     adjust_loop_top:
+        nop
+        lea      REG_XSP, [REG_XSP - 16]
+        lea      REG_XSP, [REG_XSP - 16]
+        mov      PTRSZ [REG_XSP], REG_XAX
+        mov      REG_XCX, PTRSZ [REG_XSP]
+        lea      REG_XSP, [REG_XSP + 32]
+        sub      REG_XSP, 8
+        add      REG_XSP, 8
+        sub      REG_XAX, 1
+        jnz      adjust_loop_top
+        ret
+        END_FUNC(FUNCNAME)
+#undef FUNCNAME
+#endif
+
+END_FILE
+#endif
@@ -0,0 +1,183 @@
+/* **********************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Startup scaling benchmark for basic block building: many threads start at
+ * once and each executes the same large body of not-yet-seen code, as a
+ * server's worker threads do at startup.  The time until every thread has
+ * completed its first pass is the time to steady state.
+ *
+ * Usage: bbscale [<num_threads> [-v]]
+ * With -v, timings are printed, for comparing e.g. -parallel_bb_build with
+ * the default across thread counts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define MAX_THREADS 256
+#define NOINLINE __attribute__((noinline))
+
+/* 4096 distinct functions, each with a different constant so that the
+ * compiler cannot fold them together.
+ */
+#define F1(n) static NOINLINE int func_##n(int x) { \
+    return (x & 1) ? (x ^ 0x##n) + 1 : (x + 0x##n) >> 1; }
+#define F16(n) F1(n##0) F1(n##1) F1(n##2) F1(n##3) F1(n##4) F1(n##5) F1(n##6) \
+    F1(n##7) F1(n##8) F1(n##9) F1(n##a) F1(n##b) F1(n##c) F1(n##d) F1(n##e) F1(n##f)
+#define F256(n) F16(n##0) F16(n##1) F16(n##2) F16(n##3) F16(n##4) F16(n##5) \
+    F16(n##6) F16(n##7) F16(n##8) F16(n##9) F16(n##a) F16(n##b) F16(n##c) \
+    F16(n##d) F16(n##e) F16(n##f)
+#define F4096() F256(0) F256(1) F256(2) F256(3) F256(4) F256(5) F256(6) F256(7) \
+    F256(8) F256(9) F256(a) F256(b) F256(c) F256(d) F256(e) F256(f)
+
+#define P1(n) func_##n,
+#define P16(n) P1(n##0) P1(n##1) P1(n##2) P1(n##3) P1(n##4) P1(n##5) P1(n##6) \
+    P1(n##7) P1(n##8) P1(n##9) P1(n##a) P1(n##b) P1(n##c) P1(n##d) P1(n##e) P1(n##f)
+#define P256(n) P16(n##0) P16(n##1) P16(n##2) P16(n##3) P16(n##4) P16(n##5) \
+    P16(n##6) P16(n##7) P16(n##8) P16(n##9) P16(n##a) P16(n##b) P16(n##c) \
+    P16(n##d) P16(n##e) P16(n##f)
+#define P4096() P256(0) P256(1) P256(2) P256(3) P256(4) P256(5) P256(6) P256(7) \
+    P256(8) P256(9) P256(a) P256(b) P256(c) P256(d) P256(e) P256(f)
+
+F4096()
+
+static int (*funcs[])(int) = { P4096() };
+#define NUM_FUNCS (sizeof(funcs)/sizeof(funcs[0]))
+
+static pthread_barrier_t barrier;
+static struct timeval start_time;
+
+typedef struct _thread_info_t {
+    int index;
+    int result;
+    long first_pass_usec; /* from the common start to the end of the cold pass */
+    long second_pass_usec;
+} thread_info_t;
+
+static long
+usec_since(struct timeval *since)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - since->tv_sec) * 1000000 + (now.tv_usec - since->tv_usec);
+}
+
+static int
+run_pass(int start)
+{
+    int i, res = 0;
+    /* Each thread starts at a different point so that they contend for
+     * building different blocks as well as the same ones.
+     */
+    for (i = 0; i < NUM_FUNCS; i++) {
+        int idx = (start + i) % NUM_FUNCS;
+        res += funcs[idx](idx);
+    }
+    return res;
+}
+
+static void *
+thread_func(void *arg)
+{
+    thread_info_t *info = (thread_info_t *) arg;
+    struct timeval second_start;
+    int start = info->index * (NUM_FUNCS / MAX_THREADS);
+    int res;
+    pthread_barrier_wait(&barrier);
+    res = run_pass(start);
+    info->first_pass_usec = usec_since(&start_time);
+    gettimeofday(&second_start, NULL);
+    info->result = run_pass(start);
+    info->second_pass_usec = usec_since(&second_start);
+    if (res != info->result)
+        info->result = -1;
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int num_threads = 8;
+    int verbose = 0;
+    int i;
+    long max_first = 0, max_second = 0;
+    pthread_t threads[MAX_THREADS];
+    thread_info_t info[MAX_THREADS];
+
+    if (argc > 1)
+        num_threads = atoi(argv[1]);
+    if (argc > 2 && strcmp(argv[2], "-v") == 0)
+        verbose = 1;
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [<num_threads up to %d> [-v]]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    /* The main thread joins the barrier so that it can take the start time
+     * once all threads exist.
+     */
+    pthread_barrier_init(&barrier, NULL, num_threads + 1);
+    for (i = 0; i < num_threads; i++) {
+        info[i].index = i;
+        if (pthread_create(&threads[i], NULL, thread_func, &info[i]) != 0) {
+            fprintf(stderr, "cannot create thread\n");
+            return 1;
+        }
+    }
+    gettimeofday(&start_time, NULL);
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            fprintf(stderr, "thread join failed\n");
+            return 1;
+        }
+        if (info[i].result != info[0].result)
+            printf("thread %d computed a different result\n", i);
+        if (info[i].first_pass_usec > max_first)
+            max_first = info[i].first_pass_usec;
+        if (info[i].second_pass_usec > max_second)
+            max_second = info[i].second_pass_usec;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    if (verbose) {
+        printf("%d threads, %d functions\n", num_threads, (int)NUM_FUNCS);
+        printf("time to steady state: %ld usec\n", max_first);
+        printf("steady-state pass:    %ld usec\n", max_second);
+    }
+    printf("all threads done\n");
+    return 0;
+}
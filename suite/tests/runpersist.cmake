@@ -0,0 +1,168 @@
+# **********************************************************
+# Copyright (c) 2017 Google, Inc.    All rights reserved.
+# **********************************************************
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+#
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+#
+# * Neither the name of Google, Inc. nor the names of its contributors may be
+#   used to endorse or promote products derived from this software without
+#   specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+
+# Invoked by the test suite to check that persisted caches are written,
+# published safely, and reused.  The app is run cold by one or more
+# concurrent writers into an empty -persist_dir, and then run again to load
+# what they wrote.  In debug builds, where the command also asks for stats on
+# stderr, the reload must build fewer basic blocks than the cold run and must
+# load every persisted file.  The cold and warm times are reported rather than
+# checked; run ctest -V to see them.
+
+# input:
+# * cmd = command to run, including -persist_dir <dir>
+#     should have intra-arg space=@@ and inter-arg space=@ and ;=!
+# * cmp = file containing the app's expected output, on stdout or stderr
+# * writers = number of concurrent cold runs (default 1)
+
+string(REGEX REPLACE "@@" " " cmd "${cmd}")
+string(REGEX REPLACE "@" ";" cmd "${cmd}")
+string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
+if (NOT writers)
+  set(writers 1)
+endif ()
+
+if (NOT "${cmd}" MATCHES "-persist_dir[ ;]([^ ;]+)")
+  message(FATAL_ERROR "*** ${cmd} does not use -persist_dir ***\n")
+endif ()
+set(pdir "${CMAKE_MATCH_1}")
+file(REMOVE_RECURSE "${pdir}")
+file(MAKE_DIRECTORY "${pdir}")
+
+# -persist implies -coarse_split_riprel, which decodes every instruction.
+# Keep glibc off the xsavec and AVX-512 paths the decoder does not handle.
+set(ENV{GLIBC_TUNABLES} "glibc.cpu.hwcaps=-XSAVEC,-AVX512F,-AVX512VL")
+
+file(READ "${cmp}" expect)
+
+# Microsecond timestamps need CMake 3.23; older versions only give seconds.
+if (CMAKE_VERSION VERSION_LESS 3.23)
+  set(stamp_format "%s")
+  set(stamp_unit "s")
+else ()
+  set(stamp_format "%s%f")
+  set(stamp_unit "us")
+endif ()
+
+# Returns the value of the named stat in the given stderr, or "" if the
+# stats were not printed.
+function(get_stat out_var name err)
+  if ("${err}" MATCHES "${name} *: *([0-9]+)")
+    set(${out_var} ${CMAKE_MATCH_1} PARENT_SCOPE)
+  else ()
+    set(${out_var} "" PARENT_SCOPE)
+  endif ()
+endfunction()
+
+# The app may write to either stream, and in debug builds the stats share
+# stderr with it, so we look for the expected output rather than match it.
+function(check_output out err)
+  string(FIND "${out}${err}" "${expect}" pos)
+  if (pos LESS 0)
+    message(FATAL_ERROR "*** output lacks:\n${expect}\nin:\n${out}${err}***\n")
+  endif ()
+endfunction()
+
+# The writers are started together from a shell so that they race to
+# publish the same files; each leaves its output, stderr, and status behind.
+set(quoted "")
+foreach (arg ${cmd})
+  set(quoted "${quoted} '${arg}'")
+endforeach ()
+set(script "")
+foreach (i RANGE 1 ${writers})
+  set(script "${script}(${quoted} >${pdir}/out.${i} 2>${pdir}/err.${i}; \
+echo $? >${pdir}/rc.${i}) &\n")
+endforeach ()
+set(script "${script}wait\n")
+string(TIMESTAMP start "${stamp_format}" UTC)
+execute_process(COMMAND sh -c "${script}" RESULT_VARIABLE sh_result)
+string(TIMESTAMP end "${stamp_format}" UTC)
+math(EXPR cold_time "${end} - ${start}")
+if (sh_result)
+  message(FATAL_ERROR "*** failed to start the writers (${sh_result}) ***\n")
+endif ()
+foreach (i RANGE 1 ${writers})
+  file(READ "${pdir}/rc.${i}" rc)
+  file(READ "${pdir}/out.${i}" out)
+  file(READ "${pdir}/err.${i}" err)
+  string(STRIP "${rc}" rc)
+  if (NOT rc STREQUAL "0")
+    message(FATAL_ERROR "*** writer ${i} failed (${rc}): ${err}***\n")
+  endif ()
+  check_output("${out}" "${err}")
+  if (i EQUAL 1)
+    set(cold_err "${err}")
+  endif ()
+  file(REMOVE "${pdir}/out.${i}" "${pdir}/err.${i}" "${pdir}/rc.${i}")
+endforeach ()
+
+# Every publish must have completed: no temporary or to-be-deleted files.
+file(GLOB_RECURSE pfiles "${pdir}/*")
+set(num_dpc 0)
+foreach (pfile ${pfiles})
+  get_filename_component(pname "${pfile}" NAME)
+  if ("${pname}" MATCHES "tmp|todel")
+    message(FATAL_ERROR "*** leftover file ${pfile} ***\n")
+  endif ()
+  if ("${pname}" MATCHES "\\.dpc$")
+    math(EXPR num_dpc "${num_dpc} + 1")
+  endif ()
+endforeach ()
+if (num_dpc EQUAL 0)
+  message(FATAL_ERROR "*** no caches were persisted in ${pdir} ***\n")
+endif ()
+
+string(TIMESTAMP start "${stamp_format}" UTC)
+execute_process(COMMAND ${cmd}
+  RESULT_VARIABLE cmd_result
+  ERROR_VARIABLE warm_err
+  OUTPUT_VARIABLE warm_out)
+string(TIMESTAMP end "${stamp_format}" UTC)
+math(EXPR warm_time "${end} - ${start}")
+if (cmd_result)
+  message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${warm_err}***\n")
+endif ()
+check_output("${warm_out}" "${warm_err}")
+
+get_stat(cold_bbs "Basic block fragments generated" "${cold_err}")
+get_stat(warm_bbs "Basic block fragments generated" "${warm_err}")
+get_stat(loaded "Persisted caches successfully loaded" "${warm_err}")
+if (NOT "${cold_bbs}" STREQUAL "" AND NOT "${warm_bbs}" STREQUAL "")
+  if (NOT warm_bbs LESS cold_bbs)
+    message(FATAL_ERROR "*** reload built ${warm_bbs} blocks, cold built ${cold_bbs} ***\n")
+  endif ()
+  if (NOT "${loaded}" STREQUAL "${num_dpc}")
+    message(FATAL_ERROR "*** loaded ${loaded} of ${num_dpc} persisted caches ***\n")
+  endif ()
+  message("blocks built: ${cold_bbs} cold, ${warm_bbs} reloading ${loaded} caches")
+endif ()
+message("${writers} cold run(s): ${cold_time}${stamp_unit}, "
+  "reload: ${warm_time}${stamp_unit}")